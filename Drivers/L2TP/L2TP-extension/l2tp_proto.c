@@ -89,16 +89,18 @@ extern lck_mtx_t	*ppp_domain_mutex;
 ----------------------------------------------------------------------------- */
 
 /* -----------------------------------------------------------------------------
- L2TP Timer, at 500 ms. Replaces l2tp_slowtimo, which is deprecated.
+ L2TP Timer, at 1/L2TP_TIMER_HZ. Replaces l2tp_slowtimo, which is deprecated.
+ Only ticks while some timer is armed, sleeps until l2tp_timer_wakeup otherwise.
  ----------------------------------------------------------------------------- */
 static uint8_t l2tp_timer_thread_is_dying = 0; /* > 0 if dying */
 static uint8_t l2tp_timer_thread_is_dead = 0; /* > 0 if dead */
 static void l2tp_timer()
 {
     struct timespec ts = {0};
+    u_int32_t armed;
     
-    /* timeout of 500 ms */
-    ts.tv_nsec = 500 * 1000 * 1000;
+    /* timeout of one timer wheel tick */
+    ts.tv_nsec = 1000 * 1000 * 1000 / L2TP_TIMER_HZ;
     ts.tv_sec = 0;
 
     lck_mtx_lock(ppp_domain_mutex);
@@ -107,9 +109,9 @@ static void l2tp_timer()
             break;
         }
 
-        l2tp_rfc_slowtimer();
+        armed = l2tp_rfc_timer();
         
-        msleep(&l2tp_timer_thread_is_dying, ppp_domain_mutex, PSOCK, "l2tp_timer_sleep", &ts);
+        msleep(&l2tp_timer_thread_is_dying, ppp_domain_mutex, PSOCK, "l2tp_timer_sleep", armed ? &ts : NULL);
     }
 
     l2tp_timer_thread_is_dead++;
@@ -119,6 +121,14 @@ static void l2tp_timer()
     thread_terminate(current_thread());
 }
 
+/* -----------------------------------------------------------------------------
+ a timer was armed while none were, get the timer thread ticking again
+ ----------------------------------------------------------------------------- */
+void l2tp_timer_wakeup()
+{
+    wakeup(&l2tp_timer_thread_is_dying);
+}
+
 /* -----------------------------------------------------------------------------
 Called when we need to add the L2TP protocol to the domain
 Typically, ppp_add is called by ppp_domain when we add the domain,
@@ -337,6 +347,24 @@ int l2tp_ctloutput(struct socket *so, struct sockopt *sopt)
                         error = sooptcopyout(sopt, &val, 2);
                     }
                     break;
+                case L2TP_OPT_CONTROL_STATS: {
+                    struct l2tp_control_stats stats;
+
+                    if (sopt->sopt_valsize != sizeof(stats))
+                        error = EMSGSIZE;
+                    else if ((error = l2tp_rfc_command(so->so_pcb, L2TP_CMD_GETCONTROLSTATS, &stats)) == 0)
+                        error = sooptcopyout(sopt, &stats, sizeof(stats));
+                    break;
+                }
+                case L2TP_OPT_DATA_STATS: {
+                    struct l2tp_data_stats stats;
+
+                    if (sopt->sopt_valsize != sizeof(stats))
+                        error = EMSGSIZE;
+                    else if ((error = l2tp_rfc_command(so->so_pcb, L2TP_CMD_GETDATASTATS, &stats)) == 0)
+                        error = sooptcopyout(sopt, &stats, sizeof(stats));
+                    break;
+                }
                  case L2TP_OPT_FLAGS:
                     if (sopt->sopt_valsize != 4)
                         error = EMSGSIZE;
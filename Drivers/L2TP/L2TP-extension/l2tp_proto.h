@@ -29,6 +29,7 @@
 
 int l2tp_add(struct domain *domain);
 int l2tp_remove(struct domain *domain);
+void l2tp_timer_wakeup(void);
 
 
 #endif
\ No newline at end of file
@@ -29,14 +29,18 @@
 #include <sys/malloc.h>
 #include <sys/syslog.h>
 #include <sys/domain.h>
+#include <sys/time.h>
+#include <sys/sysctl.h>
 #include <kern/locks.h>
 
 #include "../../../Family/if_ppplink.h"
 #include "../../../Family/ppp_domain.h"
 #include "l2tp.h"
 #include "l2tp_rfc.h"
+#include "l2tp_proto.h"
 #include "l2tp_udp.h"
 #include "l2tpk.h"
+#include "l2tp_seq.h"
 
 
 /* -----------------------------------------------------------------------------
@@ -50,25 +54,65 @@ Definitions
 #define L2TP_STATE_NEW_SEQUENCE	0x00000002	/* we have a seq number to acknowledge */
 #define L2TP_STATE_FREEING	0x00000004	/* rfc has been freed. structure is kept for 31 seconds */
 #define L2TP_STATE_RELIABILITY_OFF	0x00000008	/* reliability layer is currently off */
+#define L2TP_STATE_RTT_TIMING	0x00000010	/* a message is being timed for rtt estimation */
+#define L2TP_STATE_DATA_SYNCED	0x00000020	/* we have received a sequenced data packet */
 
 
+#define ROUND16DIFF(a, b)  	((a >= b) ? (a - b) : (0xFFFF - b + a + 1))
+#define ABS(a) 			(a >= 0 ? a : -a)
+
 /*
- * l2tp sequence numbers are 16 bit integers operated
- * on with modular arithmetic.  These macros can be
- * used to compare such integers.
+ * timers are kept in a two level hierarchical timer wheel, so that only the
+ * rfc with a due retransmission, delayed ack or free timer are touched on a tick.
+ * the inner wheel has one slot per tick, the outer wheel one slot per turn of the inner wheel.
  */
-#define SEQ_LT(a,b)     ((int16_t)(((int16_t)(a))-((int16_t)(b))) < 0)
-#define SEQ_LEQ(a,b)    ((int16_t)(((int16_t)(a))-((int16_t)(b))) <= 0)
-#define SEQ_GT(a,b)     ((int16_t)(((int16_t)(a))-((int16_t)(b))) > 0)
-#define SEQ_GEQ(a,b)    ((int16_t)(((int16_t)(a))-((int16_t)(b))) >= 0)
+#define L2TP_WHEEL0_BITS		8
+#define L2TP_WHEEL0_SIZE		(1 << L2TP_WHEEL0_BITS)	/* 12.8 seconds */
+#define L2TP_WHEEL0_MASK		(L2TP_WHEEL0_SIZE - 1)
+#define L2TP_WHEEL1_BITS		6
+#define L2TP_WHEEL1_SIZE		(1 << L2TP_WHEEL1_BITS)	/* 13.6 minutes */
+#define L2TP_WHEEL1_MASK		(L2TP_WHEEL1_SIZE - 1)
+#define L2TP_WHEEL_MAX_DELTA	(L2TP_WHEEL0_SIZE * (L2TP_WHEEL1_SIZE - 1))
 
-#define ROUND16DIFF(a, b)  	((a >= b) ? (a - b) : (0xFFFF - b + a + 1))
-#define ABS(a) 			(a >= 0 ? a : -a)
+#define L2TP_MS_TO_TICKS(ms)	(((ms) * L2TP_TIMER_HZ + 999) / 1000)	/* rounded up */
+
+#define L2TP_DELAYED_ACK_TICKS	L2TP_MS_TO_TICKS(100)
+#define L2TP_FREE_CONTROL_TICKS	(31 * L2TP_TIMER_HZ)	/* keep control connections for a full retransmission cycle */
+
+#define TICK_LEQ(a,b)	((int32_t)((a) - (b)) <= 0)
+
+/*
+ * round trip time estimation, as in tcp (Jacobson/Karels).
+ * srtt is kept scaled by 8, rttvar by 4. all values in ticks.
+ */
+#define L2TP_RTT_SHIFT			3
+#define L2TP_RTTVAR_SHIFT		2
+#define L2TP_MIN_RTO			L2TP_MS_TO_TICKS(200)
+
+/*
+ * sequenced data packets arriving ahead of the expected one are held
+ * in a small reorder window, until the gap is filled or the timer expires.
+ */
+#define L2TP_REORDER_WINDOW		8		/* must be a power of 2 */
+#define L2TP_REORDER_TICKS		L2TP_MS_TO_TICKS(100)
+
+struct l2tp_rfc;
+TAILQ_HEAD(l2tp_timer_head, l2tp_timer);
+
+struct l2tp_timer {
+    TAILQ_ENTRY(l2tp_timer)	next;
+    struct l2tp_timer_head	*head;			/* slot we are queued on, NULL if not armed */
+    u_int32_t				expire;			/* absolute tick of expiration */
+    struct l2tp_rfc			*rfc;
+    void					(*func)(struct l2tp_rfc *rfc);
+};
 
 struct l2tp_elem {
     TAILQ_ENTRY(l2tp_elem)	next;
-    mbuf_t 		packet;
+    mbuf_t 		packet;				/* recv queue: whole message. send queue: payload, after the header */
     u_int16_t			seqno;
+    u_int16_t			len;				/* send queue: total message length */
+    u_int8_t			hdr[L2TP_CNTL_HDR_SIZE];	/* send queue: control header, nr patched on each transmission */
     u_int8_t			addr[INET6_ADDRSTRLEN]; /* use the largest address between v4 and v6 */
 };
 
@@ -95,17 +139,35 @@ struct l2tp_rfc {
     u_int16_t		peer_session_id;		/* peer's session id */
     u_int16_t		our_window;			/* our recv window */
     u_int16_t		peer_window;			/* peer's recv window */
-    u_int16_t		free_time_remain;		/* time until rfc is freed - seconds/2 */
-    u_int16_t		initial_timeout;		/* initial timeout value - seconds/2 */
-    u_int16_t		timeout_cap;			/* maximum timeout cap - seconds/2 */
+    u_int32_t		initial_timeout;		/* initial timeout value - ticks */
+    u_int32_t		timeout_cap;			/* maximum timeout cap - ticks */
     u_int16_t		max_retries;			/* maximum retries allowed */
     u_int16_t		retry_count;			/* current retry count */
-    u_int16_t		retrans_time_remain;		/* time until next retransmission - seconds/2 */
+    u_int32_t		srtt;				/* smoothed round trip time - ticks * 8, 0 if no sample yet */
+    u_int32_t		rttvar;				/* round trip time variance - ticks * 4 */
+    u_int32_t		rto;				/* retransmission timeout computed from rtt - ticks */
+    u_int32_t		rtt_start;			/* tick the timed message was sent */
+    u_int16_t		rtt_seq;			/* seq number of the timed message */
+    u_int16_t		cwnd;				/* congestion window - RFC 2661 Appendix A */
+    u_int16_t		ssthresh;			/* slow start threshold */
+    u_int16_t		cwnd_acked;			/* messages acked since last cwnd increase in congestion avoidance */
+    u_int32_t		retransmits;			/* retransmissions since creation */
+    struct l2tp_timer	rxmt_timer;			/* retransmission of the head of the send queue */
+    struct l2tp_timer	ack_timer;			/* delayed ack */
+    struct l2tp_timer	free_timer;			/* time until rfc is freed */
     u_int16_t		our_ns;				/* last seq number we sent */
+    u_int16_t		send_next;			/* first queued seq number not sent yet */
     u_int16_t		our_nr;				/* last seq number we acked */
     u_int16_t		peer_nr;			/* last seq number peer acked */
     u_int16_t		our_last_data_seq;		/* last data seq number we sent */
-    u_int16_t		peer_last_data_seq;		/* last data seq number we received */
+    u_int16_t		data_hdr_len;			/* length of the data header template */
+    u_int8_t		data_hdr[L2TP_DATA_HDR_SIZE + 4];	/* data header template, network order */
+    u_int16_t		peer_next_data_seq;		/* next data seq number expected from peer */
+    u_int32_t		peer_data_seen;			/* delivery history behind peer_next_data_seq, see l2tp_seq.h */
+    u_int16_t		reorder_count;			/* packets held in the reorder window */
+    mbuf_t			reorder[L2TP_REORDER_WINDOW];	/* out of order data packets, indexed by seq number */
+    struct l2tp_timer	reorder_timer;			/* give up waiting for missing data packets */
+    struct l2tp_data_stats data_stats;		/* sequenced data counters */
     TAILQ_HEAD(, l2tp_elem) send_queue;		/* control message send queue */
     TAILQ_HEAD(, l2tp_elem) recv_queue;		/* control or sequenced data message recv queue */
 
@@ -115,34 +177,99 @@ struct l2tp_rfc {
     if (rfc->flags & L2TP_FLAG_DEBUG)   \
         IOLog(str, args)
 
+/* -----------------------------------------------------------------------------
+Globals
+----------------------------------------------------------------------------- */
+
+static u_int16_t unique_tunnel_id = 0;
+extern lck_mtx_t	*ppp_domain_mutex;
+
+#define L2TP_RFC_MAX_HASH 256
+static TAILQ_HEAD(, l2tp_rfc) l2tp_rfc_hash[L2TP_RFC_MAX_HASH];
+
+static struct l2tp_timer_head l2tp_wheel0[L2TP_WHEEL0_SIZE];
+static struct l2tp_timer_head l2tp_wheel1[L2TP_WHEEL1_SIZE];
+static u_int32_t l2tp_wheel_ticks = 0;		/* last tick processed by the wheel */
+static u_int64_t l2tp_wheel_clock = 0;		/* uptime of the last processed tick - ticks */
+static u_int32_t l2tp_timers_armed = 0;		/* timers on the wheel, the timer thread idles at 0 */
+
+/* pool of l2tp_elem, to avoid going to the allocator on every control message */
+static TAILQ_HEAD(, l2tp_elem) l2tp_elem_pool;
+static int l2tp_elem_pool_max = 256;	/* max elements kept in the pool */
+static int l2tp_elem_pool_free = 0;		/* elements currently in the pool */
+static int l2tp_elem_inuse = 0;			/* elements currently queued */
+static int l2tp_elem_inuse_hiwat = 0;	/* high-water mark of elements queued */
+
+#if TARGET_OS_OSX
+SYSCTL_INT(_net_ppp_l2tp, OID_AUTO, elem_pool_max, CTLTYPE_INT|CTLFLAG_RW|CTLFLAG_NOAUTO|CTLFLAG_KERN,
+    &l2tp_elem_pool_max, 0, "Max control message elements kept in the pool");
+SYSCTL_INT(_net_ppp_l2tp, OID_AUTO, elem_pool_free, CTLTYPE_INT|CTLFLAG_RD|CTLFLAG_NOAUTO|CTLFLAG_KERN,
+    &l2tp_elem_pool_free, 0, "Control message elements in the pool");
+SYSCTL_INT(_net_ppp_l2tp, OID_AUTO, elem_inuse, CTLTYPE_INT|CTLFLAG_RD|CTLFLAG_NOAUTO|CTLFLAG_KERN,
+    &l2tp_elem_inuse, 0, "Control message elements in use");
+SYSCTL_INT(_net_ppp_l2tp, OID_AUTO, elem_inuse_hiwat, CTLTYPE_INT|CTLFLAG_RW|CTLFLAG_NOAUTO|CTLFLAG_KERN,
+    &l2tp_elem_inuse_hiwat, 0, "High-water mark of control message elements in use");
+#endif
+
+static struct l2tp_elem *
+l2tp_elem_get(int how)
+{
+	struct l2tp_elem *elem;
+
+	lck_mtx_assert(ppp_domain_mutex, LCK_MTX_ASSERT_OWNED);
+
+	if ((elem = TAILQ_FIRST(&l2tp_elem_pool))) {
+		TAILQ_REMOVE(&l2tp_elem_pool, elem, next);
+		l2tp_elem_pool_free--;
+		bzero(elem, sizeof(*elem));
+	}
+	else if (how == Z_WAITOK)
+		elem = kalloc_type(struct l2tp_elem, Z_WAITOK | Z_ZERO | Z_NOFAIL);
+	else if ((elem = kalloc_type(struct l2tp_elem, Z_NOWAIT | Z_ZERO)) == NULL)
+		return NULL;
+
+	if (++l2tp_elem_inuse > l2tp_elem_inuse_hiwat)
+		l2tp_elem_inuse_hiwat = l2tp_elem_inuse;
+	return elem;
+}
+
 static struct l2tp_elem *
 l2tp_elem_alloc(void)
 {
-	return kalloc_type(struct l2tp_elem, Z_WAITOK | Z_ZERO | Z_NOFAIL);
+	return l2tp_elem_get(Z_WAITOK);
 }
 
 static struct l2tp_elem *
 l2tp_elem_alloc_noblock(void)
 {
-	return kalloc_type(struct l2tp_elem, Z_NOWAIT | Z_ZERO);
+	return l2tp_elem_get(Z_NOWAIT);
 }
 
 static void
 l2tp_elem_free(struct l2tp_elem *elem)
 {
-	return kfree_type(struct l2tp_elem, elem);
-}
-
+	lck_mtx_assert(ppp_domain_mutex, LCK_MTX_ASSERT_OWNED);
 
-/* -----------------------------------------------------------------------------
-Globals
------------------------------------------------------------------------------ */
+	l2tp_elem_inuse--;
+	if (l2tp_elem_pool_free < l2tp_elem_pool_max) {
+		TAILQ_INSERT_HEAD(&l2tp_elem_pool, elem, next);
+		l2tp_elem_pool_free++;
+	}
+	else
+		kfree_type(struct l2tp_elem, elem);
+}
 
-static u_int16_t unique_tunnel_id = 0;
-extern lck_mtx_t	*ppp_domain_mutex;
+static void
+l2tp_elem_pool_drain(void)
+{
+	struct l2tp_elem *elem;
 
-#define L2TP_RFC_MAX_HASH 256
-static TAILQ_HEAD(, l2tp_rfc) l2tp_rfc_hash[L2TP_RFC_MAX_HASH];
+	while ((elem = TAILQ_FIRST(&l2tp_elem_pool))) {
+		TAILQ_REMOVE(&l2tp_elem_pool, elem, next);
+		kfree_type(struct l2tp_elem, elem);
+	}
+	l2tp_elem_pool_free = 0;
+}
 
 static void
 l2tp_rfc_set_socket(struct l2tp_rfc *rfc, socket_t socket, int thread, struct sockaddr *local_address)
@@ -185,6 +312,197 @@ u_int16_t l2tp_handle_control(struct l2tp_rfc *rfc, mbuf_t m, struct sockaddr *f
     u_int16_t flags, u_int16_t len, u_int16_t tunnel_id, u_int16_t session_id);
 void l2tp_rfc_free_now(struct l2tp_rfc *rfc);
 void l2tp_rfc_accept(struct l2tp_rfc* rfc);
+static void l2tp_rfc_retransmit(struct l2tp_rfc *rfc);
+static void l2tp_rfc_delayed_ack(struct l2tp_rfc *rfc);
+static int l2tp_rfc_output_window(struct l2tp_rfc *rfc);
+static void l2tp_rfc_reorder_timeout(struct l2tp_rfc *rfc);
+static void l2tp_rfc_build_data_hdr(struct l2tp_rfc *rfc);
+static int l2tp_rfc_elem_set_message(struct l2tp_elem *elem, mbuf_t m, u_int16_t len);
+
+/* -----------------------------------------------------------------------------
+uptime expressed in timer wheel ticks
+----------------------------------------------------------------------------- */
+static u_int64_t l2tp_timer_uptime(void)
+{
+    struct timespec tv;
+
+    nanouptime(&tv);
+    return ((u_int64_t)tv.tv_sec * L2TP_TIMER_HZ) + (tv.tv_nsec / (1000000000 / L2TP_TIMER_HZ));
+}
+
+/* -----------------------------------------------------------------------------
+put an armed timer on the wheel slot matching its expiration
+----------------------------------------------------------------------------- */
+static void l2tp_timer_insert(struct l2tp_timer *timer)
+{
+    u_int32_t	delta = timer->expire - l2tp_wheel_ticks;
+
+    if (delta < L2TP_WHEEL0_SIZE)
+        timer->head = &l2tp_wheel0[timer->expire & L2TP_WHEEL0_MASK];
+    else {
+        /* too far away, will be cascaded again when its slot comes up */
+        if (delta > L2TP_WHEEL_MAX_DELTA)
+            delta = L2TP_WHEEL_MAX_DELTA;
+        timer->head = &l2tp_wheel1[((l2tp_wheel_ticks + delta) >> L2TP_WHEEL0_BITS) & L2TP_WHEEL1_MASK];
+    }
+    TAILQ_INSERT_TAIL(timer->head, timer, next);
+}
+
+static void l2tp_timer_init(struct l2tp_timer *timer, struct l2tp_rfc *rfc, void (*func)(struct l2tp_rfc *rfc))
+{
+    timer->head = NULL;
+    timer->rfc = rfc;
+    timer->func = func;
+}
+
+static void l2tp_timer_cancel(struct l2tp_timer *timer)
+{
+    if (timer->head) {
+        TAILQ_REMOVE(timer->head, timer, next);
+        timer->head = NULL;
+        l2tp_timers_armed--;
+    }
+}
+
+/* -----------------------------------------------------------------------------
+(re)arm a timer to fire in 'ticks' timer ticks
+----------------------------------------------------------------------------- */
+static void l2tp_timer_arm(struct l2tp_timer *timer, u_int32_t ticks)
+{
+    l2tp_timer_cancel(timer);
+    if (l2tp_timers_armed++ == 0) {
+        /* the wheel is empty and was not advanced while idle, skip the missed ticks */
+        l2tp_wheel_clock = l2tp_timer_uptime();
+        l2tp_timer_wakeup();
+    }
+    timer->expire = l2tp_wheel_ticks + (ticks ? ticks : 1);
+    l2tp_timer_insert(timer);
+}
+
+static int l2tp_timer_pending(struct l2tp_timer *timer)
+{
+    return timer->head != NULL;
+}
+
+/* -----------------------------------------------------------------------------
+advance the wheel by one tick and fire the timers that are due
+----------------------------------------------------------------------------- */
+static void l2tp_wheel_tick(void)
+{
+    struct l2tp_timer_head	*slot;
+    struct l2tp_timer		*timer;
+
+    l2tp_wheel_ticks++;
+
+    /* inner wheel wrapped, cascade the next outer slot down */
+    if ((l2tp_wheel_ticks & L2TP_WHEEL0_MASK) == 0) {
+        slot = &l2tp_wheel1[(l2tp_wheel_ticks >> L2TP_WHEEL0_BITS) & L2TP_WHEEL1_MASK];
+        while ((timer = TAILQ_FIRST(slot))) {
+            TAILQ_REMOVE(slot, timer, next);
+            l2tp_timer_insert(timer);
+        }
+    }
+
+    /* callbacks can arm or cancel any timer, including this one */
+    slot = &l2tp_wheel0[l2tp_wheel_ticks & L2TP_WHEEL0_MASK];
+    while ((timer = TAILQ_FIRST(slot))) {
+        TAILQ_REMOVE(slot, timer, next);
+        if (!TICK_LEQ(timer->expire, l2tp_wheel_ticks)) {
+            /* was capped in the outer wheel, not due yet */
+            l2tp_timer_insert(timer);
+            continue;
+        }
+        timer->head = NULL;
+        l2tp_timers_armed--;
+        (*timer->func)(timer->rfc);
+    }
+}
+
+/* -----------------------------------------------------------------------------
+schedule the transmission of an ack for the last sequence number received
+----------------------------------------------------------------------------- */
+static void l2tp_rfc_need_ack(struct l2tp_rfc *rfc)
+{
+    rfc->state |= L2TP_STATE_NEW_SEQUENCE;
+    if (!l2tp_timer_pending(&rfc->ack_timer))
+        l2tp_timer_arm(&rfc->ack_timer, L2TP_DELAYED_ACK_TICKS);
+}
+
+/* -----------------------------------------------------------------------------
+current retransmission timeout, before backoff.
+use the rtt estimate when adaptative timer is on and we have a sample
+----------------------------------------------------------------------------- */
+static u_int32_t l2tp_rfc_rto(struct l2tp_rfc *rfc)
+{
+    if ((rfc->flags & L2TP_FLAG_ADAPT_TIMER) && rfc->srtt)
+        return rfc->rto;
+    return rfc->initial_timeout;
+}
+
+/* -----------------------------------------------------------------------------
+number of messages we can have outstanding - congestion window limited by peer window
+----------------------------------------------------------------------------- */
+static u_int16_t l2tp_rfc_send_window(struct l2tp_rfc *rfc)
+{
+    return MIN(rfc->cwnd, rfc->peer_window);
+}
+
+/* -----------------------------------------------------------------------------
+update the rtt estimate with a new measurement, in ticks
+----------------------------------------------------------------------------- */
+static void l2tp_rfc_rtt_update(struct l2tp_rfc *rfc, u_int32_t rtt)
+{
+    int32_t		delta;
+
+    if (rfc->srtt == 0) {
+        /* first measurement */
+        rfc->srtt = (rtt << L2TP_RTT_SHIFT) | 1;
+        rfc->rttvar = rtt << (L2TP_RTTVAR_SHIFT - 1);
+    }
+    else {
+        delta = rtt - (rfc->srtt >> L2TP_RTT_SHIFT);
+        rfc->srtt += delta;
+        if (rfc->srtt == 0)
+            rfc->srtt = 1;
+        if (delta < 0)
+            delta = -delta;
+        delta -= rfc->rttvar >> L2TP_RTTVAR_SHIFT;
+        rfc->rttvar += delta;
+    }
+
+    rfc->rto = (rfc->srtt >> L2TP_RTT_SHIFT) + rfc->rttvar;
+    if (rfc->rto < L2TP_MIN_RTO)
+        rfc->rto = L2TP_MIN_RTO;
+    if (rfc->rto > rfc->timeout_cap)
+        rfc->rto = rfc->timeout_cap;
+}
+
+/* -----------------------------------------------------------------------------
+a message has been acked by the peer, open the congestion window.
+    slow start until ssthresh, then grow by one every cwnd acks
+----------------------------------------------------------------------------- */
+static void l2tp_rfc_cwnd_open(struct l2tp_rfc *rfc)
+{
+    if (rfc->cwnd >= rfc->peer_window)
+        return;
+
+    if (rfc->cwnd < rfc->ssthresh)
+        rfc->cwnd++;
+    else if (++rfc->cwnd_acked >= rfc->cwnd) {
+        rfc->cwnd_acked = 0;
+        rfc->cwnd++;
+    }
+}
+
+/* -----------------------------------------------------------------------------
+a retransmission timer expired, collapse the congestion window
+----------------------------------------------------------------------------- */
+static void l2tp_rfc_cwnd_loss(struct l2tp_rfc *rfc)
+{
+    rfc->ssthresh = MAX(rfc->cwnd / 2, 1);
+    rfc->cwnd = 1;
+    rfc->cwnd_acked = 0;
+}
 
 /* -----------------------------------------------------------------------------
 intialize L2TP protocol
@@ -196,6 +514,18 @@ u_int16_t l2tp_rfc_init()
     l2tp_udp_init();
 	for (i = 0; i < L2TP_RFC_MAX_HASH; i++)
 		TAILQ_INIT(&l2tp_rfc_hash[i]);
+	for (i = 0; i < L2TP_WHEEL0_SIZE; i++)
+		TAILQ_INIT(&l2tp_wheel0[i]);
+	for (i = 0; i < L2TP_WHEEL1_SIZE; i++)
+		TAILQ_INIT(&l2tp_wheel1[i]);
+	l2tp_wheel_clock = l2tp_timer_uptime();
+	TAILQ_INIT(&l2tp_elem_pool);
+#if TARGET_OS_OSX
+    sysctl_register_oid(&sysctl__net_ppp_l2tp_elem_pool_max);
+    sysctl_register_oid(&sysctl__net_ppp_l2tp_elem_pool_free);
+    sysctl_register_oid(&sysctl__net_ppp_l2tp_elem_inuse);
+    sysctl_register_oid(&sysctl__net_ppp_l2tp_elem_inuse_hiwat);
+#endif
     return 0;
 }
 
@@ -215,6 +545,14 @@ u_int16_t l2tp_rfc_dispose()
 
     if (l2tp_udp_dispose())
         return 1;
+
+#if TARGET_OS_OSX
+    sysctl_unregister_oid(&sysctl__net_ppp_l2tp_elem_pool_max);
+    sysctl_unregister_oid(&sysctl__net_ppp_l2tp_elem_pool_free);
+    sysctl_unregister_oid(&sysctl__net_ppp_l2tp_elem_inuse);
+    sysctl_unregister_oid(&sysctl__net_ppp_l2tp_elem_inuse_hiwat);
+#endif
+    l2tp_elem_pool_drain();
     return 0;
 }
 
@@ -237,17 +575,24 @@ u_int16_t l2tp_rfc_new_client(void *host, void **data,
     rfc->host = host;
     rfc->inputcb = input;
     rfc->eventcb = event;
-    rfc->timeout_cap = L2TP_DEFAULT_TIMEOUT_CAP * 2;		
-    rfc->initial_timeout = L2TP_DEFAULT_INITIAL_TIMEOUT * 2;	
+    rfc->timeout_cap = L2TP_DEFAULT_TIMEOUT_CAP * L2TP_TIMER_HZ;
+    rfc->initial_timeout = L2TP_DEFAULT_INITIAL_TIMEOUT * L2TP_TIMER_HZ;
     rfc->max_retries = L2TP_DEFAULT_RETRY_COUNT;
     rfc->flags = L2TP_FLAG_ADAPT_TIMER;
     
     // let's use some default values
     rfc->peer_window = L2TP_DEFAULT_WINDOW_SIZE;
     rfc->our_window = L2TP_DEFAULT_WINDOW_SIZE;
+    rfc->cwnd = 1;
+    rfc->ssthresh = rfc->peer_window;
     
     TAILQ_INIT(&rfc->send_queue);
     TAILQ_INIT(&rfc->recv_queue);
+    l2tp_timer_init(&rfc->rxmt_timer, rfc, l2tp_rfc_retransmit);
+    l2tp_timer_init(&rfc->ack_timer, rfc, l2tp_rfc_delayed_ack);
+    l2tp_timer_init(&rfc->free_timer, rfc, l2tp_rfc_free_now);
+    l2tp_timer_init(&rfc->reorder_timer, rfc, l2tp_rfc_reorder_timeout);
+    l2tp_rfc_build_data_hdr(rfc);
    
     *data = rfc;
 
@@ -277,11 +622,11 @@ void l2tp_rfc_free_client(void *data)
     if (rfc->flags & L2TP_FLAG_CONTROL 
         && rfc->our_tunnel_id && rfc->peer_tunnel_id) {
         /* keep control connections around for a full retransmission cycle */
-        rfc->free_time_remain = 62; // give 31 seconds
+        l2tp_timer_arm(&rfc->free_timer, L2TP_FREE_CONTROL_TICKS);
     }
     else {
         /* immediatly dispose of data connections */
-        rfc->free_time_remain = 1; // free it a.s.a.p
+        l2tp_timer_arm(&rfc->free_timer, 1); // free it a.s.a.p
     }
 }
 
@@ -292,6 +637,7 @@ void l2tp_rfc_free_now(struct l2tp_rfc *rfc)
 {
     struct l2tp_elem 	*send_elem;
     struct l2tp_elem	*recv_elem;
+    int					i;
 	
 	lck_mtx_assert(ppp_domain_mutex, LCK_MTX_ASSERT_OWNED);
     
@@ -301,10 +647,21 @@ void l2tp_rfc_free_now(struct l2tp_rfc *rfc)
         kfree_data_addr(rfc->peer_address);
 
     l2tp_rfc_set_socket(rfc, NULL, -1, NULL);
+
+    l2tp_timer_cancel(&rfc->rxmt_timer);
+    l2tp_timer_cancel(&rfc->ack_timer);
+    l2tp_timer_cancel(&rfc->free_timer);
+    l2tp_timer_cancel(&rfc->reorder_timer);
+
+    for (i = 0; i < L2TP_REORDER_WINDOW; i++) {
+        if (rfc->reorder[i])
+            mbuf_freem(rfc->reorder[i]);
+    }
                             
     while((send_elem = TAILQ_FIRST(&rfc->send_queue))) {
         TAILQ_REMOVE(&rfc->send_queue, send_elem, next);
-        mbuf_freem(send_elem->packet);
+        if (send_elem->packet)
+            mbuf_freem(send_elem->packet);
         l2tp_elem_free(send_elem);
     }
     while((recv_elem = TAILQ_FIRST(&rfc->recv_queue))) {
@@ -363,6 +720,7 @@ u_int16_t l2tp_rfc_command(void *data, u_int32_t cmd, void *cmddata)
 				error = EBUSY;
 			} else {
 				rfc->flags = new_flags;
+				l2tp_rfc_build_data_hdr(rfc);
 			}
 			break;
 		}
@@ -379,6 +737,9 @@ u_int16_t l2tp_rfc_command(void *data, u_int32_t cmd, void *cmddata)
         case L2TP_CMD_SETPEERWINDOW:
             LOGIT(rfc, "L2TP command (%p): set peer window = %d\n", rfc, *(u_int16_t *)cmddata);
             rfc->peer_window = *(u_int16_t *)cmddata;
+            rfc->ssthresh = rfc->peer_window;
+            if (rfc->cwnd > rfc->peer_window)
+                rfc->cwnd = rfc->peer_window;
             break;
 
         case L2TP_CMD_GETNEWTUNNELID:
@@ -424,6 +785,11 @@ u_int16_t l2tp_rfc_command(void *data, u_int32_t cmd, void *cmddata)
         case L2TP_CMD_SETPEERTUNNELID:
             LOGIT(rfc, "L2TP command (%p): set peer tunnel id = 0x%x\n", rfc, *(u_int16_t *)cmddata);
             rfc->peer_tunnel_id = *(u_int16_t *)cmddata;
+            l2tp_rfc_build_data_hdr(rfc);
+            /* an ack held back for the tunnel id can go now */
+            if (rfc->peer_tunnel_id && (rfc->state & L2TP_STATE_NEW_SEQUENCE)
+                && !l2tp_timer_pending(&rfc->ack_timer))
+                l2tp_timer_arm(&rfc->ack_timer, 1);
             break;
 
         case L2TP_CMD_SETSESSIONID:
@@ -440,8 +806,10 @@ u_int16_t l2tp_rfc_command(void *data, u_int32_t cmd, void *cmddata)
         case L2TP_CMD_SETPEERSESSIONID:
             LOGIT(rfc, "L2TP command (%p): set peer session id = 0x%x\n", rfc, *(u_int16_t *)cmddata);
             /* session id only used for data */
-            if (!(rfc->flags & L2TP_FLAG_CONTROL))
+            if (!(rfc->flags & L2TP_FLAG_CONTROL)) {
                 rfc->peer_session_id = *(u_int16_t *)cmddata;
+                l2tp_rfc_build_data_hdr(rfc);
+            }
             break;
                 
         case L2TP_CMD_SETBAUDRATE:
@@ -456,12 +824,12 @@ u_int16_t l2tp_rfc_command(void *data, u_int32_t cmd, void *cmddata)
 
         case L2TP_CMD_SETTIMEOUT:
             LOGIT(rfc, "L2TP command (%p): set initial timeout = %d (seconds)\n", rfc, *(u_int16_t *)cmddata);
-            rfc->initial_timeout = *(u_int16_t *)cmddata * 2;	
+            rfc->initial_timeout = *(u_int16_t *)cmddata * L2TP_TIMER_HZ;
             break;
 
         case L2TP_CMD_SETTIMEOUTCAP:
             LOGIT(rfc, "L2TP command (%p): set timeout cap = %d (seconds)\n", rfc, *(u_int16_t *)cmddata);
-            rfc->timeout_cap = *(u_int16_t *)cmddata * 2;	
+            rfc->timeout_cap = *(u_int16_t *)cmddata * L2TP_TIMER_HZ;
             break;
 
         case L2TP_CMD_SETMAXRETRIES:
@@ -593,10 +961,13 @@ u_int16_t l2tp_rfc_command(void *data, u_int32_t cmd, void *cmddata)
             if (*(u_int16_t *)cmddata) {
 				rfc->state &= ~L2TP_STATE_RELIABILITY_OFF;
 				rfc->retry_count = 0;
-				rfc->retrans_time_remain = rfc->initial_timeout;
+				if (!TAILQ_EMPTY(&rfc->send_queue))
+					l2tp_timer_arm(&rfc->rxmt_timer, l2tp_rfc_rto(rfc));
 			}
-			else 
+			else {
 				rfc->state |= L2TP_STATE_RELIABILITY_OFF;
+				l2tp_timer_cancel(&rfc->rxmt_timer);
+			}
             break;
             
         case L2TP_CMD_SETDELEGATEDPID:
@@ -605,6 +976,26 @@ u_int16_t l2tp_rfc_command(void *data, u_int32_t cmd, void *cmddata)
                 rfc->delegate_pid = *(int *)cmddata;
             break;
 
+        case L2TP_CMD_GETCONTROLSTATS: {
+            struct l2tp_control_stats *stats = (struct l2tp_control_stats *)cmddata;
+
+            bzero(stats, sizeof(*stats));
+            stats->cwnd = rfc->cwnd;
+            stats->ssthresh = rfc->ssthresh;
+            stats->peer_window = rfc->peer_window;
+            stats->srtt = (rfc->srtt >> L2TP_RTT_SHIFT) * (1000 / L2TP_TIMER_HZ);
+            stats->rttvar = (rfc->rttvar >> L2TP_RTTVAR_SHIFT) * (1000 / L2TP_TIMER_HZ);
+            stats->rto = l2tp_rfc_rto(rfc) * (1000 / L2TP_TIMER_HZ);
+            stats->retransmits = rfc->retransmits;
+            LOGIT(rfc, "L2TP command (%p): get control stats, cwnd = %d, srtt = %d ms\n", rfc, stats->cwnd, stats->srtt);
+            break;
+        }
+
+        case L2TP_CMD_GETDATASTATS:
+            LOGIT(rfc, "L2TP command (%p): get data stats, lost = %d\n", rfc, rfc->data_stats.lost);
+            memcpy(cmddata, &rfc->data_stats, sizeof(rfc->data_stats));
+            break;
+
         default:
             LOGIT(rfc, "L2TP command (%p): unknown command = %d\n", rfc, cmd);
     }
@@ -614,8 +1005,8 @@ u_int16_t l2tp_rfc_command(void *data, u_int32_t cmd, void *cmddata)
 
 
 /* -----------------------------------------------------------------------------
- main body of function used to be l2tp_rfc_fasttimer... called by protocol family when fast timer expired:
- now it's called when slow timer expired because of <rdar://problem/7617885> 
+ delayed ack timer expired: send a ZLB ack if nothing piggybacked it in the meantime.
+ without a peer tunnel id yet, the ack stays pending until the id is set.
  ----------------------------------------------------------------------------- */
 static void l2tp_rfc_delayed_ack(struct l2tp_rfc *rfc)
 {
@@ -624,8 +1015,11 @@ static void l2tp_rfc_delayed_ack(struct l2tp_rfc *rfc)
     
 	if ((rfc->state & L2TP_STATE_NEW_SEQUENCE) && rfc->peer_tunnel_id) {
 			
-		if (mbuf_gethdr(MBUF_DONTWAIT, MBUF_TYPE_DATA, &m) != 0)
+		if (mbuf_gethdr(MBUF_DONTWAIT, MBUF_TYPE_DATA, &m) != 0) {
+			/* try again on next tick */
+			l2tp_timer_arm(&rfc->ack_timer, 1);
 			return;
+		}
 			
 		mbuf_setlen(m, L2TP_CNTL_HDR_SIZE);
 		mbuf_pkthdr_setlen(m, L2TP_CNTL_HDR_SIZE);
@@ -648,59 +1042,61 @@ static void l2tp_rfc_delayed_ack(struct l2tp_rfc *rfc)
 }
 
 /* -----------------------------------------------------------------------------
-called by protocol family when slow timer expires
+ retransmission timer expired
 
-    Decrements retrans_time_remain and checks if time to re-send the message
-    at the beginning of the transmit queue.  If retry count is exhasted,
-    time to break the connection.
------------------------------------------------------------------------------ */
-void l2tp_rfc_slowtimer()
+    Re-send the message at the beginning of the transmit queue.
+    If retry count is exhasted, time to break the connection.
+ ----------------------------------------------------------------------------- */
+static void l2tp_rfc_retransmit(struct l2tp_rfc *rfc)
 {
-    struct l2tp_rfc  	*rfc1, *rfc;
-	int					i;
-    
-	for (i = 0; i < L2TP_RFC_MAX_HASH; i++) {
+    u_int32_t	timeout;
+
+    if ((rfc->state & L2TP_STATE_RELIABILITY_OFF)
+        || TAILQ_EMPTY(&rfc->send_queue))
+        return;
+
+    rfc->retry_count++;
+    if (rfc->retry_count >= rfc->max_retries) {
+        /* send event to client */
+        if (!(rfc->state & L2TP_STATE_FREEING))
+            (*rfc->eventcb)(rfc->host, L2TP_EVT_RELIABLE_FAILED, 0);
+        return;
+    }
 
-		rfc = TAILQ_FIRST(&l2tp_rfc_hash[i]);
+    /* loss: collapse the window, and don't time retransmitted messages (Karn) */
+    l2tp_rfc_cwnd_loss(rfc);
+    rfc->state &= ~L2TP_STATE_RTT_TIMING;
+    rfc->retransmits++;
 
-		while (rfc) {
+    l2tp_rfc_output_queued(rfc, TAILQ_FIRST(&rfc->send_queue));
+    if ((rfc->flags & L2TP_FLAG_ADAPT_TIMER) && rfc->retry_count < 16)
+        timeout = l2tp_rfc_rto(rfc) << rfc->retry_count;
+    else
+        timeout = rfc->initial_timeout;
+    if (timeout > rfc->timeout_cap)
+        timeout = rfc->timeout_cap;
+    l2tp_timer_arm(&rfc->rxmt_timer, timeout);
+}
 
-			if (rfc->state & L2TP_STATE_FREEING 
-				&& --rfc->free_time_remain == 0) {
-				
-				rfc1 = TAILQ_NEXT(rfc, next);
-				l2tp_rfc_free_now(rfc);
-				rfc = rfc1;
-				continue;
-			}
+/* -----------------------------------------------------------------------------
+called by the L2TP timer thread
 
-			if (!(rfc->state & L2TP_STATE_RELIABILITY_OFF) 
-				&& !TAILQ_EMPTY(&rfc->send_queue)) {
-				if (--rfc->retrans_time_remain == 0) {
-					rfc->retry_count++;
-					if (rfc->retry_count >= rfc->max_retries) {
-						/* send event to client */
-						if (!(rfc->state & L2TP_STATE_FREEING))
-							(*rfc->eventcb)(rfc->host, L2TP_EVT_RELIABLE_FAILED, 0);
-					}
-					else {						
-						l2tp_rfc_output_queued(rfc, TAILQ_FIRST(&rfc->send_queue)); 
-						if (rfc->flags & L2TP_FLAG_ADAPT_TIMER)
-							rfc->retrans_time_remain = rfc->initial_timeout << rfc->retry_count; 
-						else 
-							rfc->retrans_time_remain = rfc->initial_timeout;
-						if (rfc->retrans_time_remain > rfc->timeout_cap)
-							rfc->retrans_time_remain = rfc->timeout_cap;
-					}
-				}
-			}
+    Catches the timer wheel up with the uptime clock and runs the timers that
+    are due. Idle rfc are never visited.
+    Returns the number of timers still armed, the thread sleeps until the
+    next l2tp_timer_wakeup when there are none.
+----------------------------------------------------------------------------- */
+u_int32_t l2tp_rfc_timer()
+{
+    u_int64_t	now = l2tp_timer_uptime();
 
-			// do the delayed ack last to take advantage of any data transmits in above code
-			l2tp_rfc_delayed_ack(rfc);
+	lck_mtx_assert(ppp_domain_mutex, LCK_MTX_ASSERT_OWNED);
 
-			rfc = TAILQ_NEXT(rfc, next);
-		}
-	}
+    while (l2tp_timers_armed && l2tp_wheel_clock < now) {
+        l2tp_wheel_clock++;
+        l2tp_wheel_tick();
+    }
+    return l2tp_timers_armed;
 }
 
 /* -----------------------------------------------------------------------------
@@ -724,7 +1120,7 @@ void l2tp_rfc_accept(struct l2tp_rfc* rfc)
             TAILQ_REMOVE(&call_rfc->recv_queue, elem, next);	/* remove the packet from the call socket */
             
             rfc->our_nr = 1;							/* set nr to the correct value */
-            rfc->state |= L2TP_STATE_NEW_SEQUENCE;				/* setup to send ack */
+            l2tp_rfc_need_ack(rfc);						/* setup to send ack */
             if ((*rfc->inputcb)(rfc->host, elem->packet, (struct sockaddr *)elem->addr, 1)) {	/* up to the socket */
 				/* mbuf has been freed by upcall */ 
 			}
@@ -814,7 +1210,10 @@ u_int16_t l2tp_rfc_output_control(struct l2tp_rfc *rfc, mbuf_t m, struct sockadd
     }
 
     elem->seqno = ntohs(hdr->ns);
-    elem->packet = m;
+    if (l2tp_rfc_elem_set_message(elem, m, len)) {
+        l2tp_elem_free(elem);
+        return ENOBUFS;
+    }
     if (to->sa_family)
         bcopy(to, elem->addr, to->sa_len);
     else
@@ -822,90 +1221,328 @@ u_int16_t l2tp_rfc_output_control(struct l2tp_rfc *rfc, mbuf_t m, struct sockadd
     	
     if (TAILQ_EMPTY(&rfc->send_queue)) {			/* first on queue ? */
         rfc->retry_count = 0;
-        rfc->retrans_time_remain = rfc->initial_timeout;
+        l2tp_timer_arm(&rfc->rxmt_timer, l2tp_rfc_rto(rfc));
     }
     TAILQ_INSERT_TAIL(&rfc->send_queue, elem, next);
-    if (SEQ_LT(elem->seqno, rfc->peer_nr + rfc->peer_window)) {	/* within window ?  - send it */
-        rfc->state &= ~L2TP_STATE_NEW_SEQUENCE;			/* disable sending of ack - piggybacked on this packet */
-        return l2tp_rfc_output_queued(rfc, elem);
-    } 
     
-    return 0;
+    return l2tp_rfc_output_window(rfc);
 }
 
 /* -----------------------------------------------------------------------------
+    send the queued control messages not sent yet that fit in the window
 ----------------------------------------------------------------------------- */
-u_int16_t l2tp_rfc_output_data(struct l2tp_rfc *rfc, mbuf_t m)
+static int l2tp_rfc_output_window(struct l2tp_rfc *rfc)
 {
-    struct l2tp_header	*hdr, hdr_data;
-    mbuf_t				m0;
-    u_int16_t 			len, hdr_length, flags, i;
+    struct l2tp_elem 	*elem;
+    u_int16_t			window = l2tp_rfc_send_window(rfc);
+    int					error = 0;
 
-    len = 0;
-	i = 0;
-    for (m0 = m; m0 != 0; m0 = mbuf_next(m0)) {
-        len += mbuf_len(m0);
-		i++;
-		
-		if (i > 32) {
-			struct socket 	*so = (struct socket *)rfc->host;
-			struct ppp_link *link = ALIGNED_CAST(struct ppp_link *)so->so_tpcb;     // Wcast-align fix - we malloc so->so_tpcb
+    TAILQ_FOREACH(elem, &rfc->send_queue, next) {
+        if (SEQ_LT(elem->seqno, rfc->send_next))			/* already sent */
+            continue;
+        if (!SEQ_LT(elem->seqno, rfc->peer_nr + window))	/* outside window */
+            break;
 
-			IOLog("L2TP output packet contains too many mbufs, circular route suspected for %s%d\n", ifnet_name(link->lk_ifnet), ifnet_unit(link->lk_ifnet));
-			
-			mbuf_freem(m);
-			return ENETUNREACH;
-		};
-	}
+        if (!(rfc->state & L2TP_STATE_RTT_TIMING)) {		/* time this one */
+            rfc->state |= L2TP_STATE_RTT_TIMING;
+            rfc->rtt_seq = elem->seqno;
+            rfc->rtt_start = l2tp_wheel_ticks;
+        }
+        rfc->send_next = elem->seqno + 1;
+        rfc->state &= ~L2TP_STATE_NEW_SEQUENCE;			/* disable sending of ack - piggybacked on this packet */
+        error = l2tp_rfc_output_queued(rfc, elem);
+    }
 
-    hdr_length = L2TP_DATA_HDR_SIZE + (rfc->flags & L2TP_FLAG_PEER_SEQ_REQ ? 4 : 0);
-                
-    if (mbuf_prepend(&m, hdr_length, MBUF_WAITOK) != 0)
-        return ENOBUFS;
-    hdr = &hdr_data;
-    bzero(hdr, hdr_length);
-    
-    flags = L2TP_FLAGS_L | L2TP_HDR_VERSION; 
-    hdr->len = htons(len + hdr_length); 
-    hdr->tunnel_id = htons(rfc->peer_tunnel_id);
-    hdr->session_id = htons(rfc->peer_session_id);
+    return error;
+}
+
+/* -----------------------------------------------------------------------------
+    precompute the header of the data packets we send.
+    called when peer ids or flags change, only length and ns vary per packet
+----------------------------------------------------------------------------- */
+static void l2tp_rfc_build_data_hdr(struct l2tp_rfc *rfc)
+{
+    struct l2tp_header	hdr;
+    u_int16_t			flags = L2TP_FLAGS_L | L2TP_HDR_VERSION;
 
+    rfc->data_hdr_len = L2TP_DATA_HDR_SIZE;
+    bzero(&hdr, sizeof(hdr));
     if (rfc->flags & L2TP_FLAG_PEER_SEQ_REQ) {
         flags |= L2TP_FLAGS_S;
-        hdr->ns = htons(rfc->our_last_data_seq++);
-        hdr->nr = htons(0);
+        rfc->data_hdr_len += 4;
+    }
+    hdr.flags_vers = htons(flags);
+    hdr.tunnel_id = htons(rfc->peer_tunnel_id);
+    hdr.session_id = htons(rfc->peer_session_id);
+    memcpy(rfc->data_hdr, &hdr, rfc->data_hdr_len);
+}
+
+/* -----------------------------------------------------------------------------
+    data packets get the header template in a single prepend.
+    when the stack honored the interface hdrlen, the header goes into the leading
+    space of the first mbuf. otherwise mbuf_prepend allocates one mbuf with the
+    data at its end, leaving room for udp/ip headers.
+    a packet routed back into its own tunnel has no leading space left and grows
+    by one mbuf per turn, so the chain is only walked on that slow path.
+----------------------------------------------------------------------------- */
+u_int16_t l2tp_rfc_output_data(struct l2tp_rfc *rfc, mbuf_t m)
+{
+    u_int8_t		*hdr;
+    size_t			len = mbuf_pkthdr_len(m);
+    u_int16_t		val, i;
+    mbuf_t			m0;
+    struct socket 	*so = (struct socket *)rfc->host;
+    struct ppp_link *link = ALIGNED_CAST(struct ppp_link *)so->so_tpcb;     // Wcast-align fix - we malloc so->so_tpcb
+
+    if (len + rfc->data_hdr_len > 0xFFFF) {
+        IOLog("L2TP output packet too large for %s%d\n", ifnet_name(link->lk_ifnet), ifnet_unit(link->lk_ifnet));
+        mbuf_freem(m);
+        return EMSGSIZE;
+    }
+
+    if (mbuf_leadingspace(m) >= rfc->data_hdr_len) {
+        mbuf_setdata(m, (u_int8_t *)mbuf_data(m) - rfc->data_hdr_len, mbuf_len(m) + rfc->data_hdr_len);
+        mbuf_pkthdr_adjustlen(m, rfc->data_hdr_len);
+    }
+    else {
+        i = 0;
+        for (m0 = m; m0 != 0; m0 = mbuf_next(m0)) {
+            if (++i > 32) {
+                IOLog("L2TP output packet contains too many mbufs, circular route suspected for %s%d\n", ifnet_name(link->lk_ifnet), ifnet_unit(link->lk_ifnet));
+                mbuf_freem(m);
+                return ENETUNREACH;
+            }
+        }
+        if (mbuf_prepend(&m, rfc->data_hdr_len, MBUF_WAITOK) != 0)
+            return ENOBUFS;
+    }
+
+    hdr = mbuf_data(m);
+    memcpy(hdr, rfc->data_hdr, rfc->data_hdr_len);
+
+    /* patch length and sequence number - Wcast-align fix - memcpy for unaligned access */
+    val = htons(len + rfc->data_hdr_len);
+    memcpy(hdr + offsetof(struct l2tp_header, len), &val, sizeof(val));
+    if (rfc->flags & L2TP_FLAG_PEER_SEQ_REQ) {
+        val = htons(rfc->our_last_data_seq++);
+        memcpy(hdr + offsetof(struct l2tp_header, ns), &val, sizeof(val));
     }
-    
-    hdr->flags_vers = htons(flags);
 
-    memcpy(mbuf_data(m), hdr, hdr_length);
     return l2tp_udp_output(rfc->socket, rfc->thread, m, (struct sockaddr *)rfc->peer_address);
 }
 
 /* -----------------------------------------------------------------------------
-    send a queued control message
+    keep a control message in a send queue element.
+    the header is kept in the element, and the payload is copied to plain clusters
+    so that each transmission only references it instead of copying it.
+    the payload never keeps the packet header of the original chain, since
+    l2tp_rfc_output_queued chains it behind a header mbuf of its own.
+    the mbuf is consumed in all cases.
+----------------------------------------------------------------------------- */
+static int l2tp_rfc_elem_set_message(struct l2tp_elem *elem, mbuf_t m, u_int16_t len)
+{
+    mbuf_t		cl, last = 0;
+    size_t		plen, off, n;
+
+    memcpy(elem->hdr, mbuf_data(m), L2TP_CNTL_HDR_SIZE);
+    elem->len = len;
+    elem->packet = 0;
+
+    plen = len - L2TP_CNTL_HDR_SIZE;
+    for (off = 0; off < plen; off += n) {
+        cl = 0;
+        if (mbuf_mclget(MBUF_DONTWAIT, MBUF_TYPE_DATA, &cl)) {
+            mbuf_freem(m);
+            if (elem->packet)
+                mbuf_freem(elem->packet);
+            elem->packet = 0;
+            return ENOBUFS;
+        }
+        n = plen - off > MCLBYTES ? MCLBYTES : plen - off;
+        mbuf_copydata(m, L2TP_CNTL_HDR_SIZE + off, n, mbuf_data(cl));
+        mbuf_setlen(cl, n);
+        if (last)
+            mbuf_setnext(last, cl);
+        else
+            elem->packet = cl;
+        last = cl;
+    }
+
+    mbuf_freem(m);
+    return 0;
+}
+
+/* -----------------------------------------------------------------------------
+    send a queued control message.
+    a fresh header mbuf with the current nr is chained to a reference on the payload
 ----------------------------------------------------------------------------- */
 int l2tp_rfc_output_queued(struct l2tp_rfc *rfc, struct l2tp_elem *elem)
 {
-    mbuf_t				dup;
-    struct l2tp_header	*hdr, hdr_data;
+    mbuf_t				m, dup = 0;
+    u_int16_t			nr = htons(rfc->our_nr);
 
-    if (mbuf_copym(elem->packet, 0, MBUF_COPYALL, MBUF_DONTWAIT, &dup) != 0)
+    if (mbuf_gethdr(MBUF_DONTWAIT, MBUF_TYPE_DATA, &m) != 0)
+        return ENOBUFS;
+
+    if (elem->packet
+        && mbuf_copym(elem->packet, 0, MBUF_COPYALL, MBUF_DONTWAIT, &dup) != 0) {
+        mbuf_freem(m);
         return ENOBUFS;
-   
-    hdr = &hdr_data;
-    if (mbuf_len(dup) < L2TP_CNTL_HDR_SIZE) {
-		const errno_t pde = mbuf_pullup(&dup, L2TP_CNTL_HDR_SIZE);
-		if (0 != pde) {
-			IOLog("l2tp_rfc_output_queued mbuf_pullup len %d failed %d\n", L2TP_CNTL_HDR_SIZE, pde);
-			return EINVAL;
-		}
     }
-    memcpy(hdr, mbuf_data(dup), L2TP_CNTL_HDR_SIZE);
-    hdr->nr = htons(rfc->our_nr); 
-    memcpy(mbuf_data(dup), hdr, L2TP_CNTL_HDR_SIZE);
+
+    /* leave room in front for the udp and ip headers */
+    mbuf_align_32(m, L2TP_CNTL_HDR_SIZE);
+    mbuf_setlen(m, L2TP_CNTL_HDR_SIZE);
+    memcpy(mbuf_data(m), elem->hdr, L2TP_CNTL_HDR_SIZE);
+    memcpy((u_int8_t *)mbuf_data(m) + offsetof(struct l2tp_header, nr), &nr, sizeof(nr));
+    mbuf_setnext(m, dup);
+    mbuf_pkthdr_setlen(m, elem->len);
     
-    return l2tp_udp_output(rfc->socket, rfc->thread, dup, (struct sockaddr *)elem->addr);
+    return l2tp_udp_output(rfc->socket, rfc->thread, m, (struct sockaddr *)elem->addr);
+}
+
+/* -----------------------------------------------------------------------------
+    give a data packet, header removed, up to PPP
+----------------------------------------------------------------------------- */
+static void l2tp_rfc_deliver_data(struct l2tp_rfc *rfc, mbuf_t m)
+{
+    if (rfc->state & L2TP_STATE_FREEING)
+        mbuf_freem(m);
+    else 
+        (*rfc->inputcb)(rfc->host, m, 0, 0);
+}
+
+/* -----------------------------------------------------------------------------
+    deliver the packets held in the reorder window that are now in sequence
+----------------------------------------------------------------------------- */
+static void l2tp_rfc_reorder_drain(struct l2tp_rfc *rfc)
+{
+    mbuf_t		*slot;
+
+    while (rfc->reorder_count) {
+        slot = &rfc->reorder[rfc->peer_next_data_seq & (L2TP_REORDER_WINDOW - 1)];
+        if (*slot == 0)
+            break;
+        l2tp_rfc_deliver_data(rfc, *slot);
+        *slot = 0;
+        rfc->reorder_count--;
+        rfc->peer_next_data_seq++;
+        rfc->peer_data_seen = l2tp_seq_advance(rfc->peer_data_seen, 1, 1);
+    }
+
+    if (rfc->reorder_count == 0)
+        l2tp_timer_cancel(&rfc->reorder_timer);
+}
+
+/* -----------------------------------------------------------------------------
+    stop waiting for the packets before seq, they are lost.
+    deliver the held packets in between and signal the loss to PPP
+----------------------------------------------------------------------------- */
+static void l2tp_rfc_reorder_skip(struct l2tp_rfc *rfc, u_int16_t seq)
+{
+    mbuf_t		*slot;
+    u_int32_t	lost = 0;
+
+    while (SEQ_LT(rfc->peer_next_data_seq, seq)) {
+        if (rfc->reorder_count == 0) {
+            lost += (u_int16_t)(seq - rfc->peer_next_data_seq);
+            rfc->peer_data_seen = l2tp_seq_advance(rfc->peer_data_seen, (u_int16_t)(seq - rfc->peer_next_data_seq), 0);
+            rfc->peer_next_data_seq = seq;
+            break;
+        }
+        slot = &rfc->reorder[rfc->peer_next_data_seq & (L2TP_REORDER_WINDOW - 1)];
+        if (*slot) {
+            l2tp_rfc_deliver_data(rfc, *slot);
+            *slot = 0;
+            rfc->reorder_count--;
+            rfc->peer_data_seen = l2tp_seq_advance(rfc->peer_data_seen, 1, 1);
+        }
+        else {
+            lost++;
+            rfc->peer_data_seen = l2tp_seq_advance(rfc->peer_data_seen, 1, 0);
+        }
+        rfc->peer_next_data_seq++;
+    }
+
+    if (lost) {
+        rfc->data_stats.lost += lost;
+        if (rfc->eventcb)
+            (*rfc->eventcb)(rfc->host, L2TP_EVT_INPUTERROR, 0);
+    }
+}
+
+/* -----------------------------------------------------------------------------
+    reorder timer expired, the oldest missing packet is lost
+----------------------------------------------------------------------------- */
+static void l2tp_rfc_reorder_timeout(struct l2tp_rfc *rfc)
+{
+    u_int16_t	seq = rfc->peer_next_data_seq;
+
+    if (rfc->reorder_count == 0)
+        return;
+
+    /* skip up to the first packet we hold */
+    while (rfc->reorder[seq & (L2TP_REORDER_WINDOW - 1)] == 0)
+        seq++;
+    l2tp_rfc_reorder_skip(rfc, seq);
+    l2tp_rfc_reorder_drain(rfc);
+
+    if (rfc->reorder_count)
+        l2tp_timer_arm(&rfc->reorder_timer, L2TP_REORDER_TICKS);
+}
+
+/* -----------------------------------------------------------------------------
+    handle a sequenced data packet, header already removed.
+    packets are delivered in order, packets in advance are held in the reorder window.
+----------------------------------------------------------------------------- */
+static void l2tp_rfc_reorder_input(struct l2tp_rfc *rfc, mbuf_t m, u_int16_t ns)
+{
+    mbuf_t		*slot;
+
+    if (!(rfc->state & L2TP_STATE_DATA_SYNCED)) {
+        /* first sequenced packet, start from there */
+        rfc->state |= L2TP_STATE_DATA_SYNCED;
+        rfc->peer_next_data_seq = ns;
+        rfc->peer_data_seen = 0;
+    }
+
+    switch (l2tp_seq_class(ns, rfc->peer_next_data_seq, rfc->peer_data_seen, L2TP_REORDER_WINDOW)) {
+        case L2TP_SEQ_DUPLICATE:
+            rfc->data_stats.duplicate++;
+            mbuf_freem(m);
+            return;
+
+        case L2TP_SEQ_LATE:
+            rfc->data_stats.late++;
+            mbuf_freem(m);
+            return;
+
+        case L2TP_SEQ_BEYOND:
+            /* make room in the window */
+            l2tp_rfc_reorder_skip(rfc, ns - L2TP_REORDER_WINDOW + 1);
+            l2tp_rfc_reorder_drain(rfc);
+            if (ns != rfc->peer_next_data_seq)
+                break;
+            // no break;
+        case L2TP_SEQ_NEXT:
+            rfc->peer_next_data_seq++;
+            rfc->peer_data_seen = l2tp_seq_advance(rfc->peer_data_seen, 1, 1);
+            l2tp_rfc_deliver_data(rfc, m);
+            l2tp_rfc_reorder_drain(rfc);
+            return;
+    }
+
+    slot = &rfc->reorder[ns & (L2TP_REORDER_WINDOW - 1)];
+    if (*slot) {
+        rfc->data_stats.duplicate++;
+        mbuf_freem(m);
+        return;
+    }
+    *slot = m;
+    rfc->reorder_count++;
+    rfc->data_stats.reordered++;
+    if (!l2tp_timer_pending(&rfc->reorder_timer))
+        l2tp_timer_arm(&rfc->reorder_timer, L2TP_REORDER_TICKS);
 }
 
 /* -----------------------------------------------------------------------------
@@ -954,20 +1591,11 @@ u_int16_t l2tp_handle_data(struct l2tp_rfc *rfc, mbuf_t m, struct sockaddr *from
             hdr_length = L2TP_DATA_HDR_SIZE - 2;
         }
 
+        ns = 0;
         if (flags & L2TP_FLAGS_S) {			/* packet has sequence numbers */
             ns = ntohs(*p);
             p += 2;					/* skip sequence fields */
             hdr_length += 4;
-            if (SEQ_GT(ns, rfc->peer_last_data_seq)) {
-				rfc->peer_last_data_seq++;
-                if (rfc->peer_last_data_seq != ns) {
-                    if (rfc->eventcb)
-						(*rfc->eventcb)(rfc->host, L2TP_EVT_INPUTERROR, 0);
-					rfc->peer_last_data_seq = ns;
-				}
-            } 
-            else
-                goto dropit;
         }
 
         if (flags & L2TP_FLAGS_O) 			/* payload is at offset in the packet */
@@ -975,19 +1603,15 @@ u_int16_t l2tp_handle_data(struct l2tp_rfc *rfc, mbuf_t m, struct sockaddr *from
         
         /* data packet are given up without header */
         mbuf_adj(m, hdr_length);				/* remove the header and send it up to PPP */
-		if (rfc->state & L2TP_STATE_FREEING)
-			mbuf_freem(m);
-		else 
-			(*rfc->inputcb)(rfc->host, m, 0, 0);
+        if (flags & L2TP_FLAGS_S)
+            l2tp_rfc_reorder_input(rfc, m, ns);
+        else
+            l2tp_rfc_deliver_data(rfc, m);
 
         return 1;
     }
 
     return 0;
-
-dropit:
-    mbuf_freem(m);
-    return 1;
 }
 
 /* -----------------------------------------------------------------------------
@@ -1100,7 +1724,7 @@ u_int16_t l2tp_handle_control(struct l2tp_rfc *rfc, mbuf_t m, struct sockaddr *f
                     TAILQ_INSERT_HEAD(&rfc->recv_queue, new_elem, next);   
             } else if (SEQ_LT(ntohs(hdr->ns), rfc->our_nr)) {
                 //IOLog("L2TP dropping message already received seq#=%d\n", ntohs(hdr->ns));
-                rfc->state |= L2TP_STATE_NEW_SEQUENCE;		/* its a dup thats already been ack'd - drop it and ack */
+                l2tp_rfc_need_ack(rfc);				/* its a dup thats already been ack'd - drop it and ack */
                 goto dropit;					
             } else {						/* packet we are waiting for */
                                                                         
@@ -1113,7 +1737,7 @@ u_int16_t l2tp_handle_control(struct l2tp_rfc *rfc, mbuf_t m, struct sockaddr *f
 					return 1;
 				
                 rfc->our_nr++;
-                rfc->state |= L2TP_STATE_NEW_SEQUENCE;		/* sent up - ack it */
+                l2tp_rfc_need_ack(rfc);				/* sent up - ack it */
                 
                 /*
                     * now check for other packets on the queue that can be sent up.
@@ -1198,28 +1822,33 @@ int l2tp_rfc_compare_address(struct sockaddr* addr1, struct sockaddr* addr2)
 void l2tp_rfc_handle_ack(struct l2tp_rfc *rfc, u_int16_t nr)
 {
     struct l2tp_elem 	*elem;
-    u_int16_t			old_nr = rfc->peer_nr;
     
     rfc->peer_nr = nr;
+
+    /* rtt sample, if the timed message was not retransmitted */
+    if ((rfc->state & L2TP_STATE_RTT_TIMING) && SEQ_GT(nr, rfc->rtt_seq)) {
+        rfc->state &= ~L2TP_STATE_RTT_TIMING;
+        l2tp_rfc_rtt_update(rfc, l2tp_wheel_ticks - rfc->rtt_start);
+    }
+
     while((elem = TAILQ_FIRST(&rfc->send_queue)))
         if (SEQ_GT(nr, elem->seqno)) {
-            rfc->retrans_time_remain = rfc->initial_timeout;	/* setup timeout and count */
             rfc->retry_count = 0;
+            l2tp_rfc_cwnd_open(rfc);
             TAILQ_REMOVE(&rfc->send_queue, elem, next);
-            mbuf_freem(elem->packet);
+            if (elem->packet)
+                mbuf_freem(elem->packet);
             l2tp_elem_free(elem);
         } else
             break;
             
     
-    if (!TAILQ_EMPTY(&rfc->send_queue)) {      
-         /* check for packets that were outside the window that should now be sent */
-        TAILQ_FOREACH(elem, &rfc->send_queue, next) {
-            if (SEQ_GT(elem->seqno, nr + rfc->peer_window - 1))	/* outside current window ? */
-                break;
-            if (SEQ_GT(elem->seqno, old_nr + rfc->peer_window - 1))	/* outside previous window ? */
-                l2tp_rfc_output_queued(rfc, elem);
-        }
+    if (TAILQ_EMPTY(&rfc->send_queue))
+        l2tp_timer_cancel(&rfc->rxmt_timer);
+    else {
+        l2tp_timer_arm(&rfc->rxmt_timer, l2tp_rfc_rto(rfc));	/* setup timeout */
+        /* send packets that were outside the window and now fit in it */
+        l2tp_rfc_output_window(rfc);
     }
 }
 
@@ -27,6 +27,7 @@
 #define __L2TP_RFC_H__
 
 #define L2TP_MTU	1500
+#define L2TP_TIMER_HZ	20		/* timer ticks per second - 50 ms resolution */
 
 enum {
     L2TP_EVT_XMIT_OK = 1,
@@ -59,7 +60,9 @@ enum {
     L2TP_CMD_SETBAUDRATE,	// set tunnel baud rate
     L2TP_CMD_GETBAUDRATE,	// get tunnel baud rate
     L2TP_CMD_SETRELIABILITY, // turn on/off the reliability layer
-    L2TP_CMD_SETDELEGATEDPID // set the delegated process ID
+    L2TP_CMD_SETDELEGATEDPID, // set the delegated process ID
+    L2TP_CMD_GETCONTROLSTATS,	// get congestion and rtt state of the control connection
+    L2TP_CMD_GETDATASTATS	// get sequenced data counters
 };
 
 typedef int (*l2tp_rfc_input_callback)(void *data, mbuf_t m, struct sockaddr *from, int more);
@@ -72,7 +75,7 @@ u_int16_t l2tp_rfc_new_client(void *host, void **data,
                          l2tp_rfc_event_callback event);
 
 void l2tp_rfc_free_client(void *data);
-void l2tp_rfc_slowtimer(void);
+u_int32_t l2tp_rfc_timer(void);
 u_int16_t l2tp_rfc_command(void *userdata, u_int32_t cmd, void *cmddata);
 u_int16_t l2tp_rfc_output(void *data, mbuf_t m, struct sockaddr *to);
 
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+#ifndef __L2TP_SEQ_H__
+#define __L2TP_SEQ_H__
+
+/*
+ * l2tp sequence numbers are 16 bit integers operated
+ * on with modular arithmetic.  These macros can be
+ * used to compare such integers.
+ */
+#define SEQ_LT(a,b)     ((int16_t)(((int16_t)(a))-((int16_t)(b))) < 0)
+#define SEQ_LEQ(a,b)    ((int16_t)(((int16_t)(a))-((int16_t)(b))) <= 0)
+#define SEQ_GT(a,b)     ((int16_t)(((int16_t)(a))-((int16_t)(b))) > 0)
+#define SEQ_GEQ(a,b)    ((int16_t)(((int16_t)(a))-((int16_t)(b))) >= 0)
+
+/*
+ * where a sequenced data packet falls, relative to the next one expected.
+ * for the packets behind, a history word has one bit per seq number:
+ * bit i is set if next - 1 - i was delivered, clear if it was given up on.
+ * packets further behind than the history are counted as late.
+ */
+#define L2TP_SEQ_HISTORY	32
+
+#define L2TP_SEQ_NEXT		0	/* the packet expected */
+#define L2TP_SEQ_AHEAD		1	/* in advance, inside the reorder window */
+#define L2TP_SEQ_BEYOND		2	/* in advance, past the reorder window */
+#define L2TP_SEQ_DUPLICATE	3	/* behind, delivered already */
+#define L2TP_SEQ_LATE		4	/* behind, given up on already */
+
+/* -----------------------------------------------------------------------------
+    classify ns, with next the seq number expected and seen the history
+----------------------------------------------------------------------------- */
+static __inline__ int l2tp_seq_class(u_int16_t ns, u_int16_t next, u_int32_t seen, u_int16_t window)
+{
+    u_int16_t	behind;
+
+    if (ns == next)
+        return L2TP_SEQ_NEXT;
+    if (SEQ_GT(ns, next))
+        return SEQ_LT(ns, (u_int16_t)(next + window)) ? L2TP_SEQ_AHEAD : L2TP_SEQ_BEYOND;
+
+    behind = next - 1 - ns;
+    if (behind < L2TP_SEQ_HISTORY && (seen & (1U << behind)))
+        return L2TP_SEQ_DUPLICATE;
+    return L2TP_SEQ_LATE;
+}
+
+/* -----------------------------------------------------------------------------
+    update the history when next moves n seq numbers forward,
+    the packets passed were delivered or given up on
+----------------------------------------------------------------------------- */
+static __inline__ u_int32_t l2tp_seq_advance(u_int32_t seen, u_int32_t n, int delivered)
+{
+    if (n >= L2TP_SEQ_HISTORY)
+        return delivered ? 0xFFFFFFFF : 0;
+    seen <<= n;
+    if (delivered)
+        seen |= (1U << n) - 1;
+    return seen;
+}
+
+#endif
@@ -0,0 +1,76 @@
+/*
+ * l2tp_seq_test.c - tests for the sequenced data packet classes in l2tp_seq.h,
+ * the decisions l2tp_rfc_reorder_input takes for each data packet received.
+ *
+ * Built by the "l2tp_seq_test (Tool)" target, which runs it after the build
+ * and fails when a packet falls in the wrong class.
+ */
+
+#include <sys/types.h>
+#include <stdio.h>
+
+#include "l2tp_seq.h"
+
+#define WINDOW	8
+
+static char *class_names[] = { "next", "ahead", "beyond", "duplicate", "late" };
+
+static int failures = 0;
+
+static void
+check(char *what, u_int16_t ns, u_int16_t next, u_int32_t seen, int expected)
+{
+    int got = l2tp_seq_class(ns, next, seen, WINDOW);
+
+    if (got == expected) {
+	printf("PASS: %s\n", what);
+	return;
+    }
+    printf("FAIL: %s, ns %d next %d seen 0x%08x: got %s, expected %s\n",
+	   what, ns, next, seen, class_names[got], class_names[expected]);
+    failures++;
+}
+
+int
+main(int argc, char **argv)
+{
+    u_int32_t seen;
+
+    /* 0 to 9 delivered, 10 expected */
+    seen = l2tp_seq_advance(0, 10, 1);
+    check("next", 10, 10, seen, L2TP_SEQ_NEXT);
+    check("ahead, in the window", 13, 10, seen, L2TP_SEQ_AHEAD);
+    check("ahead, last slot of the window", 17, 10, seen, L2TP_SEQ_AHEAD);
+    check("beyond the window", 18, 10, seen, L2TP_SEQ_BEYOND);
+    check("beyond, half the space ahead", 10 + 0x7fff, 10, seen, L2TP_SEQ_BEYOND);
+    check("duplicate of the last delivered", 9, 10, seen, L2TP_SEQ_DUPLICATE);
+    check("older duplicate", 5, 10, seen, L2TP_SEQ_DUPLICATE);
+
+    /* 10 and 11 given up on, 12 delivered, 13 expected */
+    seen = l2tp_seq_advance(seen, 2, 0);
+    seen = l2tp_seq_advance(seen, 1, 1);
+    check("late, given up on", 11, 13, seen, L2TP_SEQ_LATE);
+    check("late, given up on before", 10, 13, seen, L2TP_SEQ_LATE);
+    check("duplicate after a loss", 12, 13, seen, L2TP_SEQ_DUPLICATE);
+    check("duplicate before a loss", 9, 13, seen, L2TP_SEQ_DUPLICATE);
+    check("late, older than the history", 13 - L2TP_SEQ_HISTORY - 1, 13, seen, L2TP_SEQ_LATE);
+
+    /* wrap around, everything delivered up to 0xffff, 0 and 1, 2 expected */
+    seen = l2tp_seq_advance(0, L2TP_SEQ_HISTORY, 1);
+    check("next after the wrap", 2, 2, seen, L2TP_SEQ_NEXT);
+    check("duplicate across the wrap", 0xffff, 2, seen, L2TP_SEQ_DUPLICATE);
+    check("older duplicate across the wrap", 0xfff0, 2, seen, L2TP_SEQ_DUPLICATE);
+    check("ahead across the wrap", 3, 0xfffe, seen, L2TP_SEQ_AHEAD);
+    check("beyond across the wrap", 6, 0xfffe, seen, L2TP_SEQ_BEYOND);
+
+    /* a gap larger than the history forgets everything */
+    seen = l2tp_seq_advance(seen, 100, 0);
+    check("late after a long gap", 1, 2, seen, L2TP_SEQ_LATE);
+
+    if (failures) {
+	printf("%d test(s) failed\n", failures);
+	return 1;
+    }
+    printf("all tests passed\n");
+    return 0;
+}
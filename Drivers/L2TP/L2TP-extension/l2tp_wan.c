@@ -168,7 +168,7 @@ int l2tp_wan_attach(void *rfc, struct ppp_link **link)
     lk->lk_mtu 		= L2TP_MTU;
     lk->lk_mru 		= L2TP_MTU;;
     lk->lk_type 	= PPP_TYPE_L2TP;
-    lk->lk_hdrlen 	= 80;	// ??? 
+    lk->lk_hdrlen 	= L2TP_LINK_HDRLEN;
 	l2tp_rfc_command(rfc, L2TP_CMD_GETBAUDRATE, &lk->lk_baudrate);
     lk->lk_ioctl 	= l2tp_wan_ioctl;
     lk->lk_output 	= l2tp_wan_output;
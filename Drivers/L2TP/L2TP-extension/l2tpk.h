@@ -58,6 +58,8 @@ SYSCTL_DECL(_net_ppp_l2tp);
 #define L2TP_OPT_BAUDRATE		15	/* tunnel baudrate */
 #define L2TP_OPT_RELIABILITY		16	/* turn on/off reliability layer */
 #define L2TP_OPT_SETDELEGATEDPID    17  /* set the delegated process for traffic statistics */
+#define L2TP_OPT_CONTROL_STATS		18	/* congestion and rtt state of the reliable connection layer */
+#define L2TP_OPT_DATA_STATS		19	/* sequenced data packets counters */
 
 /* flags definition */
 #define L2TP_FLAG_DEBUG		0x00000002	/* debug mode, send verbose logs to syslog */
@@ -82,6 +84,7 @@ SYSCTL_DECL(_net_ppp_l2tp);
 #define L2TP_HDR_VERSION	2
 #define L2TP_CNTL_HDR_SIZE	12	/* control headers are always this size */
 #define L2TP_DATA_HDR_SIZE	8	/* hdr size for data we send - without sequencing */
+#define L2TP_LINK_HDRLEN	80	/* leading space for l2tp data hdr with sequencing, udp and ipv6 hdrs */
 
 struct l2tp_header {
     /* header for control messages */
@@ -94,6 +97,26 @@ struct l2tp_header {
     u_int16_t	off_size;
 };
 
+/* reliable connection layer state, returned by L2TP_OPT_CONTROL_STATS */
+struct l2tp_control_stats {
+    u_int16_t	cwnd;				/* congestion window - messages */
+    u_int16_t	ssthresh;			/* slow start threshold - messages */
+    u_int16_t	peer_window;			/* peer receive window - messages */
+    u_int16_t	reserved;
+    u_int32_t	srtt;				/* smoothed round trip time - milliseconds */
+    u_int32_t	rttvar;				/* round trip time variance - milliseconds */
+    u_int32_t	rto;				/* current retransmission timeout - milliseconds */
+    u_int32_t	retransmits;			/* messages retransmitted */
+};
+
+/* sequenced data counters, returned by L2TP_OPT_DATA_STATS */
+struct l2tp_data_stats {
+    u_int32_t	reordered;			/* packets held until the missing ones arrived */
+    u_int32_t	late;				/* packets arrived after we gave up on them */
+    u_int32_t	duplicate;			/* packets received twice */
+    u_int32_t	lost;				/* packets never received */
+};
+
 struct sockaddr_l2tp {
     u_int8_t	l2tp_len;			/* sizeof(struct sockaddr_ppp) + variable part */
     u_int8_t	l2tp_family;			/* AF_PPPCTL */
@@ -266,7 +266,7 @@ void l2tp_disconnect(void);
 void l2tp_close_fds(void);
 void l2tp_cleanup(void);
 int l2tp_establish_ppp(int);
-void l2tp_wait_input(void);
+void l2tp_wait_input(int fd, void *arg);
 void l2tp_disestablish_ppp(int);
 
 static void l2tp_hello_timeout(void *arg);
@@ -299,7 +299,6 @@ int start(CFBundleRef ref)
     bzero(the_channel, sizeof(struct channel));
     the_channel->options = l2tp_options;
     the_channel->process_extra_options = l2tp_process_extra_options;
-    the_channel->wait_input = l2tp_wait_input;
     the_channel->check_options = l2tp_check_options;
     the_channel->pre_start_link_check = l2tp_pre_start_link_check;
     the_channel->connect = l2tp_connect;
@@ -422,17 +421,16 @@ static void l2tp_wait_interface_timeout (void *arg)
 }
 
 /* ----------------------------------------------------------------------------- 
-called back everytime we go out of select, and data needs to be read
-the hook is called and has a chance to get data out of its file descriptor
-in the case of L2TP, we get control data on the socket
-or get awaken when connection is closed
+called back when one of our file descriptors has data to read
+in the case of L2TP, we get control data on the control socket,
+interface events on the event socket, or get awaken when connection is closed
 ----------------------------------------------------------------------------- */
-void l2tp_wait_input()
+void l2tp_wait_input(int fd, void *arg)
 {
     int err, found;
     struct ifaddrs *ifap = NULL;
 
-    if (eventsockfd != -1 && is_ready_fd(eventsockfd)) {
+    if (eventsockfd != -1 && fd == eventsockfd) {
     
 		char                 	buf[256] __attribute__ ((aligned(4)));		// Wcast-align fix - force alignment           
         char ev_if[32];
@@ -554,7 +552,7 @@ void l2tp_wait_input()
         }
     }
 
-    if (ctrlsockfd != -1 && is_ready_fd(ctrlsockfd)) {
+    if (ctrlsockfd != -1 && fd == ctrlsockfd) {
 
        err = l2tp_data_in(ctrlsockfd);
        if (err < 0) {
@@ -575,9 +573,6 @@ void l2tp_wait_input()
             session = NULL;
 	   }
     }
-
-	ppp_process_nat_port_mapping_events();
-	ppp_process_auxiliary_probe_input();
 }
 
 /* -----------------------------------------------------------------------------
@@ -2278,8 +2273,8 @@ int l2tp_establish_ppp(int fd)
 
     // add just the control socket
     // the data socket is just for moving data in the kernel
-    add_fd(ctrlsockfd);	
-    add_fd(eventsockfd);	
+    add_fd_handler(ctrlsockfd, l2tp_wait_input, 0);
+    add_fd_handler(eventsockfd, l2tp_wait_input, 0);
     return new_fd;
 }
 
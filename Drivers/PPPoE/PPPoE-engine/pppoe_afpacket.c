@@ -0,0 +1,306 @@
+/*
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/queue.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <linux/filter.h>
+#include <linux/if_packet.h>
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pppoe_engine.h"
+#include "pppoe_afpacket.h"
+
+
+/* -----------------------------------------------------------------------------
+Definitions
+----------------------------------------------------------------------------- */
+
+#ifndef PACKET_IGNORE_OUTGOING
+#define PACKET_IGNORE_OUTGOING	23
+#endif
+
+// the data of a tx frame starts where the sockaddr_ll of an rx frame would be
+#define PPPOE_AFP_TX_DATA	(TPACKET3_HDRLEN - sizeof(struct sockaddr_ll))
+
+// only pppoe discovery and session frames are queued in the ring
+static struct sock_filter pppoe_afp_filter[] = {
+    { 0x28, 0, 0, 12 },		// ldh [12], ether type
+    { 0x15, 2, 0, 0x8863 },	// jeq #0x8863, accept
+    { 0x15, 1, 0, 0x8864 },	// jeq #0x8864, accept
+    { 0x06, 0, 0, 0 },		// ret #0
+    { 0x06, 0, 0, 0xFFFF },	// ret #0xffff
+};
+
+/* -----------------------------------------------------------------------------
+Forward declarations
+----------------------------------------------------------------------------- */
+
+static u_int8_t *pppoe_afp_tx_alloc(void *ctx);
+static void pppoe_afp_tx_send(void *ctx, u_int8_t *frame, u_int16_t len);
+static void pppoe_afp_tx_flush(void *ctx);
+static struct tpacket3_hdr *pppoe_afp_tx_frame(struct pppoe_afp *afp, u_int32_t i);
+
+
+/* -----------------------------------------------------------------------------
+open a packet socket on the interface, with its rx and tx rings
+promisc is needed to receive frames for addresses other than the interface
+one, when simulating subscribers
+return 0 or an errno
+----------------------------------------------------------------------------- */
+int pppoe_afp_open(struct pppoe_afp *afp, char *ifname, int promisc)
+{
+    struct sock_fprog	prog;
+    struct sockaddr_ll	sll;
+    struct packet_mreq	mreq;
+    struct ifreq	ifr;
+    int			val, err;
+
+    memset(afp, 0, sizeof(*afp));
+    afp->map = MAP_FAILED;
+
+    afp->ifindex = if_nametoindex(ifname);
+    if (afp->ifindex == 0)
+        return errno;
+
+    // no protocol yet, nothing is queued before the filter and the rings are set
+    afp->fd = socket(AF_PACKET, SOCK_RAW, 0);
+    if (afp->fd < 0)
+        return errno;
+
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, ifname, sizeof(ifr.ifr_name) - 1);
+    if (ioctl(afp->fd, SIOCGIFHWADDR, &ifr) < 0)
+        goto fail;
+    memcpy(afp->address, ifr.ifr_hwaddr.sa_data, ETHER_ADDR_LEN);
+
+    val = TPACKET_V3;
+    if (setsockopt(afp->fd, SOL_PACKET, PACKET_VERSION, &val, sizeof(val)) < 0)
+        goto fail;
+
+    prog.len = sizeof(pppoe_afp_filter) / sizeof(pppoe_afp_filter[0]);
+    prog.filter = pppoe_afp_filter;
+    if (setsockopt(afp->fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) < 0)
+        goto fail;
+
+    // our own frames are not looped back in the rx ring (linux 4.20)
+    val = 1;
+    setsockopt(afp->fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &val, sizeof(val));
+    // and they go straight to the driver
+    setsockopt(afp->fd, SOL_PACKET, PACKET_QDISC_BYPASS, &val, sizeof(val));
+
+    afp->rx_req.tp_block_size = PPPOE_AFP_RX_BLOCK_SIZE;
+    afp->rx_req.tp_block_nr = PPPOE_AFP_RX_BLOCK_NR;
+    afp->rx_req.tp_frame_size = PPPOE_AFP_TX_FRAME_SIZE;
+    afp->rx_req.tp_frame_nr = PPPOE_AFP_RX_BLOCK_SIZE / PPPOE_AFP_TX_FRAME_SIZE * PPPOE_AFP_RX_BLOCK_NR;
+    afp->rx_req.tp_retire_blk_tov = PPPOE_AFP_RX_BLOCK_TOV;
+    if (setsockopt(afp->fd, SOL_PACKET, PACKET_RX_RING, &afp->rx_req, sizeof(afp->rx_req)) < 0)
+        goto fail;
+
+    // the tx ring is made of frames, the block fields must be 0
+    afp->tx_req.tp_block_size = PPPOE_AFP_TX_BLOCK_SIZE;
+    afp->tx_req.tp_block_nr = PPPOE_AFP_TX_BLOCK_NR;
+    afp->tx_req.tp_frame_size = PPPOE_AFP_TX_FRAME_SIZE;
+    afp->tx_req.tp_frame_nr = PPPOE_AFP_TX_BLOCK_SIZE / PPPOE_AFP_TX_FRAME_SIZE * PPPOE_AFP_TX_BLOCK_NR;
+    if (setsockopt(afp->fd, SOL_PACKET, PACKET_TX_RING, &afp->tx_req, sizeof(afp->tx_req)) < 0)
+        goto fail;
+
+    afp->map_size = (size_t)afp->rx_req.tp_block_size * afp->rx_req.tp_block_nr
+        + (size_t)afp->tx_req.tp_block_size * afp->tx_req.tp_block_nr;
+    afp->map = mmap(0, afp->map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED | MAP_POPULATE, afp->fd, 0);
+    if (afp->map == MAP_FAILED)
+        afp->map = mmap(0, afp->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, afp->fd, 0);
+    if (afp->map == MAP_FAILED)
+        goto fail;
+    afp->tx_ring = afp->map + (size_t)afp->rx_req.tp_block_size * afp->rx_req.tp_block_nr;
+
+    if (promisc) {
+        memset(&mreq, 0, sizeof(mreq));
+        mreq.mr_ifindex = afp->ifindex;
+        mreq.mr_type = PACKET_MR_PROMISC;
+        if (setsockopt(afp->fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0)
+            goto fail;
+    }
+
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htons(ETH_P_ALL);
+    sll.sll_ifindex = afp->ifindex;
+    if (bind(afp->fd, (struct sockaddr *)&sll, sizeof(sll)) < 0)
+        goto fail;
+
+    return 0;
+
+fail:
+    err = errno;
+    pppoe_afp_close(afp);
+    return err;
+}
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+void pppoe_afp_close(struct pppoe_afp *afp)
+{
+    if (afp->map != MAP_FAILED)
+        munmap(afp->map, afp->map_size);
+    afp->map = MAP_FAILED;
+    if (afp->fd >= 0)
+        close(afp->fd);
+    afp->fd = -1;
+}
+
+/* -----------------------------------------------------------------------------
+pass the frames of the blocks the kernel handed over to input, then give the
+blocks back. waits up to timeout ms for a block when none is ready
+return the number of frames, -1 on error
+----------------------------------------------------------------------------- */
+int pppoe_afp_input(struct pppoe_afp *afp, int timeout,
+                    void (*input)(void *arg, u_int8_t *frame, u_int32_t len), void *arg)
+{
+    struct tpacket_block_desc	*block;
+    struct tpacket3_hdr		*hdr;
+    struct pollfd		pfd;
+    u_int32_t			i, n = 0;
+
+    for (;;) {
+        block = (struct tpacket_block_desc *)(afp->map + (size_t)afp->rx_block * afp->rx_req.tp_block_size);
+        if (!(__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)) {
+            if (n || timeout == 0)
+                break;
+            pfd.fd = afp->fd;
+            pfd.events = POLLIN | POLLERR;
+            pfd.revents = 0;
+            if (poll(&pfd, 1, timeout) < 0 && errno != EINTR)
+                return -1;
+            timeout = 0;
+            continue;
+        }
+
+        hdr = (struct tpacket3_hdr *)((u_int8_t *)block + block->hdr.bh1.offset_to_first_pkt);
+        for (i = 0; i < block->hdr.bh1.num_pkts; i++) {
+            (*input)(arg, (u_int8_t *)hdr + hdr->tp_mac, hdr->tp_snaplen);
+            hdr = (struct tpacket3_hdr *)((u_int8_t *)hdr + hdr->tp_next_offset);
+        }
+        n += block->hdr.bh1.num_pkts;
+
+        __atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+        afp->rx_block = (afp->rx_block + 1) % afp->rx_req.tp_block_nr;
+    }
+    return n;
+}
+
+/* -----------------------------------------------------------------------------
+the engine frame backend on the tx ring
+----------------------------------------------------------------------------- */
+void pppoe_afp_io(struct pppoe_afp *afp, struct pppoe_eng_io *io)
+{
+    io->ctx = afp;
+    io->tx_alloc = pppoe_afp_tx_alloc;
+    io->tx_send = pppoe_afp_tx_send;
+    io->tx_flush = pppoe_afp_tx_flush;
+}
+
+/* -----------------------------------------------------------------------------
+frames received and dropped by the kernel since the last call, ring full
+----------------------------------------------------------------------------- */
+int pppoe_afp_drops(struct pppoe_afp *afp, u_int32_t *packets, u_int32_t *drops)
+{
+    struct tpacket_stats_v3	st;
+    socklen_t			len = sizeof(st);
+
+    if (getsockopt(afp->fd, SOL_PACKET, PACKET_STATISTICS, &st, &len) < 0)
+        return errno;
+    *packets = st.tp_packets;
+    *drops = st.tp_drops;
+    return 0;
+}
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+struct tpacket3_hdr *pppoe_afp_tx_frame(struct pppoe_afp *afp, u_int32_t i)
+{
+    return (struct tpacket3_hdr *)(afp->tx_ring + (size_t)i * afp->tx_req.tp_frame_size);
+}
+
+/* -----------------------------------------------------------------------------
+the next tx frame, if the kernel is done with it
+----------------------------------------------------------------------------- */
+u_int8_t *pppoe_afp_tx_alloc(void *ctx)
+{
+    struct pppoe_afp	*afp = ctx;
+    struct tpacket3_hdr	*hdr = pppoe_afp_tx_frame(afp, afp->tx_head);
+    u_int32_t		status;
+
+    status = __atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE);
+    if (status & (TP_STATUS_SEND_REQUEST | TP_STATUS_SENDING)) {
+        // the ring is full of frames we did not kick yet, or the kernel is late
+        pppoe_afp_tx_flush(afp);
+        status = __atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE);
+        if (status & (TP_STATUS_SEND_REQUEST | TP_STATUS_SENDING)) {
+            afp->tx_full++;
+            return 0;
+        }
+    }
+    return (u_int8_t *)hdr + PPPOE_AFP_TX_DATA;
+}
+
+/* -----------------------------------------------------------------------------
+hand the frame filled in the ring to the kernel, it goes on the next kick
+----------------------------------------------------------------------------- */
+void pppoe_afp_tx_send(void *ctx, u_int8_t *frame, u_int16_t len)
+{
+    struct pppoe_afp	*afp = ctx;
+    struct tpacket3_hdr	*hdr = (struct tpacket3_hdr *)(frame - PPPOE_AFP_TX_DATA);
+
+    hdr->tp_len = len;
+    hdr->tp_snaplen = len;
+    hdr->tp_next_offset = 0;
+    __atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+
+    afp->tx_head = (afp->tx_head + 1) % afp->tx_req.tp_frame_nr;
+    if (++afp->tx_pending >= PPPOE_AFP_TX_BATCH)
+        pppoe_afp_tx_flush(afp);
+}
+
+/* -----------------------------------------------------------------------------
+kick the kernel, it sends all the frames handed over, without blocking
+----------------------------------------------------------------------------- */
+void pppoe_afp_tx_flush(void *ctx)
+{
+    struct pppoe_afp	*afp = ctx;
+
+    if (afp->tx_pending == 0)
+        return;
+    // on ENOBUFS or EAGAIN the frames stay in the ring, for the next kick
+    sendto(afp->fd, 0, 0, MSG_DONTWAIT, 0, 0);
+    afp->tx_pending = 0;
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+#ifndef __PPPOE_AFPACKET_H__
+#define __PPPOE_AFPACKET_H__
+
+#include <linux/if_packet.h>
+
+/*
+ * AF_PACKET backend of the pppoe engine, linux only.
+ * frames are received in a TPACKET_V3 ring of blocks, and sent from a
+ * TPACKET_V3 ring of frames, both mapped in user space: the engine parses
+ * and builds frames in place, the kernel copies them once to or from the skb.
+ */
+
+#define PPPOE_AFP_RX_BLOCK_SIZE		(1 << 18)	// 256 KB, many frames per block
+#define PPPOE_AFP_RX_BLOCK_NR		32
+#define PPPOE_AFP_RX_BLOCK_TOV		1		// ms, a partly filled block is handed over then
+#define PPPOE_AFP_TX_FRAME_SIZE		2048		// fits an ethernet frame and the tpacket header
+#define PPPOE_AFP_TX_BLOCK_SIZE		(1 << 16)
+#define PPPOE_AFP_TX_BLOCK_NR		64		// 2048 frames
+#define PPPOE_AFP_TX_BATCH		64		// frames queued before the kernel is kicked
+
+struct pppoe_afp {
+    int			fd;
+    int			ifindex;
+    u_int8_t		address[ETHER_ADDR_LEN];
+    u_int8_t		*map;			/* rx ring, followed by the tx ring */
+    size_t		map_size;
+    struct tpacket_req3	rx_req;
+    struct tpacket_req3	tx_req;
+    u_int8_t		*tx_ring;
+    u_int32_t		rx_block;		/* next block to look at */
+    u_int32_t		tx_head;		/* next frame to fill */
+    u_int32_t		tx_pending;		/* frames filled since the last kick */
+    u_int64_t		tx_full;		/* frames refused, ring full */
+};
+
+struct pppoe_eng_io;
+
+int pppoe_afp_open(struct pppoe_afp *afp, char *ifname, int promisc);
+void pppoe_afp_close(struct pppoe_afp *afp);
+int pppoe_afp_input(struct pppoe_afp *afp, int timeout,
+                    void (*input)(void *arg, u_int8_t *frame, u_int32_t len), void *arg);
+void pppoe_afp_io(struct pppoe_afp *afp, struct pppoe_eng_io *io);
+int pppoe_afp_drops(struct pppoe_afp *afp, u_int32_t *packets, u_int32_t *drops);
+
+#endif
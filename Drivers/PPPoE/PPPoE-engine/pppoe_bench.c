@@ -0,0 +1,276 @@
+/*
+ * pppoe_bench.c - sessions and packets per second of the pppoe engine.
+ *
+ * An access concentrator runs on one interface in a thread of its own, and
+ * the subscribers call from the other, each from an address of its own,
+ * through the AF_PACKET backend. Both ends are normally the two sides of a
+ * veth pair, see pppoe_veth_bench.sh.
+ *
+ *   pppoe_bench -s ac_if -c client_if [-n sessions] [-t seconds] [-w window] [-l len]
+ *
+ * All the sessions are brought up as fast as they can, with up to window
+ * calls in discovery at a time, then the subscribers send packets of len
+ * bytes, which the concentrator echoes, with up to window packets on the
+ * wire, for the given time. Last all the sessions are terminated with a PADT.
+ * Exits with 1 when a session did not come up or was not torn down.
+ */
+
+#include <sys/types.h>
+#include <sys/queue.h>
+#include <net/ethernet.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../PPPoE-extension/pppoe_tags.h"
+#include "pppoe_engine.h"
+#include "pppoe_afpacket.h"
+
+#define SERVICE		"pppoe-bench"
+
+struct ac {
+    pthread_t		thread;
+    struct pppoe_afp	afp;
+    struct pppoe_engine	eng;
+    int			stop;
+    u_int32_t		connected;	/* published for the client side */
+};
+
+static struct ac ac;
+static struct pppoe_afp client_afp;
+static struct pppoe_engine client;
+
+static u_int32_t connected, failed, echoed, inflight;
+
+static u_int64_t
+now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u_int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static double
+now_s(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+ac_frame(void *arg, u_int8_t *frame, u_int32_t len)
+{
+    pppoe_eng_input(&ac.eng, frame, len, now_ms());
+}
+
+/* echo every session packet */
+static void
+ac_input(void *arg, struct pppoe_eng_session *sess, u_int8_t *data, u_int16_t len)
+{
+    pppoe_eng_output(&ac.eng, sess, data, len);
+}
+
+static void *
+ac_run(void *arg)
+{
+    while (!__atomic_load_n(&ac.stop, __ATOMIC_ACQUIRE)) {
+	pppoe_afp_input(&ac.afp, 1, ac_frame, 0);
+	pppoe_eng_timer(&ac.eng, now_ms());
+	(*ac.eng.io.tx_flush)(ac.eng.io.ctx);
+	__atomic_store_n(&ac.connected, ac.eng.connected, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+static void
+client_frame(void *arg, u_int8_t *frame, u_int32_t len)
+{
+    pppoe_eng_input(&client, frame, len, now_ms());
+}
+
+static void
+client_event(void *arg, struct pppoe_eng_session *sess, u_int32_t event, u_int32_t msg)
+{
+    if (event == PPPOE_ENG_EVT_CONNECTED)
+	connected++;
+    else if (msg)
+	failed++;
+}
+
+static void
+client_input(void *arg, struct pppoe_eng_session *sess, u_int8_t *data, u_int16_t len)
+{
+    echoed++;
+    if (inflight)
+	inflight--;
+}
+
+/* receive what is there, waiting up to timeout ms, run the timers, send */
+static void
+client_pump(int timeout)
+{
+    pppoe_afp_input(&client_afp, timeout, client_frame, 0);
+    pppoe_eng_timer(&client, now_ms());
+    (*client.io.tx_flush)(client.io.ctx);
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr, "usage: pppoe_bench -s ac_if -c client_if [-n sessions] [-t seconds] [-w window] [-l len]\n");
+    exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+    char *ac_if = 0, *client_if = 0;
+    u_int32_t sessions = 10000, seconds = 5, window = 256, len = 64;
+    u_int8_t address[ETHER_ADDR_LEN], data[ETHER_MAX_LEN];
+    u_int32_t i, next, sent, rx_packets, rx_drops;
+    u_int64_t last;
+    struct pppoe_eng_io io;
+    double start, elapsed;
+    int c, err, status = 0;
+
+    while ((c = getopt(argc, argv, "s:c:n:t:w:l:")) != -1) {
+	switch (c) {
+	    case 's': ac_if = optarg; break;
+	    case 'c': client_if = optarg; break;
+	    case 'n': sessions = strtoul(optarg, 0, 0); break;
+	    case 't': seconds = strtoul(optarg, 0, 0); break;
+	    case 'w': window = strtoul(optarg, 0, 0); break;
+	    case 'l': len = strtoul(optarg, 0, 0); break;
+	    default: usage();
+	}
+    }
+    if (ac_if == 0 || client_if == 0 || sessions == 0 || sessions > 0xFFFE
+	|| len < 2 || len > PPPOE_MTU || window == 0)
+	usage();
+
+    if ((err = pppoe_afp_open(&ac.afp, ac_if, 0))) {
+	fprintf(stderr, "pppoe_bench: %s: %s\n", ac_if, strerror(err));
+	return 2;
+    }
+    /* the subscriber addresses are not the interface one */
+    if ((err = pppoe_afp_open(&client_afp, client_if, 1))) {
+	fprintf(stderr, "pppoe_bench: %s: %s\n", client_if, strerror(err));
+	return 2;
+    }
+
+    pppoe_afp_io(&ac.afp, &io);
+    if (pppoe_eng_init(&ac.eng, PPPOE_ENG_SERVER, ac.afp.address, sessions, &io)) {
+	fprintf(stderr, "pppoe_bench: no memory for %u sessions\n", sessions);
+	return 2;
+    }
+    ac.eng.input = ac_input;
+    pppoe_eng_set_names(&ac.eng, "pppoe-bench-ac", SERVICE);
+
+    pppoe_afp_io(&client_afp, &io);
+    if (pppoe_eng_init(&client, PPPOE_ENG_CLIENT, client_afp.address, sessions, &io)) {
+	fprintf(stderr, "pppoe_bench: no memory for %u sessions\n", sessions);
+	return 2;
+    }
+    client.event = client_event;
+    client.input = client_input;
+    pppoe_eng_set_names(&client, 0, SERVICE);
+
+    if (pthread_create(&ac.thread, 0, ac_run, 0)) {
+	fprintf(stderr, "pppoe_bench: cannot create the concentrator thread\n");
+	return 2;
+    }
+
+    /* discovery, subscriber i calls from 02:00:xx:xx:xx:xx */
+    address[0] = 0x02;
+    address[1] = 0;
+    start = now_s();
+    next = 0;
+    while (connected + failed < sessions && now_s() - start < PPPOE_ENG_TIMER_CONNECT / 1000 + 5) {
+	for (; next < sessions && next - connected - failed < window; next++) {
+	    address[2] = next >> 24;
+	    address[3] = next >> 16;
+	    address[4] = next >> 8;
+	    address[5] = next + 1;
+	    if (pppoe_eng_connect(&client, next, address, now_ms()) == 0)
+		break;
+	}
+	client_pump(next < sessions && next - connected - failed < window ? 0 : 1);
+    }
+    elapsed = now_s() - start;
+    printf("discovery: %u of %u sessions up in %.3f s, %.0f sessions/s, %llu PADI/PADR resent\n",
+	   connected, sessions, elapsed, connected / elapsed, (unsigned long long)client.stats.retries);
+    if (connected != sessions)
+	status = 1;
+
+    /* session data, echoed by the concentrator */
+    memset(data, 0, len);
+    data[1] = 0x21;
+    start = now_s();
+    last = now_ms();
+    next = sent = 0;
+    echoed = inflight = 0;
+    while ((elapsed = now_s() - start) < seconds) {
+	while (inflight < window) {
+	    if (client.sessions[next].state == PPPOE_ENG_STATE_CONNECTED) {
+		if (pppoe_eng_output(&client, &client.sessions[next], data, len))
+		    break;
+		inflight++;
+		sent++;
+	    }
+	    if (++next == sessions)
+		next = 0;
+	    if (client.connected == 0)
+		break;
+	}
+	i = echoed;
+	client_pump(0);
+	if (echoed != i)
+	    last = now_ms();
+	else if (now_ms() - last > 100) {
+	    /* what is still out there was lost, ring full on either side */
+	    inflight = 0;
+	    last = now_ms();
+	}
+    }
+    printf("data: %u packets of %u bytes sent, %u echoed in %.3f s, %.0f packets/s, %.1f Mbit/s each way\n",
+	   sent, len, echoed, elapsed, echoed / elapsed,
+	   echoed * (double)(len + ETHER_HDR_LEN + 6) * 8 / elapsed / 1e6);
+    if (pppoe_afp_drops(&client_afp, &rx_packets, &rx_drops) == 0)
+	printf("rings: client received %u frames, %u dropped\n", rx_packets, rx_drops);
+    if (pppoe_afp_drops(&ac.afp, &rx_packets, &rx_drops) == 0)
+	printf("rings: concentrator received %u frames, %u dropped\n", rx_packets, rx_drops);
+
+    /* terminate, every PADT must reach the concentrator */
+    start = now_s();
+    for (i = 0; i < sessions; ) {
+	if (client.sessions[i].state == PPPOE_ENG_STATE_CONNECTED
+	    && (*client.io.tx_alloc)(client.io.ctx) == 0) {
+	    client_pump(0);
+	    continue;
+	}
+	pppoe_eng_disconnect(&client, &client.sessions[i++]);
+    }
+    while (__atomic_load_n(&ac.connected, __ATOMIC_ACQUIRE) && now_s() - start < 5)
+	client_pump(1);
+    elapsed = now_s() - start;
+    printf("teardown: %u sessions left on the concentrator after %.3f s\n",
+	   __atomic_load_n(&ac.connected, __ATOMIC_ACQUIRE), elapsed);
+    if (__atomic_load_n(&ac.connected, __ATOMIC_ACQUIRE))
+	status = 1;
+
+    __atomic_store_n(&ac.stop, 1, __ATOMIC_RELEASE);
+    pthread_join(ac.thread, 0);
+    pppoe_eng_dispose(&client);
+    pppoe_eng_dispose(&ac.eng);
+    pppoe_afp_close(&client_afp);
+    pppoe_afp_close(&ac.afp);
+    return status;
+}
@@ -0,0 +1,678 @@
+/*
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/queue.h>
+#include <net/ethernet.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../PPPoE-extension/pppoe_tags.h"
+#include "pppoe_engine.h"
+
+
+/* -----------------------------------------------------------------------------
+Definitions
+----------------------------------------------------------------------------- */
+
+#define PPPOE_ETHERTYPE_CTRL 	0x8863		// as in PPPoE.h, which needs the kernel headers
+#define PPPOE_ETHERTYPE_DATA 	0x8864
+
+#define PPPOE_HOST_UNIQ_LEN	4		// our host-uniq is the session slot, in network order
+
+static u_int8_t pppoe_broadcast[ETHER_ADDR_LEN] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+
+/* -----------------------------------------------------------------------------
+Forward declarations
+----------------------------------------------------------------------------- */
+
+static void pppoe_eng_timer_arm(struct pppoe_engine *eng, struct pppoe_eng_session *sess, u_int64_t deadline);
+static void pppoe_eng_timer_disarm(struct pppoe_engine *eng, struct pppoe_eng_session *sess);
+static u_int32_t pppoe_eng_hash(struct pppoe_engine *eng, u_int16_t sessid, u_int8_t *address);
+static void pppoe_eng_link(struct pppoe_engine *eng, struct pppoe_eng_session *sess);
+static void pppoe_eng_unlink(struct pppoe_engine *eng, struct pppoe_eng_session *sess);
+static struct pppoe_eng_session *pppoe_eng_session_lookup(struct pppoe_engine *eng, u_int16_t sessid, u_int8_t *from, u_int8_t *to);
+static struct pppoe_eng_session *pppoe_eng_host_uniq_lookup(struct pppoe_engine *eng, struct pppoe_tags *tags);
+static void pppoe_eng_free(struct pppoe_engine *eng, struct pppoe_eng_session *sess, u_int32_t event, u_int32_t msg);
+static int send_PAD(struct pppoe_engine *eng, u_int8_t *to, u_int8_t *from, u_int16_t code, u_int16_t sessid,
+                    struct pppoe_tag *ac_name, struct pppoe_tag *service, struct pppoe_tag *host_uniq,
+                    struct pppoe_tag *ac_cookie, struct pppoe_tag *relay_id, u_int16_t max_payload);
+static int send_session_PAD(struct pppoe_engine *eng, struct pppoe_eng_session *sess, u_int16_t code);
+
+static void handle_PADI(struct pppoe_engine *eng, u_int8_t *from, struct pppoe_tags *tags);
+static void handle_PADO(struct pppoe_engine *eng, u_int8_t *from, struct pppoe_tags *tags, u_int64_t now);
+static void handle_PADR(struct pppoe_engine *eng, u_int8_t *from, struct pppoe_tags *tags);
+static void handle_PADS(struct pppoe_engine *eng, u_int8_t *from, u_int16_t sessid, struct pppoe_tags *tags);
+static void handle_PADT(struct pppoe_engine *eng, u_int8_t *from, u_int8_t *to, u_int16_t sessid);
+
+
+/* -----------------------------------------------------------------------------
+initialize an engine for nsessions sessions
+the server hands out session ids 1 to nsessions, one per session slot
+----------------------------------------------------------------------------- */
+int pppoe_eng_init(struct pppoe_engine *eng, int mode, u_int8_t *address, u_int32_t nsessions,
+                   struct pppoe_eng_io *io)
+{
+    u_int32_t	i, size;
+
+    if ((mode != PPPOE_ENG_CLIENT && mode != PPPOE_ENG_SERVER)
+        || nsessions == 0 || nsessions >= 0xFFFF)
+        return EINVAL;
+
+    memset(eng, 0, sizeof(*eng));
+    eng->mode = mode;
+    eng->io = *io;
+    memcpy(eng->address, address, ETHER_ADDR_LEN);
+    eng->nsessions = nsessions;
+    TAILQ_INIT(&eng->timers);
+
+    // a bucket for about 4 sessions
+    for (size = 16; size < nsessions / 4; size <<= 1)
+        ;
+    eng->hash_mask = size - 1;
+
+    eng->sessions = calloc(nsessions, sizeof(struct pppoe_eng_session));
+    eng->hash = calloc(size, sizeof(struct pppoe_eng_list));
+    if (mode == PPPOE_ENG_SERVER)
+        eng->free_ids = calloc(nsessions, sizeof(u_int32_t));
+    if (eng->sessions == 0 || eng->hash == 0 || (mode == PPPOE_ENG_SERVER && eng->free_ids == 0)) {
+        pppoe_eng_dispose(eng);
+        return ENOMEM;
+    }
+
+    for (i = 0; i < size; i++)
+        TAILQ_INIT(&eng->hash[i]);
+    for (i = 0; i < nsessions; i++)
+        eng->sessions[i].index = i;
+
+    // the lowest slots are handed out first
+    if (mode == PPPOE_ENG_SERVER) {
+        for (i = 0; i < nsessions; i++)
+            eng->free_ids[i] = nsessions - 1 - i;
+        eng->nfree = nsessions;
+    }
+    return 0;
+}
+
+/* -----------------------------------------------------------------------------
+release the engine tables, the sessions are dropped without any PADT
+----------------------------------------------------------------------------- */
+void pppoe_eng_dispose(struct pppoe_engine *eng)
+{
+    free(eng->sessions);
+    free(eng->hash);
+    free(eng->free_ids);
+    eng->sessions = 0;
+    eng->hash = 0;
+    eng->free_ids = 0;
+}
+
+/* -----------------------------------------------------------------------------
+ac name and service to ask for (client) or to offer (server), 0 for any
+----------------------------------------------------------------------------- */
+void pppoe_eng_set_names(struct pppoe_engine *eng, char *ac_name, char *service)
+{
+    eng->ac_name_len = 0;
+    if (ac_name) {
+        eng->ac_name_len = MIN(strlen(ac_name), sizeof(eng->ac_name));
+        memcpy(eng->ac_name, ac_name, eng->ac_name_len);
+    }
+    eng->service_len = 0;
+    if (service) {
+        eng->service_len = MIN(strlen(service), sizeof(eng->service));
+        memcpy(eng->service, service, eng->service_len);
+    }
+}
+
+/* -----------------------------------------------------------------------------
+start a call on the session slot index, from local_address
+return the session, or 0 if the slot is busy or the PADI could not be queued
+----------------------------------------------------------------------------- */
+struct pppoe_eng_session *pppoe_eng_connect(struct pppoe_engine *eng, u_int32_t index,
+                   u_int8_t *local_address, u_int64_t now)
+{
+    struct pppoe_eng_session	*sess;
+
+    if (eng->mode != PPPOE_ENG_CLIENT || index >= eng->nsessions)
+        return 0;
+
+    sess = &eng->sessions[index];
+    if (sess->state != PPPOE_ENG_STATE_DISCONNECTED)
+        return 0;
+
+    memcpy(sess->local_address, local_address, ETHER_ADDR_LEN);
+    memcpy(sess->peer_address, pppoe_broadcast, ETHER_ADDR_LEN);
+    sess->session_id = 0;
+    sess->payload = PPPOE_MTU;
+    sess->ac_cookie_len = sess->relay_id_len = 0;
+    sess->state = PPPOE_ENG_STATE_LOOKING;
+    if (send_session_PAD(eng, sess, PPPOE_PADI)) {
+        sess->state = PPPOE_ENG_STATE_DISCONNECTED;
+        return 0;
+    }
+
+    sess->retry = PPPOE_ENG_TIMER_RETRY;
+    sess->abort = now + PPPOE_ENG_TIMER_CONNECT;
+    pppoe_eng_timer_arm(eng, sess, now + sess->retry);
+    return sess;
+}
+
+/* -----------------------------------------------------------------------------
+terminate the session, the peer gets a PADT if it was connected
+----------------------------------------------------------------------------- */
+void pppoe_eng_disconnect(struct pppoe_engine *eng, struct pppoe_eng_session *sess)
+{
+    if (sess->state == PPPOE_ENG_STATE_DISCONNECTED)
+        return;
+    if (sess->state == PPPOE_ENG_STATE_CONNECTED)
+        send_session_PAD(eng, sess, PPPOE_PADT);
+    pppoe_eng_free(eng, sess, 0, 0);
+}
+
+/* -----------------------------------------------------------------------------
+send a ppp packet on the session, data starts with the ppp protocol
+return 0, ENOTCONN, EMSGSIZE, or ENOBUFS when the transmit queue is full
+----------------------------------------------------------------------------- */
+int pppoe_eng_output(struct pppoe_engine *eng, struct pppoe_eng_session *sess, u_int8_t *data, u_int16_t len)
+{
+    struct ether_header	*eh;
+    struct pppoe	p;
+    u_int8_t		*frame;
+
+    if (sess->state != PPPOE_ENG_STATE_CONNECTED)
+        return ENOTCONN;
+    if (len > sess->payload)
+        return EMSGSIZE;
+
+    frame = (*eng->io.tx_alloc)(eng->io.ctx);
+    if (frame == 0) {
+        eng->stats.tx_dropped++;
+        return ENOBUFS;
+    }
+
+    eh = (struct ether_header *)frame;
+    memcpy(eh->ether_dhost, sess->peer_address, ETHER_ADDR_LEN);
+    memcpy(eh->ether_shost, sess->local_address, ETHER_ADDR_LEN);
+    eh->ether_type = htons(PPPOE_ETHERTYPE_DATA);
+
+    memset(&p, 0, sizeof(p));
+    p.ver = PPPOE_VER;
+    p.typ = PPPOE_TYPE;
+    p.sessid = htons(sess->session_id);
+    p.len = htons(len);
+    memcpy(frame + ETHER_HDR_LEN, &p, sizeof(p));
+    memcpy(frame + ETHER_HDR_LEN + sizeof(p), data, len);
+
+    (*eng->io.tx_send)(eng->io.ctx, frame, ETHER_HDR_LEN + sizeof(p) + len);
+    eng->stats.tx_frames++;
+    eng->stats.data_out++;
+    return 0;
+}
+
+/* -----------------------------------------------------------------------------
+an ethernet frame was received, frame points to the ethernet header
+the frame is parsed in place, session data is passed up without any copy
+----------------------------------------------------------------------------- */
+void pppoe_eng_input(struct pppoe_engine *eng, u_int8_t *frame, u_int32_t len, u_int64_t now)
+{
+    struct ether_header		*eh = (struct ether_header *)frame;
+    struct pppoe_eng_session	*sess;
+    struct pppoe_tags		tags;
+    struct pppoe		p;
+    u_int8_t			*data;
+    u_int16_t			typ, plen;
+
+    eng->stats.rx_frames++;
+    if (len < ETHER_HDR_LEN + sizeof(p))
+        goto drop;
+
+    typ = ntohs(eh->ether_type);
+    memcpy(&p, frame + ETHER_HDR_LEN, sizeof(p));
+    plen = ntohs(p.len);
+    data = frame + ETHER_HDR_LEN + sizeof(p);
+    if (p.ver != PPPOE_VER || p.typ != PPPOE_TYPE || plen > len - ETHER_HDR_LEN - sizeof(p))
+        goto drop;
+
+    if (typ == PPPOE_ETHERTYPE_DATA) {
+        sess = pppoe_eng_session_lookup(eng, ntohs(p.sessid), eh->ether_shost, eh->ether_dhost);
+        if (sess == 0 || p.code != 0)
+            goto drop;
+        eng->stats.data_in++;
+        if (eng->input)
+            (*eng->input)(eng->arg, sess, data, plen);
+        return;
+    }
+
+    if (typ != PPPOE_ETHERTYPE_CTRL)
+        goto drop;
+
+    index_tags(data, plen, &tags);
+    switch (p.code) {
+        case PPPOE_PADI:
+            eng->stats.padi++;
+            if (eng->mode == PPPOE_ENG_SERVER)
+                handle_PADI(eng, eh->ether_shost, &tags);
+            break;
+        case PPPOE_PADO:
+            eng->stats.pado++;
+            if (eng->mode == PPPOE_ENG_CLIENT)
+                handle_PADO(eng, eh->ether_shost, &tags, now);
+            break;
+        case PPPOE_PADR:
+            eng->stats.padr++;
+            if (eng->mode == PPPOE_ENG_SERVER && !memcmp(eh->ether_dhost, eng->address, ETHER_ADDR_LEN))
+                handle_PADR(eng, eh->ether_shost, &tags);
+            break;
+        case PPPOE_PADS:
+            eng->stats.pads++;
+            if (eng->mode == PPPOE_ENG_CLIENT)
+                handle_PADS(eng, eh->ether_shost, ntohs(p.sessid), &tags);
+            break;
+        case PPPOE_PADT:
+            eng->stats.padt++;
+            handle_PADT(eng, eh->ether_shost, eh->ether_dhost, ntohs(p.sessid));
+            break;
+        default:
+            goto drop;
+    }
+    return;
+
+drop:
+    eng->stats.rx_dropped++;
+}
+
+/* -----------------------------------------------------------------------------
+resend the PADI and PADR due, and give up the calls past their connect timer
+return the next deadline, 0 if no timer is armed
+----------------------------------------------------------------------------- */
+u_int64_t pppoe_eng_timer(struct pppoe_engine *eng, u_int64_t now)
+{
+    struct pppoe_eng_session	*sess;
+    u_int16_t			state;
+
+    while ((sess = TAILQ_FIRST(&eng->timers)) && sess->deadline <= now) {
+
+        pppoe_eng_timer_disarm(eng, sess);
+        state = sess->state;
+        if (now >= sess->abort) {
+            // nobody answered the PADI, or the PADR
+            pppoe_eng_free(eng, sess, PPPOE_ENG_EVT_DISCONNECTED,
+                state == PPPOE_ENG_STATE_LOOKING ? EHOSTUNREACH : ECONNREFUSED);
+            continue;
+        }
+
+        // a full transmit queue is a loss, the next retry will tell
+        send_session_PAD(eng, sess, state == PPPOE_ENG_STATE_LOOKING ? PPPOE_PADI : PPPOE_PADR);
+        eng->stats.retries++;
+        sess->retry = MIN(sess->retry * 2, PPPOE_ENG_TIMER_RETRY_MAX);
+        pppoe_eng_timer_arm(eng, sess, MIN(now + sess->retry, sess->abort));
+    }
+
+    sess = TAILQ_FIRST(&eng->timers);
+    return sess ? sess->deadline : 0;
+}
+
+/* -----------------------------------------------------------------------------
+insert the session in the timer list, ordered by deadline
+new deadlines are usually the latest, the list is walked from the tail
+----------------------------------------------------------------------------- */
+void pppoe_eng_timer_arm(struct pppoe_engine *eng, struct pppoe_eng_session *sess, u_int64_t deadline)
+{
+    struct pppoe_eng_session	*prev;
+
+    pppoe_eng_timer_disarm(eng, sess);
+
+    sess->deadline = deadline;
+    TAILQ_FOREACH_REVERSE(prev, &eng->timers, pppoe_eng_list, timer_next) {
+        if (prev->deadline <= deadline)
+            break;
+    }
+    if (prev)
+        TAILQ_INSERT_AFTER(&eng->timers, prev, sess, timer_next);
+    else
+        TAILQ_INSERT_HEAD(&eng->timers, sess, timer_next);
+    sess->timer_armed = 1;
+}
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+void pppoe_eng_timer_disarm(struct pppoe_engine *eng, struct pppoe_eng_session *sess)
+{
+    if (sess->timer_armed) {
+        TAILQ_REMOVE(&eng->timers, sess, timer_next);
+        sess->timer_armed = 0;
+    }
+}
+
+/* -----------------------------------------------------------------------------
+the client hashes its sessions on (session id, peer address), the server
+only on the peer address, to find a session again from a resent PADR
+----------------------------------------------------------------------------- */
+u_int32_t pppoe_eng_hash(struct pppoe_engine *eng, u_int16_t sessid, u_int8_t *address)
+{
+    u_int32_t	h = sessid;
+    int		i;
+
+    for (i = 0; i < ETHER_ADDR_LEN; i++)
+        h = h * 31 + address[i];
+    return (h ^ (h >> 16)) & eng->hash_mask;
+}
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+void pppoe_eng_link(struct pppoe_engine *eng, struct pppoe_eng_session *sess)
+{
+    u_int16_t	sessid = eng->mode == PPPOE_ENG_CLIENT ? sess->session_id : 0;
+
+    TAILQ_INSERT_TAIL(&eng->hash[pppoe_eng_hash(eng, sessid, sess->peer_address)], sess, hash_next);
+    sess->hashed = 1;
+}
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+void pppoe_eng_unlink(struct pppoe_engine *eng, struct pppoe_eng_session *sess)
+{
+    u_int16_t	sessid = eng->mode == PPPOE_ENG_CLIENT ? sess->session_id : 0;
+
+    if (sess->hashed) {
+        TAILQ_REMOVE(&eng->hash[pppoe_eng_hash(eng, sessid, sess->peer_address)], sess, hash_next);
+        sess->hashed = 0;
+    }
+}
+
+/* -----------------------------------------------------------------------------
+find the connected session for a session packet from -> to
+the server session id is the slot, the client looks its sessions up in the hash
+----------------------------------------------------------------------------- */
+struct pppoe_eng_session *pppoe_eng_session_lookup(struct pppoe_engine *eng, u_int16_t sessid, u_int8_t *from, u_int8_t *to)
+{
+    struct pppoe_eng_session	*sess;
+
+    if (eng->mode == PPPOE_ENG_SERVER) {
+        if (sessid == 0 || sessid > eng->nsessions)
+            return 0;
+        sess = &eng->sessions[sessid - 1];
+        if (sess->state != PPPOE_ENG_STATE_CONNECTED
+            || memcmp(sess->peer_address, from, ETHER_ADDR_LEN))
+            return 0;
+        return sess;
+    }
+
+    TAILQ_FOREACH(sess, &eng->hash[pppoe_eng_hash(eng, sessid, from)], hash_next) {
+        if (sess->session_id == sessid
+            && !memcmp(sess->peer_address, from, ETHER_ADDR_LEN)
+            && !memcmp(sess->local_address, to, ETHER_ADDR_LEN))
+            return sess;
+    }
+    return 0;
+}
+
+/* -----------------------------------------------------------------------------
+client, find the session a PADO or PADS answers, from the host-uniq we sent
+----------------------------------------------------------------------------- */
+struct pppoe_eng_session *pppoe_eng_host_uniq_lookup(struct pppoe_engine *eng, struct pppoe_tags *tags)
+{
+    struct pppoe_tag	host_uniq;
+    u_int32_t		index;
+
+    if (!get_tag(tags, PPPOE_TAGIDX_HOST_UNIQ, &host_uniq) || host_uniq.len != PPPOE_HOST_UNIQ_LEN)
+        return 0;
+    memcpy(&index, host_uniq.data, sizeof(index));
+    index = ntohl(index);
+    return index < eng->nsessions ? &eng->sessions[index] : 0;
+}
+
+/* -----------------------------------------------------------------------------
+the session is over, give its slot back
+----------------------------------------------------------------------------- */
+void pppoe_eng_free(struct pppoe_engine *eng, struct pppoe_eng_session *sess, u_int32_t event, u_int32_t msg)
+{
+    if (sess->state == PPPOE_ENG_STATE_CONNECTED)
+        eng->connected--;
+    pppoe_eng_timer_disarm(eng, sess);
+    pppoe_eng_unlink(eng, sess);
+    sess->state = PPPOE_ENG_STATE_DISCONNECTED;
+    if (eng->mode == PPPOE_ENG_SERVER)
+        eng->free_ids[eng->nfree++] = sess->index;
+
+    if (event && eng->event)
+        (*eng->event)(eng->arg, sess, event, msg);
+}
+
+/* -----------------------------------------------------------------------------
+build a discovery packet directly in a transmit buffer
+return 0, or ENOBUFS if the transmit queue is full, EMSGSIZE if the tags do not fit
+----------------------------------------------------------------------------- */
+int send_PAD(struct pppoe_engine *eng, u_int8_t *to, u_int8_t *from, u_int16_t code, u_int16_t sessid,
+             struct pppoe_tag *ac_name, struct pppoe_tag *service, struct pppoe_tag *host_uniq,
+             struct pppoe_tag *ac_cookie, struct pppoe_tag *relay_id, u_int16_t max_payload)
+{
+    struct ether_header	*eh;
+    u_int8_t		*frame;
+    u_int32_t		len;
+
+    len = pad_len(ac_name, service, host_uniq, ac_cookie, relay_id, max_payload);
+    if (len > ETHERMTU)
+        return EMSGSIZE;
+
+    frame = (*eng->io.tx_alloc)(eng->io.ctx);
+    if (frame == 0) {
+        eng->stats.tx_dropped++;
+        return ENOBUFS;
+    }
+
+    eh = (struct ether_header *)frame;
+    memcpy(eh->ether_dhost, to, ETHER_ADDR_LEN);
+    memcpy(eh->ether_shost, from, ETHER_ADDR_LEN);
+    eh->ether_type = htons(PPPOE_ETHERTYPE_CTRL);
+    len = fill_PAD(frame + ETHER_HDR_LEN, code, sessid, ac_name, service, host_uniq, ac_cookie, relay_id, max_payload);
+
+    (*eng->io.tx_send)(eng->io.ctx, frame, ETHER_HDR_LEN + len);
+    eng->stats.tx_frames++;
+    return 0;
+}
+
+/* -----------------------------------------------------------------------------
+client, send the PADI, PADR or PADT of the session
+----------------------------------------------------------------------------- */
+int send_session_PAD(struct pppoe_engine *eng, struct pppoe_eng_session *sess, u_int16_t code)
+{
+    struct pppoe_tag	ac_name, service, host_uniq, ac_cookie, relay_id;
+    u_int32_t		index = htonl(sess->index);
+
+    ac_name.data = eng->ac_name;
+    ac_name.len = ac_name.max_len = eng->ac_name_len;
+    service.data = eng->service;
+    service.len = service.max_len = eng->service_len;
+    ac_cookie.data = sess->ac_cookie;
+    ac_cookie.len = ac_cookie.max_len = sess->ac_cookie_len;
+    relay_id.data = sess->relay_id;
+    relay_id.len = relay_id.max_len = sess->relay_id_len;
+    host_uniq.data = (u_int8_t *)&index;
+    host_uniq.len = host_uniq.max_len = sizeof(index);
+
+    if (code == PPPOE_PADT)
+        return send_PAD(eng, sess->peer_address, sess->local_address, code, sess->session_id,
+                        0, 0, eng->mode == PPPOE_ENG_CLIENT ? &host_uniq : 0, 0, 0, 0);
+
+    // the service name tag is mandatory, even empty
+    return send_PAD(eng, sess->peer_address, sess->local_address, code, 0,
+                    ac_name.len ? &ac_name : 0, &service, &host_uniq,
+                    ac_cookie.len ? &ac_cookie : 0, relay_id.len ? &relay_id : 0,
+                    eng->max_payload > PPPOE_MTU ? eng->max_payload : 0);
+}
+
+/* -----------------------------------------------------------------------------
+server, offer our service to a client looking for it, or for any service
+----------------------------------------------------------------------------- */
+void handle_PADI(struct pppoe_engine *eng, u_int8_t *from, struct pppoe_tags *tags)
+{
+    struct pppoe_tag	ac_name, service, host_uniq, relay_id;
+    u_int16_t		payload;
+
+    get_tag(tags, PPPOE_TAGIDX_SERVICE_NAME, &service);
+    if (service.len && eng->service_len
+        && (service.len != eng->service_len || memcmp(service.data, eng->service, service.len)))
+        return;
+
+    ac_name.data = eng->ac_name;
+    ac_name.len = ac_name.max_len = eng->ac_name_len;
+    get_tag(tags, PPPOE_TAGIDX_HOST_UNIQ, &host_uniq);
+    get_tag(tags, PPPOE_TAGIDX_RELAY_SESSION_ID, &relay_id);
+
+    // RFC 4638, echo the client max payload only if we can support it
+    payload = accept_max_payload(get_max_payload(tags), eng->max_payload);
+
+    send_PAD(eng, from, eng->address, PPPOE_PADO, 0, &ac_name, &service,
+             host_uniq.len ? &host_uniq : 0, 0, relay_id.len ? &relay_id : 0,
+             payload > PPPOE_MTU ? payload : 0);
+}
+
+/* -----------------------------------------------------------------------------
+client, take the first offer matching the ac name and service we asked for
+----------------------------------------------------------------------------- */
+void handle_PADO(struct pppoe_engine *eng, u_int8_t *from, struct pppoe_tags *tags, u_int64_t now)
+{
+    struct pppoe_eng_session	*sess;
+    struct pppoe_tag		ac_name, ac_cookie, relay_id;
+
+    sess = pppoe_eng_host_uniq_lookup(eng, tags);
+    if (sess == 0 || sess->state != PPPOE_ENG_STATE_LOOKING)
+        return;
+
+    get_tag(tags, PPPOE_TAGIDX_AC_NAME, &ac_name);
+    if (eng->ac_name_len
+        && (ac_name.len != eng->ac_name_len || memcmp(ac_name.data, eng->ac_name, ac_name.len)))
+        return;
+
+    // the cookie and relay id are echoed in each PADR, an offer we cannot echo is ignored
+    ac_cookie.data = sess->ac_cookie;
+    ac_cookie.max_len = sizeof(sess->ac_cookie);
+    relay_id.data = sess->relay_id;
+    relay_id.max_len = sizeof(sess->relay_id);
+    if (!copy_tag(tags, PPPOE_TAGIDX_AC_COOKIE, &ac_cookie)
+        || !copy_tag(tags, PPPOE_TAGIDX_RELAY_SESSION_ID, &relay_id))
+        return;
+    sess->ac_cookie_len = ac_cookie.len;
+    sess->relay_id_len = relay_id.len;
+
+    memcpy(sess->peer_address, from, ETHER_ADDR_LEN);
+    sess->state = PPPOE_ENG_STATE_CONNECTING;
+    send_session_PAD(eng, sess, PPPOE_PADR);
+
+    // the PADR phase starts, resend it with backoff from the retry timer again
+    sess->retry = PPPOE_ENG_TIMER_RETRY;
+    pppoe_eng_timer_arm(eng, sess, MIN(now + sess->retry, sess->abort));
+}
+
+/* -----------------------------------------------------------------------------
+server, open a session for the client
+a PADR resent because our PADS was lost gets the same session again
+----------------------------------------------------------------------------- */
+void handle_PADR(struct pppoe_engine *eng, u_int8_t *from, struct pppoe_tags *tags)
+{
+    struct pppoe_eng_session	*sess;
+    struct pppoe_tag		service, host_uniq, relay_id;
+
+    get_tag(tags, PPPOE_TAGIDX_SERVICE_NAME, &service);
+    if (service.len && eng->service_len
+        && (service.len != eng->service_len || memcmp(service.data, eng->service, service.len)))
+        return;
+    get_tag(tags, PPPOE_TAGIDX_HOST_UNIQ, &host_uniq);
+    get_tag(tags, PPPOE_TAGIDX_RELAY_SESSION_ID, &relay_id);
+    if (host_uniq.len > sizeof(sess->ac_cookie))
+        return;
+
+    TAILQ_FOREACH(sess, &eng->hash[pppoe_eng_hash(eng, 0, from)], hash_next) {
+        if (!memcmp(sess->peer_address, from, ETHER_ADDR_LEN)
+            && sess->ac_cookie_len == host_uniq.len
+            && !memcmp(sess->ac_cookie, host_uniq.data, host_uniq.len))
+            break;
+    }
+
+    if (sess == 0) {
+        if (eng->nfree == 0)
+            return;
+        sess = &eng->sessions[eng->free_ids[--eng->nfree]];
+        memcpy(sess->peer_address, from, ETHER_ADDR_LEN);
+        memcpy(sess->local_address, eng->address, ETHER_ADDR_LEN);
+        sess->session_id = sess->index + 1;
+        // the server keeps the client host-uniq where a client keeps the cookie
+        memcpy(sess->ac_cookie, host_uniq.data, host_uniq.len);
+        sess->ac_cookie_len = host_uniq.len;
+        sess->payload = accept_max_payload(get_max_payload(tags), eng->max_payload);
+        sess->state = PPPOE_ENG_STATE_CONNECTED;
+        pppoe_eng_link(eng, sess);
+        eng->connected++;
+        if (eng->event)
+            (*eng->event)(eng->arg, sess, PPPOE_ENG_EVT_CONNECTED, 0);
+    }
+
+    send_PAD(eng, from, eng->address, PPPOE_PADS, sess->session_id, 0, &service,
+             host_uniq.len ? &host_uniq : 0, 0, relay_id.len ? &relay_id : 0,
+             sess->payload > PPPOE_MTU ? sess->payload : 0);
+}
+
+/* -----------------------------------------------------------------------------
+client, the server confirmed the session
+----------------------------------------------------------------------------- */
+void handle_PADS(struct pppoe_engine *eng, u_int8_t *from, u_int16_t sessid, struct pppoe_tags *tags)
+{
+    struct pppoe_eng_session	*sess;
+
+    sess = pppoe_eng_host_uniq_lookup(eng, tags);
+    if (sess == 0 || sess->state != PPPOE_ENG_STATE_CONNECTING
+        || memcmp(sess->peer_address, from, ETHER_ADDR_LEN))
+        return;
+
+    // a PADS without session id refuses the service
+    if (sessid == 0) {
+        pppoe_eng_free(eng, sess, PPPOE_ENG_EVT_DISCONNECTED, ECONNREFUSED);
+        return;
+    }
+
+    pppoe_eng_timer_disarm(eng, sess);
+    sess->session_id = sessid;
+    sess->payload = confirmed_max_payload(get_max_payload(tags), eng->max_payload);
+    sess->state = PPPOE_ENG_STATE_CONNECTED;
+    pppoe_eng_link(eng, sess);
+    eng->connected++;
+    if (eng->event)
+        (*eng->event)(eng->arg, sess, PPPOE_ENG_EVT_CONNECTED, 0);
+}
+
+/* -----------------------------------------------------------------------------
+the peer terminated the session
+----------------------------------------------------------------------------- */
+void handle_PADT(struct pppoe_engine *eng, u_int8_t *from, u_int8_t *to, u_int16_t sessid)
+{
+    struct pppoe_eng_session	*sess;
+
+    sess = pppoe_eng_session_lookup(eng, sessid, from, to);
+    if (sess)
+        pppoe_eng_free(eng, sess, PPPOE_ENG_EVT_DISCONNECTED, 0);
+}
@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+#ifndef __PPPOE_ENGINE_H__
+#define __PPPOE_ENGINE_H__
+
+#include <sys/types.h>
+#include <sys/queue.h>
+#include <net/ethernet.h>
+
+/*
+ * user space pppoe engine.
+ * the discovery and session state machine of the pppoe kext, on top of a
+ * frame backend instead of the XNU KPIs. frames are built and parsed with
+ * the kext code in pppoe_tags.h, directly in the backend buffers.
+ * an engine is not locked: run one per interface and thread.
+ * times are in milliseconds, from any monotonic clock the caller uses.
+ */
+
+#define PPPOE_ENG_TIMER_CONNECT		20000	// give up a call after 20 seconds
+#define PPPOE_ENG_TIMER_RETRY		3000	// resend PADI/PADR after 3 seconds, doubled at each retry
+#define PPPOE_ENG_TIMER_RETRY_MAX	30000	// up to 30 seconds
+
+#define PPPOE_ENG_TAG_LEN		64	// ac-name, service, ac-cookie and relay-session-id we keep
+
+enum {
+    PPPOE_ENG_CLIENT = 1,		// calls out, one session per subscriber
+    PPPOE_ENG_SERVER			// access concentrator, answers every PADI for its service
+};
+
+enum {
+    PPPOE_ENG_STATE_DISCONNECTED = 0,
+    PPPOE_ENG_STATE_LOOKING,
+    PPPOE_ENG_STATE_CONNECTING,
+    PPPOE_ENG_STATE_CONNECTED
+};
+
+enum {
+    PPPOE_ENG_EVT_CONNECTED = 1,
+    PPPOE_ENG_EVT_DISCONNECTED		// msg is 0, EHOSTUNREACH (no PADO) or ECONNREFUSED (no PADS)
+};
+
+/*
+ * frame backend.
+ * tx_alloc returns a buffer for one ethernet frame of up to ETHER_MAX_LEN
+ * bytes, 0 when the transmit queue is full. the engine writes the frame in
+ * it and passes it to tx_send. frames are sent on tx_flush at the latest.
+ */
+struct pppoe_eng_io {
+    void	*ctx;
+    u_int8_t	*(*tx_alloc)(void *ctx);
+    void	(*tx_send)(void *ctx, u_int8_t *frame, u_int16_t len);
+    void	(*tx_flush)(void *ctx);
+};
+
+struct pppoe_eng_session {
+    TAILQ_ENTRY(pppoe_eng_session)	hash_next;	/* link in the session hash */
+    TAILQ_ENTRY(pppoe_eng_session)	timer_next;	/* link in the timer list, ordered by deadline */
+    u_int32_t		index;			/* slot in the engine table */
+    u_int16_t		state;
+    u_int16_t		session_id;
+    u_int16_t		payload;		/* max payload negotiated, RFC 4638 */
+    u_int8_t		hashed;			/* linked in the session hash */
+    u_int8_t		timer_armed;		/* linked in the timer list */
+    u_int8_t		local_address[ETHER_ADDR_LEN];
+    u_int8_t		peer_address[ETHER_ADDR_LEN];
+    u_int64_t		deadline;		/* next retransmission */
+    u_int64_t		abort;			/* the call is given up then */
+    u_int32_t		retry;			/* current retransmission interval */
+    u_int16_t		ac_cookie_len;
+    u_int16_t		relay_id_len;
+    u_int8_t		ac_cookie[PPPOE_ENG_TAG_LEN];
+    u_int8_t		relay_id[PPPOE_ENG_TAG_LEN];
+    void		*data;			/* for the engine user */
+};
+
+struct pppoe_eng_stats {
+    u_int64_t		rx_frames;
+    u_int64_t		rx_dropped;		/* malformed, or for no session we know */
+    u_int64_t		tx_frames;
+    u_int64_t		tx_dropped;		/* transmit queue full */
+    u_int64_t		padi;			/* discovery packets received */
+    u_int64_t		pado;
+    u_int64_t		padr;
+    u_int64_t		pads;
+    u_int64_t		padt;
+    u_int64_t		retries;		/* PADI and PADR resent */
+    u_int64_t		data_in;		/* session packets */
+    u_int64_t		data_out;
+};
+
+TAILQ_HEAD(pppoe_eng_list, pppoe_eng_session);
+
+struct pppoe_engine {
+    int			mode;			/* PPPOE_ENG_CLIENT or PPPOE_ENG_SERVER */
+    struct pppoe_eng_io	io;
+    u_int8_t		address[ETHER_ADDR_LEN];	/* interface address, the server source address */
+    u_int8_t		ac_name[PPPOE_ENG_TAG_LEN];
+    u_int8_t		service[PPPOE_ENG_TAG_LEN];
+    u_int16_t		ac_name_len;
+    u_int16_t		service_len;
+    u_int16_t		max_payload;		/* RFC 4638 payload to negotiate, 0 for the default */
+    u_int32_t		nsessions;
+    struct pppoe_eng_session	*sessions;
+    u_int32_t		*free_ids;		/* server, session slots not in use */
+    u_int32_t		nfree;
+    u_int32_t		hash_mask;
+    struct pppoe_eng_list	*hash;		/* client, connected sessions keyed on (session id, peer, local) */
+    struct pppoe_eng_list	timers;
+    u_int32_t		connected;		/* sessions up */
+
+    void		*arg;
+    void		(*event)(void *arg, struct pppoe_eng_session *sess, u_int32_t event, u_int32_t msg);
+    void		(*input)(void *arg, struct pppoe_eng_session *sess, u_int8_t *data, u_int16_t len);
+
+    struct pppoe_eng_stats	stats;
+};
+
+int pppoe_eng_init(struct pppoe_engine *eng, int mode, u_int8_t *address, u_int32_t nsessions,
+                   struct pppoe_eng_io *io);
+void pppoe_eng_dispose(struct pppoe_engine *eng);
+void pppoe_eng_set_names(struct pppoe_engine *eng, char *ac_name, char *service);
+
+struct pppoe_eng_session *pppoe_eng_connect(struct pppoe_engine *eng, u_int32_t index,
+                   u_int8_t *local_address, u_int64_t now);
+void pppoe_eng_disconnect(struct pppoe_engine *eng, struct pppoe_eng_session *sess);
+int pppoe_eng_output(struct pppoe_engine *eng, struct pppoe_eng_session *sess, u_int8_t *data, u_int16_t len);
+
+void pppoe_eng_input(struct pppoe_engine *eng, u_int8_t *frame, u_int32_t len, u_int64_t now);
+u_int64_t pppoe_eng_timer(struct pppoe_engine *eng, u_int64_t now);
+
+#endif
@@ -0,0 +1,297 @@
+/*
+ * pppoe_engine_test.c - tests for the user space pppoe engine.
+ *
+ * A client and a server engine are wired back to back through in memory
+ * queues, which can lose the frames of a given discovery code. Time only
+ * moves when the test says so, to run the retransmission and connect timers.
+ *
+ * Built and run by "make test", fails when a session does not end in the
+ * expected state.
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <net/ethernet.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../PPPoE-extension/pppoe_tags.h"
+#include "pppoe_engine.h"
+
+#define SESSIONS	2000
+#define QUEUE		(2 * SESSIONS)
+
+struct wire {
+    u_int8_t	frames[QUEUE][ETHER_MAX_LEN];
+    u_int16_t	len[QUEUE];
+    int		count;
+    int		cap;		/* transmit queue size */
+    int		lose_code;	/* discovery code lost on the wire */
+    int		lose_count;	/* that many times, -1 for always */
+};
+
+static struct wire to_server, to_client;
+static struct pppoe_engine client, server;
+static u_int64_t now;
+
+static int connected, refused, unreachable, terminated, echoed, misrouted;
+
+static int failures = 0;
+
+static u_int8_t server_address[ETHER_ADDR_LEN] = { 0x02, 0xac, 0, 0, 0, 1 };
+static u_int8_t client_address[ETHER_ADDR_LEN] = { 0x02, 0xcc, 0, 0, 0, 1 };
+
+static u_int8_t *
+wire_alloc(void *ctx)
+{
+    struct wire *w = ctx;
+
+    return w->count < w->cap ? w->frames[w->count] : 0;
+}
+
+static void
+wire_send(void *ctx, u_int8_t *frame, u_int16_t len)
+{
+    struct wire *w = ctx;
+    struct ether_header *eh = (struct ether_header *)frame;
+
+    if (w->lose_count && ntohs(eh->ether_type) == 0x8863 && frame[ETHER_HDR_LEN + 1] == w->lose_code) {
+	if (w->lose_count > 0)
+	    w->lose_count--;
+	return;
+    }
+    w->len[w->count++] = len;
+}
+
+static void
+wire_flush(void *ctx)
+{
+}
+
+/* deliver what is on the wire, the answers go on the other one */
+static int
+pump(struct wire *w, struct pppoe_engine *to)
+{
+    int i, n = w->count;
+
+    for (i = 0; i < n; i++)
+	pppoe_eng_input(to, w->frames[i], w->len[i], now);
+    w->count = 0;
+    return n;
+}
+
+static void
+run(void)
+{
+    while (pump(&to_server, &server) + pump(&to_client, &client))
+	;
+}
+
+/* move the clock, one second at a time */
+static void
+elapse(u_int32_t ms)
+{
+    u_int64_t end = now + ms;
+
+    while (now < end) {
+	now = MIN(now + 1000, end);
+	pppoe_eng_timer(&client, now);
+	pppoe_eng_timer(&server, now);
+	run();
+    }
+}
+
+static void
+client_event(void *arg, struct pppoe_eng_session *sess, u_int32_t event, u_int32_t msg)
+{
+    if (event == PPPOE_ENG_EVT_CONNECTED)
+	connected++;
+    else if (msg == ECONNREFUSED)
+	refused++;
+    else if (msg == EHOSTUNREACH)
+	unreachable++;
+    else
+	terminated++;
+}
+
+static void
+client_input(void *arg, struct pppoe_eng_session *sess, u_int8_t *data, u_int16_t len)
+{
+    u_int32_t index;
+
+    memcpy(&index, data + 2, sizeof(index));
+    if (len == 2 + sizeof(index) && ntohl(index) == sess->index)
+	echoed++;
+    else
+	misrouted++;
+}
+
+static void
+server_input(void *arg, struct pppoe_eng_session *sess, u_int8_t *data, u_int16_t len)
+{
+    pppoe_eng_output(&server, sess, data, len);
+}
+
+static void
+reset(int cap)
+{
+    struct pppoe_eng_io io;
+
+    pppoe_eng_dispose(&client);
+    pppoe_eng_dispose(&server);
+    memset(&to_server, 0, sizeof(to_server));
+    memset(&to_client, 0, sizeof(to_client));
+    to_server.cap = to_client.cap = cap;
+    connected = refused = unreachable = terminated = echoed = misrouted = 0;
+    now = 1000;
+
+    io.tx_alloc = wire_alloc;
+    io.tx_send = wire_send;
+    io.tx_flush = wire_flush;
+    io.ctx = &to_server;
+    pppoe_eng_init(&client, PPPOE_ENG_CLIENT, client_address, SESSIONS, &io);
+    client.event = client_event;
+    client.input = client_input;
+    io.ctx = &to_client;
+    pppoe_eng_init(&server, PPPOE_ENG_SERVER, server_address, SESSIONS, &io);
+    server.input = server_input;
+    pppoe_eng_set_names(&server, "Darwin", "Think-Different");
+    pppoe_eng_set_names(&client, 0, "Think-Different");
+}
+
+/* each subscriber calls from an address of its own */
+static struct pppoe_eng_session *
+call(u_int32_t i)
+{
+    u_int8_t address[ETHER_ADDR_LEN];
+
+    memcpy(address, client_address, ETHER_ADDR_LEN);
+    address[3] = i >> 16;
+    address[4] = i >> 8;
+    address[5] = i;
+    return pppoe_eng_connect(&client, i, address, now);
+}
+
+static void
+check(char *what, int ok)
+{
+    if (ok) {
+	printf("PASS: %s\n", what);
+	return;
+    }
+    printf("FAIL: %s\n", what);
+    failures++;
+}
+
+int
+main(int argc, char **argv)
+{
+    struct pppoe_eng_session *sess;
+    u_int8_t data[2 + sizeof(u_int32_t)];
+    u_int32_t index;
+    int i, ok;
+
+    /* every subscriber at once */
+    reset(QUEUE);
+    for (i = 0, ok = 1; i < SESSIONS; i++)
+	ok &= call(i) != 0;
+    run();
+    check("all sessions connect at once", ok && connected == SESSIONS
+	  && client.connected == SESSIONS && server.connected == SESSIONS);
+    for (i = 0, ok = 1; i < SESSIONS; i++)
+	ok &= client.sessions[i].session_id == server.sessions[i].session_id
+	    && !memcmp(client.sessions[i].local_address, server.sessions[i].peer_address, ETHER_ADDR_LEN);
+    check("each session gets its own id", ok);
+
+    for (i = 0; i < SESSIONS; i++) {
+	data[0] = 0;
+	data[1] = 0x21;
+	index = htonl(i);
+	memcpy(data + 2, &index, sizeof(index));
+	pppoe_eng_output(&client, &client.sessions[i], data, sizeof(data));
+    }
+    run();
+    check("session data comes back to its session", echoed == SESSIONS && misrouted == 0);
+
+    for (i = 0; i < SESSIONS; i += 2)
+	pppoe_eng_disconnect(&client, &client.sessions[i]);
+    for (i = 1; i < SESSIONS; i += 2)
+	pppoe_eng_disconnect(&server, &server.sessions[i]);
+    run();
+    check("PADT from either side ends the session", client.connected == 0 && server.connected == 0
+	  && terminated == SESSIONS / 2 && server.nfree == SESSIONS);
+
+    /* a small transmit queue refuses the calls it cannot send */
+    reset(10);
+    for (i = 0; i < 20; i++)
+	call(i);
+    check("full transmit queue", client.stats.tx_dropped == 10 && client.sessions[10].state == PPPOE_ENG_STATE_DISCONNECTED);
+    run();
+    check("calls queued connect", connected == 10);
+
+    /* lost PADI and PADS are resent with backoff */
+    reset(QUEUE);
+    to_server.lose_code = PPPOE_PADI;
+    to_server.lose_count = 1;
+    to_client.lose_code = PPPOE_PADS;
+    to_client.lose_count = 1;
+    sess = call(0);
+    run();
+    check("nothing before the retry timer", connected == 0);
+    elapse(PPPOE_ENG_TIMER_RETRY);
+    check("PADI resent", sess->state == PPPOE_ENG_STATE_CONNECTING && client.stats.retries == 1);
+    elapse(PPPOE_ENG_TIMER_RETRY);
+    check("PADR resent after a lost PADS", connected == 1 && client.stats.retries == 2);
+    check("resent PADR gets the same session", server.connected == 1 && server.nfree == SESSIONS - 1
+	  && sess->session_id == server.sessions[0].session_id);
+
+    /* nobody answers */
+    reset(QUEUE);
+    to_server.lose_code = PPPOE_PADI;
+    to_server.lose_count = -1;
+    call(0);
+    elapse(PPPOE_ENG_TIMER_CONNECT - 1000);
+    check("still looking before the connect timer", unreachable == 0 && client.stats.retries == 2);
+    elapse(1000);
+    check("no PADO is EHOSTUNREACH", unreachable == 1 && refused == 0);
+
+    /* the server offers, then never confirms */
+    reset(QUEUE);
+    to_server.lose_code = PPPOE_PADR;
+    to_server.lose_count = -1;
+    call(0);
+    run();
+    elapse(PPPOE_ENG_TIMER_CONNECT);
+    check("no PADS is ECONNREFUSED", refused == 1 && unreachable == 0 && server.connected == 0);
+
+    /* another service */
+    reset(QUEUE);
+    pppoe_eng_set_names(&client, 0, "Think-Same");
+    call(0);
+    run();
+    check("no offer for another service", client.stats.pado == 0);
+
+    /* RFC 4638 */
+    reset(QUEUE);
+    client.max_payload = 1500;
+    server.max_payload = 1500;
+    call(0);
+    call(1);
+    run();
+    check("larger payload agreed", client.sessions[0].payload == 1500 && server.sessions[0].payload == 1500);
+    server.max_payload = 0;
+    pppoe_eng_disconnect(&client, &client.sessions[0]);
+    call(0);
+    run();
+    check("default payload without server support", client.sessions[0].payload == PPPOE_MTU
+	  && server.sessions[0].payload == PPPOE_MTU);
+
+    if (failures) {
+	printf("%d tests failed\n", failures);
+	return 1;
+    }
+    printf("all tests passed\n");
+    return 0;
+}
@@ -0,0 +1,22 @@
+#!/bin/sh
+#
+# pppoe_veth_bench.sh - run pppoe_bench across a veth pair.
+# needs root, or CAP_NET_ADMIN and CAP_NET_RAW.
+#
+#   pppoe_veth_bench.sh [pppoe_bench options]
+#
+
+BENCH=${BENCH:-$(dirname "$0")/pppoe_bench}
+AC_IF=pppoe-ac
+CLIENT_IF=pppoe-cl
+
+ip link add $AC_IF type veth peer name $CLIENT_IF || exit 2
+trap 'ip link del $AC_IF 2>/dev/null' EXIT INT TERM
+
+for i in $AC_IF $CLIENT_IF; do
+    # no ipv6 autoconfiguration or other chatter in the rings
+    sysctl -qw net.ipv6.conf.$i.disable_ipv6=1 2>/dev/null
+    ip link set $i mtu 1500 up || exit 2
+done
+
+"$BENCH" -s $AC_IF -c $CLIENT_IF "$@"
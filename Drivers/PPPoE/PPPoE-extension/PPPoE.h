@@ -60,11 +60,21 @@ struct sockaddr_pppoe
 #define PPPOE_OPT_RING_TIMER	4	/* time allowed for incoming call (in seconds) */
 #define PPPOE_OPT_RETRY_TIMER	5	/* connection retry timer (in seconds) */
 #define PPPOE_OPT_PEER_ENETADDR	6	/* peer ethernet address */
+#define PPPOE_OPT_MAX_PAYLOAD	7	/* RFC 4638 PPP-Max-Payload, set the one to ask for, get the negotiated one */
+#define PPPOE_OPT_DISCOVERY_STATS 8	/* discovery counters of the last outgoing call */
 
 /* flags definition */
 #define PPPOE_FLAG_LOOPBACK	0x00000001	/* loopback mode, for debugging purpose */
 #define PPPOE_FLAG_DEBUG	0x00000002	/* debug mode, send verbose logs to syslog */
 #define PPPOE_FLAG_PROBE	0x00000004	/* just probe to detect presence of servers */
 
+/* discovery counters of the last outgoing call, returned by PPPOE_OPT_DISCOVERY_STATS */
+struct pppoe_discovery_stats {
+    u_int32_t	padi_sent;			/* PADI sent, including retransmissions */
+    u_int32_t	padr_sent;			/* PADR sent, including retransmissions */
+    u_int32_t	pado_latency;			/* milliseconds from the first PADI to the PADO */
+    u_int32_t	pads_latency;			/* milliseconds from the first PADR to the PADS */
+};
+
 
 #endif
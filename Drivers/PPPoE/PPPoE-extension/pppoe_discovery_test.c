@@ -0,0 +1,204 @@
+/*
+ * pppoe_discovery_test.c - stress test for the discovery frames construction
+ * and parsing in pppoe_tags.h.
+ *
+ * Several threads each bring up hundreds of sessions at once against a
+ * loopback access concentrator: every PADI, PADO, PADR and PADS is built in
+ * the session own buffer and parsed back by the peer. A shared buffer in
+ * the discovery code shows up as a tag carrying another session value.
+ *
+ * Built by the "pppoe_discovery_test (Tool)" target, which runs it after the
+ * build and fails when a session does not come up with its own values.
+ */
+
+#include <sys/types.h>
+#include <net/ethernet.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "pppoe_tags.h"
+
+#define THREADS		16
+#define SESSIONS	512		/* per thread, all in discovery at the same time */
+#define ROUNDS		8
+
+struct session {
+    u_int8_t		host_uniq[8];
+    u_int8_t		cookie[16];
+    u_int8_t		relay[4];
+    u_int16_t		sessid;		/* as learnt by the client */
+    u_int16_t		len;		/* frame length */
+    u_int8_t		frame[ETHERMTU];
+};
+
+struct worker {
+    pthread_t		thread;
+    int			id;
+    int			failures;
+    struct session	sessions[SESSIONS];
+};
+
+static struct worker workers[THREADS];
+
+static u_int8_t ac_name_buf[] = "Darwin";
+static u_int8_t service_buf[] = "Think-Different";
+
+static int
+tag_is(struct pppoe_tags *tags, int idx, u_int8_t *data, u_int16_t len)
+{
+    struct pppoe_tag val;
+
+    return get_tag(tags, idx, &val) && val.len == len && !memcmp(val.data, data, len);
+}
+
+/* parse the session frame, check the pppoe header */
+static int
+parse(struct session *s, u_int8_t code, struct pppoe_tags *tags, u_int16_t *sessid)
+{
+    struct pppoe p;
+
+    memcpy(&p, s->frame, sizeof(p));
+    if (p.code != code || ntohs(p.len) + sizeof(p) != s->len)
+	return 0;
+    *sessid = ntohs(p.sessid);
+    index_tags(s->frame + sizeof(p), ntohs(p.len), tags);
+    return 1;
+}
+
+static void
+fail(struct worker *w, int i, char *what)
+{
+    if (w->failures++ < 10)
+	printf("FAIL: thread %d session %d: %s\n", w->id, i, what);
+}
+
+static void *
+run(void *arg)
+{
+    struct worker *w = arg;
+    struct pppoe_tag ac_name, service, host_uniq, cookie, relay;
+    struct pppoe_tags tags;
+    struct session *s;
+    u_int8_t out[ETHERMTU];
+    u_int16_t sessid;
+    int round, i, j;
+
+    ac_name.data = ac_name_buf;
+    ac_name.len = ac_name.max_len = sizeof(ac_name_buf) - 1;
+    service.data = service_buf;
+    service.len = service.max_len = sizeof(service_buf) - 1;
+
+    for (round = 0; round < ROUNDS; round++) {
+
+	/* every client sends its PADI */
+	for (i = 0; i < SESSIONS; i++) {
+	    s = &w->sessions[i];
+	    for (j = 0; j < sizeof(s->host_uniq); j++)
+		s->host_uniq[j] = (w->id << 4) ^ (i >> (j & 1 ? 8 : 0)) ^ (round << 5) ^ j;
+	    s->sessid = 0;
+	    host_uniq.data = s->host_uniq;
+	    host_uniq.len = host_uniq.max_len = sizeof(s->host_uniq);
+	    s->len = fill_PAD(s->frame, PPPOE_PADI, 0, 0, &service, &host_uniq, 0, 0, 0);
+	}
+
+	/* the concentrator answers each with a PADO carrying a cookie of its own */
+	for (i = 0; i < SESSIONS; i++) {
+	    s = &w->sessions[i];
+	    if (!parse(s, PPPOE_PADI, &tags, &sessid)
+		|| !tag_is(&tags, PPPOE_TAGIDX_HOST_UNIQ, s->host_uniq, sizeof(s->host_uniq))) {
+		fail(w, i, "bad PADI");
+		continue;
+	    }
+	    get_tag(&tags, PPPOE_TAGIDX_HOST_UNIQ, &host_uniq);
+	    for (j = 0; j < sizeof(s->cookie); j++)
+		s->cookie[j] = s->host_uniq[j % sizeof(s->host_uniq)] + j;
+	    s->relay[0] = w->id;
+	    s->relay[1] = i >> 8;
+	    s->relay[2] = i;
+	    s->relay[3] = round;
+	    cookie.data = s->cookie;
+	    cookie.len = cookie.max_len = sizeof(s->cookie);
+	    relay.data = s->relay;
+	    relay.len = relay.max_len = sizeof(s->relay);
+	    /* the echoed tags point in the request, answer in a frame of our own */
+	    s->len = fill_PAD(out, PPPOE_PADO, 0, &ac_name, &service, &host_uniq, &cookie, &relay, 0);
+	    memcpy(s->frame, out, s->len);
+	}
+
+	/* each client keeps the cookie and relay id, and echoes them in its PADR */
+	for (i = 0; i < SESSIONS; i++) {
+	    u_int8_t cookie_buf[sizeof(s->cookie)], relay_buf[sizeof(s->relay)];
+
+	    s = &w->sessions[i];
+	    cookie.data = cookie_buf;
+	    cookie.max_len = sizeof(cookie_buf);
+	    relay.data = relay_buf;
+	    relay.max_len = sizeof(relay_buf);
+	    if (!parse(s, PPPOE_PADO, &tags, &sessid)
+		|| !tag_is(&tags, PPPOE_TAGIDX_HOST_UNIQ, s->host_uniq, sizeof(s->host_uniq))
+		|| !tag_is(&tags, PPPOE_TAGIDX_AC_NAME, ac_name.data, ac_name.len)
+		|| !copy_tag(&tags, PPPOE_TAGIDX_AC_COOKIE, &cookie)
+		|| !copy_tag(&tags, PPPOE_TAGIDX_RELAY_SESSION_ID, &relay)
+		|| cookie.len != sizeof(s->cookie) || relay.len != sizeof(s->relay)) {
+		fail(w, i, "bad PADO");
+		continue;
+	    }
+	    host_uniq.data = s->host_uniq;
+	    host_uniq.len = host_uniq.max_len = sizeof(s->host_uniq);
+	    s->len = fill_PAD(s->frame, PPPOE_PADR, 0, &ac_name, &service, &host_uniq, &cookie, &relay, 0);
+	}
+
+	/* the concentrator checks the cookie and assigns the session id */
+	for (i = 0; i < SESSIONS; i++) {
+	    s = &w->sessions[i];
+	    if (!parse(s, PPPOE_PADR, &tags, &sessid)
+		|| !tag_is(&tags, PPPOE_TAGIDX_AC_COOKIE, s->cookie, sizeof(s->cookie))
+		|| !tag_is(&tags, PPPOE_TAGIDX_RELAY_SESSION_ID, s->relay, sizeof(s->relay))) {
+		fail(w, i, "bad PADR");
+		continue;
+	    }
+	    get_tag(&tags, PPPOE_TAGIDX_HOST_UNIQ, &host_uniq);
+	    get_tag(&tags, PPPOE_TAGIDX_RELAY_SESSION_ID, &relay);
+	    s->len = fill_PAD(out, PPPOE_PADS, w->id * SESSIONS + i + 1, 0, &service, &host_uniq, 0, &relay, 0);
+	    memcpy(s->frame, out, s->len);
+	}
+
+	/* and each client comes up with its own session id */
+	for (i = 0; i < SESSIONS; i++) {
+	    s = &w->sessions[i];
+	    if (!parse(s, PPPOE_PADS, &tags, &s->sessid)
+		|| !tag_is(&tags, PPPOE_TAGIDX_HOST_UNIQ, s->host_uniq, sizeof(s->host_uniq))
+		|| s->sessid != w->id * SESSIONS + i + 1)
+		fail(w, i, "bad PADS");
+	}
+    }
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    int i, failures = 0;
+
+    for (i = 0; i < THREADS; i++) {
+	workers[i].id = i;
+	if (pthread_create(&workers[i].thread, 0, run, &workers[i])) {
+	    printf("FAIL: cannot create thread %d\n", i);
+	    return 1;
+	}
+    }
+    for (i = 0; i < THREADS; i++) {
+	pthread_join(workers[i].thread, 0);
+	failures += workers[i].failures;
+    }
+
+    if (failures) {
+	printf("%d sessions failed\n", failures);
+	return 1;
+    }
+    printf("PASS: %d sessions in discovery at once, %d rounds\n", THREADS * SESSIONS, ROUNDS);
+    printf("all tests passed\n");
+    return 0;
+}
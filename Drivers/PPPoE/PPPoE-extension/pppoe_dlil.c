@@ -49,13 +49,14 @@ struct pppoe_if {
     u_short          	unit;
     u_short				refcnt;
     ifnet_t				ifp;
+    u_int32_t			padi_count;		/* PADI accepted in the current second */
 };
 
 /* -----------------------------------------------------------------------------
 Declarations
 ----------------------------------------------------------------------------- */
 static errno_t pppoe_dlil_input(ifnet_t ifp, protocol_family_t protocol,
-									 mbuf_t packet, char* header);
+									 mbuf_t packet);
 static errno_t pppoe_dlil_pre_output(ifnet_t ifp, protocol_family_t protocol,
 									  mbuf_t *packet, const struct sockaddr *dest,
 									  void *route, char *frame_type, char *link_layer_dest);
@@ -106,7 +107,7 @@ int pppoe_dlil_attach(u_short unit, ifnet_t *ifpp)
 	ifnet_t				ifp;
     int					ret;
 	char				ifname[20];
-    struct ifnet_attach_proto_param		reg;
+    struct ifnet_attach_proto_param_v2	reg;
 	struct ifnet_demux_desc				desc[2];
     u_int16_t			ctrl_protocol = htons(PPPOE_ETHERTYPE_CTRL);
     u_int16_t			data_protocol = htons(PPPOE_ETHERTYPE_DATA);
@@ -132,7 +133,7 @@ int pppoe_dlil_attach(u_short unit, ifnet_t *ifpp)
         return 1;
     }
 
-    bzero(&reg, sizeof(struct ifnet_attach_proto_param));
+    bzero(&reg, sizeof(struct ifnet_attach_proto_param_v2));
     
     // define demux for PPPoE
     desc[0].type = DLIL_DESC_ETYPE2;
@@ -150,7 +151,7 @@ int pppoe_dlil_attach(u_short unit, ifnet_t *ifpp)
     reg.ioctl            = pppoe_dlil_ioctl;
 
 	lck_mtx_unlock(ppp_domain_mutex);
-	ret = ifnet_attach_protocol(ifp, PF_PPP, &reg);
+	ret = ifnet_attach_protocol_v2(ifp, PF_PPP, &reg);
     if (ret) {
 		lck_mtx_lock(ppp_domain_mutex);
         IOLog("pppoe_dlil_attach: error = 0x%x\n", ret);
@@ -199,6 +200,31 @@ int pppoe_dlil_detach(ifnet_t ifp)
     return 0;
 }
 
+/* -----------------------------------------------------------------------------
+PADI budget counter of the interface, 0 if pppoe is not attached to it
+----------------------------------------------------------------------------- */
+u_int32_t *pppoe_dlil_padi_count(ifnet_t ifp)
+{
+    struct pppoe_if  	*pppoeif;
+
+    TAILQ_FOREACH(pppoeif, &pppoe_if_head, next) {
+        if (pppoeif->ifp == ifp)
+            return &pppoeif->padi_count;
+    }
+    return 0;
+}
+
+/* -----------------------------------------------------------------------------
+new second, reset the PADI budget of all the interfaces
+----------------------------------------------------------------------------- */
+void pppoe_dlil_padi_reset(void)
+{
+    struct pppoe_if  	*pppoeif;
+
+    TAILQ_FOREACH(pppoeif, &pppoe_if_head, next)
+        pppoeif->padi_count = 0;
+}
+
 /* -----------------------------------------------------------------------------
 ethernet unit wants to detach
 ----------------------------------------------------------------------------- */
@@ -275,36 +301,39 @@ errno_t pppoe_dlil_ioctl(ifnet_t ifp, protocol_family_t protocol,
 
 
 /* -----------------------------------------------------------------------------
-* Process a received pppoe packet;
-* the packet is in the mbuf chain m without
-* the ether header, which is provided separately.
+* Process received pppoe packets;
+* the driver chain comes in one call, linked with mbuf_nextpkt,
+* each packet without its ether header, which is in the packet header.
 ----------------------------------------------------------------------------- */
 errno_t pppoe_dlil_input(ifnet_t ifp, protocol_family_t protocol,
-									 mbuf_t packet, char* header)
+									 mbuf_t packet)
 {
-    //unsigned char *p = frame_header;
-    //unsigned char *data;
-    struct ether_header *eh = (struct ether_header *)header;
-
     //IOLog("pppenet_input, ifp = %s%d\n", ifp->if_name, ifp->if_unit);
-    //IOLog("pppenet_input: enet_header dst : %x:%x:%x:%x:%x:%x - src %x:%x:%x:%x:%x:%x - type - %4x\n",
-        //p[0],p[1],p[2],p[3],p[4],p[5],p[6],p[7],p[8],p[9],p[10],p[11],ntohs(*(u_int16_t *)&p[12]));
-
-
-    //data = mtod(m, unsigned char *);
-    //IOLog("pppenet_input: data 0x %x %x %x %x %x %x\n",
-    //    data[0],data[1],data[2],data[3],data[4],data[5]);
 
     // only the ifp discriminate client at this point
     // pppoe will have to look at the session id to select the appropriate socket
+    // take the lock once for the whole chain
 
 	lck_mtx_lock(ppp_domain_mutex);
-    pppoe_rfc_lower_input(ifp, packet, (u_char *)header + ETHER_ADDR_LEN, ntohs(eh->ether_type));
+    pppoe_rfc_lower_input_chain(ifp, packet);
 	lck_mtx_unlock(ppp_domain_mutex);
 
     return 0;
 }
 
+/* -----------------------------------------------------------------------------
+largest PPP payload the ethernet interface can carry
+the pppoe header and the ppp protocol field take 8 bytes of the ethernet mtu
+----------------------------------------------------------------------------- */
+u_int16_t pppoe_dlil_max_payload(ifnet_t ifp)
+{
+    u_int32_t	mtu = ifnet_mtu(ifp);
+
+    if (mtu <= 8)
+        return 0;
+    return MIN(mtu - 8, UINT16_MAX);
+}
+
 /* -----------------------------------------------------------------------------
 called from pppenet_proto when data need to be sent
 ----------------------------------------------------------------------------- */
@@ -325,3 +354,16 @@ int pppoe_dlil_output(ifnet_t ifp, mbuf_t m, u_int8_t *to, u_int16_t typ)
     return 0;
 }
 
+/* -----------------------------------------------------------------------------
+called from pppoe_rfc when session data need to be sent
+the packet already starts with the complete ethernet header
+----------------------------------------------------------------------------- */
+int pppoe_dlil_output_raw(ifnet_t ifp, mbuf_t m)
+{
+    errno_t	err;
+
+	lck_mtx_unlock(ppp_domain_mutex);
+    err = ifnet_output_raw(ifp, PF_PPP, m);
+	lck_mtx_lock(ppp_domain_mutex);
+    return err;
+}
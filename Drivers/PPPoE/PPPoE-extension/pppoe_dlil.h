@@ -31,6 +31,10 @@ int pppoe_dlil_dispose(void);
 int pppoe_dlil_attach(u_short unit, ifnet_t *ifpp);
 int pppoe_dlil_detach(ifnet_t ifp);
 int pppoe_dlil_output(ifnet_t ifp, mbuf_t m, u_int8_t *to, u_int16_t typ);
+int pppoe_dlil_output_raw(ifnet_t ifp, mbuf_t m);
+u_int16_t pppoe_dlil_max_payload(ifnet_t ifp);
+u_int32_t *pppoe_dlil_padi_count(ifnet_t ifp);
+void pppoe_dlil_padi_reset(void);
 
 
 #endif
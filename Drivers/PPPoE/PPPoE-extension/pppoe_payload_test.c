@@ -0,0 +1,156 @@
+/*
+ * pppoe_payload_test.c - RFC 4638 PPP-Max-Payload interop tests.
+ *
+ * A client and a server go through PADI, PADO, PADR and PADS the way
+ * pppoe_rfc.c does, with the frames built and parsed by pppoe_tags.h,
+ * for peers that send the tag or not, ask for more than 1492 bytes or
+ * not, and cannot carry what the other side asks for.
+ *
+ * Built by the "pppoe_payload_test (Tool)" target, which runs it after the
+ * build and fails when a side does not end up with the expected payload.
+ */
+
+#include <sys/types.h>
+#include <net/ethernet.h>
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "pppoe_tags.h"
+
+struct exchange {
+    int		pado_tag;	/* PPP-Max-Payload present in the PADO */
+    int		pads_tag;	/* PPP-Max-Payload present in the PADS */
+    u_int16_t	server;		/* payload the server ends up with */
+    u_int16_t	client;		/* payload the client ends up with */
+};
+
+static int failures = 0;
+
+/* parse a frame the way pppoe_rfc_lower_input does */
+static void
+parse(u_int8_t *frame, struct pppoe_tags *tags)
+{
+    struct pppoe p;
+
+    memcpy(&p, frame, sizeof(p));
+    index_tags(frame + sizeof(p), ntohs(p.len), tags);
+}
+
+/*
+ * client_max and server_max are what pppoe_rfc_max_payload returns on each
+ * side, 0 when the side does not do RFC 4638 or its interface cannot carry it.
+ * bogus_pads, when set, is the value a broken server puts in its PADS.
+ */
+static void
+negotiate(u_int16_t client_max, u_int16_t server_max, u_int16_t bogus_pads, struct exchange *x)
+{
+    u_int8_t frame[ETHERMTU];
+    u_int8_t uniq_buf[] = { 1, 2, 3, 4 };
+    struct pppoe_tag uniq;
+    struct pppoe_tags tags;
+    u_int16_t payload;
+
+    uniq.data = uniq_buf;
+    uniq.len = uniq.max_len = sizeof(uniq_buf);
+
+    /* start_connect, the client asks for its max payload */
+    fill_PAD(frame, PPPOE_PADI, 0, 0, 0, &uniq, 0, 0, client_max);
+
+    /* handle_PADI, the server echoes it only if it can support it */
+    parse(frame, &tags);
+    payload = accept_max_payload(get_max_payload(&tags), server_max);
+    if (payload <= PPPOE_MTU)
+	payload = 0;
+    fill_PAD(frame, PPPOE_PADO, 0, 0, 0, &uniq, 0, 0, payload);
+    parse(frame, &tags);
+    x->pado_tag = (tags.present & (1 << PPPOE_TAGIDX_PPP_MAX_PAYLOAD)) != 0;
+
+    /* handle_PADO, the client asks again in the PADR */
+    fill_PAD(frame, PPPOE_PADR, 0, 0, 0, &uniq, 0, 0, client_max);
+
+    /* handle_PADR and start_accept, the server confirms in the PADS */
+    parse(frame, &tags);
+    x->server = accept_max_payload(get_max_payload(&tags), server_max);
+    payload = bogus_pads ? bogus_pads : (x->server > PPPOE_MTU ? x->server : 0);
+    fill_PAD(frame, PPPOE_PADS, 1, 0, 0, &uniq, 0, 0, payload);
+
+    /* handle_PADS */
+    parse(frame, &tags);
+    x->pads_tag = (tags.present & (1 << PPPOE_TAGIDX_PPP_MAX_PAYLOAD)) != 0;
+    x->client = confirmed_max_payload(get_max_payload(&tags), client_max);
+}
+
+static void
+check(char *what, u_int16_t client_max, u_int16_t server_max, u_int16_t bogus_pads,
+      int tags, u_int16_t server, u_int16_t client)
+{
+    struct exchange x;
+
+    negotiate(client_max, server_max, bogus_pads, &x);
+    if (x.pado_tag == tags && (bogus_pads || x.pads_tag == tags)
+	&& x.server == server && x.client == client) {
+	printf("PASS: %s\n", what);
+	return;
+    }
+    printf("FAIL: %s: tag in PADO %d PADS %d (expected %d), server %d (expected %d), client %d (expected %d)\n",
+	   what, x.pado_tag, x.pads_tag, tags, x.server, server, x.client, client);
+    failures++;
+}
+
+/* a tag with a bad length is ignored, as if absent */
+static void
+check_malformed(void)
+{
+    u_int8_t frame[ETHERMTU];
+    u_int8_t one = 0x05;
+    struct pppoe_tag bad;
+    struct pppoe_tags tags;
+    struct pppoe p;
+    u_int16_t len;
+
+    memset(&p, 0, sizeof(p));
+    p.ver = PPPOE_VER;
+    p.typ = PPPOE_TYPE;
+    p.code = PPPOE_PADI;
+    bad.data = &one;
+    bad.len = bad.max_len = sizeof(one);
+    len = add_tag(frame + sizeof(p), PPPOE_TAG_PPP_MAX_PAYLOAD, &bad);
+    p.len = htons(len);
+    memcpy(frame, &p, sizeof(p));
+
+    parse(frame, &tags);
+    if (get_max_payload(&tags) == 0
+	&& accept_max_payload(get_max_payload(&tags), 1500) == PPPOE_MTU) {
+	printf("PASS: one byte PPP-Max-Payload ignored\n");
+	return;
+    }
+    printf("FAIL: one byte PPP-Max-Payload gives %d\n", get_max_payload(&tags));
+    failures++;
+}
+
+int
+main(int argc, char **argv)
+{
+    /*    what						client	server	bogus	tags	server	client */
+    check("both sides at 1500",				1500,	1500,	0,	1,	1500,	1500);
+    check("jumbo frames, both sides at 9000",		9000,	9000,	0,	1,	9000,	9000);
+    check("server carries more than asked",		1500,	9000,	0,	1,	1500,	1500);
+    check("server cannot carry what is asked",		1500,	1496,	0,	0,	1492,	1492);
+    check("server without RFC 4638",			1500,	0,	0,	0,	1492,	1492);
+    check("client without RFC 4638",			0,	1500,	0,	0,	1492,	1492);
+    check("neither side",				0,	0,	0,	0,	1492,	1492);
+    check("client asks for 1492 or less",		1492,	1500,	0,	0,	1492,	1492);
+    check("client asks for one byte more",		1493,	1500,	0,	1,	1493,	1493);
+    check("server confirms more than asked",		1500,	1500,	9000,	1,	1500,	1500);
+    check("server confirms less than asked",		1500,	1500,	1496,	1,	1500,	1496);
+    check("server confirms 1492 or less",		1500,	1500,	1400,	1,	1500,	1492);
+    check_malformed();
+
+    if (failures) {
+	printf("%d tests failed\n", failures);
+	return 1;
+    }
+    printf("all tests passed\n");
+    return 0;
+}
@@ -94,6 +94,7 @@ extern lck_mtx_t	*ppp_domain_mutex;
 
 /* -----------------------------------------------------------------------------
  PPPOE Timer, at 100 ms. Replaces pppoe_slowtimo, which is deprecated.
+ Only ticks while a call setup timer is armed, sleeps until pppoe_timer_wakeup otherwise.
  ----------------------------------------------------------------------------- */
 static uint8_t pppoe_timer_thread_is_dying = 0; /* > 0 if dying */
 static uint8_t pppoe_timer_thread_is_dead = 0; /* > 0 if dead */
@@ -101,9 +102,10 @@ static uint8_t pppoe_timer_thread_is_dead = 0; /* > 0 if dead */
 static void pppoe_timer()
 {
     struct timespec ts = {0};
+    u_int32_t armed;
     
-    /* timeout of 1000 ms */
-    ts.tv_nsec = 1000 * 1000 * 1000;
+    /* timeout of one timer tick */
+    ts.tv_nsec = 1000 * 1000 * 1000 / PPPOE_TIMER_HZ;
     ts.tv_sec = 0;
     
     lck_mtx_lock(ppp_domain_mutex);
@@ -112,9 +114,9 @@ static void pppoe_timer()
             break;
         }
         
-        pppoe_rfc_timer();
+        armed = pppoe_rfc_timer();
         
-        msleep(&pppoe_timer_thread_is_dying, ppp_domain_mutex, PSOCK, "pppoe_timer_sleep", &ts);
+        msleep(&pppoe_timer_thread_is_dying, ppp_domain_mutex, PSOCK, "pppoe_timer_sleep", armed ? &ts : NULL);
     }
     
     pppoe_timer_thread_is_dead++;
@@ -124,6 +126,14 @@ static void pppoe_timer()
     thread_terminate(current_thread());
 }
 
+/* -----------------------------------------------------------------------------
+ a timer was armed while none were, get the timer thread ticking again
+ ----------------------------------------------------------------------------- */
+void pppoe_timer_wakeup()
+{
+    wakeup(&pppoe_timer_thread_is_dying);
+}
+
 /* -----------------------------------------------------------------------------
 Called when we need to add the PPPoE protocol to the domain
 Typically, ppp_add is called by ppp_domain when we add the domain,
@@ -288,6 +298,12 @@ int pppoe_ctloutput(struct socket *so, struct sockopt *sopt)
                     else if ((error = sooptcopyin(sopt, &str, 2, 2)) == 0)
                         pppoe_rfc_command(so->so_pcb, PPPOE_CMD_SETPEERADDR , &str);
                     break;
+                case PPPOE_OPT_MAX_PAYLOAD:
+                    if (sopt->sopt_valsize != 2)
+                        error = EMSGSIZE;
+                    else if ((error = sooptcopyin(sopt, &val, 2, 2)) == 0)
+                        pppoe_rfc_command(so->so_pcb, PPPOE_CMD_SETMAXPAYLOAD, &val);
+                    break;
                 default:
                     error = ENOPROTOOPT;
             }
@@ -345,6 +361,25 @@ int pppoe_ctloutput(struct socket *so, struct sockopt *sopt)
                         error = sooptcopyout(sopt, &str, 6);
                     }
                     break;
+                case PPPOE_OPT_MAX_PAYLOAD:
+                    if (sopt->sopt_valsize != 2)
+                        error = EMSGSIZE;
+                    else {
+                        pppoe_rfc_command(so->so_pcb, PPPOE_CMD_GETMAXPAYLOAD, &val);
+                        error = sooptcopyout(sopt, &val, 2);
+                    }
+                    break;
+                case PPPOE_OPT_DISCOVERY_STATS: {
+                    struct pppoe_discovery_stats stats;
+
+                    if (sopt->sopt_valsize != sizeof(stats))
+                        error = EMSGSIZE;
+                    else {
+                        pppoe_rfc_command(so->so_pcb, PPPOE_CMD_GETDISCOVERYSTATS, &stats);
+                        error = sooptcopyout(sopt, &stats, sizeof(stats));
+                    }
+                    break;
+                }
                 default:
                     error = ENOPROTOOPT;
             }
@@ -29,6 +29,7 @@
 
 int pppoe_add(struct domain *domain);
 int pppoe_remove(struct domain *domain);
+void pppoe_timer_wakeup(void);
 
 
 #endif
\ No newline at end of file
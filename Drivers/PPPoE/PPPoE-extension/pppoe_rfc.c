@@ -28,6 +28,9 @@
 #include <sys/malloc.h>
 #include <sys/syslog.h>
 #include <sys/domain.h>
+#include <sys/time.h>
+#include <sys/sysctl.h>
+#include <sys/random.h>
 #include <kern/locks.h>
 #include <net/if.h>
 
@@ -36,6 +39,8 @@
 #include "PPPoE.h"
 #include "pppoe_rfc.h"
 #include "pppoe_dlil.h"
+#include "pppoe_proto.h"
+#include "pppoe_tags.h"
 
 
 /* -----------------------------------------------------------------------------
@@ -44,29 +49,10 @@ Definitions
 
 //#define PPPENET_COMPAT 1
 
-#define PPPOE_VER 	1
-#define PPPOE_TYPE	1
-
-#define PPPOE_PADI	0x9
-#define PPPOE_PADO	0x7
-#define PPPOE_PADR	0x19
-#define PPPOE_PADS	0x65
-#define PPPOE_PADT	0xa7
-
-#define PPPOE_TAG_END_OF_LIST		0x0000
-#define PPPOE_TAG_SERVICE_NAME		0x0101
-#define PPPOE_TAG_AC_NAME		0x0102
-#define PPPOE_TAG_HOST_UNIQ		0x0103
-#define PPPOE_TAG_AC_COOKIE		0x0104
-#define PPPOE_TAG_VENDOR_SPECIFIC	0x0105
-#define PPPOE_TAG_RELAY_SESSION_ID	0x0110
-#define PPPOE_TAG_SERVICE_NAME_ERROR	0x0201
-#define PPPOE_TAG_AC_SYSTEM_ERROR	0x0202
-#define PPPOE_TAG_GENERIC_ERROR		0x0203
-
 #define PPPOE_TIMER_CONNECT 		20	 // let's have a connect timer of 20 seconds
 #define PPPOE_TIMER_RING 		30	 // let's have a ring timer of 30 seconds
-#define PPPOE_TIMER_RETRY 		3	 // let's have a retry period of 3 seconds
+#define PPPOE_TIMER_RETRY 		3	 // let's have a retry period of 3 seconds, doubled at each retry
+#define PPPOE_TIMER_RETRY_MAX		30	 // up to 30 seconds
 
 #define SERVER_NAME "Darwin\0"
 #define SERVICE_NAME "Think-Different\0"
@@ -75,22 +61,36 @@ Definitions
 #define	PPPOE_RELAY_ID_LEN		64	// 64 bytes (Fix Me: dynamically allocate tag)
 #define	PPPOE_AC_COOKIE_LEN		64	// 64 bytes (Fix Me: dynamically allocate tag)
 
-#define PPPOE_TMPBUF_SIZE		1500
+#define PPPOE_MAX_TAGS_LEN		(ETHERMTU - sizeof(struct pppoe))	// max tags in a discovery packet
+
+#define PPPOE_SESSION_HASH_SIZE		1024	// connected sessions buckets, must be a power of 2
+#define PPPOE_DISCOVERY_HASH_SIZE	16	// discovery listeners buckets, must be a power of 2
+
+#define PPPOE_COOKIE_LEN		8	// AC-Cookie we generate, keyed hash of client address and epoch
+#define PPPOE_COOKIE_EPOCH		30	// seconds, cookies are accepted for one to two epochs
+#define PPPOE_COOKIE_KEY_LEN		16
+
+#define PPPOE_PADI_SOURCES		256	// per source PADI rate buckets, must be a power of 2
+
+#define PPPOE_INPUT_BATCH		8	// sessions gathered from one receive chain before delivering
+
+#define PPPOE_DATA_HDR_LEN		(ETHER_HDR_LEN + sizeof(struct pppoe))	// ethernet + pppoe session header, 20 bytes
+#define PPPOE_DATA_HDR_LEN_OFF		(PPPOE_DATA_HDR_LEN - sizeof(u_int16_t))	// offset of the pppoe length field
 
-struct pppoe {
-    u_int8_t ver:4;
-    u_int8_t typ:4;
-    u_int8_t code;
-    u_int16_t sessid;
-    u_int16_t len;
+// which demux list the rfc is linked on
+enum {
+    PPPOE_DEMUX_NONE = 0,
+    PPPOE_DEMUX_DISCOVERY,		// looking, connecting, listening or ringing, keyed on ifp
+    PPPOE_DEMUX_SESSION			// connected, keyed on (ifp, session id, peer address)
 };
 
-// a pppoe_tag is basically a buffer with information how much data it contains
-// right now, and how much space it provides in total.
-struct pppoe_tag {
-    u_int16_t	len;		/* data length */
-    u_int16_t	max_len;	/* buffer size */
-    u_int8_t	*data;		/* pointer to actual data */
+// session data gathered from a receive chain, one entry per session
+struct pppoe_input_batch {
+    struct pppoe_rfc	*rfc;		/* valid for the demux generation the batch was gathered in */
+    u_int16_t		sessid;		/* session key, to look the rfc up again */
+    u_int8_t		from[ETHER_ADDR_LEN];
+    mbuf_t		head;		/* packets for the session, linked with mbuf_nextpkt */
+    mbuf_t		tail;
 };
 
 // utility macro that makes it easy to declare a pppoe_tag with static data
@@ -130,6 +130,9 @@ struct pppoe_rfc {
 
     // administrative info
     TAILQ_ENTRY(pppoe_rfc) 	next;
+    TAILQ_ENTRY(pppoe_rfc) 	demux_next;		/* link in the session hash or the discovery list */
+    u_int16_t			demux_bucket;		/* bucket we are linked on */
+    u_int8_t			demux_list;		/* list we are linked on, PPPOE_DEMUX_xxx */
     void 			*host; 			/* pointer back to the hosting structure */
     ifnet_t						ifp;			/* associated datalink attachment */
     pppoe_rfc_input_callback 	inputcb;		/* callback function when data are present */
@@ -146,14 +149,12 @@ struct pppoe_rfc {
     PPPOE_TAG(service, PPPOE_SERVICE_LEN);		/* Service name we want to reach */
     u_int16_t	timer_connect_setup;			/* number of seconds to allow for an outgoing call */
     u_int16_t	timer_retry_setup;			/* number of seconds between retries */
-    u_int16_t	timer_connect;				/* seconds remaining before aborting outgoing call */
-    u_int16_t	timer_connect_resend;			/* seconds when needs teo start retransmitting */
+    u_int32_t	retry_interval;				/* current PADI/PADR retransmission interval, in ms */
 
     // incoming call
     PPPOE_TAG(serv_ac_name, PPPOE_AC_NAME_LEN);		/* Access Concentrator we offer */
     PPPOE_TAG(serv_service, PPPOE_SERVICE_LEN);		/* Service name we offer */
     u_int16_t	timer_ring_setup;			/* number of seconds to allow for an incoming call */
-    u_int16_t	timer_ring;				/* second remaining before aborting incoming call */
 
     // commom outgoing/incoming call
     PPPOE_TAG(host_uniq, PPPOE_HOST_UNIQ_LEN);		/* client reserved cookie */
@@ -161,6 +162,23 @@ struct pppoe_rfc {
     PPPOE_TAG(relay_id, PPPOE_RELAY_ID_LEN);		/* intermediate relay cookie */
     u_int16_t	session_id;				/* session id between client and server */
     u_int8_t	peer_address[ETHER_ADDR_LEN];		/* ethernet address we are connected to */
+    u_int16_t	max_payload;				/* RFC 4638 max payload we want, 0 to use the default */
+    u_int16_t	payload;				/* max payload negotiated for the session */
+
+    // call setup timer, armed while looking, connecting or ringing
+    TAILQ_ENTRY(pppoe_rfc) 	timer_next;		/* link in the deadline ordered timer list */
+    u_int8_t	timer_armed;				/* linked in the timer list */
+    u_int64_t	timer_deadline;				/* uptime of the next timer event, in ms */
+    u_int64_t	timer_abort;				/* uptime at which the call setup is aborted */
+    u_int64_t	timer_resend;				/* uptime of the next PADI/PADR retransmission */
+
+    // discovery statistics
+    struct pppoe_discovery_stats	stats;		/* counters of the last outgoing call */
+    u_int64_t	phase_start;				/* uptime of the first PADI or PADR */
+
+    // session data fast path
+    u_int8_t	data_header[PPPOE_DATA_HDR_LEN];	/* prebuilt ethernet + pppoe header, length to patch */
+    u_int8_t	data_header_ok;				/* data_header is valid for the current session */
 
 };
 
@@ -168,36 +186,111 @@ struct pppoe_rfc {
 /* -----------------------------------------------------------------------------
 Globals
 ----------------------------------------------------------------------------- */
-// change the algo to remove that var
-u_int8_t 	pppenet_tmpbuf[PPPOE_TMPBUF_SIZE];
-
 u_int16_t 	pppoe_unique_session_id = 1;
 u_int32_t 	pppoe_unique_address = 1;
 
 TAILQ_HEAD(, pppoe_rfc) 	pppoe_rfc_head;
 
+// input demux, so we don't walk every client for every ethernet frame
+TAILQ_HEAD(pppoe_rfc_list, pppoe_rfc);
+struct pppoe_rfc_list	pppoe_session_hash[PPPOE_SESSION_HASH_SIZE];
+struct pppoe_rfc_list	pppoe_discovery_hash[PPPOE_DISCOVERY_HASH_SIZE];
+
+// call setup timers, ordered by deadline, the timer only looks at the head
+struct pppoe_rfc_list	pppoe_timer_head;
+
+// server side discovery protection
+// AC-Cookies are stateless, we only keep a secret to validate them in the PADR
+static u_int8_t		pppoe_cookie_key[PPPOE_COOKIE_KEY_LEN];
+
+// PADI rate limiting, the counts are reset every second by pppoe_rfc_timer
+struct pppoe_padi_source {
+    u_int8_t	address[ETHER_ADDR_LEN];
+    u_int16_t	count;
+};
+static struct pppoe_padi_source	pppoe_padi_sources[PPPOE_PADI_SOURCES];
+static u_int64_t	pppoe_padi_reset;		/* uptime of the next PADI budget reset */
+
+// bumped each time an rfc leaves the demux lists, before it can be freed.
+// data delivery can drop ppp_domain_mutex, an rfc pointer kept across it
+// must be looked up again when the generation changed.
+static u_int32_t	pppoe_demux_gen;
+
+static int pppoe_ac_cookie = 1;			/* issue AC-Cookies in PADO and require them in PADR */
+static int pppoe_padi_source_rate = 4;		/* max PADI per second from one source */
+static int pppoe_padi_if_rate = 200;		/* max PADI per second on one interface */
+static int pppoe_padi_accepted = 0;		/* PADI passed to the listeners */
+static int pppoe_padi_dropped = 0;		/* PADI dropped by the rate limiter */
+static int pppoe_padr_accepted = 0;		/* PADR with a valid AC-Cookie */
+static int pppoe_padr_dropped = 0;		/* PADR with a missing or invalid AC-Cookie */
+static int pppoe_retry_max = PPPOE_TIMER_RETRY_MAX;	/* ceiling of the PADI/PADR retransmission interval */
+
+#if TARGET_OS_OSX
+SYSCTL_DECL(_net_ppp_pppoe);
+SYSCTL_INT(_net_ppp_pppoe, OID_AUTO, ac_cookie, CTLTYPE_INT|CTLFLAG_RW|CTLFLAG_NOAUTO|CTLFLAG_KERN,
+    &pppoe_ac_cookie, 0, "Issue AC-Cookies in PADO and require them in PADR");
+SYSCTL_INT(_net_ppp_pppoe, OID_AUTO, padi_source_rate, CTLTYPE_INT|CTLFLAG_RW|CTLFLAG_NOAUTO|CTLFLAG_KERN,
+    &pppoe_padi_source_rate, 0, "Max PADI per second from one source, 0 for no limit");
+SYSCTL_INT(_net_ppp_pppoe, OID_AUTO, padi_if_rate, CTLTYPE_INT|CTLFLAG_RW|CTLFLAG_NOAUTO|CTLFLAG_KERN,
+    &pppoe_padi_if_rate, 0, "Max PADI per second on one interface, 0 for no limit");
+SYSCTL_INT(_net_ppp_pppoe, OID_AUTO, padi_accepted, CTLTYPE_INT|CTLFLAG_RD|CTLFLAG_NOAUTO|CTLFLAG_KERN,
+    &pppoe_padi_accepted, 0, "PADI passed to the listeners");
+SYSCTL_INT(_net_ppp_pppoe, OID_AUTO, padi_dropped, CTLTYPE_INT|CTLFLAG_RD|CTLFLAG_NOAUTO|CTLFLAG_KERN,
+    &pppoe_padi_dropped, 0, "PADI dropped by the rate limiter");
+SYSCTL_INT(_net_ppp_pppoe, OID_AUTO, padr_accepted, CTLTYPE_INT|CTLFLAG_RD|CTLFLAG_NOAUTO|CTLFLAG_KERN,
+    &pppoe_padr_accepted, 0, "PADR with a valid AC-Cookie");
+SYSCTL_INT(_net_ppp_pppoe, OID_AUTO, padr_dropped, CTLTYPE_INT|CTLFLAG_RD|CTLFLAG_NOAUTO|CTLFLAG_KERN,
+    &pppoe_padr_dropped, 0, "PADR with a missing or invalid AC-Cookie");
+SYSCTL_INT(_net_ppp_pppoe, OID_AUTO, retry_max, CTLTYPE_INT|CTLFLAG_RW|CTLFLAG_NOAUTO|CTLFLAG_KERN,
+    &pppoe_retry_max, 0, "Max PADI/PADR retransmission interval in seconds, 0 for a fixed interval");
+#endif
+
 extern lck_mtx_t	*ppp_domain_mutex;
 
 /* -----------------------------------------------------------------------------
 Forward declarations
 ----------------------------------------------------------------------------- */
-static u_int16_t handle_PADI(struct pppoe_rfc *rfc, mbuf_t m, u_int8_t *from);
-static u_int16_t handle_PADR(struct pppoe_rfc *rfc, mbuf_t m, u_int8_t *from);
-static u_int16_t handle_PADO(struct pppoe_rfc *rfc, mbuf_t m, u_int8_t *from);
-static u_int16_t handle_PADS(struct pppoe_rfc *rfc, mbuf_t m, u_int8_t *from);
-static u_int16_t handle_PADT(struct pppoe_rfc *rfc, mbuf_t m, u_int8_t *from);
+static u_int16_t handle_PADI(struct pppoe_rfc *rfc, mbuf_t m, u_int8_t *from, struct pppoe_tags *tags);
+static u_int16_t handle_PADR(struct pppoe_rfc *rfc, mbuf_t m, u_int8_t *from, struct pppoe_tags *tags);
+static u_int16_t handle_PADO(struct pppoe_rfc *rfc, mbuf_t m, u_int8_t *from, struct pppoe_tags *tags);
+static u_int16_t handle_PADS(struct pppoe_rfc *rfc, mbuf_t m, u_int8_t *from, struct pppoe_tags *tags);
+static u_int16_t handle_PADT(struct pppoe_rfc *rfc, mbuf_t m, u_int8_t *from, struct pppoe_tags *tags);
 static u_int16_t handle_data(struct pppoe_rfc *rfc, mbuf_t m, u_int8_t *from);
-static u_int16_t handle_ctrl(struct pppoe_rfc *rfc, mbuf_t m, u_int8_t *from);
+static u_int16_t handle_ctrl(struct pppoe_rfc *rfc, mbuf_t m, u_int8_t *from, struct pppoe_tags *tags);
+static void deliver_data(struct pppoe_rfc *rfc, mbuf_t m);
+
+static void pppoe_rfc_set_state(struct pppoe_rfc *rfc, u_int16_t state);
+static void pppoe_rfc_link(struct pppoe_rfc *rfc);
+static void pppoe_rfc_unlink(struct pppoe_rfc *rfc);
+static struct pppoe_rfc *pppoe_rfc_session_lookup(ifnet_t ifp, u_int16_t sessid, u_int8_t *from);
 
 static void send_event(struct pppoe_rfc *rfc, u_int32_t event, u_int32_t msg);
 static void send_PAD(struct pppoe_rfc *rfc, u_int8_t *address, u_int16_t code, u_int16_t sessid,
                      struct pppoe_tag *ac_name, struct pppoe_tag *service,
-                     struct pppoe_tag *host_uniq, struct pppoe_tag *ac_cookie, struct pppoe_tag *relay_id);
-
-static u_int16_t add_tag(u_int8_t *data, u_int16_t tag, struct pppoe_tag *val);
-static u_int16_t get_tag(mbuf_t m, u_int16_t tag, struct pppoe_tag *val);
-
-u_int16_t pppoe_rfc_input(struct pppoe_rfc *rfc, mbuf_t m, u_int8_t *from, u_int16_t typ);
+                     struct pppoe_tag *host_uniq, struct pppoe_tag *ac_cookie, struct pppoe_tag *relay_id,
+                     u_int16_t max_payload);
+static mbuf_t make_PAD(u_int16_t code, u_int16_t sessid,
+                     struct pppoe_tag *ac_name, struct pppoe_tag *service,
+                     struct pppoe_tag *host_uniq, struct pppoe_tag *ac_cookie, struct pppoe_tag *relay_id,
+                     u_int16_t max_payload);
+static u_int16_t pppoe_rfc_max_payload(struct pppoe_rfc *rfc);
+static void pppoe_rfc_build_header(struct pppoe_rfc *rfc);
+static void deliver_batch(ifnet_t ifp, struct pppoe_input_batch *batch, int *count);
+
+static u_int64_t pppoe_rfc_uptime(void);
+static void pppoe_rfc_timer_arm(struct pppoe_rfc *rfc, u_int64_t deadline);
+static void pppoe_rfc_timer_disarm(struct pppoe_rfc *rfc);
+static void pppoe_rfc_timer_schedule(struct pppoe_rfc *rfc);
+static void pppoe_rfc_timeout(struct pppoe_rfc *rfc, u_int64_t now);
+static u_int32_t pppoe_rfc_backoff(struct pppoe_rfc *rfc);
+static void pppoe_rfc_retry_start(struct pppoe_rfc *rfc, u_int64_t now);
+
+static void make_cookie(u_int8_t *address, u_int32_t epoch, struct pppoe_tag *cookie);
+static int check_cookie(u_int8_t *address, struct pppoe_tag *cookie);
+static int padi_ratelimit(ifnet_t ifp, u_int8_t *from);
+static int parse_tags(mbuf_t *mp, struct pppoe_tags *tags);
+
+u_int16_t pppoe_rfc_input(struct pppoe_rfc *rfc, mbuf_t m, u_int8_t *from, u_int16_t typ, struct pppoe_tags *tags);
 void pppoe_rfc_lower_output(struct pppoe_rfc *rfc, mbuf_t m, u_int8_t *to, u_int16_t typ);
 
 
@@ -208,8 +301,26 @@ need to change it to handle multiple ethernet interfaces
 u_int16_t pppoe_rfc_init()
 {
 
+    int i;
+
     pppoe_dlil_init();
     TAILQ_INIT(&pppoe_rfc_head);
+    for (i = 0; i < PPPOE_SESSION_HASH_SIZE; i++)
+        TAILQ_INIT(&pppoe_session_hash[i]);
+    for (i = 0; i < PPPOE_DISCOVERY_HASH_SIZE; i++)
+        TAILQ_INIT(&pppoe_discovery_hash[i]);
+    TAILQ_INIT(&pppoe_timer_head);
+    read_random(pppoe_cookie_key, sizeof(pppoe_cookie_key));
+#if TARGET_OS_OSX
+    sysctl_register_oid(&sysctl__net_ppp_pppoe_ac_cookie);
+    sysctl_register_oid(&sysctl__net_ppp_pppoe_padi_source_rate);
+    sysctl_register_oid(&sysctl__net_ppp_pppoe_padi_if_rate);
+    sysctl_register_oid(&sysctl__net_ppp_pppoe_padi_accepted);
+    sysctl_register_oid(&sysctl__net_ppp_pppoe_padi_dropped);
+    sysctl_register_oid(&sysctl__net_ppp_pppoe_padr_accepted);
+    sysctl_register_oid(&sysctl__net_ppp_pppoe_padr_dropped);
+    sysctl_register_oid(&sysctl__net_ppp_pppoe_retry_max);
+#endif
     return 0;
 }
 
@@ -221,7 +332,17 @@ u_int16_t pppoe_rfc_dispose()
 
     if (pppoe_dlil_dispose())
         return 1;
-        
+
+#if TARGET_OS_OSX
+    sysctl_unregister_oid(&sysctl__net_ppp_pppoe_ac_cookie);
+    sysctl_unregister_oid(&sysctl__net_ppp_pppoe_padi_source_rate);
+    sysctl_unregister_oid(&sysctl__net_ppp_pppoe_padi_if_rate);
+    sysctl_unregister_oid(&sysctl__net_ppp_pppoe_padi_accepted);
+    sysctl_unregister_oid(&sysctl__net_ppp_pppoe_padi_dropped);
+    sysctl_unregister_oid(&sysctl__net_ppp_pppoe_padr_accepted);
+    sysctl_unregister_oid(&sysctl__net_ppp_pppoe_padr_dropped);
+    sysctl_unregister_oid(&sysctl__net_ppp_pppoe_retry_max);
+#endif
     return 0;
 }
 
@@ -247,6 +368,7 @@ u_int16_t pppoe_rfc_new_client(void *host, void **data,
     rfc->timer_connect_setup = PPPOE_TIMER_CONNECT;
     rfc->timer_ring_setup = PPPOE_TIMER_RING;
     rfc->timer_retry_setup = PPPOE_TIMER_RETRY;
+    rfc->payload = PPPOE_MTU;
 
     rfc->state = PPPOE_STATE_DISCONNECTED;
     PPPOE_TAG_SETUP(rfc->ac_name);
@@ -280,6 +402,8 @@ void pppoe_rfc_free_client(void *data)
 
     if (rfc) {
     
+        pppoe_rfc_timer_disarm(rfc);
+        pppoe_rfc_unlink(rfc);
         if (rfc->ifp)
             pppoe_dlil_detach(rfc->ifp);
         
@@ -296,6 +420,7 @@ u_int16_t pppoe_rfc_connect(void *data, u_int8_t *ac_name, u_int8_t *service)
     struct pppoe_rfc 	*rfc = (struct pppoe_rfc *)data;
     u_int8_t       	broadcastaddr[ETHER_ADDR_LEN] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
     u_int8_t       	emptyaddr[ETHER_ADDR_LEN] = { 0, 0, 0, 0, 0, 0 };
+    u_int64_t		now;
 	
 	lck_mtx_assert(ppp_domain_mutex, LCK_MTX_ASSERT_OWNED);
 
@@ -321,18 +446,23 @@ u_int16_t pppoe_rfc_connect(void *data, u_int8_t *ac_name, u_int8_t *service)
     rfc->host_uniq.len = sizeof(uintptr_t);
     rfc->ac_cookie.len = 0;
     rfc->relay_id.len = 0;
+    rfc->payload = PPPOE_MTU;
     
-    rfc->state = PPPOE_STATE_LOOKING;
-    rfc->timer_connect = rfc->timer_connect_setup;
-    // resend PADI/PADR every PPPOE_TIMEOUT_RETRY seconds
-    rfc->timer_connect_resend = rfc->timer_connect - rfc->timer_retry_setup;
+    pppoe_rfc_set_state(rfc, PPPOE_STATE_LOOKING);
+    now = pppoe_rfc_uptime();
+    rfc->timer_abort = now + rfc->timer_connect_setup * 1000;
+    bzero(&rfc->stats, sizeof(rfc->stats));
+    rfc->stats.padi_sent++;
+    // resend PADI/PADR with backoff until the connect timer expires
+    pppoe_rfc_retry_start(rfc, now);
 
     if (!bcmp(rfc->peer_address, emptyaddr, ETHER_ADDR_LEN))
         bcopy(broadcastaddr, rfc->peer_address, ETHER_ADDR_LEN);
 
     // if ac-name specified, try to reach it, otherwise, don't use name
     // may be shoult use a '*' semantic in the address ?
-    send_PAD(rfc, rfc->peer_address, PPPOE_PADI, 0, &rfc->ac_name, &rfc->service, &rfc->host_uniq, 0, 0);
+    send_PAD(rfc, rfc->peer_address, PPPOE_PADI, 0, &rfc->ac_name, &rfc->service, &rfc->host_uniq, 0, 0,
+             pppoe_rfc_max_payload(rfc));
     return 0;
 }
 
@@ -375,10 +505,12 @@ u_int16_t pppoe_rfc_accept(void *data)
     rfc->session_id = pppoe_unique_session_id++; // generate a session id
 
     // host_uniq and rfc->relay_session_id have been got from the previous PADR
+    // rfc->payload has been accepted from the PADR, confirm it
     send_PAD(rfc, rfc->peer_address, PPPOE_PADS, rfc->session_id, &rfc->ac_name, &rfc->service,
-             rfc->host_uniq.len ? &rfc->host_uniq : 0, 0, rfc->relay_id.len ? &rfc->relay_id : 0);
+             rfc->host_uniq.len ? &rfc->host_uniq : 0, 0, rfc->relay_id.len ? &rfc->relay_id : 0,
+             rfc->payload > PPPOE_MTU ? rfc->payload : 0);
              
-    rfc->state = PPPOE_STATE_CONNECTED;
+    pppoe_rfc_set_state(rfc, PPPOE_STATE_CONNECTED);
     send_event(rfc, PPPOE_EVT_CONNECTED, 0);
 
     return 0;
@@ -407,7 +539,7 @@ u_int16_t pppoe_rfc_listen(void *data)
         rfc->unit = 0;
     }
 
-    rfc->state = PPPOE_STATE_LISTENING;
+    pppoe_rfc_set_state(rfc, PPPOE_STATE_LISTENING);
     
     return 0;
 }
@@ -429,7 +561,7 @@ u_int16_t pppoe_rfc_abort(void *data, int evt_enable)
         case PPPOE_STATE_CONNECTING:
         case PPPOE_STATE_LISTENING:
         case PPPOE_STATE_RINGING:
-            rfc->state = PPPOE_STATE_DISCONNECTED;
+            pppoe_rfc_set_state(rfc, PPPOE_STATE_DISCONNECTED);
             bzero(rfc->peer_address, sizeof(rfc->peer_address));
             if (evt_enable)
 				send_event(rfc, PPPOE_EVT_DISCONNECTED, 0);
@@ -461,9 +593,9 @@ u_int16_t pppoe_rfc_disconnect(void *data)
     if (rfc->flags & PPPOE_FLAG_DEBUG)
         IOLog("PPPoE disconnect (%p)\n", rfc);
 
-    send_PAD(rfc, rfc->peer_address, PPPOE_PADT, rfc->session_id, 0, 0, 0, 0, 0);
+    send_PAD(rfc, rfc->peer_address, PPPOE_PADT, rfc->session_id, 0, 0, 0, 0, 0, 0);
 
-    rfc->state = PPPOE_STATE_DISCONNECTED;
+    pppoe_rfc_set_state(rfc, PPPOE_STATE_DISCONNECTED);
     bzero(rfc->peer_address, sizeof(rfc->peer_address));
     send_event(rfc, PPPOE_EVT_DISCONNECTED, 0);
 
@@ -482,12 +614,22 @@ void pppoe_rfc_clone(void *data1, void *data2)
 	lck_mtx_assert(ppp_domain_mutex, LCK_MTX_ASSERT_OWNED);
 
     host2 = rfc2->host;
+    pppoe_rfc_timer_disarm(rfc2);
+    pppoe_rfc_unlink(rfc2);
     if (rfc2->ifp)
         pppoe_dlil_detach(rfc2->ifp);
     TAILQ_REMOVE(&pppoe_rfc_head, rfc2, next);
     bcopy(data1, data2, sizeof(struct pppoe_rfc));
     rfc2->host = host2;
     TAILQ_INSERT_TAIL(&pppoe_rfc_head, rfc2, next);
+    // the demux links were copied from rfc1, link rfc2 on its own
+    rfc2->demux_list = PPPOE_DEMUX_NONE;
+    pppoe_rfc_link(rfc2);
+    // same for the timer, rfc2 takes over the call setup deadline
+    if (rfc2->timer_armed) {
+        rfc2->timer_armed = 0;
+        pppoe_rfc_timer_arm(rfc2, rfc2->timer_deadline);
+    }
     // cannot fail, there is no attachment done, and it's is just refcnt bumping
     if (rfc2->ifp)
         pppoe_dlil_attach(rfc2->unit, &rfc2->ifp);
@@ -503,58 +645,170 @@ void pppoe_rfc_clone(void *data1, void *data2)
 }
 
 /* -----------------------------------------------------------------------------
-called by protocol family when slowtiemr expires
-check the active timers and fires them appropriatly
-
-refaire les timers
+called by the protocol timer thread every 1/PPPOE_TIMER_HZ
+the call setup timers are ordered by deadline, only the ones due are visited
+returns 0 when no timer is left armed, the thread then sleeps until the
+next pppoe_timer_wakeup
 ----------------------------------------------------------------------------- */
-void pppoe_rfc_timer()
+u_int32_t pppoe_rfc_timer()
 {
     struct pppoe_rfc  	*rfc;
+    u_int64_t		now = pppoe_rfc_uptime();
 
     lck_mtx_assert(ppp_domain_mutex, LCK_MTX_ASSERT_OWNED);
-	
-    TAILQ_FOREACH(rfc, &pppoe_rfc_head, next) {
 
-        switch (rfc->state) {
-            case PPPOE_STATE_LOOKING:
-            case PPPOE_STATE_CONNECTING:
-                if (rfc->timer_connect == 0) {
-                    if (rfc->flags & PPPOE_FLAG_DEBUG)
-                        IOLog("PPPoE timer (%p): CONNECT_TIMER expires\n", rfc);
-                    rfc->state = PPPOE_STATE_DISCONNECTED;
-                    bzero(rfc->peer_address, sizeof(rfc->peer_address));
-                    // double-check for the error number ?
-                    send_event(rfc, PPPOE_EVT_DISCONNECTED, 
-                        PPPOE_STATE_LOOKING ? EHOSTUNREACH : ECONNREFUSED);
-                    break;
-                }
-                if (rfc->timer_connect == rfc->timer_connect_resend) {
-                        rfc->timer_connect_resend -= rfc->timer_retry_setup;
-                        send_PAD(rfc, rfc->peer_address, 
-                        rfc->state == PPPOE_STATE_LOOKING ? PPPOE_PADI : PPPOE_PADR, 0, 
-                        rfc->ac_name.len ? &rfc->ac_name : 0, &rfc->service,
-                        &rfc->host_uniq, 
-                        rfc->ac_cookie.len ? &rfc->ac_cookie : 0, 
-                        rfc->relay_id.len ? &rfc->relay_id : 0);
-                }
-                rfc->timer_connect--;
+    while ((rfc = TAILQ_FIRST(&pppoe_timer_head)) && rfc->timer_deadline <= now) {
+        pppoe_rfc_timer_disarm(rfc);
+        pppoe_rfc_timeout(rfc, now);
+    }
+
+    return !TAILQ_EMPTY(&pppoe_timer_head);
+}
+
+/* -----------------------------------------------------------------------------
+the call setup timer of an rfc is due
+----------------------------------------------------------------------------- */
+void pppoe_rfc_timeout(struct pppoe_rfc *rfc, u_int64_t now)
+{
+    u_int32_t	delay, error;
+
+    switch (rfc->state) {
+        case PPPOE_STATE_LOOKING:
+        case PPPOE_STATE_CONNECTING:
+            if (now >= rfc->timer_abort) {
+                if (rfc->flags & PPPOE_FLAG_DEBUG)
+                    IOLog("PPPoE timer (%p): CONNECT_TIMER expires\n", rfc);
+                // no offer at all, or an offer never confirmed
+                error = rfc->state == PPPOE_STATE_LOOKING ? EHOSTUNREACH : ECONNREFUSED;
+                pppoe_rfc_set_state(rfc, PPPOE_STATE_DISCONNECTED);
+                bzero(rfc->peer_address, sizeof(rfc->peer_address));
+                send_event(rfc, PPPOE_EVT_DISCONNECTED, error);
                 break;
-            case PPPOE_STATE_RINGING:
-                if (rfc->timer_ring == 0) {
-                    if (rfc->flags & PPPOE_FLAG_DEBUG)
-                        IOLog("PPPoE timer (%p): RING_TIMER expires\n", rfc);
-                    rfc->state = PPPOE_STATE_DISCONNECTED;
-                    bzero(rfc->peer_address, sizeof(rfc->peer_address));
-                    send_event(rfc, PPPOE_EVT_DISCONNECTED, 0);
-                    break;
-                }
-                rfc->timer_ring--; 
+            }
+            if (now >= rfc->timer_resend) {
+                send_PAD(rfc, rfc->peer_address, 
+                    rfc->state == PPPOE_STATE_LOOKING ? PPPOE_PADI : PPPOE_PADR, 0, 
+                    rfc->ac_name.len ? &rfc->ac_name : 0, &rfc->service,
+                    &rfc->host_uniq, 
+                    rfc->ac_cookie.len ? &rfc->ac_cookie : 0, 
+                    rfc->relay_id.len ? &rfc->relay_id : 0,
+                    pppoe_rfc_max_payload(rfc));
+                if (rfc->state == PPPOE_STATE_LOOKING)
+                    rfc->stats.padi_sent++;
+                else
+                    rfc->stats.padr_sent++;
+                delay = pppoe_rfc_backoff(rfc);
+                rfc->timer_resend = now + delay;
+                if (rfc->flags & PPPOE_FLAG_DEBUG)
+                    IOLog("PPPoE timer (%p): resend %s, next in %d ms\n", rfc,
+                        rfc->state == PPPOE_STATE_LOOKING ? "PADI" : "PADR", delay);
+            }
+            pppoe_rfc_timer_schedule(rfc);
+            break;
+        case PPPOE_STATE_RINGING:
+            if (now >= rfc->timer_abort) {
+                if (rfc->flags & PPPOE_FLAG_DEBUG)
+                    IOLog("PPPoE timer (%p): RING_TIMER expires\n", rfc);
+                pppoe_rfc_set_state(rfc, PPPOE_STATE_DISCONNECTED);
+                bzero(rfc->peer_address, sizeof(rfc->peer_address));
+                send_event(rfc, PPPOE_EVT_DISCONNECTED, 0);
                 break;
-        }
+            }
+            pppoe_rfc_timer_schedule(rfc);
+            break;
     }
 }
 
+/* -----------------------------------------------------------------------------
+uptime in milliseconds, the timer deadlines are expressed with it
+----------------------------------------------------------------------------- */
+u_int64_t pppoe_rfc_uptime(void)
+{
+    struct timeval	tv;
+
+    microuptime(&tv);
+    return ((u_int64_t)tv.tv_sec * 1000) + (tv.tv_usec / 1000);
+}
+
+/* -----------------------------------------------------------------------------
+put the rfc in the timer list, sorted by deadline
+deadlines mostly grow, look for the place from the end
+----------------------------------------------------------------------------- */
+void pppoe_rfc_timer_arm(struct pppoe_rfc *rfc, u_int64_t deadline)
+{
+    struct pppoe_rfc	*prev;
+
+    pppoe_rfc_timer_disarm(rfc);
+
+    // the timer thread sleeps while the list is empty
+    if (TAILQ_EMPTY(&pppoe_timer_head))
+        pppoe_timer_wakeup();
+
+    rfc->timer_deadline = deadline;
+    TAILQ_FOREACH_REVERSE(prev, &pppoe_timer_head, pppoe_rfc_list, timer_next) {
+        if (prev->timer_deadline <= deadline)
+            break;
+    }
+    if (prev)
+        TAILQ_INSERT_AFTER(&pppoe_timer_head, prev, rfc, timer_next);
+    else
+        TAILQ_INSERT_HEAD(&pppoe_timer_head, rfc, timer_next);
+    rfc->timer_armed = 1;
+}
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+void pppoe_rfc_timer_disarm(struct pppoe_rfc *rfc)
+{
+    if (rfc->timer_armed) {
+        TAILQ_REMOVE(&pppoe_timer_head, rfc, timer_next);
+        rfc->timer_armed = 0;
+    }
+}
+
+/* -----------------------------------------------------------------------------
+arm the timer for the next event of the call setup
+a ringing call has no retransmission, only the ring timer
+----------------------------------------------------------------------------- */
+void pppoe_rfc_timer_schedule(struct pppoe_rfc *rfc)
+{
+    u_int64_t	deadline = rfc->timer_abort;
+
+    if (rfc->state != PPPOE_STATE_RINGING && rfc->timer_resend < deadline)
+        deadline = rfc->timer_resend;
+    pppoe_rfc_timer_arm(rfc, deadline);
+}
+
+/* -----------------------------------------------------------------------------
+delay before the next PADI/PADR retransmission, in ms
+the interval starts at the retry timer and doubles after each retransmission,
+up to pppoe_retry_max seconds. the delay is spread by +/- 25%, so the clients
+that lost the same access concentrator don't come back in lockstep
+----------------------------------------------------------------------------- */
+u_int32_t pppoe_rfc_backoff(struct pppoe_rfc *rfc)
+{
+    u_int32_t	delay = MAX(rfc->retry_interval, 1000 / PPPOE_TIMER_HZ);
+    u_int32_t	max = pppoe_retry_max > 0 ? pppoe_retry_max * 1000 : 0;
+
+    // the ceiling never goes below the configured retry timer
+    if (max)
+        rfc->retry_interval = MIN(delay * 2, MAX(max, delay));
+
+    return delay - delay / 4 + (random() % (delay / 2 + 1));
+}
+
+/* -----------------------------------------------------------------------------
+the first PADI or PADR of the phase has just been sent
+restart the backoff and the latency measurement
+----------------------------------------------------------------------------- */
+void pppoe_rfc_retry_start(struct pppoe_rfc *rfc, u_int64_t now)
+{
+    rfc->phase_start = now;
+    rfc->retry_interval = rfc->timer_retry_setup * 1000;
+    rfc->timer_resend = now + pppoe_rfc_backoff(rfc);
+    pppoe_rfc_timer_schedule(rfc);
+}
+
 /* -----------------------------------------------------------------------------
 ----------------------------------------------------------------------------- */
 u_int16_t pppoe_rfc_output(void *data, mbuf_t m)
@@ -562,18 +816,29 @@ u_int16_t pppoe_rfc_output(void *data, mbuf_t m)
     struct pppoe_rfc 	*rfc = (struct pppoe_rfc *)data;
     // u_int8_t 		*d;
     struct pppoe	*p, p_data;
-    mbuf_t			m0;
     u_int16_t 		skip, len;
 	
 	lck_mtx_assert(ppp_domain_mutex, LCK_MTX_ASSERT_OWNED);
 
-    len = 0;
-    for (m0 = m; m0 != 0; m0 = mbuf_next(m0))
-        len += mbuf_len(m0);
+    // m is always a packet header, no need to walk the chain
+    len = mbuf_pkthdr_len(m);
 
     if (rfc->state != PPPOE_STATE_CONNECTED)
         return ENXIO;
 
+    // fast path, the whole frame header is prebuilt, only the length changes
+    if (rfc->data_header_ok) {
+        u_int16_t	plen = htons(len);
+
+        if (mbuf_prepend(&m, PPPOE_DATA_HDR_LEN, MBUF_WAITOK) != 0) {
+            IOLog("pppoe_rfc_output: failed mbuf_prepend\n");
+            return ENOBUFS;
+        }
+        bcopy(rfc->data_header, mbuf_data(m), PPPOE_DATA_HDR_LEN);
+        bcopy(&plen, (u_int8_t *)mbuf_data(m) + PPPOE_DATA_HDR_LEN_OFF, sizeof(plen));
+        return pppoe_dlil_output_raw(rfc->ifp, m);
+    }
+
    // IOLog("PPPoE write, len = %d\n", len);
     //d = mtod(m, u_int8_t *);
     //IOLog("PPPoE write, data = %x %x %x %x %x %x \n", d[0], d[1], d[2], d[3], d[4], d[5]);
@@ -636,6 +901,8 @@ u_int16_t pppoe_rfc_command(void *data, u_int32_t cmd, void *cmddata)
             if (rfc->flags & PPPOE_FLAG_DEBUG)
                 IOLog("PPPoE command (%p): set interface unit = %d\n", rfc, unit);
             if (rfc->unit != unit) {
+                // the demux lists are keyed on the interface, relink once it is changed
+                pppoe_rfc_unlink(rfc);
                if (rfc->ifp) {
                     pppoe_dlil_detach(rfc->ifp);
                     rfc->ifp = 0;
@@ -646,6 +913,7 @@ u_int16_t pppoe_rfc_command(void *data, u_int32_t cmd, void *cmddata)
                         return 1;
                     rfc->unit = unit;
                 }
+                pppoe_rfc_link(rfc);
              }
             break;
 
@@ -715,6 +983,25 @@ u_int16_t pppoe_rfc_command(void *data, u_int32_t cmd, void *cmddata)
             bcopy(rfc->peer_address, cmddata, ETHER_ADDR_LEN);
             break;
 
+        // RFC 4638 max payload we want to negotiate
+        // must be called before connect or listen
+        case PPPOE_CMD_SETMAXPAYLOAD:
+            if (rfc->flags & PPPOE_FLAG_DEBUG)
+                IOLog("PPPoE command (%p): set max payload = %d\n", rfc, *(u_int16_t *)cmddata);
+            rfc->max_payload = *(u_int16_t *)cmddata;
+            break;
+
+        // return the max payload negotiated for the session
+        case PPPOE_CMD_GETMAXPAYLOAD:
+            if (rfc->flags & PPPOE_FLAG_DEBUG)
+                IOLog("PPPoE command (%p): get max payload = %d\n", rfc, rfc->payload);
+            *(u_int16_t *)cmddata = rfc->payload;
+            break;
+
+        case PPPOE_CMD_GETDISCOVERYSTATS:
+            bcopy(&rfc->stats, cmddata, sizeof(struct pppoe_discovery_stats));
+            break;
+
         default:
             if (rfc->flags & PPPOE_FLAG_DEBUG)
                 IOLog("PPPoE command (%p): unknown command = %d\n", rfc, cmd);
@@ -726,7 +1013,7 @@ u_int16_t pppoe_rfc_command(void *data, u_int32_t cmd, void *cmddata)
 
 /* -----------------------------------------------------------------------------
 ----------------------------------------------------------------------------- */
-u_int16_t pppoe_rfc_input(struct pppoe_rfc *rfc, mbuf_t m, u_int8_t *from, u_int16_t typ)
+u_int16_t pppoe_rfc_input(struct pppoe_rfc *rfc, mbuf_t m, u_int8_t *from, u_int16_t typ, struct pppoe_tags *tags)
 {
 
     //IOLog("PPPoE input, rfc = %p\n", rfc);
@@ -738,7 +1025,7 @@ u_int16_t pppoe_rfc_input(struct pppoe_rfc *rfc, mbuf_t m, u_int8_t *from, u_int
 
    switch (typ) {
         case PPPOE_ETHERTYPE_CTRL:
-            return handle_ctrl(rfc, m, from);
+            return handle_ctrl(rfc, m, from, tags);
 
         case PPPOE_ETHERTYPE_DATA:
             return handle_data(rfc, m, from);
@@ -775,185 +1062,445 @@ void send_event(struct pppoe_rfc *rfc, u_int32_t event, u_int32_t msg)
 }
 
 /* -----------------------------------------------------------------------------
-get the value for the tag
-maxlen contains the max size of name (including null terminator)
-return 1 if the tag was found and it could fit with maxlen, 0 otherwise
+hash a connected session on the interface it runs on, its session id and the
+ethernet address of the peer. session ids are usually allocated sequentially
+by the access concentrator, so they get the low bits
 ----------------------------------------------------------------------------- */
-u_int16_t get_tag(mbuf_t m, u_int16_t tag, struct pppoe_tag *val)
+static u_int16_t pppoe_rfc_session_hash(ifnet_t ifp, u_int16_t sessid, u_int8_t *addr)
 {
-    u_int8_t 		*data, *tmpbuf;
-    struct pppoe	p_data;
-    u_int16_t 		totallen, copylen, len;
+    u_int32_t	h;
 
-    data = mbuf_data(m);
-    memcpy(&p_data, data, sizeof(p_data));
-    totallen =  ntohs(p_data.len);
+    h = (u_int32_t)((uintptr_t)ifp >> 4);
+    h ^= (addr[2] << 24) | (addr[3] << 16) | (addr[4] << 8) | addr[5];
+    h *= 0x9E3779B1;		// golden ratio, spreads the address and ifp bits
+    h = (h >> 16) ^ sessid;
+    return h & (PPPOE_SESSION_HASH_SIZE - 1);
+}
 
-    // Prevent buffer overflow - the PPPoE RFC gurantees us a maximum packet size, however, an attacker
-    // might very well produce huge packets.
-    if (totallen > PPPOE_TMPBUF_SIZE)
-        totallen = PPPOE_TMPBUF_SIZE;
+/* -----------------------------------------------------------------------------
+hash an interface, for the discovery listeners
+----------------------------------------------------------------------------- */
+static u_int16_t pppoe_rfc_discovery_hash(ifnet_t ifp)
+{
+    u_int32_t	h = (u_int32_t)((uintptr_t)ifp >> 4);
 
-    copylen = MIN(totallen, mbuf_len(m) - sizeof(struct pppoe));
+    return (h ^ (h >> 8)) & (PPPOE_DISCOVERY_HASH_SIZE - 1);
+}
 
-    tmpbuf = &pppenet_tmpbuf[0];
-    bcopy(data + sizeof(struct pppoe), tmpbuf, copylen);
+/* -----------------------------------------------------------------------------
+link the rfc on the demux list matching its current state
+connected sessions go to the session hash, the other active states go to
+the discovery list of their interface
+----------------------------------------------------------------------------- */
+void pppoe_rfc_link(struct pppoe_rfc *rfc)
+{
+    if (rfc->demux_list != PPPOE_DEMUX_NONE || rfc->ifp == 0)
+        return;
 
-    for (m = mbuf_next(m); m && (copylen < totallen); m = mbuf_next(m)) {
-        if (mbuf_len(m) == 0)
-            continue;
+    switch (rfc->state) {
+        case PPPOE_STATE_LOOKING:
+        case PPPOE_STATE_CONNECTING:
+        case PPPOE_STATE_LISTENING:
+        case PPPOE_STATE_RINGING:
+            rfc->demux_bucket = pppoe_rfc_discovery_hash(rfc->ifp);
+            rfc->demux_list = PPPOE_DEMUX_DISCOVERY;
+            TAILQ_INSERT_TAIL(&pppoe_discovery_hash[rfc->demux_bucket], rfc, demux_next);
+            break;
+        case PPPOE_STATE_CONNECTED:
+            rfc->demux_bucket = pppoe_rfc_session_hash(rfc->ifp, rfc->session_id, rfc->peer_address);
+            rfc->demux_list = PPPOE_DEMUX_SESSION;
+            TAILQ_INSERT_TAIL(&pppoe_session_hash[rfc->demux_bucket], rfc, demux_next);
+            break;
+    }
+}
 
-        len = MIN(totallen - copylen, mbuf_len(m));
-        data = mbuf_data(m);
-        bcopy(data, tmpbuf + copylen, len);
-        copylen += len;
+/* -----------------------------------------------------------------------------
+remove the rfc from its demux list
+must be called before changing the interface, the session id or the peer address
+----------------------------------------------------------------------------- */
+void pppoe_rfc_unlink(struct pppoe_rfc *rfc)
+{
+    switch (rfc->demux_list) {
+        case PPPOE_DEMUX_DISCOVERY:
+            TAILQ_REMOVE(&pppoe_discovery_hash[rfc->demux_bucket], rfc, demux_next);
+            break;
+        case PPPOE_DEMUX_SESSION:
+            TAILQ_REMOVE(&pppoe_session_hash[rfc->demux_bucket], rfc, demux_next);
+            break;
     }
+    rfc->demux_list = PPPOE_DEMUX_NONE;
+    pppoe_demux_gen++;
+}
+
+/* -----------------------------------------------------------------------------
+change state, and move the rfc to the corresponding demux list
+the session id and peer address must already be set when going connected
+----------------------------------------------------------------------------- */
+void pppoe_rfc_set_state(struct pppoe_rfc *rfc, u_int16_t state)
+{
+    u_int8_t	list;
 
-    totallen = copylen;
-    data = tmpbuf;
+    rfc->state = state;
+    rfc->data_header_ok = 0;
 
-    val->len = 0;
+    // only the call setup states have a timer running
+    if (state != PPPOE_STATE_LOOKING
+        && state != PPPOE_STATE_CONNECTING
+        && state != PPPOE_STATE_RINGING)
+        pppoe_rfc_timer_disarm(rfc);
 
-    while (totallen > 0) {
-    
-        len = ntohs(*(u_int16_t *)(data + 2));
-        if ((len + 4) > totallen)
-            break;	// bogus packet
-            
-        //IOLog("tag 0x%x 0x%x 0x%x 0x%x \n", data[0], data[1], data[2], data[3]);
-        if (ntohs(*(u_int16_t *)data) == tag) {
-            data += 2;
-            if (len <= val->max_len) {
-                bcopy(data + 2, val->data, len);
-                val->len = len;
-                if (val->len < val->max_len)
-                    val->data[val->len] = 0;
-                return 1;
-            }
-            //IOLog("got PADO : %s\n", name);
+    switch (state) {
+        case PPPOE_STATE_CONNECTED:
+            list = PPPOE_DEMUX_SESSION;
+            pppoe_rfc_build_header(rfc);
+            break;
+        case PPPOE_STATE_DISCONNECTED:
+            list = PPPOE_DEMUX_NONE;
+            break;
+        default:
+            list = PPPOE_DEMUX_DISCOVERY;
             break;
-        }
-        else {
-            totallen -= 4 + len;
-            data += 4 + len;
-        }
     }
 
-    return 0;
+    // moving between discovery states keeps the rfc in place
+    if (list == rfc->demux_list)
+        return;
+
+    pppoe_rfc_unlink(rfc);
+    pppoe_rfc_link(rfc);
 }
 
 /* -----------------------------------------------------------------------------
-add a tag to the data, return the len added
+prebuild the ethernet and pppoe session headers for pppoe_rfc_output
+only the pppoe length field is left to fill in for each packet
+loopback sessions and interfaces without a link address use the regular path
 ----------------------------------------------------------------------------- */
-u_int16_t add_tag(u_int8_t *data, u_int16_t tag, struct pppoe_tag *val)
+void pppoe_rfc_build_header(struct pppoe_rfc *rfc)
 {
-    
-    *(u_int16_t *)data = htons(tag);
-    data += 2;
-    *(u_int16_t *)data = htons(val->len);
-    data += 2;
-    bcopy(val->data, data, val->len);
+    struct ether_header	*eh = (struct ether_header *)rfc->data_header;
+    struct pppoe	p_data;
+
+    if ((rfc->flags & PPPOE_FLAG_LOOPBACK) || rfc->ifp == 0)
+        return;
+
+    if (ifnet_lladdr_copy_bytes(rfc->ifp, eh->ether_shost, ETHER_ADDR_LEN))
+        return;
+
+    bcopy(rfc->peer_address, eh->ether_dhost, ETHER_ADDR_LEN);
+    eh->ether_type = htons(PPPOE_ETHERTYPE_DATA);
 
-    return (val->len + 4);
+    bzero(&p_data, sizeof(p_data));
+    p_data.ver = PPPOE_VER;
+    p_data.typ = PPPOE_TYPE;
+    p_data.code = 0;
+    p_data.sessid = htons(rfc->session_id);
+    bcopy(&p_data, &rfc->data_header[ETHER_HDR_LEN], sizeof(p_data));
+
+    rfc->data_header_ok = 1;
 }
 
 /* -----------------------------------------------------------------------------
-address MUST be a valid ethernet address (6 bytes length)
+find the connected session for a frame
 ----------------------------------------------------------------------------- */
-void send_PAD(struct pppoe_rfc *rfc, u_int8_t *address, u_int16_t code, u_int16_t sessid,
-                     struct pppoe_tag *ac_name, struct pppoe_tag *service,
-                     struct pppoe_tag *host_uniq, struct pppoe_tag *ac_cookie,
-                     struct pppoe_tag *relay_id)
+struct pppoe_rfc *pppoe_rfc_session_lookup(ifnet_t ifp, u_int16_t sessid, u_int8_t *from)
 {
-    mbuf_t			m = 0;
-    u_int8_t 		*data;
-    u_int16_t 		len;
-    struct pppoe	*p, p_data;
+    struct pppoe_rfc  	*rfc;
 
-    if (mbuf_gethdr(MBUF_WAITOK, MBUF_TYPE_DATA, &m) != 0)
-        return;
+    TAILQ_FOREACH(rfc, &pppoe_session_hash[pppoe_rfc_session_hash(ifp, sessid, from)], demux_next) {
+        if (rfc->ifp == ifp
+            && rfc->session_id == sessid
+            && !bcmp(rfc->peer_address, from, ETHER_ADDR_LEN))
+            return rfc;
+    }
 
-    if (mbuf_mclget(MBUF_WAITOK, MBUF_TYPE_DATA, &m) != 0) {
-		mbuf_freem(m);
-        return;
-	}
+    return 0;
+}
+
+/* -----------------------------------------------------------------------------
+index the tags of a discovery packet, in a single pass
+lengths are validated here, the handlers can then use the tags without
+walking the packet again. only the first occurence of a tag is kept
+when the tags span several mbufs, the packet is copied in a single mbuf
+which replaces *mp. nothing global is used, so this is reentrant
+return 1 if the tag list is usable (possibly empty), 0 otherwise
+----------------------------------------------------------------------------- */
+int parse_tags(mbuf_t *mp, struct pppoe_tags *tags)
+{
+    mbuf_t		m = *mp, m1;
+    u_int8_t 		*data;
+    struct pppoe	p_data;
+    u_int16_t 		totallen;
+    unsigned int	chunks = 1;
 
-    //MH_ALIGN(m, sizeof(struct pppoe) + namelen + 4 + servlen + 4);
     data = mbuf_data(m);
+    memcpy(&p_data, data, sizeof(p_data));
+    totallen =  ntohs(p_data.len);
+    tags->present = 0;
 
-    p = &p_data;
-    memcpy(p, data, sizeof(p_data));
-    p->ver = PPPOE_VER;
-    p->typ = PPPOE_TYPE;
-    p->code = code;
-    p->sessid = htons(sessid);
-    p->len = 0;
+    // Prevent buffer overflow - the PPPoE RFC gurantees us a maximum packet size, however, an attacker
+    // might very well produce huge packets.
+    if (totallen > PPPOE_MAX_TAGS_LEN)
+        totallen = PPPOE_MAX_TAGS_LEN;
+
+    if (mbuf_len(m) - sizeof(struct pppoe) < totallen && mbuf_next(m)) {
+        // make the packet contiguous, in a buffer of its own
+        if (mbuf_allocpacket(MBUF_DONTWAIT, sizeof(struct pppoe) + totallen, &chunks, &m1) != 0)
+            return 0;
+        if (mbuf_copydata(m, 0, sizeof(struct pppoe) + totallen, mbuf_data(m1))) {
+            mbuf_freem(m1);
+            return 0;	// shorter than advertised
+        }
+        mbuf_setlen(m1, sizeof(struct pppoe) + totallen);
+        mbuf_pkthdr_setlen(m1, sizeof(struct pppoe) + totallen);
+        mbuf_freem(m);
+        *mp = m = m1;
+        data = mbuf_data(m);
+    }
 
-    data += sizeof(struct pppoe);
+    index_tags(data + sizeof(struct pppoe), MIN(totallen, mbuf_len(m) - sizeof(struct pppoe)), tags);
+    return 1;
+}
 
-    if (service) {
-        len = add_tag(data, PPPOE_TAG_SERVICE_NAME, service);
-        p->len += len;
-        data += len;
-    }
+/* -----------------------------------------------------------------------------
+SipHash-2-4 of data, keyed with the 16 bytes key
+----------------------------------------------------------------------------- */
+#define SIP_ROTL(x, b)	(u_int64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+#define SIP_ROUND					\
+    do {						\
+        v0 += v1; v1 = SIP_ROTL(v1, 13); v1 ^= v0;	\
+        v0 = SIP_ROTL(v0, 32);				\
+        v2 += v3; v3 = SIP_ROTL(v3, 16); v3 ^= v2;	\
+        v0 += v3; v3 = SIP_ROTL(v3, 21); v3 ^= v0;	\
+        v2 += v1; v1 = SIP_ROTL(v1, 17); v1 ^= v2;	\
+        v2 = SIP_ROTL(v2, 32);				\
+    } while (0)
+
+static u_int64_t sip_load64(const u_int8_t *p)
+{
+    u_int64_t	v = 0;
+    int		i;
 
-    if (ac_name) {
-        len = add_tag(data, PPPOE_TAG_AC_NAME, ac_name);
-        p->len += len;
-        data += len;
+    for (i = 7; i >= 0; i--)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+static u_int64_t pppoe_siphash(const u_int8_t *key, const u_int8_t *data, size_t len)
+{
+    u_int64_t	k0 = sip_load64(key), k1 = sip_load64(key + 8);
+    u_int64_t	v0 = k0 ^ 0x736f6d6570736575ULL;
+    u_int64_t	v1 = k1 ^ 0x646f72616e646f6dULL;
+    u_int64_t	v2 = k0 ^ 0x6c7967656e657261ULL;
+    u_int64_t	v3 = k1 ^ 0x7465646279746573ULL;
+    u_int64_t	b = ((u_int64_t)len) << 56, m;
+    size_t	i;
+
+    for (; len >= 8; len -= 8, data += 8) {
+        m = sip_load64(data);
+        v3 ^= m;
+        SIP_ROUND;
+        SIP_ROUND;
+        v0 ^= m;
     }
+    for (i = 0; i < len; i++)
+        b |= ((u_int64_t)data[i]) << (8 * i);
+
+    v3 ^= b;
+    SIP_ROUND;
+    SIP_ROUND;
+    v0 ^= b;
+    v2 ^= 0xff;
+    SIP_ROUND;
+    SIP_ROUND;
+    SIP_ROUND;
+    SIP_ROUND;
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+/* -----------------------------------------------------------------------------
+current cookie epoch, in PPPOE_COOKIE_EPOCH seconds since boot
+----------------------------------------------------------------------------- */
+static u_int32_t pppoe_cookie_epoch(void)
+{
+    struct timeval	tv;
+
+    microuptime(&tv);
+    return (u_int32_t)(tv.tv_sec / PPPOE_COOKIE_EPOCH);
+}
+
+/* -----------------------------------------------------------------------------
+generate the ac-cookie for a client address, for the given epoch
+the cookie binds the client to the time we answered it, so we don't need
+to keep anything around between the PADO and the PADR
+----------------------------------------------------------------------------- */
+void make_cookie(u_int8_t *address, u_int32_t epoch, struct pppoe_tag *cookie)
+{
+    u_int8_t	buf[ETHER_ADDR_LEN + sizeof(u_int32_t)];
+    u_int64_t	h;
+    int		i;
+
+    bcopy(address, buf, ETHER_ADDR_LEN);
+    epoch = htonl(epoch);
+    bcopy(&epoch, buf + ETHER_ADDR_LEN, sizeof(epoch));
+
+    h = pppoe_siphash(pppoe_cookie_key, buf, sizeof(buf));
+    for (i = 0; i < PPPOE_COOKIE_LEN; i++, h >>= 8)
+        cookie->data[i] = h & 0xFF;
+    cookie->len = PPPOE_COOKIE_LEN;
+}
+
+/* -----------------------------------------------------------------------------
+check the ac-cookie echoed by a client
+it must have been generated for this address, in this epoch or the previous one
+return 1 if the cookie is valid, 0 otherwise
+----------------------------------------------------------------------------- */
+int check_cookie(u_int8_t *address, struct pppoe_tag *cookie)
+{
+    PPPOE_TAG(expected, PPPOE_COOKIE_LEN);
+    u_int32_t	epoch = pppoe_cookie_epoch();
+
+    if (cookie->len != PPPOE_COOKIE_LEN)
+        return 0;
+
+    PPPOE_TAG_SETUP(expected);
 
-    if (host_uniq) {
-        len = add_tag(data, PPPOE_TAG_HOST_UNIQ, host_uniq);
-        p->len += len;
-        data += len;
+    make_cookie(address, epoch, &expected);
+    if (!bcmp(expected.data, cookie->data, PPPOE_COOKIE_LEN))
+        return 1;
+
+    make_cookie(address, epoch - 1, &expected);
+    if (!bcmp(expected.data, cookie->data, PPPOE_COOKIE_LEN))
+        return 1;
+
+    return 0;
+}
+
+/* -----------------------------------------------------------------------------
+account a PADI against the per source and per interface budgets
+the source buckets are a small hash, a new source takes over the bucket
+return 1 if the PADI must be dropped
+----------------------------------------------------------------------------- */
+int padi_ratelimit(ifnet_t ifp, u_int8_t *from)
+{
+    struct pppoe_padi_source	*src;
+    u_int32_t			*ifcount;
+    u_int32_t			h;
+    u_int64_t			now = pppoe_rfc_uptime();
+    int				i;
+
+    // new second, new PADI budget
+    if (now >= pppoe_padi_reset) {
+        pppoe_dlil_padi_reset();
+        for (i = 0; i < PPPOE_PADI_SOURCES; i++)
+            pppoe_padi_sources[i].count = 0;
+        pppoe_padi_reset = now + 1000;
     }
 
-    if (ac_cookie) {
-        len = add_tag(data, PPPOE_TAG_AC_COOKIE, ac_cookie);
-        p->len += len;
-        data += len;
+    // the interface budget is kept with the interface entry
+    ifcount = pppoe_dlil_padi_count(ifp);
+    if (ifcount == 0)
+        return 1;
+    if (pppoe_padi_if_rate && *ifcount >= pppoe_padi_if_rate)
+        return 1;
+
+    h = (from[3] << 16) | (from[4] << 8) | from[5];
+    h = (h * 0x9E3779B1) >> 16;
+    src = &pppoe_padi_sources[h & (PPPOE_PADI_SOURCES - 1)];
+    if (bcmp(src->address, from, ETHER_ADDR_LEN)) {
+        bcopy(from, src->address, ETHER_ADDR_LEN);
+        src->count = 0;
     }
+    if (pppoe_padi_source_rate && src->count >= pppoe_padi_source_rate)
+        return 1;
+
+    src->count++;
+    (*ifcount)++;
+    return 0;
+}
+
+/* -----------------------------------------------------------------------------
+RFC 4638 max payload we can offer or ask for on the rfc interface
+0 if the default 1492 bytes must be used
+----------------------------------------------------------------------------- */
+u_int16_t pppoe_rfc_max_payload(struct pppoe_rfc *rfc)
+{
+    u_int16_t	payload;
+
+    if (rfc->max_payload <= PPPOE_MTU || rfc->ifp == 0)
+        return 0;
 
-    if (relay_id) {
-        len = add_tag(data, PPPOE_TAG_RELAY_SESSION_ID, relay_id);
-        p->len += len;
-        data += len;
+    // the ethernet interface must be able to carry it
+    payload = MIN(rfc->max_payload, pppoe_dlil_max_payload(rfc->ifp));
+    return payload > PPPOE_MTU ? payload : 0;
+}
+
+/* -----------------------------------------------------------------------------
+address MUST be a valid ethernet address (6 bytes length)
+----------------------------------------------------------------------------- */
+void send_PAD(struct pppoe_rfc *rfc, u_int8_t *address, u_int16_t code, u_int16_t sessid,
+                     struct pppoe_tag *ac_name, struct pppoe_tag *service,
+                     struct pppoe_tag *host_uniq, struct pppoe_tag *ac_cookie,
+                     struct pppoe_tag *relay_id, u_int16_t max_payload)
+{
+    mbuf_t			m;
+
+    m = make_PAD(code, sessid, ac_name, service, host_uniq, ac_cookie, relay_id, max_payload);
+    if (m)
+        pppoe_rfc_lower_output(rfc, m, address, PPPOE_ETHERTYPE_CTRL);
+}
+
+/* -----------------------------------------------------------------------------
+build a discovery packet
+max_payload is the RFC 4638 PPP-Max-Payload value to advertise, 0 for none
+----------------------------------------------------------------------------- */
+mbuf_t make_PAD(u_int16_t code, u_int16_t sessid,
+                     struct pppoe_tag *ac_name, struct pppoe_tag *service,
+                     struct pppoe_tag *host_uniq, struct pppoe_tag *ac_cookie,
+                     struct pppoe_tag *relay_id, u_int16_t max_payload)
+{
+    mbuf_t			m = 0;
+    u_int32_t 		len;
+    unsigned int	chunks = 1;
+
+    // size the packet first, the tags we echo can be as large as the peer made them
+    len = pad_len(ac_name, service, host_uniq, ac_cookie, relay_id, max_payload);
+    if (len > ETHERMTU) {
+        IOLog("PPPoE make_PAD: discovery packet too large (%d bytes)\n", len);
+        return 0;
     }
 
-    mbuf_setlen(m, sizeof(struct pppoe) + p->len);
-    mbuf_pkthdr_setlen(m, sizeof(struct pppoe) + p->len);
-    p->len = htons(p->len);
-    memcpy(mbuf_data(m), p, sizeof(p_data));
+    // one packet header mbuf with its cluster, in a single allocation
+    if (mbuf_allocpacket(MBUF_WAITOK, len, &chunks, &m) != 0)
+        return 0;
 
-    pppoe_rfc_lower_output(rfc, m, address, PPPOE_ETHERTYPE_CTRL);
+    len = fill_PAD(mbuf_data(m), code, sessid, ac_name, service, host_uniq, ac_cookie, relay_id, max_payload);
+    mbuf_setlen(m, len);
+    mbuf_pkthdr_setlen(m, len);
+
+    return m;
 }
 
 /* -----------------------------------------------------------------------------
 m contains ethernet header and the actual ethernet data
 from MUST be a valid ethernet address (6 bytes length)
 ----------------------------------------------------------------------------- */
-u_int16_t handle_PADI(struct pppoe_rfc *rfc, mbuf_t m, u_int8_t *from)
+u_int16_t handle_PADI(struct pppoe_rfc *rfc, mbuf_t m, u_int8_t *from, struct pppoe_tags *tags)
 {
-    PPPOE_TAG(name, PPPOE_AC_NAME_LEN);
-    PPPOE_TAG(service, PPPOE_SERVICE_LEN);
-    PPPOE_TAG(hostuniq, PPPOE_HOST_UNIQ_LEN);
-    PPPOE_TAG(relay, PPPOE_RELAY_ID_LEN);
+    struct pppoe_tag	name, service, hostuniq, relay;
+    PPPOE_TAG(cookie, PPPOE_COOKIE_LEN);
+    u_int16_t		payload;
 
     if (rfc->state != PPPOE_STATE_LISTENING)
         return 0;
 
-    PPPOE_TAG_SETUP(name);
-    PPPOE_TAG_SETUP(service);
-    PPPOE_TAG_SETUP(hostuniq);
-    PPPOE_TAG_SETUP(relay);
+    PPPOE_TAG_SETUP(cookie);
 
-    get_tag(m, PPPOE_TAG_AC_NAME, &name);
-    get_tag(m, PPPOE_TAG_SERVICE_NAME, &service);
+    get_tag(tags, PPPOE_TAGIDX_AC_NAME, &name);
+    get_tag(tags, PPPOE_TAGIDX_SERVICE_NAME, &service);
 
     if (rfc->flags & PPPOE_FLAG_DEBUG)
-        IOLog("PPPoE receive PADI (%p): requested service\\name = '%.64s\\%.64s', our service\\name = '%.64s\\%.64s'\n",
-        rfc, service.data, name.data, rfc->serv_service.data, rfc->serv_ac_name.data);
+        IOLog("PPPoE receive PADI (%p): requested service\\name = '%.*s\\%.*s', our service\\name = '%.64s\\%.64s'\n",
+        rfc, MIN(service.len, 64), service.data, MIN(name.len, 64), name.data, rfc->serv_service.data, rfc->serv_ac_name.data);
 
     // if the client does not specify any name, we must offer ther service
     // if the client does not specify the service, we still accept it, but don't advertise
@@ -961,12 +1508,21 @@ u_int16_t handle_PADI(struct pppoe_rfc *rfc, mbuf_t m, u_int8_t *from)
     if ((!name.len || !PPPOE_TAG_CMP(name, rfc->serv_ac_name))
         && (!service.len || !PPPOE_TAG_CMP(service, rfc->serv_service))) {
         
-        get_tag(m, PPPOE_TAG_HOST_UNIQ, &hostuniq);
-        get_tag(m, PPPOE_TAG_RELAY_SESSION_ID, &relay);
+        // echoed as is, whatever their size
+        get_tag(tags, PPPOE_TAGIDX_HOST_UNIQ, &hostuniq);
+        get_tag(tags, PPPOE_TAGIDX_RELAY_SESSION_ID, &relay);
+
+        // the ac-cookie is stateless, the PADR will bring it back and we will just check it
+        if (pppoe_ac_cookie)
+            make_cookie(from, pppoe_cookie_epoch(), &cookie);
+
+        // RFC 4638, echo the client max payload only if we can support it
+        payload = accept_max_payload(get_max_payload(tags), pppoe_rfc_max_payload(rfc));
+        if (payload <= PPPOE_MTU)
+            payload = 0;
 
-        // could generate and use ac-cookie, but in that case we would need to change state
-        // do it later...
-        send_PAD(rfc, from, PPPOE_PADO, 0, &rfc->serv_ac_name, service.len ? &service : 0, hostuniq.len ? &hostuniq : 0, 0, relay.len ? &relay : 0);
+        send_PAD(rfc, from, PPPOE_PADO, 0, &rfc->serv_ac_name, service.len ? &service : 0, hostuniq.len ? &hostuniq : 0,
+                 cookie.len ? &cookie : 0, relay.len ? &relay : 0, payload);
         return 1;
     }
 
@@ -977,28 +1533,23 @@ u_int16_t handle_PADI(struct pppoe_rfc *rfc, mbuf_t m, u_int8_t *from)
 m contains ethernet header and the actual ethernet data
 from MUST be a valid ethernet address (6 bytes length)
 ----------------------------------------------------------------------------- */
-u_int16_t handle_PADO(struct pppoe_rfc *rfc, mbuf_t m, u_int8_t *from)
+u_int16_t handle_PADO(struct pppoe_rfc *rfc, mbuf_t m, u_int8_t *from, struct pppoe_tags *tags)
 {
-    PPPOE_TAG(name, PPPOE_AC_NAME_LEN);
-    PPPOE_TAG(service, PPPOE_SERVICE_LEN);
-    PPPOE_TAG(hostuniq, PPPOE_HOST_UNIQ_LEN);
+    struct pppoe_tag	name, service, hostuniq;
+    u_int64_t		now;
 
     if (rfc->state != PPPOE_STATE_LOOKING)
         return 0;
 
-    PPPOE_TAG_SETUP(name);
-    PPPOE_TAG_SETUP(service);
-    PPPOE_TAG_SETUP(hostuniq);
-
-    get_tag(m, PPPOE_TAG_AC_NAME, &name);
-    get_tag(m, PPPOE_TAG_SERVICE_NAME, &service);
+    get_tag(tags, PPPOE_TAGIDX_AC_NAME, &name);
+    get_tag(tags, PPPOE_TAGIDX_SERVICE_NAME, &service);
 
     if (rfc->flags & PPPOE_FLAG_DEBUG)
-        IOLog("PPPoE receive PADO (%p): offered service\\name = '%.64s\\%.64s', expected service\\name = '%.64s\\%.64s'\n",
-        rfc, service.data, name.data, rfc->service.data, rfc->ac_name.data);
+        IOLog("PPPoE receive PADO (%p): offered service\\name = '%.*s\\%.*s', expected service\\name = '%.64s\\%.64s'\n",
+        rfc, MIN(service.len, 64), service.data, MIN(name.len, 64), name.data, rfc->service.data, rfc->ac_name.data);
 
     // since we sent PPPOE_TAG_HOST_UNIQ in our PADI, the tag MUST be present in this PADO
-    get_tag(m, PPPOE_TAG_HOST_UNIQ, &hostuniq);
+    get_tag(tags, PPPOE_TAGIDX_HOST_UNIQ, &hostuniq);
 
     // the connecting rfc is identified by our host_uniq value
     // check if the ac-name and ac-service match our expectations
@@ -1007,8 +1558,12 @@ u_int16_t handle_PADO(struct pppoe_rfc *rfc, mbuf_t m, u_int8_t *from)
         && (!rfc->ac_name.len || !PPPOE_TAG_CMP(name, rfc->ac_name))
         && (!rfc->service.len || !PPPOE_TAG_CMP(service, rfc->service)) ) {
 #endif
-        get_tag(m, PPPOE_TAG_AC_COOKIE, &rfc->ac_cookie);
-        get_tag(m, PPPOE_TAG_RELAY_SESSION_ID, &rfc->relay_id);
+        if (!copy_tag(tags, PPPOE_TAGIDX_AC_COOKIE, &rfc->ac_cookie)
+            || !copy_tag(tags, PPPOE_TAGIDX_RELAY_SESSION_ID, &rfc->relay_id)) {
+            if (rfc->flags & PPPOE_FLAG_DEBUG)
+                IOLog("PPPoE receive PADO (%p): ac-cookie or relay-session-id too long, offer ignored\n", rfc);
+            return 1;
+        }
         
         bcopy(from, rfc->peer_address, ETHER_ADDR_LEN);
 
@@ -1019,15 +1574,19 @@ u_int16_t handle_PADO(struct pppoe_rfc *rfc, mbuf_t m, u_int8_t *from)
 			return 1;
 		}
 		
-        // resend PADI/PADR every PPPOE_TIMEOUT_RETRY seconds
-        rfc->timer_connect_resend = rfc->timer_connect - rfc->timer_retry_setup;
-
         send_PAD(rfc, rfc->peer_address, PPPOE_PADR, 0, 
                 rfc->ac_name.len ? &rfc->ac_name : 0, &rfc->service,
                 &rfc->host_uniq, 
                 rfc->ac_cookie.len ? &rfc->ac_cookie : 0, 
-                rfc->relay_id.len ? &rfc->relay_id : 0);
-        rfc->state = PPPOE_STATE_CONNECTING;
+                rfc->relay_id.len ? &rfc->relay_id : 0,
+                pppoe_rfc_max_payload(rfc));
+        pppoe_rfc_set_state(rfc, PPPOE_STATE_CONNECTING);
+
+        // the PADR phase starts, resend it with backoff from the retry timer again
+        now = pppoe_rfc_uptime();
+        rfc->stats.pado_latency = now - rfc->phase_start;
+        rfc->stats.padr_sent++;
+        pppoe_rfc_retry_start(rfc, now);
         return 1;
 #ifndef PPPENET_COMPAT
     }
@@ -1039,36 +1598,56 @@ u_int16_t handle_PADO(struct pppoe_rfc *rfc, mbuf_t m, u_int8_t *from)
 m contains ethernet header and the actual ethernet data
 from MUST be a valid ethernet address (6 bytes length)
 ----------------------------------------------------------------------------- */
-u_int16_t handle_PADR(struct pppoe_rfc *rfc, mbuf_t m, u_int8_t *from)
+u_int16_t handle_PADR(struct pppoe_rfc *rfc, mbuf_t m, u_int8_t *from, struct pppoe_tags *tags)
 {
-    PPPOE_TAG(name, PPPOE_AC_NAME_LEN);
-    PPPOE_TAG(service, PPPOE_SERVICE_LEN);
+    struct pppoe_tag	name, service, cookie;
     
     if (rfc->state != PPPOE_STATE_LISTENING)
         return 0;
 
-    PPPOE_TAG_SETUP(name);
-    PPPOE_TAG_SETUP(service);
-
-    get_tag(m, PPPOE_TAG_AC_NAME, &name);
-    get_tag(m, PPPOE_TAG_SERVICE_NAME, &service);
+    get_tag(tags, PPPOE_TAGIDX_AC_NAME, &name);
+    get_tag(tags, PPPOE_TAGIDX_SERVICE_NAME, &service);
     
     if (rfc->flags & PPPOE_FLAG_DEBUG)
-        IOLog("PPPoE receive PADR (%p): requested service\\name = '%.64s\\%.64s', our service\\name = '%.64s\\%.64s'\n", rfc, service.data, name.data, rfc->serv_service.data, rfc->serv_ac_name.data);
+        IOLog("PPPoE receive PADR (%p): requested service\\name = '%.*s\\%.*s', our service\\name = '%.64s\\%.64s'\n", rfc, MIN(service.len, 64), service.data, MIN(name.len, 64), name.data, rfc->serv_service.data, rfc->serv_ac_name.data);
 
     // if the client does not specify any name, we must offer ther service
     // if the client does not specify the service, still accept it ?
     if ((!name.len || !PPPOE_TAG_CMP(name, rfc->serv_ac_name))
         && (!service.len || !PPPOE_TAG_CMP(service, rfc->serv_service))) {
         
+        // the client must echo the ac-cookie from our PADO, and it must be recent
+        // a bad one is dropped silently, other listeners would refuse it as well
+        if (pppoe_ac_cookie) {
+            get_tag(tags, PPPOE_TAGIDX_AC_COOKIE, &cookie);
+            if (!check_cookie(from, &cookie)) {
+                pppoe_padr_dropped++;
+                if (rfc->flags & PPPOE_FLAG_DEBUG)
+                    IOLog("PPPoE receive PADR (%p): invalid ac-cookie from %x:%x:%x:%x:%x:%x\n", rfc,
+                        from[0], from[1], from[2], from[3], from[4], from[5]);
+                return 1;
+            }
+            pppoe_padr_accepted++;
+        }
+
+        if (!copy_tag(tags, PPPOE_TAGIDX_HOST_UNIQ, &rfc->host_uniq)
+            || !copy_tag(tags, PPPOE_TAGIDX_RELAY_SESSION_ID, &rfc->relay_id)) {
+            pppoe_padr_dropped++;
+            if (rfc->flags & PPPOE_FLAG_DEBUG)
+                IOLog("PPPoE receive PADR (%p): host-uniq or relay-session-id too long from %x:%x:%x:%x:%x:%x\n", rfc,
+                    from[0], from[1], from[2], from[3], from[4], from[5]);
+            return 1;
+        }
+
         bcopy(from, rfc->peer_address, ETHER_ADDR_LEN);
-        
-        get_tag(m, PPPOE_TAG_HOST_UNIQ, &rfc->host_uniq);
-        get_tag(m, PPPOE_TAG_RELAY_SESSION_ID, &rfc->relay_id);
+
+        // RFC 4638, accept the client max payload if we can support it, the PADS will confirm it
+        rfc->payload = accept_max_payload(get_max_payload(tags), pppoe_rfc_max_payload(rfc));
 
         // change the state, so there is no other client trying to call...
-        rfc->timer_ring = rfc->timer_ring_setup;
-        rfc->state = PPPOE_STATE_RINGING;
+        pppoe_rfc_set_state(rfc, PPPOE_STATE_RINGING);
+        rfc->timer_abort = pppoe_rfc_uptime() + rfc->timer_ring_setup * 1000;
+        pppoe_rfc_timer_schedule(rfc);
         send_event(rfc, PPPOE_EVT_RINGING, 0);
 
         // only ring to the first client that matches...
@@ -1082,9 +1661,9 @@ u_int16_t handle_PADR(struct pppoe_rfc *rfc, mbuf_t m, u_int8_t *from)
 m contains ethernet header and the actual ethernet data
 from MUST be a valid ethernet address (6 bytes length)
 ----------------------------------------------------------------------------- */
-u_int16_t handle_PADS(struct pppoe_rfc *rfc, mbuf_t m, u_int8_t *from)
+u_int16_t handle_PADS(struct pppoe_rfc *rfc, mbuf_t m, u_int8_t *from, struct pppoe_tags *tags)
 {
-    PPPOE_TAG(hostuniq, PPPOE_HOST_UNIQ_LEN);
+    struct pppoe_tag	hostuniq;
     struct pppoe 	p_data;
     u_int16_t		sessid;
 
@@ -1094,13 +1673,11 @@ u_int16_t handle_PADS(struct pppoe_rfc *rfc, mbuf_t m, u_int8_t *from)
     if (rfc->state != PPPOE_STATE_CONNECTING)
         return 0;
 
-    PPPOE_TAG_SETUP(hostuniq);
-
     if (rfc->flags & PPPOE_FLAG_DEBUG)
         IOLog("PPPoE receive PADS (%p): session id = 0x%x\n", rfc, sessid);
 
     // since we sent PPPOE_TAG_HOST_UNIQ in our PADR, the tag MUST be present in this PADS
-    get_tag(m, PPPOE_TAG_HOST_UNIQ, &hostuniq);
+    get_tag(tags, PPPOE_TAGIDX_HOST_UNIQ, &hostuniq);
 
     // the connecting rfc is identified by our host_uniq value
 #ifndef PPPENET_COMPAT
@@ -1110,8 +1687,13 @@ u_int16_t handle_PADS(struct pppoe_rfc *rfc, mbuf_t m, u_int8_t *from)
         ) {
 #endif
 //        bcopy(from, rfc->peer_address, ETHER_ADDR_LEN);
-        rfc->state = PPPOE_STATE_CONNECTED;
+        // RFC 4638, the larger payload can only be used if the server confirmed it
+        rfc->payload = confirmed_max_payload(get_max_payload(tags), pppoe_rfc_max_payload(rfc));
+        if (rfc->flags & PPPOE_FLAG_DEBUG)
+            IOLog("PPPoE receive PADS (%p): max payload = %d\n", rfc, rfc->payload);
         rfc->session_id = sessid;
+        rfc->stats.pads_latency = pppoe_rfc_uptime() - rfc->phase_start;
+        pppoe_rfc_set_state(rfc, PPPOE_STATE_CONNECTED);
         send_event(rfc, PPPOE_EVT_CONNECTED, 0);
 
         return 1;
@@ -1125,7 +1707,7 @@ u_int16_t handle_PADS(struct pppoe_rfc *rfc, mbuf_t m, u_int8_t *from)
 m contains ethernet header and the actual ethernet data
 from MUST be a valid ethernet address (6 bytes length)
 ----------------------------------------------------------------------------- */
-u_int16_t handle_PADT(struct pppoe_rfc *rfc, mbuf_t m, u_int8_t *from)
+u_int16_t handle_PADT(struct pppoe_rfc *rfc, mbuf_t m, u_int8_t *from, struct pppoe_tags *tags)
 {
     struct pppoe 	p_data;
     u_int16_t 		sessid;
@@ -1141,7 +1723,7 @@ u_int16_t handle_PADT(struct pppoe_rfc *rfc, mbuf_t m, u_int8_t *from)
 
     if ((sessid == rfc->session_id) && !bcmp(rfc->peer_address, from, ETHER_ADDR_LEN)) {
 
-        rfc->state = PPPOE_STATE_DISCONNECTED;
+        pppoe_rfc_set_state(rfc, PPPOE_STATE_DISCONNECTED);
         bzero(rfc->peer_address, sizeof(rfc->peer_address));
         send_event(rfc, PPPOE_EVT_DISCONNECTED, 0);
 
@@ -1153,7 +1735,7 @@ u_int16_t handle_PADT(struct pppoe_rfc *rfc, mbuf_t m, u_int8_t *from)
 
 /* -----------------------------------------------------------------------------
 ----------------------------------------------------------------------------- */
-u_int16_t handle_ctrl(struct pppoe_rfc *rfc, mbuf_t m, u_int8_t *from)
+u_int16_t handle_ctrl(struct pppoe_rfc *rfc, mbuf_t m, u_int8_t *from, struct pppoe_tags *tags)
 {
     struct pppoe 	*p = mbuf_data(m);
     u_int16_t 		done = 0;
@@ -1162,19 +1744,19 @@ u_int16_t handle_ctrl(struct pppoe_rfc *rfc, mbuf_t m, u_int8_t *from)
 
     switch (p->code) { 		// no alignment issue as p->code is u_int8_t.
        case PPPOE_PADI:
-            done = handle_PADI(rfc, m, from);
+            done = handle_PADI(rfc, m, from, tags);
             break;
         case PPPOE_PADO:
-            done = handle_PADO(rfc, m, from);
+            done = handle_PADO(rfc, m, from, tags);
             break;
         case PPPOE_PADR:
-            done = handle_PADR(rfc, m, from);
+            done = handle_PADR(rfc, m, from, tags);
             break;
         case PPPOE_PADS:
-            done = handle_PADS(rfc, m, from);
+            done = handle_PADS(rfc, m, from, tags);
             break;
        case PPPOE_PADT:
-            done = handle_PADT(rfc, m, from);
+            done = handle_PADT(rfc, m, from, tags);
             break;
     }
 
@@ -1206,27 +1788,7 @@ u_int16_t handle_data(struct pppoe_rfc *rfc, mbuf_t m, u_int8_t *from)
         && (rfc->session_id == sessid)
         && !bcmp(rfc->peer_address, from, ETHER_ADDR_LEN)) {
 
-        // adjust the packet length
-        // don't only use the m_adj function, because the packet we get here is a etherneet packet
-        // and ethernet packet have a minimum size of 64 bytes.
-        // i.e when getting small packets, mbuf still has at least 64 bytes.
-        // so we need to adjust the len accrding to the len field from the pppoe header
-        // should do something safer, in case first buffer smaller than 6 bytes ???
-
-        if (mbuf_next(m))
-			mbuf_setlen(m, mbuf_len(m) - sizeof(struct pppoe));
-        else
-			mbuf_setlen(m, ntohs(p_data.len));
-        if (mbuf_setdata(m, mbuf_data(m) + sizeof(struct pppoe), mbuf_len(m))) {
-			IOLog("pppoe_rfc_output: failed mbuf_setdata\n");
-            mbuf_freem(m);
-            return 1;
-        }
-		mbuf_pkthdr_setlen(m, ntohs(p_data.len));
-
-        // packet is passed up to the host
-        if (rfc->inputcb)
-                (*rfc->inputcb)(rfc->host, m);
+        deliver_data(rfc, m);
 
         // let's say the packet have been treated
         return 1;
@@ -1236,6 +1798,39 @@ u_int16_t handle_data(struct pppoe_rfc *rfc, mbuf_t m, u_int8_t *from)
     return 0;
 }
 
+/* -----------------------------------------------------------------------------
+strip the pppoe header and pass the packet up to the host
+the session has already been identified
+----------------------------------------------------------------------------- */
+void deliver_data(struct pppoe_rfc *rfc, mbuf_t m)
+{
+    struct pppoe 	p_data;
+
+    memcpy(&p_data, mbuf_data(m), sizeof(p_data));
+
+    // adjust the packet length
+    // don't only use the m_adj function, because the packet we get here is a etherneet packet
+    // and ethernet packet have a minimum size of 64 bytes.
+    // i.e when getting small packets, mbuf still has at least 64 bytes.
+    // so we need to adjust the len accrding to the len field from the pppoe header
+    // should do something safer, in case first buffer smaller than 6 bytes ???
+
+    if (mbuf_next(m))
+        mbuf_setlen(m, mbuf_len(m) - sizeof(struct pppoe));
+    else
+        mbuf_setlen(m, ntohs(p_data.len));
+    if (mbuf_setdata(m, mbuf_data(m) + sizeof(struct pppoe), mbuf_len(m))) {
+        IOLog("pppoe_rfc_output: failed mbuf_setdata\n");
+        mbuf_freem(m);
+        return;
+    }
+    mbuf_pkthdr_setlen(m, ntohs(p_data.len));
+
+    // packet is passed up to the host
+    if (rfc->inputcb)
+        (*rfc->inputcb)(rfc->host, m);
+}
+
 /* -----------------------------------------------------------------------------
 called from pppoe_rfc when data need to be sent
 ----------------------------------------------------------------------------- */
@@ -1271,48 +1866,210 @@ void pppoe_rfc_lower_output(struct pppoe_rfc *rfc, mbuf_t m, u_int8_t *to, u_int
 
 /* -----------------------------------------------------------------------------
 called from pppoe_dlil when pppoe data are present
+data frames and PADT go straight to their session through the session hash,
+the other discovery frames are offered to the rfcs discovering on the interface
 ----------------------------------------------------------------------------- */
 void pppoe_rfc_lower_input(ifnet_t ifp, mbuf_t m, u_int8_t *from, u_int16_t typ)
 {
     struct pppoe_rfc  	*rfc, *lastrfc = 0;
+    struct pppoe	p_data;
+    struct pppoe_tags	tags;
     
     //IOLog("PPPoE inputdata, tag = %d\n", dl_tag);
 	
 	lck_mtx_assert(ppp_domain_mutex, LCK_MTX_ASSERT_OWNED);
 
-    TAILQ_FOREACH(rfc, &pppoe_rfc_head, next) {
-        // we use dl_tag because we only respond to the peer on the same interface
-        if (rfc->ifp == ifp) {
+    if (mbuf_len(m) < sizeof(struct pppoe)) {
+        // packet too short
+        mbuf_freem(m);
+        return;
+    }
+
+    memcpy(&p_data, mbuf_data(m), sizeof(p_data));
+    tags.present = 0;
 
-            if (pppoe_rfc_input(rfc, m, from, typ))
+    if (typ == PPPOE_ETHERTYPE_DATA
+        || (typ == PPPOE_ETHERTYPE_CTRL && p_data.code == PPPOE_PADT)) {
+        
+        rfc = pppoe_rfc_session_lookup(ifp, ntohs(p_data.sessid), from);
+        if (rfc) {
+            if (typ == PPPOE_ETHERTYPE_DATA) {
+                deliver_data(rfc, m);
+                return;
+            }
+            if (handle_ctrl(rfc, m, from, &tags))
+                return;
+        }
+    }
+    else {
+        // PADI are broadcast by anybody, don't let a flood reach the listeners
+        if (typ == PPPOE_ETHERTYPE_CTRL && p_data.code == PPPOE_PADI) {
+            if (padi_ratelimit(ifp, from)) {
+                pppoe_padi_dropped++;
+                mbuf_freem(m);
                 return;
-                
-            lastrfc = rfc;
+            }
+            pppoe_padi_accepted++;
+        }
+
+        // index the tags once for all the listeners
+        if (typ == PPPOE_ETHERTYPE_CTRL && !parse_tags(&m, &tags)) {
+            IOLog("PPPoE inputdata: malformed control packet on unit = %d\n", ifnet_unit(ifp));
+            mbuf_freem(m);
+            return;
+        }
+
+        TAILQ_FOREACH(rfc, &pppoe_discovery_hash[pppoe_rfc_discovery_hash(ifp)], demux_next) {
+            // we only respond to the peer on the same interface
+            if (rfc->ifp == ifp) {
+
+                if (pppoe_rfc_input(rfc, m, from, typ, &tags))
+                    return;
+                    
+                lastrfc = rfc;
+            }
         }
     }
 
     // the last matching rfc itself is irrelevant, just need unit number and tag information
     
     IOLog("PPPoE inputdata: unexpected %s packet on unit = %d\n", 
-        (typ == PPPOE_ETHERTYPE_CTRL ? "control" : "data"), lastrfc ? lastrfc->unit : -1);
+        (typ == PPPOE_ETHERTYPE_CTRL ? "control" : "data"), ifnet_unit(ifp));
         
     if (typ == PPPOE_ETHERTYPE_DATA) {
         // in case of PPPOE_ETHERTYPE_DATA, send a PADT to the peer
         // trying to talk to us with an incorrect session id
-        struct pppoe	p_data;
-        u_int16_t	sessid;
-
-	memcpy(&p_data, mbuf_data(m), sizeof(p_data));
-	sessid = ntohs(p_data.sessid);
+        // always go through one of our clients on the interface, like the other
+        // control packets, so that its loopback mode is honored.
+        // this is the error path, any client will do, connected ones included
+        if (lastrfc == 0) {
+            TAILQ_FOREACH(rfc, &pppoe_rfc_head, next) {
+                if (rfc->ifp == ifp) {
+                    lastrfc = rfc;
+                    break;
+                }
+            }
+        }
 
         if (lastrfc)
-            send_PAD(lastrfc, from, PPPOE_PADT, sessid, 0, 0, 0, 0, 0);
+            send_PAD(lastrfc, from, PPPOE_PADT, ntohs(p_data.sessid), 0, 0, 0, 0, 0, 0);
     }
     
     // nobody was intersted in the packet, just ignore it
     mbuf_freem(m);
 }
 
+/* -----------------------------------------------------------------------------
+called from pppoe_dlil with a chain of packets received on the interface
+session data are sorted per session and delivered a session at a time,
+consecutive packets of a session skip the hash lookup.
+everything else goes through pppoe_rfc_lower_input, after the data gathered
+so far, to keep the order seen on the wire
+----------------------------------------------------------------------------- */
+void pppoe_rfc_lower_input_chain(ifnet_t ifp, mbuf_t m)
+{
+    struct pppoe_input_batch	batch[PPPOE_INPUT_BATCH];
+    struct pppoe_rfc		*rfc, *lastrfc = 0;
+    struct ether_header		*eh;
+    struct pppoe		p_data;
+    mbuf_t			next;
+    u_int16_t			typ;
+    int				count = 0, i = 0;
+
+	lck_mtx_assert(ppp_domain_mutex, LCK_MTX_ASSERT_OWNED);
+
+    for (; m; m = next) {
+
+        next = mbuf_nextpkt(m);
+        mbuf_setnextpkt(m, 0);
+
+        eh = (struct ether_header *)mbuf_pkthdr_header(m);
+        typ = ntohs(eh->ether_type);
+
+        if (typ == PPPOE_ETHERTYPE_DATA && mbuf_len(m) >= sizeof(struct pppoe)) {
+
+            memcpy(&p_data, mbuf_data(m), sizeof(p_data));
+
+            // same session as the previous packet, i still points to its entry
+            rfc = lastrfc;
+            if (rfc == 0
+                || rfc->session_id != ntohs(p_data.sessid)
+                || bcmp(rfc->peer_address, eh->ether_shost, ETHER_ADDR_LEN)) {
+
+                rfc = pppoe_rfc_session_lookup(ifp, ntohs(p_data.sessid), eh->ether_shost);
+                if (rfc) {
+                    for (i = 0; i < count; i++)
+                        if (batch[i].rfc == rfc)
+                            break;
+                    if (i == PPPOE_INPUT_BATCH) {
+                        // the delivery can drop the lock, rfc must be looked up again
+                        deliver_batch(ifp, batch, &count);
+                        lastrfc = 0;
+                        i = 0;
+                        rfc = pppoe_rfc_session_lookup(ifp, ntohs(p_data.sessid), eh->ether_shost);
+                    }
+                    if (rfc && i == count) {
+                        batch[i].rfc = rfc;
+                        batch[i].sessid = ntohs(p_data.sessid);
+                        bcopy(eh->ether_shost, batch[i].from, ETHER_ADDR_LEN);
+                        batch[i].head = 0;
+                        count++;
+                    }
+                }
+            }
+
+            if (rfc) {
+                if (batch[i].head)
+                    mbuf_setnextpkt(batch[i].tail, m);
+                else
+                    batch[i].head = m;
+                batch[i].tail = m;
+                lastrfc = rfc;
+                continue;
+            }
+        }
+
+        // control or unknown session, may change the sessions, flush first
+        deliver_batch(ifp, batch, &count);
+        lastrfc = 0;
+        pppoe_rfc_lower_input(ifp, m, eh->ether_shost, typ);
+    }
+
+    deliver_batch(ifp, batch, &count);
+}
+
+/* -----------------------------------------------------------------------------
+deliver the session data gathered by pppoe_rfc_lower_input_chain
+the upper layers drop ppp_domain_mutex around the stack input, a session can
+be freed meanwhile. after a demux generation change, the rfc is looked up
+again from its key before the next packet, packets of a gone session are freed
+----------------------------------------------------------------------------- */
+void deliver_batch(ifnet_t ifp, struct pppoe_input_batch *batch, int *count)
+{
+    struct pppoe_rfc	*rfc;
+    mbuf_t		m, next;
+    u_int32_t		gen = pppoe_demux_gen, rfcgen;
+    int			i;
+
+    for (i = 0; i < *count; i++) {
+        rfc = batch[i].rfc;
+        rfcgen = gen;
+        for (m = batch[i].head; m; m = next) {
+            next = mbuf_nextpkt(m);
+            mbuf_setnextpkt(m, 0);
+            if (rfcgen != pppoe_demux_gen) {
+                rfc = pppoe_rfc_session_lookup(ifp, batch[i].sessid, batch[i].from);
+                rfcgen = pppoe_demux_gen;
+            }
+            if (rfc)
+                deliver_data(rfc, m);
+            else
+                mbuf_freem(m);
+        }
+    }
+    *count = 0;
+}
+
 /* -----------------------------------------------------------------------------
 calls when the lower layer is detaching
 ----------------------------------------------------------------------------- */
@@ -1327,13 +2084,14 @@ void pppoe_rfc_lower_detaching(ifnet_t ifp)
             if (rfc->flags & PPPOE_FLAG_DEBUG)
                 IOLog("PPPoE lower layer detaching (%p): ethernet unit = %d\n", rfc, rfc->unit);
         
+            pppoe_rfc_unlink(rfc);
             pppoe_dlil_detach(rfc->ifp);
             rfc->ifp = 0;
             rfc->unit = 0xFFFF;
         
             if (rfc->state != PPPOE_STATE_DISCONNECTED) {
         
-                rfc->state = PPPOE_STATE_DISCONNECTED;
+                pppoe_rfc_set_state(rfc, PPPOE_STATE_DISCONNECTED);
                 bzero(rfc->peer_address, sizeof(rfc->peer_address));
                 send_event(rfc, PPPOE_EVT_DISCONNECTED, ENXIO);
             }
@@ -26,7 +26,7 @@
 #ifndef __PPPOE_RFC_H__
 #define __PPPOE_RFC_H__
 
-#define PPPOE_MTU	1492
+#define PPPOE_TIMER_HZ	10		/* timer ticks per second - 100 ms resolution */
 
 enum {
     PPPOE_STATE_DISCONNECTED = 0,
@@ -58,7 +58,10 @@ enum {
     PPPOE_CMD_SETPEERADDR,	// set peer ethernet address
     PPPOE_CMD_GETPEERADDR,	// get peer ethernet address
     PPPOE_CMD_SETRETRYTIMER, 	// set ring timer
-    PPPOE_CMD_GETRETRYTIMER 	// get ring timer
+    PPPOE_CMD_GETRETRYTIMER, 	// get ring timer
+    PPPOE_CMD_SETMAXPAYLOAD,	// set RFC 4638 max payload to negotiate
+    PPPOE_CMD_GETMAXPAYLOAD,	// get max payload negotiated for the session
+    PPPOE_CMD_GETDISCOVERYSTATS	// get discovery counters of the last outgoing call
 };
 
 typedef void (*pppoe_rfc_event_callback)(void *data, u_int32_t event, u_int32_t msg);
@@ -83,12 +86,13 @@ u_int16_t pppoe_rfc_accept(void *data);
 void pppoe_rfc_clone(void *data1, void *data2);
 u_int16_t pppoe_rfc_command(void *userdata, u_int32_t cmd, void *cmddata);
 
-void pppoe_rfc_timer(void);
+u_int32_t pppoe_rfc_timer(void);
 
 u_int16_t pppoe_rfc_output(void *data, mbuf_t m);
 
 // callback from dlil layer
 void pppoe_rfc_lower_input(ifnet_t ifp, mbuf_t m, u_int8_t *from, u_int16_t typ);
+void pppoe_rfc_lower_input_chain(ifnet_t ifp, mbuf_t m);
 void pppoe_rfc_lower_detaching(ifnet_t ifp);
 
 
@@ -0,0 +1,308 @@
+/*
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+#ifndef __PPPOE_TAGS_H__
+#define __PPPOE_TAGS_H__
+
+/*
+ * discovery packets construction and parsing.
+ * everything works on the caller buffers, nothing global is used,
+ * so discovery for several interfaces can build and parse frames at once.
+ * the includer provides memcpy, htons and ntohs.
+ */
+
+#define PPPOE_MTU	1492		/* payload without RFC 4638 */
+
+#define PPPOE_VER 	1
+#define PPPOE_TYPE	1
+
+#define PPPOE_PADI	0x9
+#define PPPOE_PADO	0x7
+#define PPPOE_PADR	0x19
+#define PPPOE_PADS	0x65
+#define PPPOE_PADT	0xa7
+
+#define PPPOE_TAG_END_OF_LIST		0x0000
+#define PPPOE_TAG_SERVICE_NAME		0x0101
+#define PPPOE_TAG_AC_NAME		0x0102
+#define PPPOE_TAG_HOST_UNIQ		0x0103
+#define PPPOE_TAG_AC_COOKIE		0x0104
+#define PPPOE_TAG_VENDOR_SPECIFIC	0x0105
+#define PPPOE_TAG_RELAY_SESSION_ID	0x0110
+#define PPPOE_TAG_PPP_MAX_PAYLOAD	0x0120	// RFC 4638
+#define PPPOE_TAG_SERVICE_NAME_ERROR	0x0201
+#define PPPOE_TAG_AC_SYSTEM_ERROR	0x0202
+#define PPPOE_TAG_GENERIC_ERROR		0x0203
+
+struct pppoe {
+    u_int8_t ver:4;
+    u_int8_t typ:4;
+    u_int8_t code;
+    u_int16_t sessid;
+    u_int16_t len;
+};
+
+// a pppoe_tag is basically a buffer with information how much data it contains
+// right now, and how much space it provides in total.
+struct pppoe_tag {
+    u_int16_t	len;		/* data length */
+    u_int16_t	max_len;	/* buffer size */
+    u_int8_t	*data;		/* pointer to actual data */
+};
+
+// discovery tags we look at, index in the pppoe_tags table
+enum {
+    PPPOE_TAGIDX_SERVICE_NAME = 0,
+    PPPOE_TAGIDX_AC_NAME,
+    PPPOE_TAGIDX_HOST_UNIQ,
+    PPPOE_TAGIDX_AC_COOKIE,
+    PPPOE_TAGIDX_RELAY_SESSION_ID,
+    PPPOE_TAGIDX_PPP_MAX_PAYLOAD,
+    PPPOE_TAGIDX_MAX
+};
+
+// tags of a discovery packet, indexed in a single pass over the packet.
+// offsets are relative to data, which points either in the packet itself
+// or in a contiguous copy when the packet spans several mbufs
+struct pppoe_tags {
+    u_int8_t	*data;			/* start of the tag list */
+    u_int16_t	present;		/* bit set for each tag found */
+    struct {
+        u_int16_t	off;		/* offset of the tag value */
+        u_int16_t	len;		/* length of the tag value */
+    } tag[PPPOE_TAGIDX_MAX];
+};
+
+/* -----------------------------------------------------------------------------
+index the totallen bytes of tags at data, in a single pass
+lengths are validated here, the handlers can then use the tags without
+walking the packet again. only the first occurence of a tag is kept
+----------------------------------------------------------------------------- */
+static __inline__ void index_tags(u_int8_t *data, u_int16_t totallen, struct pppoe_tags *tags)
+{
+    u_int16_t 	tag, len, off;
+    int		idx;
+
+    tags->data = data;
+    tags->present = 0;
+    for (off = 0; totallen - off >= 4; off += 4 + len) {
+
+        memcpy(&tag, data + off, sizeof(tag));
+        memcpy(&len, data + off + 2, sizeof(len));
+        tag = ntohs(tag);
+        len = ntohs(len);
+        if ((len + 4) > (totallen - off))
+            break;	// bogus packet, keep the tags we have so far
+
+        if (tag == PPPOE_TAG_END_OF_LIST)
+            break;
+
+        switch (tag) {
+            case PPPOE_TAG_SERVICE_NAME:	idx = PPPOE_TAGIDX_SERVICE_NAME; break;
+            case PPPOE_TAG_AC_NAME:		idx = PPPOE_TAGIDX_AC_NAME; break;
+            case PPPOE_TAG_HOST_UNIQ:		idx = PPPOE_TAGIDX_HOST_UNIQ; break;
+            case PPPOE_TAG_AC_COOKIE:		idx = PPPOE_TAGIDX_AC_COOKIE; break;
+            case PPPOE_TAG_RELAY_SESSION_ID:	idx = PPPOE_TAGIDX_RELAY_SESSION_ID; break;
+            case PPPOE_TAG_PPP_MAX_PAYLOAD:	idx = PPPOE_TAGIDX_PPP_MAX_PAYLOAD; break;
+            default:				continue;
+        }
+
+        if (tags->present & (1 << idx))
+            continue;
+        tags->present |= 1 << idx;
+        tags->tag[idx].off = off + 4;
+        tags->tag[idx].len = len;
+    }
+}
+
+/* -----------------------------------------------------------------------------
+get a view of the tag, pointing in the packet. nothing is copied.
+the view is not null terminated, and is only valid as long as the packet is
+return 1 if the tag was found, 0 otherwise (val is then empty)
+----------------------------------------------------------------------------- */
+static __inline__ u_int16_t get_tag(struct pppoe_tags *tags, int idx, struct pppoe_tag *val)
+{
+    if (!(tags->present & (1 << idx))) {
+        val->data = (u_int8_t *)"";
+        val->len = val->max_len = 0;
+        return 0;
+    }
+
+    val->data = tags->data + tags->tag[idx].off;
+    val->len = val->max_len = tags->tag[idx].len;
+    return 1;
+}
+
+/* -----------------------------------------------------------------------------
+copy the value of the tag, for the tags we need to keep after the packet is gone
+maxlen contains the max size of name (including null terminator)
+return 0 if the tag is present but does not fit with maxlen, 1 otherwise.
+the tags we keep are echoed to the peer, so a truncated or missing value
+would only get the connection refused later: the packet must be rejected.
+----------------------------------------------------------------------------- */
+static __inline__ u_int16_t copy_tag(struct pppoe_tags *tags, int idx, struct pppoe_tag *val)
+{
+    u_int16_t	len;
+
+    val->len = 0;
+    if (!(tags->present & (1 << idx)))
+        return 1;
+
+    len = tags->tag[idx].len;
+    if (len > val->max_len)
+        return 0;
+
+    memcpy(val->data, tags->data + tags->tag[idx].off, len);
+    val->len = len;
+    if (val->len < val->max_len)
+        val->data[val->len] = 0;
+    return 1;
+}
+
+/* -----------------------------------------------------------------------------
+add a tag to the data, return the len added
+----------------------------------------------------------------------------- */
+static __inline__ u_int16_t add_tag(u_int8_t *data, u_int16_t tag, struct pppoe_tag *val)
+{
+    u_int16_t	val16;
+
+    val16 = htons(tag);
+    memcpy(data, &val16, sizeof(val16));
+    val16 = htons(val->len);
+    memcpy(data + 2, &val16, sizeof(val16));
+    memcpy(data + 4, val->data, val->len);
+
+    return (val->len + 4);
+}
+
+/* -----------------------------------------------------------------------------
+size of a discovery packet, pppoe header included
+max_payload is the RFC 4638 PPP-Max-Payload value to advertise, 0 for none
+----------------------------------------------------------------------------- */
+static __inline__ u_int32_t pad_len(struct pppoe_tag *ac_name, struct pppoe_tag *service,
+                     struct pppoe_tag *host_uniq, struct pppoe_tag *ac_cookie,
+                     struct pppoe_tag *relay_id, u_int16_t max_payload)
+{
+    u_int32_t	len;
+
+    // the tags we echo can be as large as the peer made them
+    len = sizeof(struct pppoe);
+    if (service)
+        len += 4 + service->len;
+    if (ac_name)
+        len += 4 + ac_name->len;
+    if (host_uniq)
+        len += 4 + host_uniq->len;
+    if (ac_cookie)
+        len += 4 + ac_cookie->len;
+    if (relay_id)
+        len += 4 + relay_id->len;
+    if (max_payload)
+        len += 4 + sizeof(max_payload);
+    return len;
+}
+
+/* -----------------------------------------------------------------------------
+write a discovery packet at data, which must hold pad_len() bytes
+return the length written, pppoe header included
+----------------------------------------------------------------------------- */
+static __inline__ u_int16_t fill_PAD(u_int8_t *data, u_int16_t code, u_int16_t sessid,
+                     struct pppoe_tag *ac_name, struct pppoe_tag *service,
+                     struct pppoe_tag *host_uniq, struct pppoe_tag *ac_cookie,
+                     struct pppoe_tag *relay_id, u_int16_t max_payload)
+{
+    struct pppoe_tag	payload;
+    struct pppoe	p;
+    u_int16_t 		len = 0;
+
+    memset(&p, 0, sizeof(p));
+    p.ver = PPPOE_VER;
+    p.typ = PPPOE_TYPE;
+    p.code = code;
+    p.sessid = htons(sessid);
+
+    data += sizeof(struct pppoe);
+
+    if (service)
+        len += add_tag(data + len, PPPOE_TAG_SERVICE_NAME, service);
+    if (ac_name)
+        len += add_tag(data + len, PPPOE_TAG_AC_NAME, ac_name);
+    if (host_uniq)
+        len += add_tag(data + len, PPPOE_TAG_HOST_UNIQ, host_uniq);
+    if (ac_cookie)
+        len += add_tag(data + len, PPPOE_TAG_AC_COOKIE, ac_cookie);
+    if (relay_id)
+        len += add_tag(data + len, PPPOE_TAG_RELAY_SESSION_ID, relay_id);
+    if (max_payload) {
+        max_payload = htons(max_payload);
+        payload.data = (u_int8_t *)&max_payload;
+        payload.len = payload.max_len = sizeof(max_payload);
+        len += add_tag(data + len, PPPOE_TAG_PPP_MAX_PAYLOAD, &payload);
+    }
+
+    p.len = htons(len);
+    memcpy(data - sizeof(struct pppoe), &p, sizeof(p));
+    return sizeof(struct pppoe) + len;
+}
+
+/* -----------------------------------------------------------------------------
+return the PPP-Max-Payload value found in the packet, 0 if absent or invalid
+----------------------------------------------------------------------------- */
+static __inline__ u_int16_t get_max_payload(struct pppoe_tags *tags)
+{
+    struct pppoe_tag	val;
+    u_int16_t		payload;
+
+    if (!get_tag(tags, PPPOE_TAGIDX_PPP_MAX_PAYLOAD, &val) || val.len != sizeof(payload))
+        return 0;
+    memcpy(&payload, val.data, sizeof(payload));
+    return ntohs(payload);
+}
+
+/* -----------------------------------------------------------------------------
+RFC 4638, server side. asked is the client PPP-Max-Payload (0 if absent),
+ours the largest payload we support (0 if none above PPPOE_MTU).
+return the payload for the session, PPPOE_MTU unless we support the request
+----------------------------------------------------------------------------- */
+static __inline__ u_int16_t accept_max_payload(u_int16_t asked, u_int16_t ours)
+{
+    if (asked <= PPPOE_MTU || asked > ours)
+        return PPPOE_MTU;
+    return asked;
+}
+
+/* -----------------------------------------------------------------------------
+RFC 4638, client side. confirmed is the PPP-Max-Payload of the PADS (0 if
+absent), ours the value we asked for. the larger payload can only be used
+if the server confirmed it, and never above what we asked for.
+return the payload for the session, PPPOE_MTU if nothing larger was agreed
+----------------------------------------------------------------------------- */
+static __inline__ u_int16_t confirmed_max_payload(u_int16_t confirmed, u_int16_t ours)
+{
+    u_int16_t	payload = confirmed < ours ? confirmed : ours;
+
+    return payload > PPPOE_MTU ? payload : PPPOE_MTU;
+}
+
+#endif
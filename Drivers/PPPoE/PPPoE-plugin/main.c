@@ -86,6 +86,8 @@
 #define PPPOE_NKE	"/System/Library/Extensions/PPPoE.kext"
 #define PPPOE_NKE_ID	"com.apple.nke.pppoe"
 
+#define PPPOE_MTU_DEFAULT	1492		/* payload without RFC 4638 */
+
 /* -----------------------------------------------------------------------------
  Forward declarations
 ----------------------------------------------------------------------------- */
@@ -96,13 +98,14 @@ void pppoe_disconnect(void);
 void pppoe_close(void);
 void pppoe_cleanup(void);
 int pppoe_establish_ppp(int);
-void pppoe_wait_input(void);
+void pppoe_wait_input(int fd, void *arg);
 void pppoe_disestablish_ppp(int);
 void pppoe_link_down(void *arg, uintptr_t p);
 
 static int pppoe_dial(void);
 static int pppoe_listen(void);
 static void closeall(void);
+static void pppoe_adjust_mru(void);
 static u_long load_kext(char *kext, int byBundleID);
 
 /* -----------------------------------------------------------------------------
@@ -121,6 +124,7 @@ static char	*service = NULL; 		/* service selection to use */
 static char	*access_concentrator = NULL; 	/* access concentrator to connect to */
 static int	retrytimer = 0; 		/* retry timer (default is 3 seconds) */
 static int	connecttimer = 65; 		/* bump the connection timer from 20 to 65 seconds */
+static int	maxpayload = 0; 		/* RFC 4638 max payload to negotiate, 0 for the default 1492 */
 static bool	linkdown = 0; 			/* flag set when we receive link down event */
 
 extern int kill_link;
@@ -141,6 +145,8 @@ option_t pppoe_options[] = {
       "Connect timer for outgoing call (default 65 seconds)" },
     { "pppoeretrytimer", o_int, &retrytimer,
       "Retry timer for outgoing call (default 3 seconds)" },
+    { "pppoemaxpayload", o_int, &maxpayload,
+      "Negotiate a PPP payload larger than 1492 bytes (RFC 4638)" },
     { NULL }
 };
 
@@ -158,7 +164,6 @@ int start(CFBundleRef ref)
     bzero(the_channel, sizeof(struct channel));
     the_channel->options = pppoe_options;
     the_channel->process_extra_options = pppoe_process_extra_options;
-    the_channel->wait_input = pppoe_wait_input;
     the_channel->check_options = pppoe_check_options;
     the_channel->connect = pppoe_connect;
     the_channel->disconnect = pppoe_disconnect;
@@ -204,15 +209,14 @@ void pppoe_check_options()
 }
 
 /* ----------------------------------------------------------------------------- 
-called back everytime we go out of select, and data needs to be read
-the hook is called and has a chance to get data out of its file descriptor
+called back when our socket has data to read
 in the case of PPPoE, we are not supposed to get data on the socket
 if our socket gets awaken, that's because is has been closed
 ----------------------------------------------------------------------------- */
-void pppoe_wait_input()
+void pppoe_wait_input(int fd, void *arg)
 {
    
-    if (sockfd != -1 && is_ready_fd(sockfd)) {
+    if (sockfd != -1 && fd == sockfd) {
         // looks like we have been disconnected...
         // the status is updated only if link is not already down
         if (linkdown == 0) {
@@ -320,6 +324,14 @@ int pppoe_connect(int *errorcode)
         }
     }
 
+    if (maxpayload > 0) {
+        u_int16_t 	payload = maxpayload > 0xFFFF ? 0xFFFF : maxpayload;
+        if (setsockopt(sockfd, PPPPROTO_PPPOE, PPPOE_OPT_MAX_PAYLOAD, &payload, 2)) {
+            error("PPPoE can't set PPPoE max payload...\n");
+            return errno;
+        }
+    }
+
     if (setsockopt(sockfd, PPPPROTO_PPPOE, PPPOE_OPT_INTERFACE, device, (socklen_t)strlen(device))) {
         error("PPPoE can't specify interface...\n");
         return errno;
@@ -399,8 +411,8 @@ int pppoe_establish_ppp(int fd)
     if (new_fd == -1)
         return -1;
 
-    /* add our pppoe socket to the select */
-    add_fd(fd);
+    /* wait for our pppoe socket to be closed */
+    add_fd_handler(fd, pppoe_wait_input, 0);
     
     return new_fd;
 }
@@ -430,6 +442,8 @@ int pppoe_dial()
 	char ac_string[ETHER_ADDR_LEN * 3];
 	socklen_t ac_len = ETHER_ADDR_LEN;
 	int err;
+	struct pppoe_discovery_stats stats;
+	socklen_t stats_len = sizeof(stats);
     
     // if the specific pppoe option are not used, try to see 
     // if the remote address generic field can be decomposed
@@ -499,6 +513,11 @@ int pppoe_dial()
 		set_network_signature("PPPoE.AccessConcentratorAddress", ac_string, 0, 0);
 	}
 	
+	if (getsockopt(sockfd, PPPPROTO_PPPOE, PPPOE_OPT_DISCOVERY_STATS, &stats, &stats_len) == 0)
+		info("PPPoE discovery: %d PADI, PADO after %d ms, %d PADR, PADS after %d ms",
+			stats.padi_sent, stats.pado_latency, stats.padr_sent, stats.pads_latency);
+
+    pppoe_adjust_mru();
     notice("PPPoE connection established.");
     return 0;
 }
@@ -544,10 +563,38 @@ int pppoe_listen()
     close(sockfd);	// close the socket used for listening
     sockfd = fd;	// use the accepted socket instead of
     
+    pppoe_adjust_mru();
     notice("PPPoE connection established in incoming call.");
     return 0;
 }
 
+/* -----------------------------------------------------------------------------
+if the peer agreed on a payload larger than 1492 (RFC 4638), let LCP use it
+----------------------------------------------------------------------------- */
+void pppoe_adjust_mru()
+{
+    u_int16_t	payload;
+    socklen_t	len = sizeof(payload);
+
+    if (maxpayload <= 0)
+        return;
+
+    if (getsockopt(sockfd, PPPPROTO_PPPOE, PPPOE_OPT_MAX_PAYLOAD, &payload, &len) == -1) {
+        warning("PPPoE cannot retrieve negotiated max payload, %m");
+        return;
+    }
+
+    if (payload <= PPPOE_MTU_DEFAULT) {
+        notice("PPPoE peer did not agree on a larger payload, using %d.", PPPOE_MTU_DEFAULT);
+        return;
+    }
+
+    notice("PPPoE negotiated max payload %d.", payload);
+    lcp_allowoptions[0].mru = payload;	/* defines our mtu */
+    lcp_wantoptions[0].mru = payload;	/* defines our mru */
+    lcp_wantoptions[0].neg_mru = 1;
+}
+
 /* -----------------------------------------------------------------------------
 ----------------------------------------------------------------------------- */
 void closeall()
@@ -157,6 +157,81 @@ struct ifpppdelegate {
     char ifr_delegate_name[IFNAMSIZ];
 };
 
+/* LCP echo offload, answered and generated by the kernel on behalf of pppd */
+struct ppp_echo {
+    u_int32_t	our_magic;		/* our negotiated magic number */
+    u_int32_t	peer_magic;		/* peer negotiated magic number */
+    u_int16_t	interval;		/* seconds between echo-requests, 0 to turn off */
+    u_int16_t	fails;			/* unanswered echo-requests before failure, 0 for none */
+    u_int32_t	state;			/* see PPP_ECHO_xxx below, returned by PPPIOCGECHO */
+};
+
+#define PPP_ECHO_OFF		0	/* not offloaded */
+#define PPP_ECHO_ON		1	/* kernel is handling echo */
+#define PPP_ECHO_FAILED		2	/* peer stopped answering */
+#define PPP_ECHO_MAGIC		3	/* unexpected magic number, given back to pppd */
+
+/* pseudo protocol used to tell pppd the echo state changed, never seen on the wire */
+#define PPP_ECHO_NOTIFY		0x0000
+
+/* data path samples taken by the kernel, drained by pppd with PPPIOCGTRACE */
+struct ppp_trace_sample {
+    u_int32_t	sec;			/* microtime() when the packet was seen */
+    u_int32_t	usec;
+    u_int16_t	proto;			/* PPP protocol, before compression */
+    u_int16_t	len;			/* packet length, protocol field excluded */
+    u_int8_t	dir;			/* PPP_TRACE_IN or PPP_TRACE_OUT */
+    u_int8_t	pad[3];
+};
+
+#define PPP_TRACE_IN		0
+#define PPP_TRACE_OUT		1
+#define PPP_TRACE_BATCH		32	/* max samples returned by one PPPIOCGTRACE */
+
+struct ppp_trace {
+    u_int32_t	rate;			/* one packet in rate is sampled, 0 when off */
+    u_int32_t	count;			/* valid entries in samples */
+    u_int32_t	dropped;		/* samples lost to a full ring since the last read */
+    u_int32_t	pad;
+    struct ppp_trace_sample samples[PPP_TRACE_BATCH];
+};
+
+/*
+ * Trace ring file written by pppd (trace-file option) and decoded by pppdump -t.
+ * A ppp_trace_file header is followed by size bytes of ppp_trace_record entries,
+ * each followed by caplen packet bytes and padded to 4 bytes. Records run from
+ * head to tail, a reclen of 0 or the end of the area sends the reader back to 0.
+ * Everything is in host byte order.
+ */
+#define PPP_TRACE_MAGIC		0x70707472	/* "pptr" */
+#define PPP_TRACE_VERSION	1
+
+struct ppp_trace_file {
+    u_int32_t	magic;
+    u_int32_t	version;
+    u_int32_t	size;			/* bytes of records following this header */
+    u_int32_t	snaplen;		/* max packet bytes kept in a pppd record */
+    u_int32_t	head;			/* offset of the oldest record */
+    u_int32_t	tail;			/* offset of the next record */
+    u_int32_t	records;		/* records between head and tail */
+    u_int32_t	overwritten;		/* old records lost when the ring wrapped */
+    u_int32_t	dropped;		/* new records lost to a full ring (trace-nowrap) */
+    u_int32_t	kdropped;		/* kernel samples lost before pppd read them */
+    u_int32_t	pad[2];
+};
+
+struct ppp_trace_record {
+    u_int16_t	reclen;			/* whole record, 0 marks the wrap point */
+    u_int8_t	dir;			/* PPP_TRACE_IN or PPP_TRACE_OUT */
+    u_int8_t	kernel;			/* 1 for a kernel data path sample */
+    u_int32_t	sec;
+    u_int32_t	usec;
+    u_int16_t	proto;
+    u_int16_t	len;			/* packet length, protocol field excluded */
+    u_int16_t	caplen;			/* packet bytes following this record */
+    u_int16_t	pad;
+};
+
 #if __DARWIN_ALIGN_POWER
 #pragma options align=reset
 #endif
@@ -206,6 +281,10 @@ struct ifpppdelegate {
 #define PPPIOCGNPAFMODE	_IOWR('t', 54, struct npafioctl) /* get NPAF mode */
 #define PPPIOCSNPAFMODE	_IOW('t', 53, struct npafioctl)  /* set NPAF mode */
 #define PPPIOCSDELEGATE _IOW('t', 52, struct ifpppdelegate)   /* set the delegate interface */
+#define PPPIOCSECHO	_IOW('t', 51, struct ppp_echo)	/* set LCP echo offload */
+#define PPPIOCGECHO	_IOR('t', 50, struct ppp_echo)	/* get LCP echo offload */
+#define PPPIOCSTRACE	_IOW('t', 49, u_int32_t)	/* set data path sampling rate */
+#define PPPIOCGTRACE	_IOR('t', 48, struct ppp_trace)	/* read data path samples */
 
 /*
  * These two are interface ioctls so that pppstats can do them on
@@ -60,6 +60,7 @@
 #include "ppp_link.h"
 #include "ppp_comp.h"
 #include "ppp_compress.h"
+#include "ppp_mppe.h"
 
 #include "ppp_serial.h"
 #include "ppp_ip.h"
@@ -105,6 +106,8 @@ int ppp_module_start(struct kmod_info *ki, void *data)
     ppp_if_init();
     ppp_link_init();
     ppp_comp_init();
+    ret = ppp_mppe_init();
+    LOGRETURN(ret, KERN_FAILURE, "ppp_module_start: ppp_mppe_init error = 0x%x\n");
 
     /* init ip protocol */
     ppp_ip_init(0);
@@ -145,6 +148,8 @@ int ppp_module_stop(struct kmod_info *ki, void *data)
     LOGGOTOFAIL(ret, "ppp_terminate: ppp_if_dispose error = 0x%x\n");
     ret = ppp_link_dispose();
     LOGGOTOFAIL(ret, "ppp_terminate: ppp_link_dispose error = 0x%x\n");
+    ret = ppp_mppe_dispose();
+    LOGGOTOFAIL(ret, "ppp_terminate: ppp_mppe_dispose error = 0x%x\n");
     ret = ppp_comp_dispose();
     LOGGOTOFAIL(ret, "ppp_terminate: ppp_comp_dispose error = 0x%x\n");
 
@@ -497,15 +497,29 @@ int ppp_comp_decompress(struct ppp_if *wan, mbuf_t *m)
 {
     int err;
     
-    if ((wan->rc_state == 0) || (wan->sc_flags & (SC_DC_ERROR | SC_DC_FERROR)))
+    if ((wan->rc_state == 0) || (wan->sc_flags & SC_DC_FERROR))
+        return DECOMP_ERROR;
+
+    /* 
+        after an error, wait for the CCP Reset-Ack.
+        MPPE peers never send one, the decompressor resyncs on the flushed bit
+    */
+    if ((wan->sc_flags & SC_DC_ERROR) && wan->rcomp->protocol != CI_MPPE)
         return DECOMP_ERROR;
             
     err = wan->rcomp->decompress(wan->rc_state, m);
-    if (err != DECOMP_OK) {
-        if (err == DECOMP_FATALERROR)
+    switch (err) {
+        case DECOMP_OK:
+            wan->sc_flags &= ~SC_DC_ERROR;
+            break;
+        case DECOMP_DROPPED:
+            break;
+        case DECOMP_FATALERROR:
             wan->sc_flags |= SC_DC_FERROR;
-        wan->sc_flags |= SC_DC_ERROR;
-        ppp_if_error(wan->net);
+            // no break;
+        default:
+            wan->sc_flags |= SC_DC_ERROR;
+            ppp_if_error(wan->net);
     }
 
     return err;	
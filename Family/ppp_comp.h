@@ -117,6 +117,7 @@ struct ppp_comp_reg {
 #define DECOMP_OK		0	/* everything went OK */
 #define DECOMP_ERROR		1	/* error detected before decomp. */
 #define DECOMP_FATALERROR	2	/* error detected after decomp. */
+#define DECOMP_DROPPED		3	/* packet dropped, still in sync */
 
 #define COMP_OK			0	/* everything went OK, packet is compressed */
 #define COMP_NOTDONE		1	/* packet has not been compressed */
@@ -80,6 +80,17 @@ Includes
 Definitions
 ----------------------------------------------------------------------------- */
 
+#define PPP_IF_TRACE_RING	256	/* data path samples kept until pppd reads them */
+
+struct ppp_if_trace {
+    u_int32_t			rate;		/* sample one packet in rate, 0 when off */
+    u_int32_t			skip;		/* packets seen since the last sample */
+    u_int32_t			head;		/* oldest sample */
+    u_int32_t			count;		/* samples in the ring */
+    u_int32_t			dropped;	/* samples lost since the last read */
+    struct ppp_trace_sample	ring[PPP_IF_TRACE_RING];
+};
+
 /* -----------------------------------------------------------------------------
 Forward declarations
 ----------------------------------------------------------------------------- */
@@ -105,6 +116,8 @@ static errno_t  ppp_if_frameout(ifnet_t ifp, mbuf_t *m0,
 static int 	ppp_if_detach(ifnet_t ifp);
 static struct ppp_if *ppp_if_findunit(u_short unit);
 static int ppp_if_set_bpf_tap(ifnet_t ifp, bpf_tap_mode mode, bpf_packet_func func);
+static void ppp_if_set_hdrlen(struct ppp_if *wan);
+static void ppp_if_trace(struct ppp_if *wan, u_int8_t dir, u_int16_t proto, size_t len);
 
 /* -----------------------------------------------------------------------------
 Globals
@@ -326,6 +339,10 @@ int ppp_if_detach(ifnet_t ifp)
 	kfree_type(struct slcompress, wan->vjcomp);
 	wan->vjcomp = 0;
     }
+    if (wan->trace) {
+	kfree_type(struct ppp_if_trace, wan->trace);
+	wan->trace = 0;
+    }
 
 	wan->state |= PPP_IF_STATE_DETACHING;
 	lck_mtx_unlock(ppp_domain_mutex);
@@ -540,7 +557,7 @@ called when data are present
 int ppp_if_input(ifnet_t ifp, mbuf_t m, u_int16_t proto, u_int16_t hdrlen)
 {    
     struct ppp_if 	*wan = ifnet_softc(ifp);
-    int 		inlen, vjlen;
+    int 		inlen, vjlen, decomp;
     u_char		*iphdr, *p = mbuf_data(m);	// no alignment issue as p is *u_char.
     u_int 		hlen;
     int 		error = ENOMEM;
@@ -557,9 +574,15 @@ int ppp_if_input(ifnet_t ifp, mbuf_t m, u_int16_t proto, u_int16_t hdrlen)
     if (wan->sc_flags & SC_DECOMP_RUN) {
         switch (proto) {
             case PPP_COMP:
-                if (ppp_comp_decompress(wan, &m) != DECOMP_OK) {
-                    LOGDBG(ifp, ("ppp%d: decompression error\n", ifnet_unit(ifp)));
+                decomp = ppp_comp_decompress(wan, &m);
+                if (decomp == DECOMP_DROPPED)
                     goto free;
+                if (decomp != DECOMP_OK) {
+                    LOGDBG(ifp, ("ppp%d: decompression error\n", ifnet_unit(ifp)));
+                    if (m == NULL)
+                        goto end;
+                    // pass the frame to pppd, it sends a CCP Reset-Request or takes CCP down
+                    goto reject;
                 }
                 p = mbuf_data(m);
                 proto = p[0];
@@ -577,6 +600,9 @@ int ppp_if_input(ifnet_t ifp, mbuf_t m, u_int16_t proto, u_int16_t hdrlen)
         }
     }
 
+    if (wan->trace)
+        ppp_if_trace(wan, PPP_TRACE_IN, proto, mbuf_pkthdr_len(m));
+
     switch (proto) {
         case PPP_VJC_COMP:
         case PPP_VJC_UNCOMP:
@@ -772,6 +798,36 @@ void ppp_if_if_free(ifnet_t ifp)
     wakeup(ifp);
 }
 
+/* -----------------------------------------------------------------------------
+record a data path sample for one packet in every trace->rate.
+pppd drains the ring with PPPIOCGTRACE, nothing is overwritten,
+samples taken while the ring is full are only counted.
+----------------------------------------------------------------------------- */
+static void ppp_if_trace(struct ppp_if *wan, u_int8_t dir, u_int16_t proto, size_t len)
+{
+    struct ppp_if_trace		*tr = wan->trace;
+    struct ppp_trace_sample	*s;
+    struct timeval		tv;
+
+    if (tr->rate == 0 || ++tr->skip < tr->rate)
+        return;
+    tr->skip = 0;
+
+    if (tr->count == PPP_IF_TRACE_RING) {
+        tr->dropped++;
+        return;
+    }
+
+    s = &tr->ring[(tr->head + tr->count) % PPP_IF_TRACE_RING];
+    tr->count++;
+    microtime(&tv);
+    s->sec = (u_int32_t)tv.tv_sec;
+    s->usec = (u_int32_t)tv.tv_usec;
+    s->proto = proto;
+    s->len = len > 0xFFFF ? 0xFFFF : (u_int16_t)len;
+    s->dir = dir;
+}
+
 /* -----------------------------------------------------------------------------
 Process an ioctl request to the ppp interface
 ----------------------------------------------------------------------------- */
@@ -787,6 +843,7 @@ int ppp_if_control(ifnet_t ifp, u_long cmd, void *data)
 	struct timespec tv;	
     struct ifpppdelegate    *ifdelegate;
     ifnet_t                 del_ifp = NULL;
+    struct ppp_trace        *trace;
 
     //LOGDBG(ifp, ("ppp_if_control, (ifnet = %s%d), cmd = 0x%x\n", ifp->if_name, ifp->if_unit, cmd));
 
@@ -924,6 +981,32 @@ int ppp_if_control(ifnet_t ifp, u_long cmd, void *data)
         }
         break;
 
+    case PPPIOCSTRACE:
+        LOGDBG(ifp, ("ppp_if_control: PPPIOCSTRACE (rate = %d)\n", *(u_int32_t *)data));
+        // the ring stays allocated when sampling stops, pppd may still drain it
+        if (*(u_int32_t *)data && !wan->trace)
+            wan->trace = kalloc_type(struct ppp_if_trace, Z_WAITOK | Z_ZERO | Z_NOFAIL);
+        if (wan->trace) {
+            wan->trace->rate = *(u_int32_t *)data;
+            wan->trace->skip = 0;
+        }
+        break;
+
+    case PPPIOCGTRACE:
+        trace = (struct ppp_trace *)data;
+        bzero(trace, sizeof(*trace));
+        if (wan->trace) {
+            trace->rate = wan->trace->rate;
+            trace->dropped = wan->trace->dropped;
+            wan->trace->dropped = 0;
+            while (wan->trace->count && trace->count < PPP_TRACE_BATCH) {
+                trace->samples[trace->count++] = wan->trace->ring[wan->trace->head];
+                wan->trace->head = (wan->trace->head + 1) % PPP_IF_TRACE_RING;
+                wan->trace->count--;
+            }
+        }
+        break;
+
 	default:
             LOGDBG(ifp, ("ppp_if_control: unknown ioctl, cmd = 0x%x\n", cmd));
             error = EINVAL;
@@ -1264,6 +1347,23 @@ errno_t ppp_if_frameout(ifnet_t ifp, mbuf_t *m0,
     return 0;
 }
 
+/* -----------------------------------------------------------------------------
+advertise the ppp header plus the largest media header of the attached links,
+so the stack leaves room for them in front of the packets it sends us
+(udp/ip for tunnels, ethernet for pppoe).
+----------------------------------------------------------------------------- */
+static void ppp_if_set_hdrlen(struct ppp_if *wan)
+{
+    struct ppp_link	*link;
+    u_int32_t		hdrlen = 0;
+
+    TAILQ_FOREACH(link, &wan->link_head, lk_bdl_next) {
+        if (link->lk_hdrlen > hdrlen)
+            hdrlen = link->lk_hdrlen;
+    }
+    ifnet_set_hdrlen(wan->net, PPP_HDRLEN + hdrlen);
+}
+
 /* -----------------------------------------------------------------------------
  * Connect a PPP channel to a PPP interface unit.
 ----------------------------------------------------------------------------- */
@@ -1286,6 +1386,7 @@ int ppp_if_attachlink(struct ppp_link *link, int unit)
     TAILQ_INSERT_TAIL(&wan->link_head, link, lk_bdl_next);
     wan->nblinks++;
     link->lk_ifnet = wan->net;
+    ppp_if_set_hdrlen(wan);
 
     return 0;
 }
@@ -1312,6 +1413,7 @@ int ppp_if_detachlink(struct ppp_link *link)
     TAILQ_REMOVE(&wan->link_head, link, lk_bdl_next);
     wan->nblinks--;
     link->lk_ifnet = 0;
+    ppp_if_set_hdrlen(wan);
     return 0;
 }
 
@@ -1322,13 +1424,16 @@ int ppp_if_send(ifnet_t ifp, mbuf_t m)
     struct ppp_if 	*wan = ifnet_softc(ifp);
     u_int16_t		proto;
 	struct			ifnet_stat_increment_param statsinc;
-	int				error = 0;
+	int				error = 0, comp;
 	
 	lck_mtx_assert(ppp_domain_mutex, LCK_MTX_ASSERT_OWNED);
         
     memcpy(&proto, mbuf_data(m), sizeof(u_int16_t));	// always the 2 first bytes
     proto = ntohs(proto);
 
+    if (wan->trace)
+        ppp_if_trace(wan, PPP_TRACE_OUT, proto, mbuf_pkthdr_len(m) - 2);
+
     if (ppp_qfull(&wan->sndq)) {
         ppp_drop(&wan->sndq);
 		bzero(&statsinc, sizeof(statsinc));
@@ -1391,7 +1496,17 @@ int ppp_if_send(ifnet_t ifp, mbuf_t m)
 
     if (wan->sc_flags & SC_COMP_RUN) {
 
-        if (ppp_comp_compress(wan, &m) == COMP_OK) {
+        comp = ppp_comp_compress(wan, &m);
+        if (comp < 0) {
+            // the compressor dropped the packet rather than send it in clear
+            if (m)
+                mbuf_freem(m);
+            bzero(&statsinc, sizeof(statsinc));
+            statsinc.errors_out = 1;
+            ifnet_stat_increment(ifp, &statsinc);
+            return -comp;
+        }
+        if (comp == COMP_OK) {
             if (mbuf_prepend(&m, 2, MBUF_DONTWAIT) != 0) {
 				bzero(&statsinc, sizeof(statsinc));
 				statsinc.errors_out = 1;
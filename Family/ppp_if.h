@@ -64,6 +64,7 @@ struct ppp_if {
 	struct pppqueue		sndq;		/* send queue */
 	bpf_packet_func		bpf_input;	/* bpf input function */
 	bpf_packet_func		bpf_output;	/* bpf output function */
+	struct ppp_if_trace	*trace;		/* data path samples, see PPPIOCSTRACE */
 	
     /* data compression */
     void				*xc_state;	/* send compressor state */
@@ -47,6 +47,7 @@ Includes
 #include <sys/syslog.h>
 #include <sys/sockio.h>
 #include <kern/locks.h>
+#include <kern/thread.h>
 #include <net/if_types.h>
 #include <net/if.h>
 #include <netinet/in.h>
@@ -76,16 +77,27 @@ Definitions
         IOLog text; 		\
     }
 
+#define LCP_ECHOREQ		9	/* LCP codes we need for echo offload */
+#define LCP_ECHOREP		10
+#define LCP_CODEREJ		7
+#define LCP_HDRLEN		4
+#define LCP_ECHOLEN		(LCP_HDRLEN + 4)	/* header + magic number */
+
 /* 
-    As the private structure contains only one field, 
-    there is no need for an extra malloc .
-    Can be changed later, if we need to keep
-    more information in the private structure.
+    The private structure keeps the client and
+    the state of the LCP echo offload.
 */
+#define USE_PRIVATE_STRUCT 1
+
 #ifdef USE_PRIVATE_STRUCT
 /* Link private data structure */
 struct ppp_priv {
     void 		*host;		/* our client structure */
+    struct ppp_echo	echo;		/* echo offload parameters and state */
+    u_int8_t		echo_id;	/* id of next echo-request */
+    u_int16_t		echo_pending;	/* outstanding echo-requests */
+    u_int32_t		echo_deadline;	/* uptime (sec) of next echo check */
+    u_int32_t		last_recv;	/* uptime (sec) of last packet received */
 };
 #endif
 
@@ -93,6 +105,11 @@ struct ppp_priv {
 Forward declarations
 ----------------------------------------------------------------------------- */
 
+static int ppp_link_echo_start(void);
+static void ppp_link_echo_thread(void);
+static void ppp_link_echo_timer(struct ppp_link *link);
+static int ppp_link_echo_input(struct ppp_link *link, mbuf_t *mp);
+static void ppp_link_echo_notify(struct ppp_link *link, u_int32_t state);
 
 
 /* -----------------------------------------------------------------------------
@@ -102,16 +119,26 @@ Globals
 static TAILQ_HEAD(, ppp_link) 	ppp_link_head;
 extern lck_mtx_t   *ppp_domain_mutex;
 
+static thread_t		ppp_link_echo_thread_id;
+static int		ppp_link_echo_terminate;
+static int		ppp_link_echo_terminated;
+
 /* -----------------------------------------------------------------------------
 ----------------------------------------------------------------------------- */
 int ppp_link_init()
 {
     TAILQ_INIT(&ppp_link_head);
     
+    // the echo offload thread is started when a link first enables it
+    ppp_link_echo_terminate = 0;
+    ppp_link_echo_terminated = 0;
+    ppp_link_echo_thread_id = 0;
+
     return 0;
 }
 
 /* -----------------------------------------------------------------------------
+called with ppp_domain_mutex held
 ----------------------------------------------------------------------------- */
 int ppp_link_dispose()
 {
@@ -119,9 +146,82 @@ int ppp_link_dispose()
     if (TAILQ_FIRST(&ppp_link_head))
         return EBUSY;
 
+    if (ppp_link_echo_thread_id) {
+        ppp_link_echo_terminate = 1;
+        wakeup(&ppp_link_echo_terminate);
+        while (!ppp_link_echo_terminated)
+            msleep(&ppp_link_echo_terminated, ppp_domain_mutex, PZERO+1, 0, 0);
+        thread_deallocate(ppp_link_echo_thread_id);
+        ppp_link_echo_thread_id = 0;
+    }
+
     return 0;
 }
 
+/* -----------------------------------------------------------------------------
+uptime in seconds, used for echo scheduling
+----------------------------------------------------------------------------- */
+static u_int32_t ppp_link_uptime(void)
+{
+    struct timeval	tv;
+
+    microuptime(&tv);
+    return (u_int32_t)tv.tv_sec;
+}
+
+/* -----------------------------------------------------------------------------
+start the echo offload thread, or wake it up if it is sleeping idle
+called with ppp_domain_mutex held
+----------------------------------------------------------------------------- */
+static int ppp_link_echo_start(void)
+{
+    if (ppp_link_echo_thread_id) {
+        wakeup(&ppp_link_echo_terminate);
+        return 0;
+    }
+
+    if (kernel_thread_start((thread_continue_t)ppp_link_echo_thread, NULL, &ppp_link_echo_thread_id) != KERN_SUCCESS) {
+        IOLog("ppp_link_echo_start: cannot start echo thread, echo offload disabled\n");
+        ppp_link_echo_thread_id = 0;
+        return ENOTSUP;
+    }
+    return 0;
+}
+
+/* -----------------------------------------------------------------------------
+echo offload thread, ticks once a second and checks the offloaded links
+sleeps until ppp_link_echo_start while no link has echo offload on
+----------------------------------------------------------------------------- */
+static void ppp_link_echo_thread(void)
+{
+    struct ppp_link	*link;
+    struct ppp_priv	*priv;
+    struct timespec	ts = {1, 0};
+    int			active;
+
+    lck_mtx_lock(ppp_domain_mutex);
+
+    while (!ppp_link_echo_terminate) {
+        active = 0;
+        TAILQ_FOREACH(link, &ppp_link_head, lk_next) {
+            ppp_link_echo_timer(link);
+            priv = (struct ppp_priv *)link->lk_ppp_private;
+            if (priv && priv->echo.state == PPP_ECHO_ON)
+                active = 1;
+        }
+
+        msleep(&ppp_link_echo_terminate, ppp_domain_mutex, PZERO+1, 0, active ? &ts : 0);
+    }
+
+    ppp_link_echo_terminated = 1;
+    lck_mtx_unlock(ppp_domain_mutex);
+
+    wakeup(&ppp_link_echo_terminated);
+
+    thread_terminate(current_thread());
+    /* NOTREACHED */
+}
+
 /* -----------------------------------------------------------------------------
 find a free unit in the interface list
 ----------------------------------------------------------------------------- */
@@ -230,6 +330,10 @@ int ppp_link_input(struct ppp_link *link, mbuf_t m)
     if (link->lk_ifnet && (ifnet_flags(link->lk_ifnet) & PPP_LOG_INPKT)) 
         ppp_link_logmbuf(link, "ppp_link_input", m);
 
+#ifdef USE_PRIVATE_STRUCT
+    priv->last_recv = ppp_link_uptime();
+#endif
+
 	if (mbuf_len(m) < PPP_HDRLEN && 
 		mbuf_pullup(&m, PPP_HDRLEN)) {
 			if (m) {
@@ -257,6 +361,9 @@ int ppp_link_input(struct ppp_link *link, mbuf_t m)
     }
     else {
 #ifdef USE_PRIVATE_STRUCT
+	if (proto == PPP_LCP && priv->echo.state == PPP_ECHO_ON
+	    && ppp_link_echo_input(link, &m))
+	    return 0;				// echo handled here
 	ppp_proto_input(priv->host, m);		// LCP/Auth/unexpected network protocol
 #else
         ppp_proto_input(link->lk_ppp_private, m);// LCP/Auth/unexpected network protocol
@@ -271,10 +378,30 @@ int ppp_link_control(struct ppp_link *link, u_long cmd, void *data)
 {
     int 	error = 0;
     u_int32_t	flags, mru;    
+#ifdef USE_PRIVATE_STRUCT
+    struct ppp_priv 	*priv = (struct ppp_priv *)link->lk_ppp_private;
+    struct ppp_echo	*echo;
+#endif
 	
 	lck_mtx_assert(ppp_domain_mutex, LCK_MTX_ASSERT_OWNED);
         
     switch (cmd) {
+#ifdef USE_PRIVATE_STRUCT
+        case PPPIOCSECHO:
+            echo = (struct ppp_echo *)data;
+            LOGLKDBG(link, ("ppp_link_control : PPPIOCSECHO, (link = %s%d), interval = %d, fails = %d\n",
+                LKNAME(link), LKUNIT(link), echo->interval, echo->fails));
+            if (echo->interval && (error = ppp_link_echo_start()))
+                break;
+            priv->echo = *echo;
+            priv->echo.state = echo->interval ? PPP_ECHO_ON : PPP_ECHO_OFF;
+            priv->echo_pending = 0;
+            priv->echo_deadline = ppp_link_uptime() + echo->interval;
+            break;
+        case PPPIOCGECHO:
+            *(struct ppp_echo *)data = priv->echo;
+            break;
+#endif
         case PPPIOCCONNECT:
             LOGLKDBG(link, ("ppp_link_control : PPPIOCCONNECT, (link = %s%d), attach to interface = %d \n",
                 LKNAME(link), LKUNIT(link), *(u_int32_t *)data));
@@ -381,14 +508,161 @@ void ppp_link_detachclient(struct ppp_link *link, void *host)
 	
 	lck_mtx_assert(ppp_domain_mutex, LCK_MTX_ASSERT_OWNED);
 
-    if (priv && (priv->host == host))
+    if (priv && (priv->host == host)) {
         priv->host = 0;
+        // nobody to give the echo back to, the next client starts with it off
+        priv->echo.state = PPP_ECHO_OFF;
+        priv->echo_pending = 0;
+    }
 #else
     if (link->lk_ppp_private == host)
         link->lk_ppp_private = 0;
 #endif
 }
 
+/* -----------------------------------------------------------------------------
+LCP packet received while echo is offloaded.
+answer echo-requests and absorb echo-replies, give everything else to pppd.
+return 1 if the packet was consumed.
+----------------------------------------------------------------------------- */
+static int ppp_link_echo_input(struct ppp_link *link, mbuf_t *mp)
+{
+    struct ppp_priv 	*priv = (struct ppp_priv *)link->lk_ppp_private;
+    mbuf_t		m = *mp;
+    u_char		*p;
+    u_int32_t		magic;
+    u_int16_t		lcplen;
+    size_t		pktlen;
+
+    if (mbuf_pkthdr_len(m) < 2 + LCP_ECHOLEN)
+        return 0;
+
+    if (mbuf_len(m) < 2 + LCP_ECHOLEN &&
+        mbuf_pullup(mp, 2 + LCP_ECHOLEN)) {
+        if (*mp)
+            mbuf_freem(*mp);
+        IOLog("ppp_link_echo_input: cannot pullup header\n");
+        return 1;
+    }
+    m = *mp;
+
+    p = mbuf_data(m);	// no alignment issue as p is *uchar.
+    magic = ((u_int32_t)p[6] << 24) | ((u_int32_t)p[7] << 16) | ((u_int32_t)p[8] << 8) | p[9];
+
+    switch (p[2]) {
+        case LCP_ECHOREQ:
+            if (magic != priv->echo.peer_magic) {
+                // loopback or peer changed its mind, let pppd sort it out
+                ppp_link_echo_notify(link, PPP_ECHO_MAGIC);
+                return 0;
+            }
+            lcplen = ((u_int16_t)p[4] << 8) + p[5];
+            pktlen = mbuf_pkthdr_len(m);
+            if (lcplen < LCP_ECHOLEN || 2 + lcplen > pktlen)
+                return 0;	// malformed, pppd will complain
+            if (2 + lcplen < pktlen)
+                mbuf_adj(m, -(int)(pktlen - 2 - lcplen));	// strip padding
+            p[2] = LCP_ECHOREP;
+            p[6] = priv->echo.our_magic >> 24;
+            p[7] = priv->echo.our_magic >> 16;
+            p[8] = priv->echo.our_magic >> 8;
+            p[9] = priv->echo.our_magic;
+            ppp_link_send(link, m);
+            return 1;
+
+        case LCP_ECHOREP:
+            if (priv->echo.our_magic && magic == priv->echo.our_magic)
+                return 0;	// our own echo looped back
+            priv->echo_pending = 0;
+            mbuf_freem(m);
+            return 1;
+
+        default:
+            // LCP is renegotiating, pppd takes back echo
+            if (p[2] <= LCP_CODEREJ)
+                ppp_link_echo_notify(link, PPP_ECHO_OFF);
+            break;
+    }
+    return 0;
+}
+
+/* -----------------------------------------------------------------------------
+echo offload timer, send an echo-request when the link has been quiet
+for an interval, declare failure after too many unanswered ones
+----------------------------------------------------------------------------- */
+static void ppp_link_echo_timer(struct ppp_link *link)
+{
+    struct ppp_priv 	*priv = (struct ppp_priv *)link->lk_ppp_private;
+    u_int32_t		now = ppp_link_uptime();
+    mbuf_t		m;
+    u_char		*p;
+
+    if (priv == 0 || priv->echo.state != PPP_ECHO_ON || (int32_t)(now - priv->echo_deadline) < 0)
+        return;
+
+    priv->echo_deadline = now + priv->echo.interval;
+
+    // activity on the link, no need to probe the peer
+    if (now - priv->last_recv < priv->echo.interval) {
+        priv->echo_pending = 0;
+        return;
+    }
+
+    if (priv->echo.fails && priv->echo_pending >= priv->echo.fails) {
+        ppp_link_echo_notify(link, PPP_ECHO_FAILED);
+        return;
+    }
+
+    if (mbuf_gethdr(MBUF_DONTWAIT, MBUF_TYPE_DATA, &m) != 0)
+        return;
+    mbuf_align_32(m, 2 + LCP_ECHOLEN);
+    mbuf_setlen(m, 2 + LCP_ECHOLEN);
+    mbuf_pkthdr_setlen(m, 2 + LCP_ECHOLEN);
+
+    p = mbuf_data(m);	// no alignment issue as p is *uchar.
+    p[0] = PPP_LCP >> 8;
+    p[1] = PPP_LCP & 0xFF;
+    p[2] = LCP_ECHOREQ;
+    p[3] = priv->echo_id++;
+    p[4] = 0;
+    p[5] = LCP_ECHOLEN;
+    p[6] = priv->echo.our_magic >> 24;
+    p[7] = priv->echo.our_magic >> 16;
+    p[8] = priv->echo.our_magic >> 8;
+    p[9] = priv->echo.our_magic;
+
+    priv->echo_pending++;
+    ppp_link_send(link, m);
+}
+
+/* -----------------------------------------------------------------------------
+stop echo offload and wake up pppd with an empty PPP_ECHO_NOTIFY packet.
+pppd reads the reason with PPPIOCGECHO.
+----------------------------------------------------------------------------- */
+static void ppp_link_echo_notify(struct ppp_link *link, u_int32_t state)
+{
+    struct ppp_priv 	*priv = (struct ppp_priv *)link->lk_ppp_private;
+    mbuf_t		m;
+    u_char		*p;
+
+    LOGLKDBG(link, ("ppp_link_echo_notify : (link = %s%d), state = %d, pending = %d\n",
+        LKNAME(link), LKUNIT(link), state, priv->echo_pending));
+
+    priv->echo.state = state;
+    priv->echo_pending = 0;
+
+    if (mbuf_gethdr(MBUF_DONTWAIT, MBUF_TYPE_DATA, &m) != 0)
+        return;
+    mbuf_setlen(m, 4);
+    mbuf_pkthdr_setlen(m, 4);
+    p = mbuf_data(m);	// no alignment issue as p is *uchar.
+    p[0] = PPP_ECHO_NOTIFY >> 8;
+    p[1] = PPP_ECHO_NOTIFY & 0xFF;
+    p[2] = 0;
+    p[3] = (u_char)state;
+    ppp_proto_input(priv->host, m);
+}
+
 /* -----------------------------------------------------------------------------
 we wend packet without link framing (FF03)
 it's the reponsability of the driver to add the header, it the links need it.
@@ -0,0 +1,567 @@
+/*
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+/* -----------------------------------------------------------------------------
+*
+*  Theory of operation :
+*
+*  this file implements Microsoft Point-To-Point Encryption (RFC 3078),
+*	with the key changes of RFC 3079, as a ppp family compressor.
+*
+*  pppd hands the 16 bytes start key over with the CCP option, through
+*	PPPIOCSCOMPRESS, and the negotiated option with the CCP Conf-Ack.
+*	MPPC compression is not supported, only the 40 and 128 bits
+*	encryption, in stateless or stateful mode.
+*
+*  on output, the packet (protocol field included) is encrypted into
+*	a new chain, the original one may still be referenced by the
+*	socket layer. on input, the packet is decrypted in place.
+*
+*  the session key changes for every packet in stateless mode, and every
+*	256 packets (or after a CCP Reset-Request) in stateful mode.
+*	a receiver that lost packets catches up by rekeying once per
+*	missed key change, before decrypting.
+*
+----------------------------------------------------------------------------- */
+
+
+/* -----------------------------------------------------------------------------
+Includes
+----------------------------------------------------------------------------- */
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/mbuf.h>
+#include <sys/socket.h>
+#include <sys/syslog.h>
+#include <net/if.h>
+#include <libkern/crypto/sha1.h>
+
+#include "ppp_defs.h"		// public ppp values
+#include "if_ppp.h"
+#include "ppp_comp.h"
+#include "ppp_mppe.h"
+
+
+/* -----------------------------------------------------------------------------
+Definitions
+----------------------------------------------------------------------------- */
+
+#define MPPE_OVHD		2		/* MPPE header per packet */
+#define MPPE_LEADING		16		/* room left for the PPP and link headers */
+
+/* bits of the MPPE header, in front of the 12 bits coherency count */
+#define MPPE_BIT_FLUSHED	0x80		/* A: the key has just changed */
+#define MPPE_BIT_RESET		0x40		/* B: MPPC history reset */
+#define MPPE_BIT_COMP		0x20		/* C: MPPC compressed */
+#define MPPE_BIT_ENCRYPTED	0x10		/* D: encrypted */
+
+#define MPPE_CCOUNT_SPACE	0x1000		/* coherency count is 12 bits */
+#define MPPE_CCOUNT_MASK	(MPPE_CCOUNT_SPACE - 1)
+#define MPPE_CCOUNT(p)		((((p)[0] & 0x0f) << 8) + (p)[1])
+#define MPPE_BITS(p)		((p)[0] & 0xf0)
+
+/* consecutive bad packets before giving up on the link */
+#define MPPE_SANITY_MAX		1600
+
+struct ppp_mppe_rc4 {
+    u_char	perm[256];
+    u_char	index1;
+    u_char	index2;
+};
+
+struct ppp_mppe_state {
+    struct ppp_mppe_rc4	rc4;			/* keystream for the current session key */
+    u_char		master_key[MPPE_MAX_KEY_LEN];	/* start key, from pppd */
+    u_char		session_key[MPPE_MAX_KEY_LEN];	/* current session key */
+    u_int32_t		keylen;			/* 8 (40 bits) or 16 (128 bits) */
+    u_int32_t		stateful;		/* stateful mode negotiated */
+    u_int32_t		discard;		/* stateful: lost sync, wait for a flushed packet */
+    u_int32_t		sanity_errors;		/* decay of bad packets received */
+    u_int16_t		ccount;			/* last coherency count sent or received */
+    u_char		bits;			/* header bits for the next packet sent */
+    int			unit;
+    int			mru;
+    int			debug;
+    struct compstat	stats;
+};
+
+/* -----------------------------------------------------------------------------
+Forward declarations
+----------------------------------------------------------------------------- */
+
+static void	*ppp_mppe_alloc(u_char *options, int opt_len);
+static void	ppp_mppe_free(void *arg);
+static int	ppp_mppe_comp_init(void *arg, u_char *options, int opt_len,
+                        int unit, int hdrlen, int mtu, int debug);
+static int	ppp_mppe_decomp_init(void *arg, u_char *options, int opt_len,
+                        int unit, int hdrlen, int mru, int debug);
+static void	ppp_mppe_comp_reset(void *arg);
+static void	ppp_mppe_decomp_reset(void *arg);
+static int	ppp_mppe_compress(void *arg, mbuf_t *m);
+static int	ppp_mppe_decompress(void *arg, mbuf_t *m);
+static void	ppp_mppe_incomp(void *arg, mbuf_t m);
+static void	ppp_mppe_stats(void *arg, struct compstat *stats);
+
+/* -----------------------------------------------------------------------------
+Globals
+----------------------------------------------------------------------------- */
+
+static ppp_comp_ref	ppp_mppe_ref = NULL;
+
+/* RFC 3079, 3.3: padding for the session key derivation */
+static const u_char ppp_mppe_pad1[40] = {
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const u_char ppp_mppe_pad2[40] = {
+    0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2,
+    0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2,
+    0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2,
+    0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2
+};
+
+/* -----------------------------------------------------------------------------
+register MPPE with the compressor list
+----------------------------------------------------------------------------- */
+int ppp_mppe_init()
+{
+    struct ppp_comp_reg	reg;
+
+    bzero(&reg, sizeof(reg));
+    reg.compress_proto = CI_MPPE;
+    reg.comp_alloc = ppp_mppe_alloc;
+    reg.comp_free = ppp_mppe_free;
+    reg.comp_init = ppp_mppe_comp_init;
+    reg.comp_reset = ppp_mppe_comp_reset;
+    reg.compress = ppp_mppe_compress;
+    reg.comp_stat = ppp_mppe_stats;
+    reg.decomp_alloc = ppp_mppe_alloc;
+    reg.decomp_free = ppp_mppe_free;
+    reg.decomp_init = ppp_mppe_decomp_init;
+    reg.decomp_reset = ppp_mppe_decomp_reset;
+    reg.decompress = ppp_mppe_decompress;
+    reg.incomp = ppp_mppe_incomp;
+    reg.decomp_stat = ppp_mppe_stats;
+
+    return ppp_comp_register(&reg, &ppp_mppe_ref);
+}
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+int ppp_mppe_dispose()
+{
+    int 	error = 0;
+
+    if (ppp_mppe_ref) {
+        error = ppp_comp_deregister(ppp_mppe_ref);
+        ppp_mppe_ref = NULL;
+    }
+    return error;
+}
+
+/* -----------------------------------------------------------------------------
+RC4 keystream. MPPE keys are 8 or 16 bytes, so the key index is a mask,
+and the indices stay in registers for the whole buffer
+----------------------------------------------------------------------------- */
+static void ppp_mppe_rc4_setkey(struct ppp_mppe_rc4 *rc4, const u_char *key, u_int32_t keylen)
+{
+    u_char	*perm = rc4->perm;
+    u_char	j, t;
+    int 	i;
+
+    for (i = 0; i < 256; i++)
+        perm[i] = i;
+
+    for (i = 0, j = 0; i < 256; i++) {
+        t = perm[i];
+        j += t + key[i & (keylen - 1)];
+        perm[i] = perm[j];
+        perm[j] = t;
+    }
+    rc4->index1 = 0;
+    rc4->index2 = 0;
+}
+
+/* -----------------------------------------------------------------------------
+in and out may be the same buffer
+----------------------------------------------------------------------------- */
+static void ppp_mppe_rc4_crypt(struct ppp_mppe_rc4 *rc4, const u_char *in, u_char *out, size_t len)
+{
+    u_char	*perm = rc4->perm;
+    u_char	i = rc4->index1;
+    u_char	j = rc4->index2;
+    u_char	a, b;
+
+    while (len--) {
+        a = perm[++i];
+        j += a;
+        b = perm[j];
+        perm[i] = b;
+        perm[j] = a;
+        *out++ = *in++ ^ perm[(u_char)(a + b)];
+    }
+    rc4->index1 = i;
+    rc4->index2 = j;
+}
+
+/* -----------------------------------------------------------------------------
+RFC 3079, 3.3 GetNewKeyFromSHA, followed by the RC4 pass of 7.1.
+the initial key only goes through SHA
+----------------------------------------------------------------------------- */
+static void ppp_mppe_rekey(struct ppp_mppe_state *state, int initial)
+{
+    SHA1_CTX	ctx;
+    u_char	digest[SHA_DIGEST_LENGTH];
+
+    SHA1Init(&ctx);
+    SHA1Update(&ctx, state->master_key, state->keylen);
+    SHA1Update(&ctx, ppp_mppe_pad1, sizeof(ppp_mppe_pad1));
+    SHA1Update(&ctx, state->session_key, state->keylen);
+    SHA1Update(&ctx, ppp_mppe_pad2, sizeof(ppp_mppe_pad2));
+    SHA1Final(digest, &ctx);
+
+    if (initial)
+        bcopy(digest, state->session_key, state->keylen);
+    else {
+        ppp_mppe_rc4_setkey(&state->rc4, digest, state->keylen);
+        ppp_mppe_rc4_crypt(&state->rc4, digest, state->session_key, state->keylen);
+    }
+
+    /* 40 bits keys, RFC 3079 3.1 */
+    if (state->keylen == 8) {
+        state->session_key[0] = 0xd1;
+        state->session_key[1] = 0x26;
+        state->session_key[2] = 0x9e;
+    }
+
+    ppp_mppe_rc4_setkey(&state->rc4, state->session_key, state->keylen);
+    bzero(digest, sizeof(digest));
+}
+
+/* -----------------------------------------------------------------------------
+run len bytes of src (from its start) through the keystream into dst,
+from offset dstoff. dst may be src, with the same offset
+----------------------------------------------------------------------------- */
+static void ppp_mppe_crypt_chain(struct ppp_mppe_rc4 *rc4, mbuf_t src, mbuf_t dst, size_t dstoff, size_t len)
+{
+    u_char	*sp = mbuf_data(src), *dp = (u_char *)mbuf_data(dst) + dstoff;
+    size_t	slen = mbuf_len(src), dlen = mbuf_len(dst) - dstoff, n;
+
+    while (len) {
+        while (slen == 0 && (src = mbuf_next(src))) {
+            sp = mbuf_data(src);
+            slen = mbuf_len(src);
+        }
+        while (dlen == 0 && (dst = mbuf_next(dst))) {
+            dp = mbuf_data(dst);
+            dlen = mbuf_len(dst);
+        }
+        if (src == NULL || dst == NULL)
+            break;
+
+        n = MIN(len, MIN(slen, dlen));
+        ppp_mppe_rc4_crypt(rc4, sp, dp, n);
+        sp += n; slen -= n;
+        dp += n; dlen -= n;
+        len -= n;
+    }
+}
+
+/* -----------------------------------------------------------------------------
+options is the CCP option, followed by the start key
+----------------------------------------------------------------------------- */
+static void *ppp_mppe_alloc(u_char *options, int opt_len)
+{
+    struct ppp_mppe_state	*state;
+
+    if (opt_len != CILEN_MPPE + MPPE_MAX_KEY_LEN
+        || options[0] != CI_MPPE || options[1] != CILEN_MPPE)
+        return NULL;
+
+    state = kalloc_type(struct ppp_mppe_state, Z_WAITOK | Z_ZERO | Z_NOFAIL);
+    bcopy(options + CILEN_MPPE, state->master_key, MPPE_MAX_KEY_LEN);
+    return state;
+}
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+static void ppp_mppe_free(void *arg)
+{
+    struct ppp_mppe_state	*state = arg;
+
+    if (state) {
+        bzero(state, sizeof(*state));
+        kfree_type(struct ppp_mppe_state, state);
+    }
+}
+
+/* -----------------------------------------------------------------------------
+common init, options is the acked CCP option.
+return 1 if MPPE can run with these options, 0 otherwise
+----------------------------------------------------------------------------- */
+static int ppp_mppe_init_state(struct ppp_mppe_state *state, u_char *options, int opt_len,
+                        int unit, int debug)
+{
+    u_int32_t	mppe_opts;
+
+    if (opt_len < CILEN_MPPE || options[0] != CI_MPPE || options[1] != CILEN_MPPE)
+        return 0;
+
+    MPPE_CI_TO_OPTS(&options[2], mppe_opts);
+    if (mppe_opts & MPPE_OPT_128)
+        state->keylen = 16;
+    else if (mppe_opts & MPPE_OPT_40)
+        state->keylen = 8;
+    else {
+        IOLog("ppp%d: mppe, unknown key length\n", unit);
+        return 0;
+    }
+    state->stateful = (mppe_opts & MPPE_OPT_STATEFUL) != 0;
+    state->unit = unit;
+    state->debug = debug;
+
+    bcopy(state->master_key, state->session_key, MPPE_MAX_KEY_LEN);
+    ppp_mppe_rekey(state, 1);
+
+    /* the first packet carries ccount 0 */
+    state->ccount = MPPE_CCOUNT_SPACE - 1;
+    state->discard = 0;
+    state->sanity_errors = 0;
+    bzero(&state->stats, sizeof(state->stats));
+
+    if (debug)
+        IOLog("ppp%d: mppe, %d bits %s\n", unit, state->keylen == 16 ? 128 : 40,
+            state->stateful ? "stateful" : "stateless");
+    return 1;
+}
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+static int ppp_mppe_comp_init(void *arg, u_char *options, int opt_len,
+                        int unit, int hdrlen, int mtu, int debug)
+{
+    struct ppp_mppe_state	*state = arg;
+
+    if (!ppp_mppe_init_state(state, options, opt_len, unit, debug))
+        return 0;
+
+    /* RFC 3078 wants the first packet flushed, peers do not expect it */
+    state->bits = MPPE_BIT_ENCRYPTED;
+    return 1;
+}
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+static int ppp_mppe_decomp_init(void *arg, u_char *options, int opt_len,
+                        int unit, int hdrlen, int mru, int debug)
+{
+    struct ppp_mppe_state	*state = arg;
+
+    if (!ppp_mppe_init_state(state, options, opt_len, unit, debug))
+        return 0;
+
+    state->mru = mru;
+    return 1;
+}
+
+/* -----------------------------------------------------------------------------
+we sent a CCP Reset-Ack, change key with the next packet
+----------------------------------------------------------------------------- */
+static void ppp_mppe_comp_reset(void *arg)
+{
+    struct ppp_mppe_state	*state = arg;
+
+    state->bits |= MPPE_BIT_FLUSHED;
+}
+
+/* -----------------------------------------------------------------------------
+the decompressor resynchronizes on the flushed packets by itself
+----------------------------------------------------------------------------- */
+static void ppp_mppe_decomp_reset(void *arg)
+{
+}
+
+/* -----------------------------------------------------------------------------
+a packet must never leave in clear once MPPE is up,
+so failures drop the packet and return -error
+----------------------------------------------------------------------------- */
+static int ppp_mppe_compress(void *arg, mbuf_t *m)
+{
+    struct ppp_mppe_state	*state = arg;
+    mbuf_t			dst;
+    size_t			len = mbuf_pkthdr_len(*m);
+    u_char			*p;
+
+    if (mbuf_allocpacket(MBUF_DONTWAIT, MPPE_LEADING + MPPE_OVHD + len, NULL, &dst) != 0) {
+        mbuf_freem(*m);
+        *m = NULL;
+        return -ENOBUFS;
+    }
+    mbuf_adj(dst, MPPE_LEADING);
+
+    state->ccount = (state->ccount + 1) & MPPE_CCOUNT_MASK;
+    if (!state->stateful
+        || (state->ccount & 0xff) == 0xff
+        || (state->bits & MPPE_BIT_FLUSHED)) {
+        ppp_mppe_rekey(state, 0);
+        state->bits |= MPPE_BIT_FLUSHED;
+    }
+
+    p = mbuf_data(dst);
+    p[0] = state->bits | (state->ccount >> 8);
+    p[1] = state->ccount & 0xff;
+    state->bits &= ~MPPE_BIT_FLUSHED;
+
+    ppp_mppe_crypt_chain(&state->rc4, *m, dst, MPPE_OVHD, len);
+
+    mbuf_copy_pkthdr(dst, *m);
+    mbuf_pkthdr_setlen(dst, len + MPPE_OVHD);
+    mbuf_freem(*m);
+    *m = dst;
+
+    state->stats.unc_bytes += len;
+    state->stats.unc_packets++;
+    state->stats.comp_bytes += len + MPPE_OVHD;
+    state->stats.comp_packets++;
+    return COMP_OK;
+}
+
+/* -----------------------------------------------------------------------------
+RFC 3078, 8. m starts with the MPPE header, it is decrypted in place
+----------------------------------------------------------------------------- */
+static int ppp_mppe_decompress(void *arg, mbuf_t *m)
+{
+    struct ppp_mppe_state	*state = arg;
+    size_t			len = mbuf_pkthdr_len(*m);
+    u_char			hdr[MPPE_OVHD];
+    u_int16_t			ccount;
+    int				flushed;
+
+    if (len <= MPPE_OVHD || mbuf_copydata(*m, 0, MPPE_OVHD, hdr)) {
+        if (state->debug)
+            IOLog("ppp%d: mppe, short packet (%d)\n", state->unit, (int)len);
+        return DECOMP_ERROR;
+    }
+    len -= MPPE_OVHD;
+    if (len > state->mru + 2) {
+        if (state->debug)
+            IOLog("ppp%d: mppe, packet too big (%d)\n", state->unit, (int)len);
+        return DECOMP_ERROR;
+    }
+
+    ccount = MPPE_CCOUNT(hdr);
+    flushed = MPPE_BITS(hdr) & MPPE_BIT_FLUSHED;
+
+    /* packets we cannot decrypt, or must not accept */
+    if (!(MPPE_BITS(hdr) & MPPE_BIT_ENCRYPTED)
+        || (MPPE_BITS(hdr) & MPPE_BIT_COMP)
+        || (!state->stateful && !flushed)
+        || (state->stateful && (ccount & 0xff) == 0xff && !flushed)) {
+        if (state->debug)
+            IOLog("ppp%d: mppe, bad header %02x %02x\n", state->unit, hdr[0], hdr[1]);
+        state->sanity_errors += 100;
+        goto sanity;
+    }
+
+    if (!state->stateful) {
+        /* late or duplicate packet, the key it used is gone, nothing to resync */
+        if (ccount == state->ccount
+            || ((ccount - state->ccount) & MPPE_CCOUNT_MASK) > MPPE_CCOUNT_SPACE / 2) {
+            if (state->debug)
+                IOLog("ppp%d: mppe, late packet %d, expected > %d\n", state->unit, ccount, state->ccount);
+            return DECOMP_DROPPED;
+        }
+        /* one key change per packet sent, lost ones included */
+        while (state->ccount != ccount) {
+            ppp_mppe_rekey(state, 0);
+            state->ccount = (state->ccount + 1) & MPPE_CCOUNT_MASK;
+        }
+    }
+    else {
+        if (!state->discard) {
+            state->ccount = (state->ccount + 1) & MPPE_CCOUNT_MASK;
+            if (ccount != state->ccount) {
+                /* lost packets, ppp_if_input passes the frame to pppd, which sends a CCP Reset-Request */
+                state->discard = 1;
+                return DECOMP_ERROR;
+            }
+        }
+        else {
+            /* wait for the peer to flush */
+            if (!flushed)
+                return DECOMP_ERROR;
+            /* one key change per flag packet missed */
+            while ((ccount & ~0xff) != (state->ccount & ~0xff)) {
+                ppp_mppe_rekey(state, 0);
+                state->ccount = (state->ccount + 256) & MPPE_CCOUNT_MASK;
+            }
+            state->discard = 0;
+            state->ccount = ccount;
+        }
+        if (flushed)
+            ppp_mppe_rekey(state, 0);
+    }
+
+    mbuf_adj(*m, MPPE_OVHD);
+    ppp_mppe_crypt_chain(&state->rc4, *m, *m, 0, len);
+
+    /* the protocol field is read in place by the caller */
+    if (mbuf_len(*m) < MIN(len, 2) && mbuf_pullup(m, MIN(len, 2)))
+        return DECOMP_ERROR;
+
+    state->stats.unc_bytes += len;
+    state->stats.unc_packets++;
+    state->stats.comp_bytes += len + MPPE_OVHD;
+    state->stats.comp_packets++;
+    state->sanity_errors >>= 1;
+    return DECOMP_OK;
+
+sanity:
+    return state->sanity_errors < MPPE_SANITY_MAX ? DECOMP_ERROR : DECOMP_FATALERROR;
+}
+
+/* -----------------------------------------------------------------------------
+a packet received in clear while MPPE runs, nothing to update
+----------------------------------------------------------------------------- */
+static void ppp_mppe_incomp(void *arg, mbuf_t m)
+{
+    struct ppp_mppe_state	*state = arg;
+
+    if (state->debug)
+        IOLog("ppp%d: mppe, unencrypted packet received\n", state->unit);
+    state->stats.inc_bytes += mbuf_pkthdr_len(m);
+    state->stats.inc_packets++;
+}
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+static void ppp_mppe_stats(void *arg, struct compstat *stats)
+{
+    struct ppp_mppe_state	*state = arg;
+
+    *stats = state->stats;
+}
@@ -2540,6 +2540,340 @@ check_access(f, filename)
 }
 
 
+/*
+ * Secrets files are parsed once into a secrets_cache, kept by file
+ * name for the life of the process and parsed again when the file
+ * changes (device, inode, size or modification time), so that a file
+ * replaced by a rename is picked up as well as one edited in place.
+ * Entries are hashed on their (client, server) words so that a lookup
+ * only looks at the four chains that can match: client/server,
+ * client/'*', '*'/server and '*'/'*'.  Lookups for a NULL client or
+ * server walk all the entries.
+ * All the words of a line are kept in a single block, which is
+ * cleared as a whole when the cache is freed: the secrets of an old
+ * version of a file do not linger in freed memory.
+ */
+struct secret_entry {
+    char	*client;
+    char	*server;
+    char	*secret;
+    char	**words;	/* address authorization info and options */
+    int		nwords;
+    int		next;		/* next entry in hash chain, -1 at end */
+    char	**line;		/* block holding all the words of the line */
+    size_t	size;		/* size of the block */
+};
+
+struct secrets_cache {
+    struct secrets_cache *next;
+    char	*name;		/* file name, as opened */
+    dev_t	dev;
+    ino_t	ino;
+    off_t	size;
+    struct timespec mtime;
+    struct secret_entry *entries; /* in file order */
+    int		nentries;
+    int		*buckets;	/* first entry of each hash chain, -1 if empty */
+    int		nbuckets;	/* power of 2 */
+};
+
+static struct secrets_cache *secrets_caches = NULL;
+
+/*
+ * secrets_hash - hash a (client, server) pair.
+ */
+static unsigned int
+secrets_hash(client, server)
+    char *client;
+    char *server;
+{
+    unsigned int h = 5381;
+
+    while (*client)
+	h = h * 33 + (u_char) *client++;
+    h = h * 33;
+    while (*server)
+	h = h * 33 + (u_char) *server++;
+    return h;
+}
+
+/*
+ * secrets_cache_free - release a cache and all its entries,
+ * clearing the secrets first.
+ */
+static void
+secrets_cache_free(sc)
+    struct secrets_cache *sc;
+{
+    struct secret_entry *e;
+    int i;
+
+    for (i = 0; i < sc->nentries; i++) {
+	e = &sc->entries[i];
+	BZERO(e->line, e->size);
+	free(e->line);
+    }
+    free(sc->entries);
+    free(sc->buckets);
+    free(sc->name);
+    free(sc);
+}
+
+/*
+ * secrets_entry_set - copy the words of a line, client, server, secret
+ * then the address authorization info and options, to a single block.
+ * The words are in buf, each one followed by a nul.
+ */
+static void
+secrets_entry_set(e, buf, len, nwords)
+    struct secret_entry *e;
+    char *buf;
+    size_t len;
+    int nwords;
+{
+    char **wp, *p;
+    int i;
+
+    e->size = (nwords + 1) * sizeof(char *) + len;
+    if ((wp = malloc(e->size)) == NULL)
+	novm("secrets file");
+    p = (char *) (wp + nwords + 1);
+    memcpy(p, buf, len);
+    for (i = 0; i < nwords; i++) {
+	wp[i] = p;
+	p += strlen(p) + 1;
+    }
+    wp[nwords] = NULL;
+
+    e->line = wp;
+    e->client = wp[0];
+    e->server = wp[1];
+    e->secret = wp[2];
+    e->words = wp + 3;
+    e->nwords = nwords - 3;
+}
+
+/*
+ * secrets_cache_parse - read all the entries of an authorization file.
+ * Lines are split the same way scan_authfile always did: client,
+ * server, secret, then address authorization words and options.
+ * Lines with fewer than three words are ignored.
+ */
+static void
+secrets_cache_parse(f, sc, filename)
+    FILE *f;
+    struct secrets_cache *sc;
+    char *filename;
+{
+    int newline, more, maxentries, nwords;
+    size_t len, wlen, maxlen;
+    char *buf, *nbuf;
+    char word[MAXWORDLEN];
+
+    maxentries = 0;
+    maxlen = 4 * MAXWORDLEN;
+    if ((buf = malloc(maxlen)) == NULL)
+	novm("secrets file");
+    if (!getword(f, word, &newline, filename))
+	goto done;		/* file is empty??? */
+    newline = 1;
+    for (;;) {
+	/*
+	 * Skip until we find a word at the start of a line.
+	 */
+	while (!newline && getword(f, word, &newline, filename))
+	    ;
+	if (!newline)
+	    break;		/* got to end of file */
+
+	/*
+	 * Collect the words of the line, the line is an entry
+	 * if it has a client, a server and a secret.
+	 */
+	len = 0;
+	nwords = 0;
+	do {
+	    wlen = strlen(word) + 1;
+	    if (len + wlen > maxlen) {
+		/* don't leave secrets behind in a freed block */
+		if ((nbuf = malloc((len + wlen) * 2)) == NULL)
+		    novm("secrets file");
+		memcpy(nbuf, buf, len);
+		BZERO(buf, maxlen);
+		free(buf);
+		buf = nbuf;
+		maxlen = (len + wlen) * 2;
+	    }
+	    memcpy(buf + len, word, wlen);
+	    len += wlen;
+	    nwords++;
+	} while ((more = getword(f, word, &newline, filename)) && !newline);
+
+	if (nwords >= 3) {
+	    if (sc->nentries == maxentries) {
+		maxentries = maxentries ? maxentries * 2 : 64;
+		sc->entries = realloc(sc->entries, maxentries * sizeof(struct secret_entry));
+		if (sc->entries == NULL)
+		    novm("secrets file");
+	    }
+	    secrets_entry_set(&sc->entries[sc->nentries++], buf, len, nwords);
+	}
+
+	if (!more)
+	    break;		/* got to end of file */
+    }
+
+done:
+    BZERO(buf, maxlen);
+    free(buf);
+    BZERO(word, sizeof(word));
+}
+
+/*
+ * secrets_cache_index - build the hash chains, walking backwards
+ * so that each chain ends up in file order.
+ */
+static void
+secrets_cache_index(sc)
+    struct secrets_cache *sc;
+{
+    struct secret_entry *e;
+    unsigned int h;
+    int i;
+
+    for (sc->nbuckets = 16; sc->nbuckets < sc->nentries; sc->nbuckets *= 2)
+	;
+    if ((sc->buckets = malloc(sc->nbuckets * sizeof(int))) == NULL)
+	novm("secrets file");
+    for (i = 0; i < sc->nbuckets; i++)
+	sc->buckets[i] = -1;
+    for (i = sc->nentries - 1; i >= 0; i--) {
+	e = &sc->entries[i];
+	h = secrets_hash(e->client, e->server) & (sc->nbuckets - 1);
+	e->next = sc->buckets[h];
+	sc->buckets[h] = i;
+    }
+}
+
+/*
+ * secrets_cache_get - return the parsed contents of f,
+ * reading it only if we don't already have them.
+ */
+static struct secrets_cache *
+secrets_cache_get(f, filename)
+    FILE *f;
+    char *filename;
+{
+    struct secrets_cache *sc, **scp;
+    struct stat sbuf;
+
+    if (fstat(fileno(f), &sbuf) < 0) {
+	error("cannot stat secret file %s: %m", filename);
+	return NULL;
+    }
+
+    for (scp = &secrets_caches; (sc = *scp) != NULL; scp = &sc->next) {
+	if (strcmp(sc->name, filename))
+	    continue;
+	if (sc->dev == sbuf.st_dev && sc->ino == sbuf.st_ino
+	    && sc->size == sbuf.st_size
+	    && sc->mtime.tv_sec == sbuf.st_mtimespec.tv_sec
+	    && sc->mtime.tv_nsec == sbuf.st_mtimespec.tv_nsec)
+	    return sc;
+	/* the file changed, forget what we had */
+	*scp = sc->next;
+	secrets_cache_free(sc);
+	break;
+    }
+
+    if ((sc = calloc(1, sizeof(struct secrets_cache))) == NULL
+	|| (sc->name = strdup(filename)) == NULL)
+	novm("secrets file");
+    sc->dev = sbuf.st_dev;
+    sc->ino = sbuf.st_ino;
+    sc->size = sbuf.st_size;
+    sc->mtime = sbuf.st_mtimespec;
+    secrets_cache_parse(f, sc, filename);
+    secrets_cache_index(sc);
+    sc->next = secrets_caches;
+    secrets_caches = sc;
+    return sc;
+}
+
+/*
+ * secret_usable - check that the secret of an entry can be used,
+ * and copy it to lsecret.  See scan_authfile for secret and flags.
+ */
+static int
+secret_usable(e, secret, lsecret, flags)
+    struct secret_entry *e;
+    char *secret;
+    char *lsecret;
+    int flags;
+{
+    FILE *sf;
+    int xxx;
+    char *cp;
+    char atfile[MAXWORDLEN];
+
+    /*
+     * SRP-SHA1 authenticator should never be reading secrets from
+     * a file.  (Authenticatee may, though.)
+     */
+    if (flags && ((cp = strchr(e->secret, ':')) == NULL ||
+	strchr(cp + 1, ':') == NULL))
+	return 0;
+
+    if (secret == NULL)
+	return 1;
+
+    /*
+     * Special syntax: @/pathname means read secret from file.
+     */
+    if (e->secret[0] == '@' && e->secret[1] == '/') {
+	strlcpy(atfile, e->secret+1, sizeof(atfile));
+	if ((sf = fopen(atfile, "r")) == NULL) {
+	    warning("can't open indirect secret file %s", atfile);
+	    return 0;
+	}
+	check_access(sf, atfile);
+	if (!getword(sf, lsecret, &xxx, atfile)) {
+	    warning("no secret in indirect secret file %s", atfile);
+	    fclose(sf);
+	    return 0;
+	}
+	fclose(sf);
+	return 1;
+    }
+    strlcpy(lsecret, e->secret, MAXWORDLEN);
+    return 1;
+}
+
+/*
+ * secret_match - return the scan_authfile flags for an entry,
+ * or -1 if it is not for client on server.
+ */
+static int
+secret_match(e, client, server)
+    struct secret_entry *e;
+    char *client;
+    char *server;
+{
+    int got_flag = 0;
+
+    if (!ISWILD(e->client)) {
+	if (client != NULL && strcmp(e->client, client) != 0)
+	    return -1;
+	got_flag = NONWILD_CLIENT;
+    }
+    if (!ISWILD(e->server)) {
+	if (server != NULL && strcmp(e->server, server) != 0)
+	    return -1;
+	got_flag |= NONWILD_SERVER;
+    }
+    return got_flag;
+}
+
 /*
  * scan_authfile - Scan an authorization file for a secret suitable
  * for authenticating `client' on `server'.  The return value is -1
@@ -2553,6 +2887,8 @@ check_access(f, filename)
  * We assume secret is NULL or points to MAXWORDLEN bytes of space.
   * Flags are non-zero if we need two colons in the secret in order to
  * match.
+ * When several lines match, the most specific one wins, and the first
+ * one in the file among equally specific ones.
 */
 static int
 scan_authfile(f, client, server, secret, addrs, opts, filename, flags)
@@ -2565,133 +2901,83 @@ scan_authfile(f, client, server, secret, addrs, opts, filename, flags)
     char *filename;
     int flags;
 {
-    int newline, xxx;
-    int got_flag, best_flag;
-    FILE *sf;
-    struct wordlist *ap, *addr_list, *alist, **app;
-    char word[MAXWORDLEN];
-    char atfile[MAXWORDLEN];
+    int got_flag, best_flag, i, k, len;
+    struct secrets_cache *sc;
+    struct secret_entry *e, *best;
+    struct wordlist *ap, *addr_list, **app;
     char lsecret[MAXWORDLEN];
-    char *cp;
+    char *keys[4][2];
 
     if (addrs != NULL)
 	*addrs = NULL;
     if (opts != NULL)
 	*opts = NULL;
     addr_list = NULL;
-    if (!getword(f, word, &newline, filename))
-	return -1;		/* file is empty??? */
-    newline = 1;
-    best_flag = -1;
-    for (;;) {
-	/*
-	 * Skip until we find a word at the start of a line.
-	 */
-	while (!newline && getword(f, word, &newline, filename))
-	    ;
-	if (!newline)
-	    break;		/* got to end of file */
-
-	/*
-	 * Got a client - check if it's a match or a wildcard.
-	 */
-	got_flag = 0;
-	if (client != NULL && strcmp(word, client) != 0 && !ISWILD(word)) {
-	    newline = 0;
-	    continue;
-	}
-	if (!ISWILD(word))
-	    got_flag = NONWILD_CLIENT;
-
-	/*
-	 * Now get a server and check if it matches.
-	 */
-	if (!getword(f, word, &newline, filename))
-	    break;
-	if (newline)
-	    continue;
-	if (!ISWILD(word)) {
-	    if (server != NULL && strcmp(word, server) != 0)
-		continue;
-	    got_flag |= NONWILD_SERVER;
-	}
-
-	/*
-	 * Got some sort of a match - see if it's better than what
-	 * we have already.
-	 */
-	if (got_flag <= best_flag)
-	    continue;
-
-	/*
-	 * Get the secret.
-	 */
-	if (!getword(f, word, &newline, filename))
-	    break;
-	if (newline)
-	    continue;
+    if ((sc = secrets_cache_get(f, filename)) == NULL)
+	return -1;
 
+    best = NULL;
+    best_flag = -1;
+    if (client != NULL && server != NULL) {
 	/*
-	 * SRP-SHA1 authenticator should never be reading secrets from
-	 * a file.  (Authenticatee may, though.)
+	 * Each chain holds entries with the same specificity,
+	 * look at them from the most specific to the least.
 	 */
-	if (flags && ((cp = strchr(word, ':')) == NULL ||
-	    strchr(cp + 1, ':') == NULL))
-	    continue;
-
-	if (secret != NULL) {
-	    /*
-	     * Special syntax: @/pathname means read secret from file.
-	     */
-	    if (word[0] == '@' && word[1] == '/') {
-		strlcpy(atfile, word+1, sizeof(atfile));
-		if ((sf = fopen(atfile, "r")) == NULL) {
-		    warning("can't open indirect secret file %s", atfile);
+	keys[0][0] = client; keys[0][1] = server;
+	keys[1][0] = client; keys[1][1] = "*";
+	keys[2][0] = "*"; keys[2][1] = server;
+	keys[3][0] = "*"; keys[3][1] = "*";
+	for (k = 0; k < 4 && best == NULL; k++) {
+	    i = sc->buckets[secrets_hash(keys[k][0], keys[k][1]) & (sc->nbuckets - 1)];
+	    for (; i != -1; i = e->next) {
+		e = &sc->entries[i];
+		if (strcmp(e->client, keys[k][0]) != 0 || strcmp(e->server, keys[k][1]) != 0)
 		    continue;
-		}
-		check_access(sf, atfile);
-		if (!getword(sf, word, &xxx, atfile)) {
-		    warning("no secret in indirect secret file %s", atfile);
-		    fclose(sf);
+		if ((got_flag = secret_match(e, client, server)) < 0
+		    || !secret_usable(e, secret, lsecret, flags))
 		    continue;
-		}
-		fclose(sf);
-	    }
-	    strlcpy(lsecret, word, sizeof(lsecret));
-	}
-
-	/*
-	 * Now read address authorization info and make a wordlist.
-	 */
-	app = &alist;
-	for (;;) {
-	    if (!getword(f, word, &newline, filename) || newline)
+		best = e;
+		best_flag = got_flag;
 		break;
-		int	len = (int)strlen(word) + 1;
-	    ap = (struct wordlist *)
-		    malloc(sizeof(struct wordlist) + len);
-	    if (ap == NULL)
-		novm("authorized addresses");
-	    ap->word = (char *) (ap + 1);
-	    strlcpy(ap->word, word, len);
-	    *app = ap;
-	    app = &ap->next;
+	    }
 	}
-	*app = NULL;
-
-	/*
-	 * This is the best so far; remember it.
-	 */
-	best_flag = got_flag;
-	if (addr_list)
-	    free_wordlist(addr_list);
-	addr_list = alist;
-	if (secret != NULL)
+	if (best != NULL && secret != NULL)
 	    strlcpy(secret, lsecret, MAXWORDLEN);
+    } else {
+	for (i = 0; i < sc->nentries; i++) {
+	    e = &sc->entries[i];
+	    if ((got_flag = secret_match(e, client, server)) <= best_flag
+		|| !secret_usable(e, secret, lsecret, flags))
+		continue;
+	    /*
+	     * This is the best so far; remember it.
+	     */
+	    best = e;
+	    best_flag = got_flag;
+	    if (secret != NULL)
+		strlcpy(secret, lsecret, MAXWORDLEN);
+	}
+    }
+    BZERO(lsecret, sizeof(lsecret));
+    if (best == NULL)
+	return -1;
 
-	if (!newline)
-	    break;
+    /*
+     * Now make a wordlist of the address authorization info.
+     */
+    app = &addr_list;
+    for (i = 0; i < best->nwords; i++) {
+	len = (int)strlen(best->words[i]) + 1;
+	ap = (struct wordlist *)
+		malloc(sizeof(struct wordlist) + len);
+	if (ap == NULL)
+	    novm("authorized addresses");
+	ap->word = (char *) (ap + 1);
+	strlcpy(ap->word, best->words[i], len);
+	*app = ap;
+	app = &ap->next;
     }
+    *app = NULL;
 
     /* scan for a -- word indicating the start of options */
     for (app = &addr_list; (ap = *app) != NULL; app = &ap->next)
@@ -0,0 +1,318 @@
+/*
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+/*
+ * callout.h - the pending timeouts of pppd.
+ *
+ * Callouts are kept in a binary min-heap ordered by expiry time, ties broken
+ * by insertion order so that timeouts due at the same time run first-in
+ * first-out.  Each callout is also hashed on (func, arg), the handle of the
+ * timeout()/untimeout() API, so that a cancel finds its callout without
+ * searching the heap.  The hash doubles when it holds more callouts than
+ * buckets and halves when it holds less than a quarter, so a lookup stays
+ * O(1) with thousands of timers; the heap array follows the same way.
+ * Released callouts are kept on a short free list and given back to malloc
+ * beyond that.
+ *
+ * Everything is static inline so that main.c and callout_test.c each get a copy;
+ * an allocation failure is returned, pppd treats it as fatal.
+ */
+
+#ifndef __CALLOUT_H__
+#define __CALLOUT_H__
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct	callout {
+    struct timeval	c_time;		/* time at which to call routine */
+    void		*c_arg;		/* argument to routine */
+    void		(*c_func) __P((void *)); /* routine */
+    u_int32_t		c_seq;		/* insertion order, for equal times */
+    int			c_index;	/* position in the heap */
+    struct		callout *c_next; /* hash chain, or free list */
+};
+
+struct callout_table {
+    struct callout	**heap;		/* pending callouts, soonest first */
+    int			count;		/* callouts in heap */
+    int			max;		/* slots allocated in heap */
+    struct callout	**hash;		/* by (func, arg) */
+    int			hash_size;	/* buckets, a power of 2 */
+    struct callout	*free;		/* released callouts kept for reuse */
+    int			nfree;
+    u_int32_t		seq;		/* next insertion order */
+};
+
+#define CALLOUT_MIN		32	/* heap slots and hash buckets, never less */
+#define CALLOUT_FREE_MAX	32	/* released callouts kept for reuse */
+
+#define CALLOUT_HASH(t, func, arg) \
+    ((((uintptr_t)(func) ^ (uintptr_t)(arg)) >> 3) & ((t)->hash_size - 1))
+
+/*
+ * callout_before - true if a expires before b.
+ */
+static __inline__ int
+callout_before(a, b)
+    struct callout *a, *b;
+{
+    if (a->c_time.tv_sec != b->c_time.tv_sec)
+	return a->c_time.tv_sec < b->c_time.tv_sec;
+    if (a->c_time.tv_usec != b->c_time.tv_usec)
+	return a->c_time.tv_usec < b->c_time.tv_usec;
+    return (int32_t)(a->c_seq - b->c_seq) < 0;
+}
+
+/*
+ * callout_set - Store p at heap position i.
+ */
+static __inline__ void
+callout_set(t, i, p)
+    struct callout_table *t;
+    int i;
+    struct callout *p;
+{
+    t->heap[i] = p;
+    p->c_index = i;
+}
+
+/*
+ * callout_up - Move the callout at position i towards the root.
+ */
+static __inline__ void
+callout_up(t, i)
+    struct callout_table *t;
+    int i;
+{
+    struct callout *p = t->heap[i];
+    int parent;
+
+    while (i > 0) {
+	parent = (i - 1) / 2;
+	if (!callout_before(p, t->heap[parent]))
+	    break;
+	callout_set(t, i, t->heap[parent]);
+	i = parent;
+    }
+    callout_set(t, i, p);
+}
+
+/*
+ * callout_down - Move the callout at position i towards the leaves.
+ */
+static __inline__ void
+callout_down(t, i)
+    struct callout_table *t;
+    int i;
+{
+    struct callout *p = t->heap[i];
+    int child;
+
+    while ((child = 2 * i + 1) < t->count) {
+	if (child + 1 < t->count
+	    && callout_before(t->heap[child + 1], t->heap[child]))
+	    child++;
+	if (!callout_before(t->heap[child], p))
+	    break;
+	callout_set(t, i, t->heap[child]);
+	i = child;
+    }
+    callout_set(t, i, p);
+}
+
+/*
+ * callout_rehash - Move the pending callouts to a hash of size buckets.
+ * The old hash is kept if the new one cannot be allocated.
+ */
+static __inline__ int
+callout_rehash(t, size)
+    struct callout_table *t;
+    int size;
+{
+    struct callout **hash, **bucket, *p;
+    int i;
+
+    if ((hash = (struct callout **) calloc(size, sizeof(struct callout *))) == NULL)
+	return -1;
+    free(t->hash);
+    t->hash = hash;
+    t->hash_size = size;
+    for (i = 0; i < t->count; i++) {
+	p = t->heap[i];
+	bucket = &t->hash[CALLOUT_HASH(t, p->c_func, p->c_arg)];
+	p->c_next = *bucket;
+	*bucket = p;
+    }
+    return 0;
+}
+
+/*
+ * callout_resize - Resize the heap array to max slots.
+ */
+static __inline__ int
+callout_resize(t, max)
+    struct callout_table *t;
+    int max;
+{
+    struct callout **heap;
+
+    if ((heap = (struct callout **) realloc(t->heap, max * sizeof(struct callout *))) == NULL)
+	return -1;
+    t->heap = heap;
+    t->max = max;
+    return 0;
+}
+
+/*
+ * callout_insert - Schedule func(arg) at time *when.
+ * Returns -1 if memory is exhausted.
+ */
+static __inline__ int
+callout_insert(t, func, arg, when)
+    struct callout_table *t;
+    void (*func) __P((void *));
+    void *arg;
+    struct timeval *when;
+{
+    struct callout *p, **bucket;
+
+    if (t->count == t->max
+	&& callout_resize(t, t->max ? t->max * 2 : CALLOUT_MIN) < 0)
+	return -1;
+    if (t->count >= t->hash_size
+	&& callout_rehash(t, t->hash_size ? t->hash_size * 2 : CALLOUT_MIN) < 0
+	&& t->hash_size == 0)
+	return -1;
+
+    if ((p = t->free) != NULL) {
+	t->free = p->c_next;
+	t->nfree--;
+    } else if ((p = (struct callout *) malloc(sizeof(struct callout))) == NULL)
+	return -1;
+
+    p->c_func = func;
+    p->c_arg = arg;
+    p->c_time = *when;
+    p->c_seq = t->seq++;
+
+    bucket = &t->hash[CALLOUT_HASH(t, func, arg)];
+    p->c_next = *bucket;
+    *bucket = p;
+    callout_set(t, t->count, p);
+    callout_up(t, t->count++);
+    return 0;
+}
+
+/*
+ * callout_find - The first callout for func(arg) to expire, or NULL.
+ */
+static __inline__ struct callout *
+callout_find(t, func, arg)
+    struct callout_table *t;
+    void (*func) __P((void *));
+    void *arg;
+{
+    struct callout *p, *first = NULL;
+
+    if (t->hash_size == 0)
+	return NULL;
+    for (p = t->hash[CALLOUT_HASH(t, func, arg)]; p; p = p->c_next)
+	if (p->c_func == func && p->c_arg == arg
+	    && (first == NULL || callout_before(p, first)))
+	    first = p;
+    return first;
+}
+
+/*
+ * callout_remove - Take p out of the heap and the hash, and release it.
+ */
+static __inline__ void
+callout_remove(t, p)
+    struct callout_table *t;
+    struct callout *p;
+{
+    struct callout **pp;
+    int i = p->c_index;
+
+    for (pp = &t->hash[CALLOUT_HASH(t, p->c_func, p->c_arg)]; *pp != p;
+	 pp = &(*pp)->c_next)
+	;
+    *pp = p->c_next;
+
+    if (i != --t->count) {
+	callout_set(t, i, t->heap[t->count]);
+	if (i > 0 && callout_before(t->heap[i], t->heap[(i - 1) / 2]))
+	    callout_up(t, i);
+	else
+	    callout_down(t, i);
+    }
+
+    if (t->nfree < CALLOUT_FREE_MAX) {
+	p->c_next = t->free;
+	t->free = p;
+	t->nfree++;
+    } else
+	free(p);
+
+    /* shrink after a burst, failing to is harmless */
+    if (t->max > CALLOUT_MIN && t->count < t->max / 4)
+	callout_resize(t, t->max / 2);
+    if (t->hash_size > CALLOUT_MIN && t->count < t->hash_size / 4)
+	callout_rehash(t, t->hash_size / 2);
+}
+
+/*
+ * callout_first - The next callout to expire, or NULL.
+ */
+static __inline__ struct callout *
+callout_first(t)
+    struct callout_table *t;
+{
+    return t->count ? t->heap[0] : NULL;
+}
+
+/*
+ * callout_flush - Release all the callouts and the tables.
+ */
+static __inline__ void
+callout_flush(t)
+    struct callout_table *t;
+{
+    struct callout *p;
+
+    while (t->count)
+	free(t->heap[--t->count]);
+    while ((p = t->free) != NULL) {
+	t->free = p->c_next;
+	free(p);
+    }
+    free(t->heap);
+    free(t->hash);
+    memset(t, 0, sizeof(*t));
+}
+
+#endif /* __CALLOUT_H__ */
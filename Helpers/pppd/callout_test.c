@@ -0,0 +1,298 @@
+/*
+ * callout_test.c - tests and benchmark for the pppd timeout queue in callout.h.
+ *
+ * Built by the "callout_test (Tool)" target, which runs it after the build
+ * and fails when callouts do not expire in order or a cancel removes the
+ * wrong one.  It also times timeout/untimeout churn and expiry with thousands
+ * of pending timers, next to the sorted list pppd used before.
+ */
+
+#include <sys/cdefs.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "callout.h"
+
+#define ARGS		16384		/* distinct (func, arg) handles */
+#define CHURN		200000		/* cancel and re-arm per run */
+
+static struct callout_table t;
+static int failures = 0;
+
+static void *fired[ARGS + 1];
+static int nfired;
+
+static void
+func_a(arg)
+    void *arg;
+{
+    fired[nfired++] = arg;
+}
+
+static void
+func_b(arg)
+    void *arg;
+{
+    fired[nfired++] = arg;
+}
+
+static void
+check(what, ok)
+    char *what;
+    int ok;
+{
+    if (ok) {
+	printf("PASS: %s\n", what);
+	return;
+    }
+    printf("FAIL: %s\n", what);
+    failures++;
+}
+
+static double
+now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+at(tv, ms)
+    struct timeval *tv;
+    long ms;
+{
+    tv->tv_sec = ms / 1000;
+    tv->tv_usec = (ms % 1000) * 1000;
+}
+
+/* run everything due at ms, as calltimeout does */
+static void
+expire(ms)
+    long ms;
+{
+    struct callout *p;
+    struct timeval tv;
+    void (*func) __P((void *));
+    void *arg;
+
+    at(&tv, ms);
+    while ((p = callout_first(&t)) != NULL
+	   && (p->c_time.tv_sec < tv.tv_sec
+	       || (p->c_time.tv_sec == tv.tv_sec && p->c_time.tv_usec <= tv.tv_usec))) {
+	func = p->c_func;
+	arg = p->c_arg;
+	callout_remove(&t, p);
+	(*func)(arg);
+    }
+}
+
+static void
+untimeout(func, arg)
+    void (*func) __P((void *));
+    void *arg;
+{
+    struct callout *p;
+
+    if ((p = callout_find(&t, func, arg)) != NULL)
+	callout_remove(&t, p);
+}
+
+static void
+tests()
+{
+    struct timeval tv;
+    int i, ok;
+
+    /* reverse order of arming, expiry order wins */
+    for (i = ARGS; i > 0; i--) {
+	at(&tv, i * 10);
+	callout_insert(&t, func_a, (void *)(uintptr_t)i, &tv);
+    }
+    check("hash grows with the timers", t.hash_size >= ARGS);
+    expire(ARGS * 10);
+    for (i = 0, ok = nfired == ARGS; ok && i < ARGS; i++)
+	ok = fired[i] == (void *)(uintptr_t)(i + 1);
+    check("callouts expire by time", ok);
+    check("tables shrink when empty", t.count == 0 && t.max == CALLOUT_MIN
+	  && t.hash_size == CALLOUT_MIN && t.nfree <= CALLOUT_FREE_MAX);
+
+    /* same time, first in first out */
+    nfired = 0;
+    at(&tv, 1000);
+    for (i = 1; i <= 100; i++)
+	callout_insert(&t, func_a, (void *)(uintptr_t)i, &tv);
+    expire(1000);
+    for (i = 0, ok = nfired == 100; ok && i < 100; i++)
+	ok = fired[i] == (void *)(uintptr_t)(i + 1);
+    check("equal times run in insertion order", ok);
+
+    /* untimeout takes the first of several identical ones, and only matching ones */
+    nfired = 0;
+    at(&tv, 3000);
+    callout_insert(&t, func_a, (void *)1, &tv);
+    at(&tv, 2000);
+    callout_insert(&t, func_a, (void *)1, &tv);
+    callout_insert(&t, func_b, (void *)1, &tv);
+    untimeout(func_a, (void *)1);
+    expire(2000);
+    check("untimeout removes the first to expire", nfired == 1 && t.count == 1);
+    untimeout(func_b, (void *)1);
+    check("untimeout of a fired callout does nothing", t.count == 1);
+    untimeout(func_a, (void *)1);
+    check("untimeout removes the last one", t.count == 0);
+
+    callout_flush(&t);
+}
+
+/*
+ * The sorted list and linear search pppd used before, for comparison.
+ */
+struct lcallout {
+    struct timeval	c_time;
+    void		*c_arg;
+    void		(*c_func) __P((void *));
+    struct lcallout	*c_next;
+};
+
+static struct lcallout *lcallout = NULL;
+
+static void
+ltimeout(func, arg, tv)
+    void (*func) __P((void *));
+    void *arg;
+    struct timeval *tv;
+{
+    struct lcallout *newp, *p, **pp;
+
+    newp = (struct lcallout *) malloc(sizeof(struct lcallout));
+    newp->c_arg = arg;
+    newp->c_func = func;
+    newp->c_time = *tv;
+    for (pp = &lcallout; (p = *pp); pp = &p->c_next)
+	if (newp->c_time.tv_sec < p->c_time.tv_sec
+	    || (newp->c_time.tv_sec == p->c_time.tv_sec
+		&& newp->c_time.tv_usec < p->c_time.tv_usec))
+	    break;
+    newp->c_next = p;
+    *pp = newp;
+}
+
+static void
+luntimeout(func, arg)
+    void (*func) __P((void *));
+    void *arg;
+{
+    struct lcallout **copp, *freep;
+
+    for (copp = &lcallout; (freep = *copp); copp = &freep->c_next)
+	if (freep->c_func == func && freep->c_arg == arg) {
+	    *copp = freep->c_next;
+	    free(freep);
+	    break;
+	}
+}
+
+static void
+lflush()
+{
+    struct lcallout *p;
+
+    while ((p = lcallout) != NULL) {
+	lcallout = p->c_next;
+	free(p);
+    }
+}
+
+/*
+ * n timers pending, each restart cancels a random one and arms it again
+ * later, the way LCP and IPCP restart timers and echo timers are used.
+ */
+static void
+bench(n)
+    int n;
+{
+    struct timeval tv;
+    double start, heap, list;
+    long clock = 0;
+    int i, arg, churn;
+
+    srandom(n);
+    for (i = 1; i <= n; i++) {
+	at(&tv, random() % 30000);
+	callout_insert(&t, func_a, (void *)(uintptr_t)i, &tv);
+    }
+    start = now();
+    for (i = 0; i < CHURN; i++) {
+	arg = 1 + random() % n;
+	untimeout(func_a, (void *)(uintptr_t)arg);
+	at(&tv, clock++ + random() % 30000);
+	callout_insert(&t, func_a, (void *)(uintptr_t)arg, &tv);
+    }
+    heap = (now() - start) / CHURN * 1e9;
+    callout_flush(&t);
+
+    /* the list is O(n) a restart, keep its run short */
+    churn = CHURN / (n / 256 + 1);
+    srandom(n);
+    for (i = 1; i <= n; i++) {
+	at(&tv, random() % 30000);
+	ltimeout(func_a, (void *)(uintptr_t)i, &tv);
+    }
+    start = now();
+    clock = 0;
+    for (i = 0; i < churn; i++) {
+	arg = 1 + random() % n;
+	luntimeout(func_a, (void *)(uintptr_t)arg);
+	at(&tv, clock++ + random() % 30000);
+	ltimeout(func_a, (void *)(uintptr_t)arg, &tv);
+    }
+    list = (now() - start) / churn * 1e9;
+    lflush();
+
+    printf("BENCH: %5d timers, untimeout and timeout %6.0f ns (sorted list %8.0f ns)\n",
+	   n, heap, list);
+}
+
+/* arm n timers, then let them all expire */
+static void
+bench_expire(n)
+    int n;
+{
+    struct timeval tv;
+    double start;
+    int i;
+
+    srandom(n);
+    start = now();
+    for (i = 1; i <= n; i++) {
+	at(&tv, random() % 30000);
+	callout_insert(&t, func_a, (void *)(uintptr_t)i, &tv);
+    }
+    nfired = 0;
+    expire(30000);
+    printf("BENCH: %5d timers, timeout and expiry %6.0f ns\n",
+	   n, (now() - start) / n * 1e9);
+    callout_flush(&t);
+}
+
+int
+main(argc, argv)
+    int argc;
+    char **argv;
+{
+    tests();
+
+    bench(1024);
+    bench(4096);
+    bench(16384);
+    bench_expire(16384);
+
+    if (failures) {
+	printf("%d test(s) failed\n", failures);
+	return 1;
+    }
+    printf("all tests passed\n");
+    return 0;
+}
@@ -646,7 +646,7 @@ chap_respond(struct chap_client_state *cs, int id,
 }
 
 static void
-chap_wait_input_fd(void)
+chap_wait_input_fd(int fd, void *arg)
 {
     char	result;
 	int		nlen, err;
@@ -657,13 +657,12 @@ chap_wait_input_fd(void)
 	u_char secret[MAXSECRETLEN+1];
 	struct chap_client_state *cs = &client;
 	
-    if (chap_ui_fds[0] != -1 && is_ready_fd(chap_ui_fds[0])) {
+    if (chap_ui_fds[0] != -1 && chap_ui_fds[0] == fd) {
     
 		inside_UI = 0;
         result = 0;
         read(chap_ui_fds[0], &result, 1);
         
-        wait_input_hook = 0;
         remove_fd(chap_ui_fds[0]);
         close(chap_ui_fds[0]);
         close(chap_ui_fds[1]);
@@ -768,8 +767,7 @@ chap_invoke_ui()
         return -1;
     }
     
-    wait_input_hook = chap_wait_input_fd;
-    add_fd(chap_ui_fds[0]);
+    add_fd_handler(chap_ui_fds[0], chap_wait_input_fd, 0);
     return 0;
 }
 
@@ -445,23 +445,29 @@ static void
 rc4_crypt(struct rc4_state *const state,
         const u_char *inbuf, u_char *outbuf, int buflen)
 {
+        u_char *const perm = state->perm;
+        u_char index1 = state->index1;
+        u_char index2 = state->index2;
+        u_char a, b;
         int i;
-        u_char j;
 
+        /* keep the indices in registers, store them back once */
         for (i = 0; i < buflen; i++) {
 
                 /* Update modification indicies */
-                state->index1++;
-                state->index2 += state->perm[state->index1];
+                a = perm[++index1];
+                index2 += a;
 
                 /* Modify permutation */
-                swap_bytes(&state->perm[state->index1],
-                    &state->perm[state->index2]);
+                b = perm[index2];
+                perm[index1] = b;
+                perm[index2] = a;
 
                 /* Encrypt/decrypt next byte */
-                j = state->perm[state->index1] + state->perm[state->index2];
-                outbuf[i] = inbuf[i] ^ state->perm[j];
+                outbuf[i] = inbuf[i] ^ perm[(u_char)(a + b)];
         }
+        state->index1 = index1;
+        state->index2 = index2;
 }
 
 
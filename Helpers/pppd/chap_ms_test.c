@@ -0,0 +1,173 @@
+/*
+ * chap_ms_test.c - known answer tests for the MS-CHAPv2 code in chap_ms.c.
+ *
+ * Built by the "chap_ms_test (Tool)" target, which runs it after the build
+ * and fails when a computed value differs from the published one.
+ *
+ * chap_ms.c is included so that its static helpers can be checked one by
+ * one; the pppd routines it calls are stubbed below.
+ */
+
+#include "chap_ms.c"
+
+#include <stdarg.h>
+
+#ifndef CHAPMS
+#error chap_ms_test needs CHAPMS
+#endif
+
+/*
+ * Stubs for the parts of pppd that chap_ms.c refers to.
+ */
+int (*change_password_hook) __P((u_char *msg)) = NULL;
+int (*retry_password_hook) __P((u_char *msg)) = NULL;
+#ifdef MPPE
+ccp_options ccp_wantoptions[NUM_PPP];
+#endif
+
+void
+chap_register_digest(struct chap_digest_type *dp)
+{
+}
+
+void
+add_options(option_t *opt)
+{
+}
+
+void
+random_bytes(unsigned char *buf, int len)
+{
+    BZERO(buf, len);
+}
+
+int
+slprintf(char *buf, int buflen, char *fmt, ...)
+{
+    va_list args;
+    int n;
+
+    va_start(args, fmt);
+    n = vsnprintf(buf, buflen, fmt, args);
+    va_end(args);
+    return n;
+}
+
+void
+dbglog(char *fmt, ...)
+{
+}
+
+void
+notice(char *fmt, ...)
+{
+}
+
+void
+error(char *fmt, ...)
+{
+}
+
+/*
+ * RFC 2759 section 9.2, "Example of Computing the Authenticator Response"
+ */
+static char *user = "User";
+static char *password = "clientPass";
+static u_char auth_challenge[16] =
+    { 0x5B, 0x5D, 0x7C, 0x7D, 0x7B, 0x3F, 0x2F, 0x3E,
+      0x3C, 0x2C, 0x60, 0x21, 0x32, 0x26, 0x26, 0x28 };
+static u_char peer_challenge[16] =
+    { 0x21, 0x40, 0x23, 0x24, 0x25, 0x5E, 0x26, 0x2A,
+      0x28, 0x29, 0x5F, 0x2B, 0x3A, 0x33, 0x7C, 0x7E };
+static u_char challenge[8] =
+    { 0xD0, 0x2E, 0x43, 0x86, 0xBC, 0xE9, 0x12, 0x26 };
+static u_char password_hash[16] =
+    { 0x44, 0xEB, 0xBA, 0x8D, 0x53, 0x12, 0xB8, 0xD6,
+      0x11, 0x47, 0x44, 0x11, 0xF5, 0x69, 0x89, 0xAE };
+static u_char nt_response[24] =
+    { 0x82, 0x30, 0x9E, 0xCD, 0x8D, 0x70, 0x8B, 0x5E,
+      0xA0, 0x8F, 0xAA, 0x39, 0x81, 0xCD, 0x83, 0x54,
+      0x42, 0x33, 0x11, 0x4A, 0x3D, 0x85, 0xD6, 0xDF };
+static u_char password_hash_hash[16] =
+    { 0x41, 0xC0, 0x0C, 0x58, 0x4B, 0xD2, 0xD9, 0x1C,
+      0x40, 0x17, 0xA2, 0xA1, 0x2F, 0xA5, 0x9F, 0x3F };
+static char *auth_response = "407A5589115FD0D6209F510FE9C04566932CDA56";
+
+#ifdef MPPE
+/*
+ * RFC 3079 section 3.5.3, 128-bit key derivation from the same exchange.
+ * The sample is worked from the authenticator's side, so its send key is
+ * the key the authenticatee receives with.
+ */
+static u_char send_start_key128[16] =
+    { 0x8B, 0x7C, 0xDC, 0x14, 0x9B, 0x99, 0x3A, 0x1B,
+      0xA1, 0x18, 0xCB, 0x15, 0x3F, 0x56, 0xDC, 0xCB };
+#endif
+
+static int failures = 0;
+
+static void
+check(char *what, u_char *got, u_char *expected, int len)
+{
+    int i;
+
+    if (memcmp(got, expected, len) == 0) {
+	printf("PASS: %s\n", what);
+	return;
+    }
+    printf("FAIL: %s\n  got      ", what);
+    for (i = 0; i < len; i++)
+	printf("%02X", got[i]);
+    printf("\n  expected ");
+    for (i = 0; i < len; i++)
+	printf("%02X", expected[i]);
+    printf("\n");
+    failures++;
+}
+
+int
+main(int argc, char **argv)
+{
+    u_char unicode[MAX_NT_PASSWORD * 2];
+    u_char hash[MD4_SIGNATURE_SIZE];
+    u_char hashhash[MD4_SIGNATURE_SIZE];
+    u_char chal[8];
+    u_char resp[24];
+    u_char authresp[MS_AUTH_RESPONSE_LENGTH + 1];
+    MS_Chap2Response response;
+    int len = strlen(password);
+
+    /* each step of the computation */
+    ChallengeHash(peer_challenge, auth_challenge, user, chal);
+    check("ChallengeHash", chal, challenge, sizeof(challenge));
+
+    ascii2unicode((u_char *)password, len, unicode);
+    NTPasswordHash(unicode, len * 2, hash);
+    check("NtPasswordHash", hash, password_hash, sizeof(password_hash));
+
+    ChallengeResponse(chal, hash, resp);
+    check("ChallengeResponse", resp, nt_response, sizeof(nt_response));
+
+    NTPasswordHash(hash, sizeof(hash), hashhash);
+    check("HashNtPasswordHash", hashhash, password_hash_hash,
+	  sizeof(password_hash_hash));
+
+    /* and the whole response, as pppd computes it */
+    ChapMS2(auth_challenge, peer_challenge, user, (u_char *)password, len,
+	    &response, authresp, MS_CHAP2_AUTHENTICATEE);
+    check("ChapMS2 NT-Response", response.NTResp, nt_response,
+	  sizeof(nt_response));
+    check("ChapMS2 AuthenticatorResponse", authresp, (u_char *)auth_response,
+	  MS_AUTH_RESPONSE_LENGTH);
+#ifdef MPPE
+    check("MPPE receive key", mppe_recv_key, send_start_key128,
+	  sizeof(send_start_key128));
+#endif
+
+    if (failures) {
+	printf("%d test(s) failed\n", failures);
+	return 1;
+    }
+    printf("all tests passed\n");
+    return 0;
+}
@@ -129,7 +129,7 @@ static int EAPServerProcess(eap_state *, u_int16_t, u_char *, int);
 static int EAPClientProcess(eap_state *, u_int16_t, u_char *, int);
 static void EAPClientAction(eap_state *);
 static void EAPServerAction(eap_state *);
-static void EAPInput_fd(void);
+static void EAPInput_fd(int fd, void *arg);
 
 
 /*
@@ -937,21 +937,20 @@ bad:
 }
 
 /*
- * EAPInput_fd - called when activity occurs on a file descriptor, 
- * so eap has a chance to test its file descriptors.
+ * EAPInput_fd - called when the user interface thread
+ * writes its result on the pipe.
  */
-void EAPInput_fd(void)
+void EAPInput_fd(int fd, void *arg)
 {
     int unit = 0;
     eap_state *cstate = &eap[unit];
     char	result;
 
-    if (cstate->client_ext_ui_fds[0] != -1 && is_ready_fd(cstate->client_ext_ui_fds[0])) {
+    if (cstate->client_ext_ui_fds[0] != -1 && cstate->client_ext_ui_fds[0] == fd) {
     
         result = 0;
         read(cstate->client_ext_ui_fds[0], &result, 1);
         
-        wait_input_hook = 0;
         remove_fd(cstate->client_ext_ui_fds[0]);
         close(cstate->client_ext_ui_fds[0]);
         close(cstate->client_ext_ui_fds[1]);
@@ -1011,8 +1010,7 @@ EAPClientInvokeUI(cstate)
         return -1;
     }
     
-    wait_input_hook = EAPInput_fd;
-    add_fd(cstate->client_ext_ui_fds[0]);
+    add_fd_handler(cstate->client_ext_ui_fds[0], EAPInput_fd, 0);
     return 0;
 }
 
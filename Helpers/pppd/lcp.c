@@ -77,6 +77,10 @@
 #include "lcp.h"
 #include "chap-new.h"
 #include "magic.h"
+#ifdef __APPLE__
+#include <net/if.h> 		// required for if_ppp.h
+#include "../../Family/if_ppp.h"
+#endif
 
 #ifndef __APPLE__
 static const char rcsid[] = RCSID;
@@ -103,6 +107,7 @@ bool	noendpoint = 0;		/* don't send/accept endpoint discriminator */
 int lcp_echo_interval_slow = 0;
 int lcp_echo_fails_slow = 0;
 int lcp_echos_hastened = 0;
+bool lcp_echo_offload = 0;	/* let the kernel answer and send LCP echos */
 
 static int noopt __P((char **));
 
@@ -179,6 +184,10 @@ static option_t lcp_option_list[] = {
       OPT_PRIO },
     { "lcp-echo-interval", o_int, &lcp_echo_interval,
       "Set time in seconds between LCP echo requests", OPT_PRIO },
+#ifdef __APPLE__
+    { "lcp-echo-offload", o_bool, &lcp_echo_offload,
+      "Let the kernel handle LCP echo requests", 1 },
+#endif
     { "lcp-restart", o_int, &lcp_fsm[0].timeouttime,
       "Set time in seconds between LCP retransmissions", OPT_PRIO },
     { "lcp-max-terminate", o_int, &lcp_fsm[0].maxtermtransmits,
@@ -224,6 +233,9 @@ lcp_options lcp_hisoptions[NUM_PPP];	/* Options that we ack'd */
 static int lcp_echos_pending = 0;	/* Number of outstanding echo msgs */
 static int lcp_echo_number   = 0;	/* ID number of next echo frame */
 static int lcp_echo_timer_running = 0;  /* set if a timer is running */
+#ifdef __APPLE__
+static int lcp_echo_offloaded = 0;	/* set if the kernel is doing echo */
+#endif
 
 static u_char nak_buffer[PPP_MRU];	/* where we construct a nak packet */
 
@@ -264,6 +276,8 @@ static void LcpSendEchoRequest __P((fsm *));
 static void LcpLinkFailure __P((fsm *));
 static void LcpEchoCheck __P((fsm *));
 #ifdef __APPLE__
+static void LcpEchoStart __P((fsm *));
+static void LcpEchoStop __P((fsm *));
 static void lcp_received_timeremaining __P((fsm *, int, u_char *, int));
 #endif
 
@@ -2444,7 +2458,11 @@ lcp_echo_lowerup (unit)
   
     /* If a timeout interval is specified then start the timer */
     if (lcp_echo_interval != 0)
+#ifdef __APPLE__
+        LcpEchoStart (f);
+#else
         LcpEchoCheck (f);
+#endif
 }
 
 /*
@@ -2461,6 +2479,9 @@ lcp_echo_lowerdown (unit)
         UNTIMEOUT (LcpEchoTimeout, f);
         lcp_echo_timer_running = 0;
     }
+#ifdef __APPLE__
+    LcpEchoStop (f);
+#endif
 
 }
 
@@ -2512,9 +2533,82 @@ lcp_echo_restart (unit)
         UNTIMEOUT (LcpEchoTimeout, f);
         lcp_echo_timer_running = 0;
     }
+    LcpEchoStop (f);
 
     /* If a timeout interval is specified then start the timer */
     if (lcp_echo_interval != 0)
-        LcpEchoCheck (f);
+        LcpEchoStart (f);
+}
+
+/*
+ * LcpEchoStart - Hand echo over to the kernel if allowed, 
+ * or run our own timer. Variable echo needs to see every reply,
+ * so it always runs here.
+ */
+
+static void
+LcpEchoStart (f)
+    fsm *f;
+{
+    lcp_options *go = &lcp_gotoptions[f->unit];
+    lcp_options *ho = &lcp_hisoptions[f->unit];
+
+    if (lcp_echo_offload && ppp_variable_echo_is_off()
+        && sys_echo_offload(go->neg_magicnumber ? go->magicnumber : 0,
+                            ho->neg_magicnumber ? ho->magicnumber : 0,
+                            lcp_echo_interval, lcp_echo_fails) == 0) {
+        dbglog("LCP echo offloaded, interval %d", lcp_echo_interval);
+        lcp_echo_offloaded = 1;
+        return;
+    }
+    LcpEchoCheck (f);
+}
+
+/*
+ * LcpEchoStop - Take echo back from the kernel
+ */
+
+static void
+LcpEchoStop (f)
+    fsm *f;
+{
+    if (lcp_echo_offloaded) {
+        sys_echo_offload(0, 0, 0, 0);
+        lcp_echo_offloaded = 0;
+    }
+}
+
+/*
+ * lcp_echo_notify - The kernel gave echo back to us,
+ * either because the peer is gone or because it saw something
+ * it doesn't want to handle.
+ */
+
+void
+lcp_echo_notify (unit)
+    int unit;
+{
+    fsm *f = &lcp_fsm[unit];
+
+    if (!lcp_echo_offloaded)
+	return;
+
+    switch (sys_echo_state()) {
+	case PPP_ECHO_ON:
+	    return;		/* stale notification */
+	case PPP_ECHO_FAILED:
+	    lcp_echo_offloaded = 0;
+	    lcp_echos_pending = lcp_echo_fails;
+	    LcpLinkFailure(f);
+	    lcp_echos_pending = 0;
+	    break;
+	default:
+	    lcp_echo_offloaded = 0;
+	    dbglog("LCP echo taken back from the kernel");
+	    if (f->state == OPENED && lcp_echo_interval != 0
+		&& !lcp_echo_timer_running)
+		LcpEchoCheck (f);
+	    break;
+    }
 }
 #endif
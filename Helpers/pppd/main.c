@@ -104,6 +104,11 @@
 #include "ccp.h"
 #include "ecp.h"
 #include "pathnames.h"
+#include "callout.h"
+#ifdef __APPLE__
+#include <net/if.h> 		// required for if_ppp.h
+#include "../../Family/if_ppp.h"
+#endif
 
 #ifdef USE_TDB
 #include "tdb.h"
@@ -245,6 +250,7 @@ static void create_pidfile __P((int pid));
 static void create_linkpidfile __P((int pid));
 static void cleanup __P((void));
 static void get_input __P((void));
+static void input_packet __P((u_char *, int));
 static void calltimeout __P((void));
 static struct timeval *timeleft __P((struct timeval *));
 static void kill_my_pg __P((int));
@@ -337,6 +343,11 @@ struct protent *protocols[] = {
     NULL
 };
 
+/*
+ * Packets handled by get_input before going back to the main loop.
+ */
+#define INPUT_BUDGET	16
+
 /*
  * If PPP_DRV_NAME is not defined, use the default "ppp" as the device name.
  */
@@ -499,7 +510,7 @@ main(argc, argv)
     }
 
 #ifdef USE_TDB
-    pppdb = tdb_open(_PATH_PPPDB, 0, 0, O_RDWR|O_CREAT, 0644);
+    pppdb = tdb_open(_PATH_PPPDB, pppdb_hash_size, 0, O_RDWR|O_CREAT, 0644);
     if (pppdb != NULL) {
 	slprintf(db_key, sizeof(db_key), "pppd%d", getpid());
 	update_db_entry();
@@ -512,12 +523,15 @@ main(argc, argv)
     }
 #endif
 
+    trace_open();
+
     /*
      * Detach ourselves from the terminal, if required,
      * and identify who is running us.
      */
     if (!nodetach && !updetach)
 	detach();
+    start_async_log();
 #ifndef __APPLE__
 	// radar 6153490
 	p = getlogin();
@@ -1066,6 +1080,9 @@ handle_events()
     }
 #endif
     waiting = 0;
+#ifdef __APPLE__
+    dispatch_fds();
+#endif
     calltimeout();
 #ifdef __APPLE__
     if (got_sigtstp) {
@@ -1208,6 +1225,7 @@ set_ifunit(iskey)
     info("Using interface %s%d", PPP_DRV_NAME, ifunit);
     slprintf(ifname, sizeof(ifname), "%s%d", PPP_DRV_NAME, ifunit);
     script_setenv("IFNAME", ifname, iskey);
+    trace_kernel_start();
     if (iskey) {
 	create_pidfile(getpid());	/* write pid to file */
 	create_linkpidfile(getpid());
@@ -1261,6 +1279,7 @@ detach()
 #ifdef __APPLE__
     sys_reinit();
 #endif    
+    start_async_log();		/* the ring is ours now, start our writer */
 }
 
 /*
@@ -1417,32 +1436,47 @@ protocol_name(proto)
 
 /*
  * get_input - called when incoming data is available.
+ * Read and handle all the packets already queued, up to INPUT_BUDGET
+ * so that a flood on the link doesn't starve timers and other fds.
  */
 static void
 get_input()
 {
-    int len, i;
-    u_char *p;
-    u_short protocol;
-    struct protent *protp;
-
-    p = inpacket_buf;	/* point to beginning of packet buffer */
+    int len, n;
 
-    len = read_packet(inpacket_buf);
-    if (len < 0)
-	return;
+    for (n = 0; n < INPUT_BUDGET && phase != PHASE_DEAD; n++) {
+	len = read_packet(inpacket_buf);
+	if (len < 0)
+	    return;		/* nothing more to read */
 
-    if (len == 0) {
-	notice("Modem hangup");
-	hungup = 1;
+	if (len == 0) {
+	    notice("Modem hangup");
+	    hungup = 1;
 #ifdef __APPLE__
-        if (status != EXIT_USER_REQUEST)
+	    if (status != EXIT_USER_REQUEST)
 #endif
-	status = EXIT_HANGUP;
-	lcp_lowerdown(0);	/* serial link is no longer available */
-	link_terminated(0);
-	return;
+	    status = EXIT_HANGUP;
+	    lcp_lowerdown(0);	/* serial link is no longer available */
+	    link_terminated(0);
+	    return;
+	}
+
+	input_packet(inpacket_buf, len);
     }
+}
+
+/*
+ * input_packet - hand one received packet to its protocol.
+ * p points to the address field, len includes the PPP header.
+ */
+static void
+input_packet(p, len)
+    u_char *p;
+    int len;
+{
+    int i;
+    u_short protocol;
+    struct protent *protp;
 
     if (len < PPP_HDRLEN) {
 #ifdef __APPLE__
@@ -1452,7 +1486,16 @@ get_input()
 	return;
     }
 
+#ifdef __APPLE__
+    /* kernel LCP echo state changed, not a real packet */
+    if (((p[2] << 8) | p[3]) == PPP_ECHO_NOTIFY) {
+	lcp_echo_notify(0);
+	return;
+    }
+#endif
+
     dump_packet("rcvd", p, len);
+    trace_packet(PPP_TRACE_IN, p, len);
     if (snoop_recv_hook) snoop_recv_hook(p, len);
 
     p += 2;				/* Skip address and control */
@@ -1604,6 +1647,7 @@ die(status)
 #endif
     cleanup();
     notify(exitnotify, status);
+    sync_log();
     sys_log(LOG_INFO, "Exit.");
     exit(status);
 }
@@ -1615,6 +1659,7 @@ die(status)
 static void
 cleanup()
 {
+    trace_close();
     sys_cleanup();
 
     if (fd_ppp >= 0)
@@ -1675,14 +1720,7 @@ update_link_stats(u)
 }
 
 
-struct	callout {
-    struct timeval	c_time;		/* time at which to call routine */
-    void		*c_arg;		/* argument to routine */
-    void		(*c_func) __P((void *)); /* routine */
-    struct		callout *c_next;
-};
-
-static struct callout *callout = NULL;	/* Callout list */
+static struct callout_table callouts;	/* pending timeouts, see callout.h */
 static struct timeval timenow;		/* Current time */
 
 /*
@@ -1694,18 +1732,11 @@ timeout(func, arg, secs, usecs)
     void *arg;
     int secs, usecs;
 {
-    struct callout *newp, *p, **pp;
+    struct timeval when;
 
     MAINDEBUG(("Timeout %p:%p in %d.%03d seconds.", func, arg,
 	       secs, usecs/1000));
 
-    /*
-     * Allocate timeout.
-     */
-    if ((newp = (struct callout *) malloc(sizeof(struct callout))) == NULL)
-	fatal("Out of memory in timeout()!");
-    newp->c_arg = arg;
-    newp->c_func = func;
 #ifdef __APPLE__
     // timeout get screwed up if you change the current time of the machine...
     // use absolute time instead, as we are just interested in deltas, not actual time.
@@ -1713,23 +1744,15 @@ timeout(func, arg, secs, usecs)
 #else
     gettimeofday(&timenow, NULL);
 #endif
-    newp->c_time.tv_sec = timenow.tv_sec + secs;
-    newp->c_time.tv_usec = timenow.tv_usec + usecs;
-    if (newp->c_time.tv_usec >= 1000000) {
-	newp->c_time.tv_sec += newp->c_time.tv_usec / 1000000;
-	newp->c_time.tv_usec %= 1000000;
+    when.tv_sec = timenow.tv_sec + secs;
+    when.tv_usec = timenow.tv_usec + usecs;
+    if (when.tv_usec >= 1000000) {
+	when.tv_sec += when.tv_usec / 1000000;
+	when.tv_usec %= 1000000;
     }
 
-    /*
-     * Find correct place and link it in.
-     */
-    for (pp = &callout; (p = *pp); pp = &p->c_next)
-	if (newp->c_time.tv_sec < p->c_time.tv_sec
-	    || (newp->c_time.tv_sec == p->c_time.tv_sec
-		&& newp->c_time.tv_usec < p->c_time.tv_usec))
-	    break;
-    newp->c_next = p;
-    *pp = newp;
+    if (callout_insert(&callouts, func, arg, &when) < 0)
+	fatal("Out of memory in timeout()!");
 }
 
 
@@ -1741,19 +1764,15 @@ untimeout(func, arg)
     void (*func) __P((void *));
     void *arg;
 {
-    struct callout **copp, *freep;
+    struct callout *p;
 
     MAINDEBUG(("Untimeout %p:%p.", func, arg));
 
     /*
-     * Find first matching timeout and remove it from the list.
+     * Remove the first matching timeout to expire.
      */
-    for (copp = &callout; (freep = *copp); copp = &freep->c_next)
-	if (freep->c_func == func && freep->c_arg == arg) {
-	    *copp = freep->c_next;
-	    free((char *) freep);
-	    break;
-	}
+    if ((p = callout_find(&callouts, func, arg)) != NULL)
+	callout_remove(&callouts, p);
 }
 
 
@@ -1764,25 +1783,31 @@ static void
 calltimeout()
 {
     struct callout *p;
+    struct timeval now;
+    void (*func) __P((void *));
+    void *arg;
 
-    while (callout != NULL) {
-	p = callout;
+    if (callout_first(&callouts) == NULL)
+	return;
 
 #ifdef __APPLE__
-        if (getabsolutetime(&timenow) < 0)
+    if (getabsolutetime(&timenow) < 0)
 #else
-	if (gettimeofday(&timenow, NULL) < 0)
+    if (gettimeofday(&timenow, NULL) < 0)
 #endif
-	    fatal("Failed to get time of day: %m");
-	if (!(p->c_time.tv_sec < timenow.tv_sec
-	      || (p->c_time.tv_sec == timenow.tv_sec
-		  && p->c_time.tv_usec <= timenow.tv_usec)))
-	    break;		/* no, it's not time yet */
+	fatal("Failed to get time of day: %m");
+    now = timenow;	/* timeout() called from a routine updates timenow */
 
-	callout = p->c_next;
-	(*p->c_func)(p->c_arg);
+    while ((p = callout_first(&callouts)) != NULL) {
+	if (!(p->c_time.tv_sec < now.tv_sec
+	      || (p->c_time.tv_sec == now.tv_sec
+		  && p->c_time.tv_usec <= now.tv_usec)))
+	    break;		/* no, it's not time yet */
 
-	free((char *) p);
+	func = p->c_func;
+	arg = p->c_arg;
+	callout_remove(&callouts, p);
+	(*func)(arg);
     }
 }
 
@@ -1794,7 +1819,9 @@ static struct timeval *
 timeleft(tvp)
     struct timeval *tvp;
 {
-    if (callout == NULL)
+    struct callout *p;
+
+    if ((p = callout_first(&callouts)) == NULL)
 	return NULL;
 
 #ifdef __APPLE__
@@ -1802,8 +1829,8 @@ timeleft(tvp)
 #else
     gettimeofday(&timenow, NULL);
 #endif
-    tvp->tv_sec = callout->c_time.tv_sec - timenow.tv_sec;
-    tvp->tv_usec = callout->c_time.tv_usec - timenow.tv_usec;
+    tvp->tv_sec = p->c_time.tv_sec - timenow.tv_sec;
+    tvp->tv_usec = p->c_time.tv_usec - timenow.tv_usec;
     if (tvp->tv_usec < 0) {
 	tvp->tv_usec += 1000000;
 	tvp->tv_sec -= 1;
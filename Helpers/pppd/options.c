@@ -119,6 +119,14 @@ char	devnam[MAXPATHLEN] = { 0 };	/* Device name */
 bool	nodetach = 0;		/* Don't detach from controlling tty */
 bool	updetach = 0;		/* Detach once link is up */
 int	maxconnect = 0;		/* Maximum connect time */
+#ifdef USE_TDB
+int	pppdb_hash_size = 0;	/* Hash chains when creating the ppp database */
+#endif
+char	*trace_file = NULL;	/* Binary packet trace ring file */
+int	trace_size = 1024 * 1024; /* Size of the trace ring in bytes */
+int	trace_snaplen = 64;	/* Packet bytes kept per trace record */
+int	trace_kernel_rate = 0;	/* Kernel samples 1 data packet in this many */
+bool	trace_nowrap = 0;	/* Drop new trace records rather than old ones */
 char	user[MAXNAMELEN] = { 0 };	/* Username for PAP */
 #ifdef __APPLE__
 bool	controlled = 0;		/* Is pppd controlled by the PPPController ?  */
@@ -142,6 +150,7 @@ int	holdoff = 30;		/* # seconds to pause before reconnecting */
 bool	holdoff_specified = FALSE;	/* true if a holdoff value has been given */
 int	log_to_fd = 1;		/* send log messages to this fd too */
 bool	log_default = 1;	/* log_to_fd is default (stdout) */
+bool	log_async = 1;		/* queue log messages, write them when idle */
 int	maxfail = 10;		/* max # of unsuccessful connection attempts */
 char	linkname[MAXPATHLEN] = { 0 };	/* logical name for link */
 bool	tune_kernel = FALSE;		/* may alter kernel settings */
@@ -312,6 +321,10 @@ option_t general_options[] = {
     { "nologfd", o_int, &log_to_fd,
       "Don't send log messages to any file descriptor",
       OPT_PRIOSUB | OPT_ALIAS | OPT_NOARG | OPT_VAL(-1) },
+    { "log-async", o_bool, &log_async,
+      "Queue log messages and write them when idle", OPT_PRIO | 1 },
+    { "nolog-async", o_bool, &log_async,
+      "Write log messages as they are logged", OPT_PRIOSUB },
 
     { "linkname", o_string, linkname,
       "Set logical name for link",
@@ -339,6 +352,27 @@ option_t general_options[] = {
     { "dryrun", o_bool, &dryrun,
       "Stop after parsing, printing, and checking options", 1 },
 
+#ifdef USE_TDB
+    { "pppdb-hash-size", o_int, &pppdb_hash_size,
+      "Set number of hash chains when creating the ppp database",
+      OPT_PRIO | OPT_PRIV | OPT_LLIMIT | OPT_ULIMIT, 0, 65536 },
+#endif
+
+    { "trace-file", o_string, &trace_file,
+      "Record packets in a binary trace ring file",
+      OPT_PRIO | OPT_PRIV },
+    { "trace-size", o_int, &trace_size,
+      "Set size of the packet trace ring in bytes",
+      OPT_PRIO | OPT_LLIMIT | OPT_ULIMIT, 0, 64 * 1024 * 1024, 4096 },
+    { "trace-snaplen", o_int, &trace_snaplen,
+      "Set number of packet bytes kept in each trace record",
+      OPT_PRIO | OPT_LLIMIT | OPT_ULIMIT, 0, 4096 },
+    { "trace-kernel-rate", o_int, &trace_kernel_rate,
+      "Have the kernel trace 1 data packet in this many",
+      OPT_PRIO | OPT_LLIMIT },
+    { "trace-nowrap", o_bool, &trace_nowrap,
+      "Drop new trace records when the ring is full", OPT_PRIO | 1 },
+
 #ifdef HAVE_MULTILINK
     { "multilink", o_bool, &multilink,
       "Enable multilink operation", OPT_PRIO | 1 },
@@ -89,12 +89,264 @@ u_char *des_key;	/* OUT 64 bit DES key with parity bits added */
 	des_key[6] = Get7Bits(key, 42);
 	des_key[7] = Get7Bits(key, 49);
 
-#ifndef USE_CRYPT
+#if !defined(USE_CRYPT) && !defined(DES_TABLES)
 	des_set_odd_parity((des_cblock *)des_key);
 #endif
 }
 
-#ifdef USE_CRYPT
+#ifdef DES_TABLES
+/*
+ * Table driven DES.  Every bit permutation (IP, FP, PC1, PC2) is done
+ * with one lookup per input byte, and the S-boxes are merged with the
+ * P permutation so that a round costs eight lookups.  The tables are
+ * built from the FIPS 46 definitions the first time a key is set.
+ * Parity bits of the key are ignored, as DES itself does.
+ */
+static const u_char des_ip[64] = {
+	58, 50, 42, 34, 26, 18, 10,  2, 60, 52, 44, 36, 28, 20, 12,  4,
+	62, 54, 46, 38, 30, 22, 14,  6, 64, 56, 48, 40, 32, 24, 16,  8,
+	57, 49, 41, 33, 25, 17,  9,  1, 59, 51, 43, 35, 27, 19, 11,  3,
+	61, 53, 45, 37, 29, 21, 13,  5, 63, 55, 47, 39, 31, 23, 15,  7
+};
+
+static const u_char des_fp[64] = {
+	40,  8, 48, 16, 56, 24, 64, 32, 39,  7, 47, 15, 55, 23, 63, 31,
+	38,  6, 46, 14, 54, 22, 62, 30, 37,  5, 45, 13, 53, 21, 61, 29,
+	36,  4, 44, 12, 52, 20, 60, 28, 35,  3, 43, 11, 51, 19, 59, 27,
+	34,  2, 42, 10, 50, 18, 58, 26, 33,  1, 41,  9, 49, 17, 57, 25
+};
+
+static const u_char des_pc1[56] = {
+	57, 49, 41, 33, 25, 17,  9,  1, 58, 50, 42, 34, 26, 18,
+	10,  2, 59, 51, 43, 35, 27, 19, 11,  3, 60, 52, 44, 36,
+	63, 55, 47, 39, 31, 23, 15,  7, 62, 54, 46, 38, 30, 22,
+	14,  6, 61, 53, 45, 37, 29, 21, 13,  5, 28, 20, 12,  4
+};
+
+static const u_char des_pc2[48] = {
+	14, 17, 11, 24,  1,  5,  3, 28, 15,  6, 21, 10,
+	23, 19, 12,  4, 26,  8, 16,  7, 27, 20, 13,  2,
+	41, 52, 31, 37, 47, 55, 30, 40, 51, 45, 33, 48,
+	44, 49, 39, 56, 34, 53, 46, 42, 50, 36, 29, 32
+};
+
+static const u_char des_p[32] = {
+	16,  7, 20, 21, 29, 12, 28, 17,  1, 15, 23, 26,  5, 18, 31, 10,
+	 2,  8, 24, 14, 32, 27,  3,  9, 19, 13, 30,  6, 22, 11,  4, 25
+};
+
+static const u_char des_sbox[8][64] = {
+	{ 14,  4, 13,  1,  2, 15, 11,  8,  3, 10,  6, 12,  5,  9,  0,  7,
+	   0, 15,  7,  4, 14,  2, 13,  1, 10,  6, 12, 11,  9,  5,  3,  8,
+	   4,  1, 14,  8, 13,  6,  2, 11, 15, 12,  9,  7,  3, 10,  5,  0,
+	  15, 12,  8,  2,  4,  9,  1,  7,  5, 11,  3, 14, 10,  0,  6, 13 },
+	{ 15,  1,  8, 14,  6, 11,  3,  4,  9,  7,  2, 13, 12,  0,  5, 10,
+	   3, 13,  4,  7, 15,  2,  8, 14, 12,  0,  1, 10,  6,  9, 11,  5,
+	   0, 14,  7, 11, 10,  4, 13,  1,  5,  8, 12,  6,  9,  3,  2, 15,
+	  13,  8, 10,  1,  3, 15,  4,  2, 11,  6,  7, 12,  0,  5, 14,  9 },
+	{ 10,  0,  9, 14,  6,  3, 15,  5,  1, 13, 12,  7, 11,  4,  2,  8,
+	  13,  7,  0,  9,  3,  4,  6, 10,  2,  8,  5, 14, 12, 11, 15,  1,
+	  13,  6,  4,  9,  8, 15,  3,  0, 11,  1,  2, 12,  5, 10, 14,  7,
+	   1, 10, 13,  0,  6,  9,  8,  7,  4, 15, 14,  3, 11,  5,  2, 12 },
+	{  7, 13, 14,  3,  0,  6,  9, 10,  1,  2,  8,  5, 11, 12,  4, 15,
+	  13,  8, 11,  5,  6, 15,  0,  3,  4,  7,  2, 12,  1, 10, 14,  9,
+	  10,  6,  9,  0, 12, 11,  7, 13, 15,  1,  3, 14,  5,  2,  8,  4,
+	   3, 15,  0,  6, 10,  1, 13,  8,  9,  4,  5, 11, 12,  7,  2, 14 },
+	{  2, 12,  4,  1,  7, 10, 11,  6,  8,  5,  3, 15, 13,  0, 14,  9,
+	  14, 11,  2, 12,  4,  7, 13,  1,  5,  0, 15, 10,  3,  9,  8,  6,
+	   4,  2,  1, 11, 10, 13,  7,  8, 15,  9, 12,  5,  6,  3,  0, 14,
+	  11,  8, 12,  7,  1, 14,  2, 13,  6, 15,  0,  9, 10,  4,  5,  3 },
+	{ 12,  1, 10, 15,  9,  2,  6,  8,  0, 13,  3,  4, 14,  7,  5, 11,
+	  10, 15,  4,  2,  7, 12,  9,  5,  6,  1, 13, 14,  0, 11,  3,  8,
+	   9, 14, 15,  5,  2,  8, 12,  3,  7,  0,  4, 10,  1, 13, 11,  6,
+	   4,  3,  2, 12,  9,  5, 15, 10, 11, 14,  1,  7,  6,  0,  8, 13 },
+	{  4, 11,  2, 14, 15,  0,  8, 13,  3, 12,  9,  7,  5, 10,  6,  1,
+	  13,  0, 11,  7,  4,  9,  1, 10, 14,  3,  5, 12,  2, 15,  8,  6,
+	   1,  4, 11, 13, 12,  3,  7, 14, 10, 15,  6,  8,  0,  5,  9,  2,
+	   6, 11, 13,  8,  1,  4, 10,  7,  9,  5,  0, 15, 14,  2,  3, 12 },
+	{ 13,  2,  8,  4,  6, 15, 11,  1, 10,  9,  3, 14,  5,  0, 12,  7,
+	   1, 15, 13,  8, 10,  3,  7,  4, 12,  5,  6, 11,  0, 14,  9,  2,
+	   7, 11,  4,  1,  9, 12, 14,  2,  0,  6, 10, 13, 15,  3,  5,  8,
+	   2,  1, 14,  7,  4, 10,  8, 13, 15, 12,  9,  0,  3,  5,  6, 11 }
+};
+
+static const u_char des_shifts[16] = {
+	1, 1, 2, 2, 2, 2, 2, 2, 1, 2, 2, 2, 2, 2, 2, 1
+};
+
+static u_int64_t	des_ip_tab[8][256];
+static u_int64_t	des_fp_tab[8][256];
+static u_int64_t	des_pc1_tab[8][256];
+static u_int64_t	des_pc2_tab[7][256];
+static u_int32_t	des_sp_tab[8][64];
+static int		des_tables_built;
+
+static u_char		des_subkeys[16][8];
+
+/*
+ * Fill tab so that OR-ing tab[i][byte i of the input] gives the
+ * permutation of the input.  perm lists, for each output bit, the
+ * (1-based, most significant first) input bit it comes from.
+ */
+static void
+DesPermTable(tab, perm, outbits)
+u_int64_t tab[][256];
+const u_char *perm;
+int outbits;
+{
+	int o, in, v;
+
+	for (o = 0; o < outbits; o++) {
+		in = perm[o] - 1;
+		for (v = 0; v < 256; v++)
+			if (v & (0x80 >> (in % 8)))
+				tab[in / 8][v] |= (u_int64_t)1 << (outbits - 1 - o);
+	}
+}
+
+static u_int64_t
+DesPermute(tab, in, inbytes)
+u_int64_t tab[][256];
+u_int64_t in;
+int inbytes;
+{
+	u_int64_t out = 0;
+	int i;
+
+	for (i = 0; i < inbytes; i++)
+		out |= tab[i][(in >> (8 * (inbytes - 1 - i))) & 0xff];
+	return out;
+}
+
+static void
+DesBuildTables()
+{
+	int i, v, j;
+	u_int32_t s, out;
+
+	DesPermTable(des_ip_tab, des_ip, 64);
+	DesPermTable(des_fp_tab, des_fp, 64);
+	DesPermTable(des_pc1_tab, des_pc1, 56);
+	DesPermTable(des_pc2_tab, des_pc2, 48);
+
+	/* S-box i output, already passed through P */
+	for (i = 0; i < 8; i++) {
+		for (v = 0; v < 64; v++) {
+			s = des_sbox[i][(((v >> 4) & 2) | (v & 1)) << 4 | ((v >> 1) & 0xf)];
+			s <<= 28 - 4 * i;
+			out = 0;
+			for (j = 0; j < 32; j++)
+				if (s & (0x80000000U >> (des_p[j] - 1)))
+					out |= 0x80000000U >> j;
+			des_sp_tab[i][v] = out;
+		}
+	}
+	des_tables_built = 1;
+}
+
+static u_int64_t
+DesLoad(p)
+u_char *p;
+{
+	u_int64_t v = 0;
+	int i;
+
+	for (i = 0; i < 8; i++)
+		v = (v << 8) | p[i];
+	return v;
+}
+
+static void
+DesStore(v, p)
+u_int64_t v;
+u_char *p;
+{
+	int i;
+
+	for (i = 7; i >= 0; i--, v >>= 8)
+		p[i] = v & 0xff;
+}
+
+static void
+DesCrypt(in, out, decrypt)
+u_char *in;
+u_char *out;
+int decrypt;
+{
+	u_int64_t b;
+	u_int32_t l, r, t, f;
+	u_char *k;
+	int n, i, sh;
+
+	b = DesPermute(des_ip_tab, DesLoad(in), 8);
+	l = b >> 32;
+	r = b & 0xffffffff;
+
+	for (n = 0; n < 16; n++) {
+		k = des_subkeys[decrypt ? 15 - n : n];
+		f = 0;
+		/* E expansion: S-box i sees bits 4i..4i+5 of r, wrapping */
+		for (i = 0; i < 8; i++) {
+			sh = (4 * i + 5) & 31;
+			t = (r << sh) | (r >> (32 - sh));
+			f |= des_sp_tab[i][(t & 0x3f) ^ k[i]];
+		}
+		t = l ^ f;
+		l = r;
+		r = t;
+	}
+
+	b = ((u_int64_t)r << 32) | l;
+	DesStore(DesPermute(des_fp_tab, b, 8), out);
+}
+
+bool
+DesSetkey(key)
+u_char *key;
+{
+	u_char des_key[8];
+	u_int64_t cd, sub;
+	u_int32_t c, d;
+	int n, i;
+
+	if (!des_tables_built)
+		DesBuildTables();
+
+	MakeKey(key, des_key);
+	cd = DesPermute(des_pc1_tab, DesLoad(des_key), 8);
+	c = (cd >> 28) & 0xfffffff;
+	d = cd & 0xfffffff;
+
+	for (n = 0; n < 16; n++) {
+		c = ((c << des_shifts[n]) | (c >> (28 - des_shifts[n]))) & 0xfffffff;
+		d = ((d << des_shifts[n]) | (d >> (28 - des_shifts[n]))) & 0xfffffff;
+		sub = DesPermute(des_pc2_tab, ((u_int64_t)c << 28) | d, 7);
+		for (i = 0; i < 8; i++)
+			des_subkeys[n][i] = (sub >> (42 - 6 * i)) & 0x3f;
+	}
+	BZERO(des_key, sizeof(des_key));
+	return (1);
+}
+
+bool
+DesEncrypt(clear, cipher)
+u_char *clear;	/* IN  8 octets */
+u_char *cipher;	/* OUT 8 octets */
+{
+	DesCrypt(clear, cipher, 0);
+	return (1);
+}
+
+bool
+DesDecrypt(cipher, clear)
+u_char *cipher;	/* IN  8 octets */
+u_char *clear;	/* OUT 8 octets */
+{
+	DesCrypt(cipher, clear, 1);
+	return (1);
+}
+
+#elif defined(USE_CRYPT)
 /*
  * in == 8-byte string (expanded version of the 56-bit key)
  * out == 64-byte string where each byte is either 1 or 0
@@ -183,7 +435,7 @@ u_char *clear;	/* OUT 8 octets */
 	return (1);
 }
 
-#else /* USE_CRYPT */
+#else /* DES_TABLES, USE_CRYPT */
 static des_key_schedule	key_schedule;
 
 bool
@@ -216,4 +468,4 @@ u_char *clear;	/* OUT 8 octets */
 	return (1);
 }
 
-#endif /* USE_CRYPT */
+#endif /* DES_TABLES, USE_CRYPT */
@@ -59,7 +59,12 @@
 #include <crypt.h>
 #endif
 
-#ifndef USE_CRYPT
+/* use the in-tree table driven DES rather than setkey()/encrypt() */
+#if defined(__APPLE__) && !defined(NO_DES_TABLES)
+#define DES_TABLES 1
+#endif
+
+#if !defined(USE_CRYPT) && !defined(DES_TABLES)
 #include <des.h>
 #endif
 
@@ -287,6 +287,7 @@ extern unsigned	link_connect_time; /* time the link was up for */
 extern int	using_pty;	/* using pty as device (notty or pty opt.) */
 extern int	log_to_fd;	/* logging to this fd as well as syslog */
 extern bool	log_default;	/* log_to_fd is default (stdout) */
+extern bool	log_async;	/* queue log messages, write them when idle */
 extern char	*no_ppp_msg;	/* message to print if ppp not in kernel */
 extern volatile int status;	/* exit status for pppd */
 #ifdef __APPLE__
@@ -352,7 +353,7 @@ extern int (*change_password_hook) __P((u_char *msg));
 extern int (*retry_password_hook) __P((u_char *msg));
 extern int (*link_up_hook) __P((void));
 extern bool link_up_done;
-extern void (*wait_input_hook) __P((void));
+extern void (*wait_input_hook) __P((void));	/* called after every wakeup, prefer add_fd_handler */
 extern int 	extraconnecttime;	/* give some extra connection time to the connection sequence */
 extern int    retry_pre_start_link_check;
 
@@ -415,6 +416,14 @@ extern int lcp_echo_fails_slow;
 extern int lcp_echo_interval_slow;
 extern int lcp_echos_hastened;
 void lcp_echo_restart __P((int));
+void lcp_echo_notify __P((int));
+int sys_echo_offload __P((u_int32_t, u_int32_t, int, int));
+				/* Hand LCP echo over to the kernel */
+int sys_echo_state __P((void));	/* Get kernel LCP echo state */
+struct ppp_trace;
+int sys_trace_kernel __P((int));	/* Set kernel data path sampling rate */
+int sys_trace_read __P((struct ppp_trace *));
+				/* Read queued kernel trace samples */
 
 #endif
 
@@ -443,6 +452,14 @@ extern char	*disconnect_script; /* Script to disestablish physical link */
 extern char	*welcomer;	/* Script to welcome client after connection */
 extern char	*ptycommand;	/* Command to run on other side of pty */
 extern int	maxconnect;	/* Maximum connect time (seconds) */
+#ifdef USE_TDB
+extern int	pppdb_hash_size; /* Hash chains when creating the ppp database */
+#endif
+extern char	*trace_file;	/* Binary packet trace ring file */
+extern int	trace_size;	/* Size of the trace ring in bytes */
+extern int	trace_snaplen;	/* Packet bytes kept per trace record */
+extern int	trace_kernel_rate; /* Kernel samples 1 data packet in this many */
+extern bool	trace_nowrap;	/* Drop new trace records rather than old ones */
 extern char	user[MAXNAMELEN];/* Our name for authenticating ourselves */
 extern char	passwd[MAXSECRETLEN];	/* Password for PAP or CHAP */
 extern bool	auth_required;	/* Peer is required to authenticate */
@@ -644,6 +661,7 @@ struct channel {
 	/* close the device, called in children after fork */
 	void (*close) __P((void));
 #ifdef __APPLE__
+	/* called after every wakeup, new code should use add_fd_handler */
 	void (*wait_input) __P((void));
 	/* before start_link_hook, check reachability of server amongst other things */
 	int (*pre_start_link_check) __P((void));
@@ -714,8 +732,16 @@ void fatal __P((char *, ...)) __attribute__ ((noreturn));	/* log an error messag
 void init_pr_log __P((char *, int));	/* initialize for using pr_log */
 void pr_log __P((void *, char *, ...));	/* printer fn, output to syslog */
 void end_pr_log __P((void));	/* finish up after using pr_log */
+void start_async_log __P((void)); /* queue log messages from now on */
+void flush_log __P((void));	/* wait for queued log messages to be written */
+void sync_log __P((void));	/* flush log messages and fsync the log file */
 void dump_packet __P((const char *, u_char *, int));
 				/* dump packet to debug log if interesting */
+void trace_open __P((void));	/* map the packet trace ring */
+void trace_close __P((void));	/* flush and unmap the packet trace ring */
+void trace_packet __P((int, u_char *, int));
+				/* record a packet in the trace ring */
+void trace_kernel_start __P((void)); /* start kernel data path sampling */
 ssize_t complete_read __P((int, void *, size_t));
 				/* read a complete buffer */
 #ifdef __APPLE__
@@ -876,6 +902,11 @@ void wait_input __P((struct timeval *));
 void add_fd __P((int));		/* Add fd to set to wait for */
 void remove_fd __P((int));	/* Remove fd from set to wait for */
 #ifdef __APPLE__
+void add_fd_handler __P((int, void (*)(int, void *), void *));
+				/* Add fd with a handler called when readable */
+void dispatch_fds __P((void));	/* Call handlers of ready fds */
+#endif
+#ifdef __APPLE__
 void sys_runloop __P((void));	/* Do system-dependent runloop action */
 int save_new_password(void); /* save new password to the keychain */
 void sys_statusnotify(void); /* send status notification to the controller */
@@ -886,7 +917,7 @@ int sys_setup_security_session(void);
 int sys_loadplugin(char *arg);
 void sys_publish_remoteaddress(char *addr);
 int getabsolutetime(struct timeval *timenow);
-bool is_ready_fd(int fd);	/* check if fd is ready (out of select) */
+bool is_ready_fd(int fd);	/* check if fd is ready (out of wait_input) */
 void set_up_tty_local __P((int, int)); /* Set up port's 'local' parameters only. */
 void ppp_hold __P((int unit));	/* stop ppp traffic on this link */
 void ppp_cont __P((int unit));	/* resume ppp traffic on this link */
@@ -67,6 +67,7 @@
 #include <sys/wait.h>
 #include <sys/un.h>
 #include <sys/ucred.h>
+#include <sys/event.h>
 #import "acsp.h"
 #ifdef PPP_FILTER
 #include <net/bpf.h>
@@ -163,6 +164,11 @@ static int make_ppp_unit(void);
 /* Prototypes for procedures local to this file. */
 static int get_ether_addr __P((u_int32_t, struct sockaddr_dl *));
 static int connect_pfppp(void);
+static void kq_init(void);
+static void ppp_auxiliary_probe_input_fd(int fd, void *arg);
+#if TARGET_OS_OSX
+static void ppp_nat_port_mapping_input_fd(int fd, void *arg);
+#endif
 //static void sys_pidchange(void *arg, int pid);
 static void sys_phasechange(void *arg, uintptr_t phase);
 static void sys_exitnotify(void *arg, uintptr_t exitcode);
@@ -208,9 +214,21 @@ static struct winsize 	wsinfo;			/* Initial window size info */
 
 static int 		ip_sockfd;		/* socket for doing interface ioctls */
 
-static fd_set 		in_fds;			/* set of fds that wait_input waits for */
-static fd_set 		ready_fds;		/* set of fds currently ready (out of select) */
-static int 		max_in_fd;		/* highest fd set in in_fds */
+/* fd that wait_input waits for, with an optional handler */
+struct fd_source {
+    int			fd;			/* -1 when removed */
+    void		(*handler) __P((int, void *));
+    void		*arg;
+    int			ready;			/* fd fired in the last wait_input */
+};
+
+static int		kq = -1;		/* kqueue that wait_input waits on */
+static struct fd_source	*fd_sources;		/* fds registered with kq */
+static int		fd_nsources;		/* entries used in fd_sources */
+static int		fd_maxsources;		/* entries allocated in fd_sources */
+static struct kevent	*fd_events;		/* kevent output, fd_maxsources long */
+
+#define FD_SOURCES_INIT	8
 
 static int 		if_is_up;		/* the interface is currently up */
 static int		ipv4_plumbed = 0; 	/* is ipv4 plumbed on the interface ? */
@@ -864,9 +882,13 @@ void sys_init()
         timeScaleSeconds = timeScaleMicroSeconds / 1000000;
     }
 
-    FD_ZERO(&in_fds);
-    FD_ZERO(&ready_fds);
-    max_in_fd = 0;
+    fd_maxsources = FD_SOURCES_INIT;
+    fd_sources = malloc(fd_maxsources * sizeof(struct fd_source));
+    fd_events = malloc(fd_maxsources * sizeof(struct kevent));
+    if (fd_sources == NULL || fd_events == NULL)
+        novm("fd sources");
+    fd_nsources = 0;
+    kq_init();
 }
 
 /* ----------------------------------------------------------------------------- 
@@ -1601,6 +1623,7 @@ void output(int unit, u_char *p, int len)
 {
 
     dump_packet("sent", p, len);
+    trace_packet(PPP_TRACE_OUT, p, len);
     
     // don't write FF03
     len -= 2;
@@ -1616,22 +1639,98 @@ void output(int unit, u_char *p, int len)
     }
 }
 
+/* -----------------------------------------------------------------------------
+add or delete fd in the kqueue
+----------------------------------------------------------------------------- */
+static void kq_register(int fd, u_short flags)
+{
+    struct kevent kev;
+
+    EV_SET(&kev, fd, EVFILT_READ, flags, 0, 0, NULL);
+    if (kevent(kq, &kev, 1, NULL, 0, NULL) < 0 && (flags & EV_ADD))
+        error("kevent(EV_ADD, %d): %m", fd);
+    // fd may already be closed on EV_DELETE, which removed it from kq
+}
+
+/* -----------------------------------------------------------------------------
+(re)create the kqueue and register the fds we already know
+----------------------------------------------------------------------------- */
+static void kq_init(void)
+{
+    int i;
+
+    if (kq >= 0)
+        close(kq);
+    kq = kqueue();
+    if (kq < 0)
+        fatal("kqueue: %m");
+    fcntl(kq, F_SETFD, FD_CLOEXEC);
+
+    for (i = 0; i < fd_nsources; i++)
+        if (fd_sources[i].fd != -1)
+            kq_register(fd_sources[i].fd, EV_ADD);
+}
+
+/* -----------------------------------------------------------------------------
+find the source for fd
+----------------------------------------------------------------------------- */
+static struct fd_source *find_fd_source(int fd)
+{
+    int i;
+
+    for (i = 0; i < fd_nsources; i++)
+        if (fd_sources[i].fd == fd)
+            return &fd_sources[i];
+    return NULL;
+}
+
 /* -----------------------------------------------------------------------------
 wait until there is data available, for the length of time specified by *timo
 (indefinite if timo is NULL)
 ----------------------------------------------------------------------------- */
 void wait_input(struct timeval *timo)
 {
-    int n;
+    struct fd_source *src;
+    struct timespec ts;
+    int i, j, n;
 
-    ready_fds = in_fds;
-    n = select(max_in_fd + 1, &ready_fds, NULL, NULL, timo);
-   if (n < 0 && errno != EINTR)
-	fatal("select: %m");
+    // drop the sources removed since last time, nobody is walking the list now
+    for (i = 0, j = 0; i < fd_nsources; i++) {
+        if (fd_sources[i].fd == -1)
+            continue;
+        fd_sources[j] = fd_sources[i];
+        fd_sources[j++].ready = 0;
+    }
+    fd_nsources = j;
 
-   if (n < 0) {
-        FD_ZERO(&ready_fds);
-   }
+    if (timo) {
+        ts.tv_sec = timo->tv_sec;
+        ts.tv_nsec = timo->tv_usec * 1000;
+    }
+    n = kevent(kq, NULL, 0, fd_events, fd_maxsources, timo ? &ts : NULL);
+    if (n < 0 && errno != EINTR)
+	fatal("kevent: %m");
+
+    for (i = 0; i < n; i++) {
+        if ((src = find_fd_source((int)fd_events[i].ident)))
+            src->ready = 1;
+    }
+}
+
+/* -----------------------------------------------------------------------------
+call the handlers of the fds that fired in the last wait_input
+a handler may add or remove fds, including its own, and may use is_ready_fd
+----------------------------------------------------------------------------- */
+void dispatch_fds()
+{
+    int i;
+
+    for (i = 0; i < fd_nsources; i++) {
+        if (fd_sources[i].fd != -1 && fd_sources[i].ready && fd_sources[i].handler) {
+            (*fd_sources[i].handler)(fd_sources[i].fd, fd_sources[i].arg);
+            fd_sources[i].ready = 0;	// by index, the handler may have grown the table
+        }
+    }
 }
 
 /* -----------------------------------------------------------------------------
@@ -1667,9 +1766,33 @@ add an fd to the set that wait_input waits for
 ----------------------------------------------------------------------------- */
 void add_fd(int fd)
 {
-    FD_SET(fd, &in_fds);
-    if (fd > max_in_fd)
-	max_in_fd = fd;
+    add_fd_handler(fd, NULL, NULL);
+}
+
+/* -----------------------------------------------------------------------------
+add an fd to the set that wait_input waits for,
+handler is called by dispatch_fds when data is available
+----------------------------------------------------------------------------- */
+void add_fd_handler(int fd, void (*handler) __P((int, void *)), void *arg)
+{
+    struct fd_source *src;
+
+    if ((src = find_fd_source(fd)) == NULL) {
+        if (fd_nsources == fd_maxsources) {
+            fd_maxsources *= 2;
+            fd_sources = realloc(fd_sources, fd_maxsources * sizeof(struct fd_source));
+            fd_events = realloc(fd_events, fd_maxsources * sizeof(struct kevent));
+            if (fd_sources == NULL || fd_events == NULL)
+                novm("fd sources");
+        }
+        src = &fd_sources[fd_nsources++];
+        src->fd = fd;
+        src->ready = 0;
+    }
+    // always, close() drops the fd from kq without remove_fd, and the number may be reused
+    kq_register(fd, EV_ADD);
+    src->handler = handler;
+    src->arg = arg;
 }
 
 /* -----------------------------------------------------------------------------
@@ -1677,15 +1800,24 @@ remove an fd from the set that wait_input waits for
 ----------------------------------------------------------------------------- */
 void remove_fd(int fd)
 {
-    FD_CLR(fd, &in_fds);
+    struct fd_source *src;
+
+    if ((src = find_fd_source(fd)) == NULL)
+        return;
+    // the slot is reclaimed in wait_input, dispatch_fds may be walking the list
+    src->fd = -1;
+    src->ready = 0;
+    kq_register(fd, EV_DELETE);
 }
 
 /* -----------------------------------------------------------------------------
-return 1 is fd is set (i.e. select returned with this file descriptor set)
+return 1 is fd is set (i.e. wait_input returned with this file descriptor ready)
 ----------------------------------------------------------------------------- */
 bool is_ready_fd(int fd)
 {
-    return (FD_ISSET(fd, &ready_fds) != 0);
+    struct fd_source *src = find_fd_source(fd);
+
+    return (src && src->ready);
 }
 
 /* -----------------------------------------------------------------------------
@@ -1901,6 +2033,72 @@ void generic_recv_config(int mru, u_int32_t asyncmap, int pcomp, int accomp)
     publish_dictnumentry(kSCEntNetPPP, kSCPropNetPPPLCPMRU, mru);
 }
 
+/* -----------------------------------------------------------------------------
+hand LCP echo over to the kernel, an interval of 0 takes it back.
+returns 0 if the kernel accepted it.
+----------------------------------------------------------------------------- */
+int sys_echo_offload(u_int32_t our_magic, u_int32_t peer_magic, int interval, int fails)
+{
+    struct ppp_echo echo;
+
+    if (!still_ppp())
+	return -1;
+
+    bzero(&echo, sizeof(echo));
+    echo.our_magic = our_magic;
+    echo.peer_magic = peer_magic;
+    echo.interval = interval;
+    echo.fails = fails;
+    if (ioctl(ppp_fd, PPPIOCSECHO, (caddr_t) &echo) < 0) {
+	if (interval)
+	    dbglog("kernel LCP echo not available: %m");
+	return -1;
+    }
+    return 0;
+}
+
+/* -----------------------------------------------------------------------------
+return the kernel LCP echo state, PPP_ECHO_OFF if unknown
+----------------------------------------------------------------------------- */
+int sys_echo_state()
+{
+    struct ppp_echo echo;
+
+    if (ppp_fd < 0 || ioctl(ppp_fd, PPPIOCGECHO, (caddr_t) &echo) < 0)
+	return PPP_ECHO_OFF;
+    return echo.state;
+}
+
+/* -----------------------------------------------------------------------------
+have the kernel sample one data packet in rate on our unit, 0 stops it.
+returns 0 if the kernel accepted it.
+----------------------------------------------------------------------------- */
+int sys_trace_kernel(int rate)
+{
+    u_int32_t	r = rate;
+
+    if (ppp_sockfd < 0 || ifunit < 0)
+	return -1;
+
+    if (ioctl(ppp_sockfd, PPPIOCSTRACE, (caddr_t) &r) < 0) {
+	if (rate)
+	    dbglog("kernel packet trace not available: %m");
+	return -1;
+    }
+    return 0;
+}
+
+/* -----------------------------------------------------------------------------
+read the next batch of kernel trace samples, -1 if the unit is gone
+----------------------------------------------------------------------------- */
+int sys_trace_read(struct ppp_trace *trace)
+{
+    if (ppp_sockfd < 0 || ifunit < 0
+        || ioctl(ppp_sockfd, PPPIOCGTRACE, (caddr_t) trace) < 0)
+	return -1;
+    return 0;
+}
+
 /* -----------------------------------------------------------------------------
 ask kernel whether a given compression method
  * is acceptable for use.  Returns 1 if the method and parameters
@@ -3822,6 +4020,11 @@ void sys_reinit()
         fatal("SCDynamicStoreCreate failed: %s", SCErrorString(SCError()));
     
     publish_dictnumentry(kSCEntNetPPP, CFSTR("pid"), getpid());
+
+    // kqueues are not inherited by fork, the parent's descriptor number
+    // may already be reused by another fd in the child, don't close it
+    kq = -1;
+    kq_init();
 }
 
 /* ----------------------------------------------------------------------------- 
@@ -4088,7 +4291,7 @@ ppp_ip_probe_send (void *arg)
 																  scope,
 																  &session->probe_addrs[GOOG_DNS_PROBE],
 																  session->probe_ntransmit)) != -1) {
-			add_fd(session->probe_fds[GOOG_DNS_PROBE]);
+			add_fd_handler(session->probe_fds[GOOG_DNS_PROBE], ppp_auxiliary_probe_input_fd, 0);
 			dbglog("%s: sent to goog-dns over scope %d", __FUNCTION__, scope);
 			i++;
 		}
@@ -4104,7 +4307,7 @@ ppp_ip_probe_send (void *arg)
 																   scope,
 																   &session->probe_addrs[PEER_ADDR_PROBE],
 																   session->probe_ntransmit)) != -1) {
-			add_fd(session->probe_fds[PEER_ADDR_PROBE]);
+			add_fd_handler(session->probe_fds[PEER_ADDR_PROBE], ppp_auxiliary_probe_input_fd, 0);
 			dbglog("%s: sent to peer over scope %d", __FUNCTION__, scope);
 			i++;
 		}
@@ -4117,7 +4320,7 @@ ppp_ip_probe_send (void *arg)
 																		   scope,
 																		   &session->probe_addrs[ALT_PEER_ADDR_PROBE],
 																		   session->probe_ntransmit)) != -1) {
-				add_fd(session->probe_fds[ALT_PEER_ADDR_PROBE]);
+				add_fd_handler(session->probe_fds[ALT_PEER_ADDR_PROBE], ppp_auxiliary_probe_input_fd, 0);
 				info("%s: sent to alternate peer over scope %d", __FUNCTION__, scope);
 				i++;
 			}
@@ -4336,6 +4539,12 @@ ppp_process_auxiliary_probe_input (void)
 	}
 }
 
+static void
+ppp_auxiliary_probe_input_fd (int fd, void *arg)
+{
+	ppp_process_auxiliary_probe_input();
+}
+
 #if TARGET_OS_OSX
 static void
 ppp_clear_one_nat_port_mapping (mdns_nat_mapping_t *mapping)
@@ -4803,7 +5012,7 @@ ppp_set_nat_port_mapping (mdns_nat_mapping_t *mapping,
 			return -1;
 		}
 		mapping->mDNSRef_fd = DNSServiceRefSockFD(mapping->mDNSRef);
-		add_fd(mapping->mDNSRef_fd);
+		add_fd_handler(mapping->mDNSRef_fd, ppp_nat_port_mapping_input_fd, 0);
 	}
 	mapping->mDNSRef_tmp = mapping->mDNSRef;
 	err = DNSServiceNATPortMappingCreate(&mapping->mDNSRef_tmp, kDNSServiceFlagsShareConnection, interfaceIndex, protocol, htons(privatePort), publicPort, ttl, ppp_set_nat_port_mapping_callback, session);
@@ -4943,6 +5152,14 @@ ppp_process_nat_port_mapping_events (void)
 #endif // TARGET_OS_OSX
 }
 
+#if TARGET_OS_OSX
+static void
+ppp_nat_port_mapping_input_fd (int fd, void *arg)
+{
+	ppp_process_nat_port_mapping_events();
+}
+#endif // TARGET_OS_OSX
+
 int
 sys_setup_security_session(void)
 {
@@ -74,6 +74,12 @@
 #define MAP_FILE 0
 #endif
 
+/* map the database file so that lookups and updates are plain memory
+   accesses; pread/pwrite remain as the fallback when mmap fails */
+#ifndef HAVE_MMAP
+#define HAVE_MMAP 1
+#endif
+
 /* the body of the database is made of one list_struct for the free space
    plus a separate data list for each hash value */
 struct list_struct {
@@ -251,8 +257,7 @@ static int tdb_write(TDB_CONTEXT *tdb, tdb_off offset, const char *buf, tdb_len
 	if (tdb->map_ptr) {
 		memcpy(offset + (char *)tdb->map_ptr, buf, len);
 	} else {
-		if (lseek(tdb->fd, offset, SEEK_SET) != offset ||
-		    write(tdb->fd, buf, len) != (ssize_t)len) {
+		if (pwrite(tdb->fd, buf, len, offset) != (ssize_t)len) {
 			tdb->ecode = TDB_ERR_IO;
 			return -1;
 		}
@@ -271,8 +276,7 @@ static int tdb_read(TDB_CONTEXT *tdb, tdb_off offset, char *buf, tdb_len len)
 	if (tdb->map_ptr) {
 		memcpy(buf, offset + (char *)tdb->map_ptr, len);
 	} else {
-		if (lseek(tdb->fd, offset, SEEK_SET) != offset ||
-		    read(tdb->fd, buf, len) != (ssize_t)len) {
+		if (pread(tdb->fd, buf, len, offset) != (ssize_t)len) {
 			tdb->ecode = TDB_ERR_IO;
 			return -1;
 		}
@@ -75,6 +75,8 @@
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <pthread.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #ifdef SVR4
@@ -92,6 +94,7 @@
 #include "pppd.h"
 #include "fsm.h"
 #include "lcp.h"
+#include "../../Family/if_ppp.h"
 
 #ifndef lint
 static const char rcsid[] = RCSID;
@@ -103,9 +106,24 @@ extern char *strerror();
 
 static void logit __P((int, char *, va_list));
 static void log_write __P((int, char *));
+static int log_queue __P((int, char *));
+static int log_next __P((int *, time_t *, char *, size_t));
+static void log_copy __P((size_t, char *, size_t, int));
+static void log_repeated __P((int, time_t, int *));
+static void *log_writer __P((void *));
+static void log_init __P((void));
+static void log_reset __P((void));
+static void log_lock __P((sigset_t *));
+static void log_unlock __P((sigset_t *));
+static void log_fork_child __P((void));
+static void log_output __P((int, time_t, char *));
 static void vslp_printer __P((void *, char *, ...));
 static void format_packet __P((u_char *, int, void (*) (void *, char *, ...),
 			       void *));
+static void trace_append __P((int, int, struct timeval *, int, int,
+			      u_char *, int));
+static int trace_kernel_drain __P((void));
+static void trace_kernel_poll __P((void *));
 
 struct buffer_info {
     char *ptr;
@@ -735,15 +753,431 @@ logit(level, fmt, args)
     log_write(level, buf);
 }
 
+/*
+ * Asynchronous logging.  Once start_async_log has been called, messages
+ * formatted by logit and pr_log are queued in log_ring, and a writer
+ * thread writes them to syslog and log_to_fd, so a slow disk or syslogd
+ * does not hold up protocol processing or the waits of a connector.
+ *
+ * The ring is lock-free: the main thread, the UI threads and signal
+ * handlers queue messages by reserving runs of slots with a compare and
+ * swap on log_enq, and the writer, the only consumer, frees them in
+ * order.  Each slot carries a sequence number, which tells whether it is
+ * free for a given position or holds a message for it.  log_mutex is
+ * only taken to wake up an idle writer and to wait for it to catch up.
+ *
+ * The ring belongs to the process that started the writer; forked
+ * children log synchronously as before.  A fork does not wait for the
+ * writer: the messages queued at that time stay with the parent, which
+ * writes them, and a child that takes the ring over in detach starts it
+ * empty.  A message identical to the previous one is only counted by
+ * the writer.  Messages that do not fit in the ring are counted and the
+ * count is logged.
+ */
+#define LOG_SLOT_SIZE	64		/* bytes, a message takes a run of slots */
+#define LOG_SLOTS	1024		/* power of 2, 64KB of messages */
+#define LOG_REPEAT_TIME	30		/* secs before a repeat count is logged anyway */
+#define LOG_FLUSH_TIME	2		/* secs without progress before flush_log gives up */
+
+struct log_rec {
+    u_int32_t	nslots;			/* slots taken by the record */
+    int		level;
+    time_t	when;			/* time the message was logged */
+    /* NUL terminated message follows, across the slots */
+};
+
+static char log_ring[LOG_SLOTS * LOG_SLOT_SIZE];
+static u_int32_t log_seq[LOG_SLOTS];	/* position a slot is free for, or that + 1 once filled */
+static u_int32_t log_enq;		/* next position to reserve */
+static u_int32_t log_deq;		/* next position to write, writer only */
+static u_int32_t log_done;		/* positions before it are written */
+static int log_dropped;			/* messages lost to a full ring */
+static int log_sleeping;		/* writer waits on log_cond */
+static pid_t log_pid;			/* process owning the ring, 0 if none */
+static int log_inited;			/* mutex and fork handlers set up */
+static pthread_mutex_t log_mutex;	/* protects the waits below */
+static pthread_cond_t log_cond;		/* work for the writer */
+static pthread_cond_t log_idle;		/* the writer caught up */
+static int log_waiters;			/* threads waiting on log_idle */
+static u_int32_t log_idle_gen;		/* times the writer caught up for a waiter */
+
+/*
+ * start_async_log - queue log messages from now on, and start the
+ * writer thread.  Called again by detach in the child, which takes
+ * the ring over and needs a writer of its own.
+ */
+void
+start_async_log()
+{
+    pthread_t thread;
+    sigset_t mask, omask;
+    int err;
+
+    if (!log_async || log_pid == getpid())
+	return;
+    if (!log_inited) {
+	log_init();
+	log_reset();
+	pthread_atfork(NULL, NULL, log_fork_child);
+	atexit(flush_log);
+	log_inited = 1;
+    }
+    /* the writer inherits a mask that blocks everything */
+    sigfillset(&mask);
+    pthread_sigmask(SIG_BLOCK, &mask, &omask);
+    err = pthread_create(&thread, NULL, log_writer, NULL);
+    pthread_sigmask(SIG_SETMASK, &omask, NULL);
+    if (err) {
+	log_pid = 0;
+	return;
+    }
+    pthread_detach(thread);
+    log_pid = getpid();
+}
+
+/*
+ * log_init - set up the lock and conditions of the writer.
+ */
+static void
+log_init()
+{
+    pthread_mutex_init(&log_mutex, NULL);
+    pthread_cond_init(&log_cond, NULL);
+    pthread_cond_init(&log_idle, NULL);
+    log_sleeping = 0;
+    log_waiters = 0;
+}
+
+/*
+ * log_reset - empty the ring.
+ */
+static void
+log_reset()
+{
+    u_int32_t i;
+
+    for (i = 0; i < LOG_SLOTS; i++)
+	log_seq[i] = i;
+    log_enq = log_deq = log_done = 0;
+    log_dropped = 0;
+}
+
+/*
+ * log_lock - take log_mutex, with signals blocked so that a handler
+ * that logs cannot deadlock on it.
+ */
+static void
+log_lock(omask)
+    sigset_t *omask;
+{
+    sigset_t mask;
+
+    sigfillset(&mask);
+    pthread_sigmask(SIG_BLOCK, &mask, omask);
+    pthread_mutex_lock(&log_mutex);
+}
+
+/*
+ * log_unlock - release log_mutex and restore the signal mask.
+ */
+static void
+log_unlock(omask)
+    sigset_t *omask;
+{
+    pthread_mutex_unlock(&log_mutex);
+    pthread_sigmask(SIG_SETMASK, omask, NULL);
+}
+
+/*
+ * log_copy - copy len bytes between buf and the ring, from byte off of
+ * the ring on, in either direction.
+ */
+static void
+log_copy(off, buf, len, to_ring)
+    size_t off;
+    char *buf;
+    size_t len;
+    int to_ring;
+{
+    size_t n;
+
+    off %= sizeof(log_ring);
+    n = MIN(len, sizeof(log_ring) - off);
+
+    if (to_ring) {
+	memcpy(log_ring + off, buf, n);
+	memcpy(log_ring, buf + n, len - n);
+    } else {
+	memcpy(buf, log_ring + off, n);
+	memcpy(buf + n, log_ring, len - n);
+    }
+}
+
+/*
+ * log_queue - add a message to the ring if we may.
+ * Returns 0 if the caller must write it out itself.
+ */
+static int
+log_queue(level, buf)
+    int level;
+    char *buf;
+{
+    struct log_rec r;
+    size_t len = strlen(buf) + 1;
+    u_int32_t pos, first, last, i;
+    size_t off;
+    sigset_t omask;
+
+    if (log_pid != getpid())
+	return 0;
+
+    r.nslots = (sizeof(r) + len + LOG_SLOT_SIZE - 1) / LOG_SLOT_SIZE;
+    r.level = level;
+    time(&r.when);
+
+    /*
+     * Reserve the run of slots at log_enq.  The writer frees slots in
+     * order, so the run is free when its first and last slots are.
+     */
+    pos = __atomic_load_n(&log_enq, __ATOMIC_RELAXED);
+    for (;;) {
+	first = __atomic_load_n(&log_seq[pos % LOG_SLOTS], __ATOMIC_ACQUIRE);
+	last = __atomic_load_n(&log_seq[(pos + r.nslots - 1) % LOG_SLOTS], __ATOMIC_ACQUIRE);
+	if (first == pos && last == pos + r.nslots - 1) {
+	    if (__atomic_compare_exchange_n(&log_enq, &pos, pos + r.nslots, 1,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		break;
+	} else if ((int32_t)(first - pos) < 0 || (int32_t)(last - (pos + r.nslots - 1)) < 0) {
+	    /* the writer is behind */
+	    __atomic_fetch_add(&log_dropped, 1, __ATOMIC_RELAXED);
+	    return 1;
+	} else
+	    pos = __atomic_load_n(&log_enq, __ATOMIC_RELAXED);
+    }
+
+    off = (pos % LOG_SLOTS) * LOG_SLOT_SIZE;
+    log_copy(off, (char *) &r, sizeof(r), 1);
+    log_copy(off + sizeof(r), buf, len, 1);
+
+    /* publish, the first slot last: the writer starts from it */
+    for (i = r.nslots - 1; i > 0; i--)
+	__atomic_store_n(&log_seq[(pos + i) % LOG_SLOTS], pos + i + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&log_seq[pos % LOG_SLOTS], pos + 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&log_sleeping, __ATOMIC_SEQ_CST)) {
+	log_lock(&omask);
+	__atomic_store_n(&log_sleeping, 0, __ATOMIC_SEQ_CST);
+	pthread_cond_signal(&log_cond);
+	log_unlock(&omask);
+    }
+    return 1;
+}
+
+/*
+ * log_next - take the next message out of the ring into buf.
+ * Returns 0 if there is none yet.  Writer only.
+ */
+static int
+log_next(level, when, buf, size)
+    int *level;
+    time_t *when;
+    char *buf;
+    size_t size;
+{
+    struct log_rec r;
+    u_int32_t pos = log_deq, i;
+    size_t off, len;
+
+    if (__atomic_load_n(&log_seq[pos % LOG_SLOTS], __ATOMIC_SEQ_CST) != pos + 1)
+	return 0;
+
+    off = (pos % LOG_SLOTS) * LOG_SLOT_SIZE;
+    log_copy(off, (char *) &r, sizeof(r), 0);
+    len = MIN(r.nslots * LOG_SLOT_SIZE - sizeof(r), size);
+    log_copy(off + sizeof(r), buf, len, 0);
+    buf[len - 1] = 0;
+    *level = r.level;
+    *when = r.when;
+
+    /* free the slots for their next round, in order */
+    for (i = 0; i < r.nslots; i++)
+	__atomic_store_n(&log_seq[(pos + i) % LOG_SLOTS], pos + i + LOG_SLOTS, __ATOMIC_RELEASE);
+    log_deq = pos + r.nslots;
+    return 1;
+}
+
+/*
+ * log_writer - the writer thread.  Takes the messages out of the ring
+ * one at a time and writes them.  A message identical to the last one
+ * written is only counted; the count is written before the next other
+ * message, once it is LOG_REPEAT_TIME old, or when somebody waits for
+ * the ring to be flushed.
+ */
+static void *
+log_writer(arg)
+    void *arg;
+{
+    struct timespec ts;
+    time_t now, when, repeat_time = 0;
+    int level, last_level = -1, repeats = 0, dropped;
+    char buf[4096], last[sizeof(buf)];
+
+    for (;;) {
+	if (log_next(&level, &when, buf, sizeof(buf))) {
+	    if (level == last_level && strcmp(buf, last) == 0) {
+		if (repeats++ == 0)
+		    repeat_time = when;
+	    } else {
+		if (repeats)
+		    log_repeated(last_level, when, &repeats);
+		log_output(level, when, buf);
+		strlcpy(last, buf, sizeof(last));
+		last_level = level;
+	    }
+	    __atomic_store_n(&log_done, log_deq, __ATOMIC_RELEASE);
+	    continue;
+	}
+
+	time(&now);
+	if ((dropped = __atomic_exchange_n(&log_dropped, 0, __ATOMIC_RELAXED))) {
+	    slprintf(buf, sizeof(buf), "%d log messages dropped", dropped);
+	    log_output(LOG_WARNING, now, buf);
+	    last_level = -1;
+	}
+	if (repeats && now - repeat_time >= LOG_REPEAT_TIME)
+	    log_repeated(last_level, now, &repeats);
+
+	/* nothing to write, go idle unless a message came in meanwhile */
+	pthread_mutex_lock(&log_mutex);
+	__atomic_store_n(&log_sleeping, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&log_seq[log_deq % LOG_SLOTS], __ATOMIC_SEQ_CST) == log_deq + 1) {
+	    __atomic_store_n(&log_sleeping, 0, __ATOMIC_SEQ_CST);
+	    pthread_mutex_unlock(&log_mutex);
+	    continue;
+	}
+	if (log_waiters) {
+	    if (repeats) {
+		__atomic_store_n(&log_sleeping, 0, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&log_mutex);
+		log_repeated(last_level, now, &repeats);
+		continue;
+	    }
+	    log_idle_gen++;
+	    pthread_cond_broadcast(&log_idle);
+	}
+	if (repeats) {
+	    ts.tv_sec = repeat_time + LOG_REPEAT_TIME;
+	    ts.tv_nsec = 0;
+	    pthread_cond_timedwait(&log_cond, &log_mutex, &ts);
+	} else {
+	    while (__atomic_load_n(&log_sleeping, __ATOMIC_SEQ_CST))
+		pthread_cond_wait(&log_cond, &log_mutex);
+	}
+	__atomic_store_n(&log_sleeping, 0, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&log_mutex);
+    }
+    return NULL;
+}
+
+/*
+ * log_repeated - write the repeat count of the last message.
+ */
+static void
+log_repeated(level, now, repeats)
+    int level;
+    time_t now;
+    int *repeats;
+{
+    char buf[64];
+
+    slprintf(buf, sizeof(buf), "last message repeated %d time%s",
+	     *repeats, *repeats > 1? "s": "");
+    log_output(level, now, buf);
+    *repeats = 0;
+}
+
+/*
+ * log_fork_child - the writer is gone in the child, and the lock may
+ * have been held by it, so start over.  The messages queued before the
+ * fork are written by the parent: a child that takes the ring over in
+ * detach starts it empty, rather than write them a second time.
+ */
+static void
+log_fork_child()
+{
+    log_init();
+    log_reset();
+}
+
+/*
+ * flush_log - wait until the messages queued so far have been written,
+ * repeat count included.  A message may never be completed, by a thread
+ * or a code that die interrupted while it was queuing it: give up when
+ * the writer made no progress for LOG_FLUSH_TIME.
+ */
+void
+flush_log()
+{
+    u_int32_t target, gen, done;
+    struct timeval tv;
+    struct timespec ts;
+    sigset_t omask;
+
+    if (log_pid != getpid())
+	return;
+
+    target = __atomic_load_n(&log_enq, __ATOMIC_ACQUIRE);
+    log_lock(&omask);
+    log_waiters++;
+    gen = log_idle_gen;
+    __atomic_store_n(&log_sleeping, 0, __ATOMIC_SEQ_CST);
+    pthread_cond_signal(&log_cond);
+    for (;;) {
+	done = __atomic_load_n(&log_done, __ATOMIC_ACQUIRE);
+	if ((int32_t)(done - target) >= 0 && gen != log_idle_gen)
+	    break;
+	gettimeofday(&tv, NULL);
+	ts.tv_sec = tv.tv_sec + LOG_FLUSH_TIME;
+	ts.tv_nsec = tv.tv_usec * 1000;
+	if (pthread_cond_timedwait(&log_idle, &log_mutex, &ts) == ETIMEDOUT
+	    && __atomic_load_n(&log_done, __ATOMIC_ACQUIRE) == done)
+	    break;
+    }
+    log_waiters--;
+    log_unlock(&omask);
+}
+
+/*
+ * sync_log - write out everything queued and push the log file to
+ * disk, so that nothing is lost when we are about to die.
+ */
+void
+sync_log()
+{
+    flush_log();
+    if (log_to_fd >= 0)
+	fsync(log_to_fd);
+}
+
 static void
 log_write(level, buf)
     int level;
     char *buf;
+{
+    if (!log_queue(level, buf))
+	log_output(level, time(NULL), buf);
+}
+
+static void
+log_output(level, t, buf)
+    int level;
+    time_t t;
+    char *buf;
 {
 #ifdef __APPLE__
-	time_t t;
 	int ns;
 	char s[64];
+	struct tm tm;
 #endif
 
 	sys_log(level, "%s", buf);
@@ -751,8 +1185,7 @@ log_write(level, buf)
 		int n = (int)strlen(buf);
 
 #ifdef __APPLE__
-		time(&t);
-		ns = (int)strftime(s, sizeof(s), "%c : ", localtime(&t));
+		ns = (int)strftime(s, sizeof(s), "%c : ", localtime_r(&t, &tm));
 		if (write(log_to_fd, s, ns) != ns)
 			log_to_fd = -1;
 #endif
@@ -783,6 +1216,7 @@ fatal __V((char *fmt, ...))
 
     logit(LOG_ERR, fmt, pvar);
     va_end(pvar);
+    sync_log();
 
     die(1);			/* as promised */
 }
@@ -926,6 +1360,219 @@ dump_packet(const char *tag, unsigned char *p, int len)
     dbglog("%s %P", tag, p, len);
 }
 
+/*
+ * Binary packet trace.  With the trace-file option, pppd maps a fixed
+ * size ring file and appends a (timestamp, direction, protocol, length,
+ * first trace-snaplen bytes) record for each packet it sends or receives,
+ * without formatting anything.  With trace-kernel-rate, the kernel also
+ * samples the data path of our unit and the samples are drained into
+ * the same ring once a second.  When the ring is full the oldest records
+ * are overwritten and counted, or with trace-nowrap the new ones are
+ * dropped and counted.  pppdump -t decodes the file.
+ */
+static struct ppp_trace_file *trace_ring;	/* mapped trace file, or NULL */
+static u_char *trace_area;			/* records, after the header */
+
+/*
+ * trace_open - create the trace file and map it.
+ */
+void
+trace_open()
+{
+    int fd;
+    size_t size, maplen;
+    void *p;
+
+    if (trace_file == NULL || trace_ring != NULL)
+	return;
+
+    /* keep room for at least one full record */
+    size = (trace_size + 3) & ~3;
+    if (size < sizeof(struct ppp_trace_record) + trace_snaplen + 3)
+	size = (sizeof(struct ppp_trace_record) + trace_snaplen + 3) & ~3;
+    maplen = sizeof(struct ppp_trace_file) + size;
+
+    fd = open(trace_file, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+	error("Can't create trace file %s: %m", trace_file);
+	return;
+    }
+    if (ftruncate(fd, maplen) < 0) {
+	error("Can't size trace file %s: %m", trace_file);
+	close(fd);
+	return;
+    }
+    p = mmap(NULL, maplen, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+	error("Can't map trace file %s: %m", trace_file);
+	return;
+    }
+
+    trace_ring = p;
+    trace_area = (u_char *) (trace_ring + 1);
+    trace_ring->version = PPP_TRACE_VERSION;
+    trace_ring->size = size;
+    trace_ring->snaplen = trace_snaplen;
+    trace_ring->magic = PPP_TRACE_MAGIC;
+}
+
+/*
+ * trace_close - drain the last kernel samples and flush the trace file.
+ */
+void
+trace_close()
+{
+    if (trace_ring == NULL)
+	return;
+
+    if (trace_kernel_rate) {
+	UNTIMEOUT(trace_kernel_poll, NULL);
+	trace_kernel_drain();
+	sys_trace_kernel(0);
+    }
+    msync(trace_ring, sizeof(struct ppp_trace_file) + trace_ring->size, MS_SYNC);
+    munmap(trace_ring, sizeof(struct ppp_trace_file) + trace_ring->size);
+    trace_ring = NULL;
+}
+
+/*
+ * trace_append - add a record at the tail of the ring, making room
+ * by dropping the oldest records unless trace-nowrap is set.
+ */
+static void
+trace_append(dir, kernel, tv, proto, len, data, caplen)
+    int dir, kernel;
+    struct timeval *tv;
+    int proto, len;
+    u_char *data;
+    int caplen;
+{
+    struct ppp_trace_file *t = trace_ring;
+    struct ppp_trace_record *r;
+    u_int32_t n;
+
+    n = (sizeof(struct ppp_trace_record) + caplen + 3) & ~3;
+    for (;;) {
+	if (t->records == 0) {
+	    t->head = t->tail = 0;
+	    break;
+	}
+	if (t->tail > t->head) {
+	    /* free space runs from tail to the end, then up to head */
+	    if (t->tail + n <= t->size)
+		break;
+	    if (trace_nowrap && n > t->head) {
+		t->dropped++;
+		return;
+	    }
+	    if (t->tail < t->size)
+		((struct ppp_trace_record *) (trace_area + t->tail))->reclen = 0;
+	    t->tail = 0;
+	    continue;
+	}
+	/* wrapped, free space runs from tail to head */
+	if (t->tail + n <= t->head)
+	    break;
+	if (trace_nowrap) {
+	    t->dropped++;
+	    return;
+	}
+	r = (struct ppp_trace_record *) (trace_area + t->head);
+	t->head += r->reclen;
+	t->records--;
+	t->overwritten++;
+	if (t->head >= t->size
+	    || ((struct ppp_trace_record *) (trace_area + t->head))->reclen == 0)
+	    t->head = 0;
+    }
+
+    r = (struct ppp_trace_record *) (trace_area + t->tail);
+    r->reclen = n;
+    r->dir = dir;
+    r->kernel = kernel;
+    r->sec = tv->tv_sec;
+    r->usec = tv->tv_usec;
+    r->proto = proto;
+    r->len = len > 0xffff ? 0xffff : len;
+    r->caplen = caplen;
+    r->pad = 0;
+    if (caplen)
+	memcpy(r + 1, data, caplen);
+    t->tail += n;
+    t->records++;
+}
+
+/*
+ * trace_packet - record a packet pppd sent or received.
+ * p points to the PPP header, as for dump_packet.
+ */
+void
+trace_packet(dir, p, len)
+    int dir;
+    u_char *p;
+    int len;
+{
+    struct timeval tv;
+    int caplen;
+
+    if (trace_ring == NULL || len < PPP_HDRLEN)
+	return;
+
+    gettimeofday(&tv, NULL);
+    len -= PPP_HDRLEN;
+    caplen = len < trace_ring->snaplen ? len : trace_ring->snaplen;
+    trace_append(dir, 0, &tv, (p[2] << 8) + p[3], len, p + PPP_HDRLEN, caplen);
+}
+
+/*
+ * trace_kernel_start - have the kernel sample the data path of our
+ * unit, once we know which unit we are using.
+ */
+void
+trace_kernel_start()
+{
+    if (trace_ring == NULL || trace_kernel_rate == 0)
+	return;
+
+    UNTIMEOUT(trace_kernel_poll, NULL);
+    if (sys_trace_kernel(trace_kernel_rate) == 0)
+	TIMEOUT(trace_kernel_poll, NULL, 1);
+}
+
+/*
+ * trace_kernel_drain - move the samples the kernel has queued into
+ * the ring.  Returns -1 once the unit is gone.
+ */
+static int
+trace_kernel_drain()
+{
+    struct ppp_trace kt;
+    struct timeval tv;
+    int i;
+
+    do {
+	if (sys_trace_read(&kt) < 0)
+	    return -1;
+	trace_ring->kdropped += kt.dropped;
+	for (i = 0; i < kt.count; ++i) {
+	    tv.tv_sec = kt.samples[i].sec;
+	    tv.tv_usec = kt.samples[i].usec;
+	    trace_append(kt.samples[i].dir, 1, &tv, kt.samples[i].proto,
+			 kt.samples[i].len, NULL, 0);
+	}
+    } while (kt.count == PPP_TRACE_BATCH);
+    return 0;
+}
+
+static void
+trace_kernel_poll(arg)
+    void *arg;
+{
+    if (trace_ring != NULL && trace_kernel_drain() == 0)
+	TIMEOUT(trace_kernel_poll, NULL, 1);
+}
+
 /*
  * complete_read - read a full `count' bytes from fd,
  * unless end-of-file or an error other than EINTR is encountered.
@@ -32,14 +32,18 @@
  *  2 of the License, or (at your option) any later version.
  */
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <time.h>
 #include <sys/types.h>
+#include <net/if.h>
 #include "ppp_defs.h"
 #include "ppp-comp.h"
+#include "if_ppp.h"
 
 int hexmode;
 int pppmode;
+int tracemode;
 int reverse;
 int decompress;
 int mru = 1500;
@@ -59,7 +63,7 @@ main(ac, av)
     char *p;
     FILE *f;
 
-    while ((i = getopt(ac, av, "hprdm:a")) != -1) {
+    while ((i = getopt(ac, av, "hprdm:at")) != -1) {
 	switch (i) {
 	case 'h':
 	    hexmode = 1;
@@ -79,21 +83,29 @@ main(ac, av)
 	case 'a':
 	    abs_times = 1;
 	    break;
+	case 't':
+	    tracemode = 1;
+	    break;
 	default:
-	    fprintf(stderr, "Usage: %s [-h | -p[d]] [-r] [-m mru] [-a] [file ...]\n", av[0]);
+	    fprintf(stderr, "Usage: %s [-h | -p[d] | -t] [-r] [-m mru] [-a] [file ...]\n", av[0]);
 	    exit(1);
 	}
     }
-    if (optind >= ac)
-	dumplog(stdin);
-    else {
+    if (optind >= ac) {
+	if (tracemode)
+	    dumptrace(stdin);
+	else
+	    dumplog(stdin);
+    } else {
 	for (i = optind; i < ac; ++i) {
 	    p = av[i];
 	    if ((f = fopen(p, "r")) == NULL) {
 		perror(p);
 		exit(1);
 	    }
-	    if (pppmode)
+	    if (tracemode)
+		dumptrace(f);
+	    else if (pppmode)
 		dumpppp(f);
 	    else
 		dumplog(f);
@@ -518,3 +530,84 @@ show_time(f, c)
 	    printf("time  %.1fs\n", (double) n / 10);
     }
 }
+
+/*
+ * dumptrace - print the records of a trace ring file written by
+ * pppd's trace-file option, oldest first.
+ */
+dumptrace(f)
+    FILE *f;
+{
+    struct ppp_trace_file hdr;
+    struct ppp_trace_record *r;
+    unsigned char *area, *p;
+    u_int32_t pos, i;
+    time_t t;
+    struct tm *tm;
+    double start;
+    int c, k, nb, nl, dir;
+
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != PPP_TRACE_MAGIC) {
+	fprintf(stderr, "not a ppp trace file\n");
+	exit(1);
+    }
+    if (hdr.version != PPP_TRACE_VERSION) {
+	fprintf(stderr, "unknown trace file version %d\n", hdr.version);
+	exit(1);
+    }
+    if ((area = malloc(hdr.size)) == NULL
+	|| fread(area, 1, hdr.size, f) != hdr.size) {
+	fprintf(stderr, "truncated trace file\n");
+	exit(1);
+    }
+    printf("trace %d records, snaplen %d, overwritten %d, dropped %d, kernel dropped %d\n",
+	   hdr.records, hdr.snaplen, hdr.overwritten, hdr.dropped, hdr.kdropped);
+
+    start = -1;
+    pos = hdr.head;
+    for (i = 0; i < hdr.records; ++i) {
+	if (pos >= hdr.size || ((struct ppp_trace_record *)(area + pos))->reclen == 0)
+	    pos = 0;
+	r = (struct ppp_trace_record *)(area + pos);
+	if (r->reclen < sizeof(*r) || pos + r->reclen > hdr.size
+	    || sizeof(*r) + r->caplen > r->reclen) {
+	    printf("BAD RECORD at %d\n", pos);
+	    break;
+	}
+	pos += r->reclen;
+
+	dir = reverse? !r->dir: r->dir;
+	if (abs_times) {
+	    t = r->sec;
+	    tm = localtime(&t);
+	    printf("%.2d:%.2d:%.2d.%.6d", tm->tm_hour, tm->tm_min, tm->tm_sec,
+		   r->usec);
+	} else {
+	    if (start < 0)
+		start = r->sec + r->usec / 1e6;
+	    printf("%12.6f", r->sec + r->usec / 1e6 - start);
+	}
+	printf(" %s %.4x len %d%s\n", dir == PPP_TRACE_OUT? "sent": "rcvd",
+	       r->proto, r->len, r->kernel? " (kernel)": "");
+
+	p = (unsigned char *)(r + 1);
+	nb = r->caplen;
+	while (nb > 0) {
+	    nl = nb < 16? nb: 16;
+	    printf("    ");
+	    for (k = 0; k < nl; ++k)
+		printf(" %.2x", p[k]);
+	    for (; k < 16; ++k)
+		printf("   ");
+	    printf("  ");
+	    for (k = 0; k < nl; ++k) {
+		c = p[k];
+		putchar((' ' <= c && c <= '~')? c: '.');
+	    }
+	    printf("\n");
+	    p += nl;
+	    nb -= nl;
+	}
+    }
+    free(area);
+}
@@ -47,6 +47,7 @@
 
 #include <netinet/in_var.h>
 #include <mach/mach_time.h>
+#include <spawn.h>
 
 #include <CoreFoundation/CoreFoundation.h>
 #include <SystemConfiguration/SystemConfiguration.h>
@@ -121,7 +122,7 @@ extern int got_sig_hup(void);
 extern int got_sig_usr1(void);
 extern int got_terminate(void);
 
-static pid_t fork_child(int fdSocket);
+static pid_t spawn_child(int fdSocket, char **args);
 static int reap_children(void);
 static int terminate_children(void);
 static int getabsolutetime(struct timeval *timenow);
@@ -894,37 +895,32 @@ void accept_connections(struct vpn_params* params)
                 }
                 if (child_sockfd == 0)
                     continue;
-                // Turn this connection over to a child.
-                while ((pid_child = fork_child(child_sockfd)) < 0) {
-                    if (errno != EINTR) {
-                        vpnlog(LOG_ERR, "Error during fork = %s\n", strerror(errno));
-                        goto fail;
-                    } else if (got_terminate())
-                        goto fail;
+                if (address_slot == 0) {
+                    // refused call, nobody to hand the socket to
+                    close(child_sockfd);
+                    continue;
                 }
-                if (pid_child && address_slot) {			// parent
-                    vpnlog(LOG_NOTICE, "Incoming call... Address given to client = %s\n", address_slot->ip_address);
-                    TAILQ_REMOVE(&free_address_list, address_slot, next);
-                    address_slot->pid = pid_child;
-                    TAILQ_INSERT_TAIL(&child_list, address_slot, next);
-					lb_cur_connections++;
-                } else if (address_slot) {	
-                    // child
-                    snprintf(addr_str, sizeof(addr_str), ":%s", address_slot->ip_address);
-                    params->exec_args[params->next_arg_index] = addr_str;	// setup ip address in arg list
-                    params->exec_args[params->next_arg_index + 1] = 0;		// make sure arg list end with zero
-                    execve(PATH_PPPD, params->exec_args, NULL);			// launch it
-                    
-                    /* not reached except if there is an error */
-                    vpnlog(LOG_ERR, "execve failed during exec of /usr/sbin/pppd\nARGUMENTS\n");
+                // Turn this connection over to a pppd.
+                snprintf(addr_str, sizeof(addr_str), ":%s", address_slot->ip_address);
+                params->exec_args[params->next_arg_index] = addr_str;	// setup ip address in arg list
+                params->exec_args[params->next_arg_index + 1] = 0;		// make sure arg list end with zero
+                if ((pid_child = spawn_child(child_sockfd, params->exec_args)) < 0) {
+                    vpnlog(LOG_ERR, "Error during spawn of %s = %s\nARGUMENTS\n", PATH_PPPD, strerror(errno));
                     for (i = 1; i < MAXARG && i < params->next_arg_index; i++) {
                         if (params->exec_args[i])
                             vpnlog(LOG_DEBUG, "%d :  %s\n", i, params->exec_args[i]);
                     }
                     vpnlog(LOG_DEBUG, "\n");
-				
-                    exit(1);
+                    // drop this call only, spawn_child closed its socket
+                    // and the address is still on the free list
+                    vpnlog(LOG_ERR, "Incoming call dropped\n");
+                    continue;
                 }
+                vpnlog(LOG_NOTICE, "Incoming call... Address given to client = %s\n", address_slot->ip_address);
+                TAILQ_REMOVE(&free_address_list, address_slot, next);
+                address_slot->pid = pid_child;
+                TAILQ_INSERT_TAIL(&child_list, address_slot, next);
+                lb_cur_connections++;
             }
         }
 		
@@ -1026,35 +1022,44 @@ fail:
 
 
 //-----------------------------------------------------------------------------
-//	fork_child
+//	spawn_child
+//	launch pppd with fdSocket as stdin, /dev/null as stdout and stderr,
+//	and no other descriptor. posix_spawn avoids copying our address space
+//	and closing every possible descriptor in a forked child for each call.
+//	fdSocket is closed in the parent. returns the pid, or -1 with errno set.
 //-----------------------------------------------------------------------------
-static pid_t fork_child(int fdSocket)
+static pid_t spawn_child(int fdSocket, char **args)
 {
-    register pid_t	pidChild = 0 ;
-    int 		i;
-    
-    errno = 0 ;
-
-    switch (pidChild = fork ()) {
-        case 0:		// in child
-            break ;
-        case -1:	// error
-            syslog(LOG_ERR, "fork() failed: %m") ;
-            /* FALLTHRU */
-        default:	// parent
-            close (fdSocket) ;
-            return pidChild ;
+    posix_spawn_file_actions_t	actions;
+    posix_spawnattr_t		attr;
+    pid_t			pidChild = -1;
+    int 			err;
+    char			*env[] = { NULL };	// pppd runs with an empty environment
+
+    if ((err = posix_spawn_file_actions_init(&actions)) != 0)
+        goto done;
+    if ((err = posix_spawnattr_init(&attr)) != 0) {
+        posix_spawn_file_actions_destroy(&actions);
+        goto done;
     }
 
-    for (i = getdtablesize() - 1; i >= 0; i--) 
-        if (i != fdSocket) 
-            close(i);
-    dup2 (fdSocket, STDIN_FILENO) ;
-    open("/dev/null", O_RDWR, 0);
-    open("/dev/null", O_RDWR, 0);
-    close (fdSocket) ;
+    if ((err = posix_spawn_file_actions_adddup2(&actions, fdSocket, STDIN_FILENO)) == 0
+        && (err = posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_RDWR, 0)) == 0
+        && (err = posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_RDWR, 0)) == 0
+        // everything not named above is closed in the child
+        && (err = posix_spawnattr_setflags(&attr, POSIX_SPAWN_CLOEXEC_DEFAULT)) == 0)
+        err = posix_spawn(&pidChild, PATH_PPPD, &actions, &attr, args, env);
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
 
-    return pidChild ;
+done:
+    close(fdSocket);
+    if (err) {
+        errno = err;
+        return -1;
+    }
+    return pidChild;
 }
 
 